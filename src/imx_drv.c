@@ -79,6 +79,8 @@ static Bool	IMXPreInit(ScrnInfoPtr pScrn, int flags);
 static Bool	IMXScreenInit(int Index, ScreenPtr pScreen, int argc,
 				char **argv);
 static Bool	IMXCloseScreen(int scrnIndex, ScreenPtr pScreen);
+static Bool	IMXEnterVT(int scrnIndex, int flags);
+static void	IMXLeaveVT(int scrnIndex, int flags);
 static Bool	IMXDriverFunc(ScrnInfoPtr pScrn, xorgDriverFuncOp op,
 				pointer ptr);
 
@@ -93,7 +95,14 @@ extern void IMX_EXA_FreeRec(ScrnInfoPtr pScrn);
 extern Bool IMX_EXA_PreInit(ScrnInfoPtr pScrn);
 extern Bool IMX_EXA_ScreenInit(int scrnIndex, ScreenPtr pScreen);
 extern Bool IMX_EXA_CloseScreen(int scrnIndex, ScreenPtr pScreen);
+extern void IMX_EXA_EnterVT(int scrnIndex, int flags);
+extern void IMX_EXA_LeaveVT(int scrnIndex, int flags);
 extern Bool IMX_EXA_GetPixmapProperties(PixmapPtr pPixmap, void** pPhysAddr, int* pPitch);
+extern void IMX_EXA_PinPixmap(PixmapPtr pPixmap);
+extern Bool IMX_EXA_GetOffscreenStats(ScreenPtr pScreen, IMXOffscreenStatsPtr pStats);
+extern int IMX_EXA_GetOffscreenMap(ScreenPtr pScreen, IMXOffscreenHeapInfoPtr heaps,
+				int* pNumHeaps, IMXOffscreenAreaInfoPtr areas, int maxAreas);
+extern int IMX_EXA_GetAccelThresholds(ScreenPtr pScreen, IMXAccelThresholdInfoPtr infos);
 
 /* for X extension */
 extern void IMX_EXT_Init();
@@ -139,6 +148,8 @@ typedef enum {
 	OPTION_ACCELMETHOD,
 	OPTION_ROTATE,
 	OPTION_DEBUG,
+	OPTION_GLYPH_CACHE_SIZE,
+	OPTION_OFFSCREEN_POOLS,
 } IMXOpts;
 
 #define	OPTION_STR_FBDEV	"fbdev"
@@ -147,6 +158,8 @@ typedef enum {
 #define	OPTION_STR_ACCELMETHOD	"AccelMethod"
 #define	OPTION_STR_ROTATE	"Rotate"
 #define	OPTION_STR_DEBUG	"debug"
+#define	OPTION_STR_GLYPH_CACHE_SIZE	"GlyphCacheSize"
+#define	OPTION_STR_OFFSCREEN_POOLS	"OffscreenPools"
 
 static const OptionInfoRec IMXOptions[] = {
 	{ OPTION_FBDEV,		OPTION_STR_FBDEV,	OPTV_STRING,	{0},	FALSE },
@@ -155,6 +168,8 @@ static const OptionInfoRec IMXOptions[] = {
 	{ OPTION_ACCELMETHOD,	OPTION_STR_ACCELMETHOD,	OPTV_STRING,	{0},	FALSE },
 	{ OPTION_ROTATE,	OPTION_STR_ROTATE,	OPTV_STRING,	{0},	FALSE },
 	{ OPTION_DEBUG,		OPTION_STR_DEBUG,	OPTV_BOOLEAN,	{0},	FALSE },
+	{ OPTION_GLYPH_CACHE_SIZE, OPTION_STR_GLYPH_CACHE_SIZE, OPTV_INTEGER, {0}, FALSE },
+	{ OPTION_OFFSCREEN_POOLS, OPTION_STR_OFFSCREEN_POOLS, OPTV_STRING, {0}, FALSE },
 	{ -1,			NULL,			OPTV_NONE,	{0},	FALSE }
 };
 
@@ -283,8 +298,8 @@ IMXProbe(DriverPtr drv, int flags)
 				pScrn->ScreenInit    = IMXScreenInit;
 				pScrn->SwitchMode    = fbdevHWSwitchModeWeak();
 				pScrn->AdjustFrame   = fbdevHWAdjustFrameWeak();
-				pScrn->EnterVT       = fbdevHWEnterVTWeak();
-				pScrn->LeaveVT       = fbdevHWLeaveVTWeak();
+				pScrn->EnterVT       = IMXEnterVT;
+				pScrn->LeaveVT       = IMXLeaveVT;
 				pScrn->ValidMode     = fbdevHWValidModeWeak();
 
 				xf86DrvMsg(pScrn->scrnIndex, X_INFO,
@@ -392,6 +407,22 @@ IMXPreInit(ScrnInfoPtr pScrn, int flags)
 		}
 	}
 
+	/* GlyphCacheSize option, in KB of offscreen memory */
+	fPtr->offScreenGlyphSize = -1;
+	{
+		int glyphCacheSize;
+		if (xf86GetOptValInteger(fPtr->Options, OPTION_GLYPH_CACHE_SIZE,
+						&glyphCacheSize) &&
+			(glyphCacheSize >= 0)) {
+			fPtr->offScreenGlyphSize = glyphCacheSize * 1024;
+		}
+	}
+
+	/* OffscreenPools option, opened at screen init */
+	fPtr->offScreenPoolSpec =
+		xf86GetOptValString(fPtr->Options, OPTION_OFFSCREEN_POOLS);
+	fPtr->numOffscreenPools = 0;
+
 	/* select video modes */
 
 	xf86DrvMsg(pScrn->scrnIndex, X_INFO, "checking modes against framebuffer device...\n");
@@ -746,6 +777,38 @@ IMXCloseScreen(int scrnIndex, ScreenPtr pScreen)
 	return (*pScreen->CloseScreen)(scrnIndex, pScreen);
 }
 
+/* Also called by the server around suspend and resume. */
+static Bool
+IMXEnterVT(int scrnIndex, int flags)
+{
+	ScrnInfoPtr pScrn = xf86Screens[scrnIndex];
+	IMXPtr fPtr = IMXPTR(pScrn);
+
+	if (!fbdevHWEnterVT(scrnIndex, flags)) {
+		return FALSE;
+	}
+
+	if (fPtr->useAccel) {
+		IMX_EXA_EnterVT(scrnIndex, flags);
+	}
+
+	return TRUE;
+}
+
+static void
+IMXLeaveVT(int scrnIndex, int flags)
+{
+	ScrnInfoPtr pScrn = xf86Screens[scrnIndex];
+	IMXPtr fPtr = IMXPTR(pScrn);
+
+	/* Offscreen pixmaps are saved while the frame buffer is ours. */
+	if (fPtr->useAccel) {
+		IMX_EXA_LeaveVT(scrnIndex, flags);
+	}
+
+	fbdevHWLeaveVT(scrnIndex, flags);
+}
+
 
 Bool
 IMXGetPixmapProperties(
@@ -779,7 +842,78 @@ IMXGetPixmapProperties(
 	}
 
 	/* If we get here, then query EXA portion of driver. */
-	return IMX_EXA_GetPixmapProperties(pPixmap, pPhysAddr, pPitch);
+	if (!IMX_EXA_GetPixmapProperties(pPixmap, pPhysAddr, pPitch)) {
+		return FALSE;
+	}
+
+	/* The caller may hold on to the physical address, so the pixmap */
+	/* must stay where it is from now on. */
+	IMX_EXA_PinPixmap(pPixmap);
+
+	return TRUE;
+}
+
+/* Returns the IMX driver data of a screen, or NULL if the screen is */
+/* driven by another driver or not accelerated. */
+static IMXPtr
+IMXGetAccelScreenPtr(ScreenPtr pScreen)
+{
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+
+	/* Check if the screen has IMX driver. */
+	if (0 != strcmp(IMX_DRIVER_NAME, pScrn->driverName)) {
+		return NULL;
+	}
+
+	/* Access driver specific content. */
+	IMXPtr fPtr = IMXPTR(pScrn);
+
+	/* Cannot process if not accelerating. */
+	if (!fPtr->useAccel) {
+		return NULL;
+	}
+
+	return fPtr;
+}
+
+Bool
+IMXGetOffscreenStats(
+	ScreenPtr pScreen,
+	IMXOffscreenStatsPtr pStats)
+{
+	if (NULL == IMXGetAccelScreenPtr(pScreen)) {
+		return FALSE;
+	}
+
+	return IMX_EXA_GetOffscreenStats(pScreen, pStats);
+}
+
+int
+IMXGetOffscreenMap(
+	ScreenPtr pScreen,
+	IMXOffscreenHeapInfoPtr heaps,
+	int* pNumHeaps,
+	IMXOffscreenAreaInfoPtr areas,
+	int maxAreas)
+{
+	if (NULL == IMXGetAccelScreenPtr(pScreen)) {
+		return -1;
+	}
+
+	return IMX_EXA_GetOffscreenMap(pScreen, heaps, pNumHeaps,
+					areas, maxAreas);
+}
+
+int
+IMXGetAccelThresholds(
+	ScreenPtr pScreen,
+	IMXAccelThresholdInfoPtr infos)
+{
+	if (NULL == IMXGetAccelScreenPtr(pScreen)) {
+		return -1;
+	}
+
+	return IMX_EXA_GetAccelThresholds(pScreen, infos);
 }
 
 static Bool
@@ -52,16 +52,56 @@
  * This allocator allocates blocks of memory by maintaining a list of areas.
  * When allocating, the contiguous block of areas with the minimum eviction
  * cost is found and evicted in order to make room for the new allocation.
+ *
+ * Free areas are additionally indexed by a balanced (AVL) tree ordered by
+ * size and then offset, so that finding the best fitting free area and the
+ * largest free area does not require walking the whole list.  Neighbouring
+ * areas are found through the address ordered list when coalescing.  Each
+ * tree node also records the lowest and highest offset in its subtree, so
+ * that the lowest or highest free area of a given size is found quickly.
+ *
+ * Offscreen memory is split into heaps, each with its own list and tree.
+ * Glyph pictures have a heap of their own, and each extra memory pool
+ * configured with the OffscreenPools option is a heap which is used once
+ * the main heap has no free area left.  In the main heap, short lived
+ * allocations are placed from the bottom up and long lived ones from the
+ * top down, so that each kind does not fragment the other.
+ *
+ * Small blocks can instead be sub-allocated from shared pages, each an area
+ * split into 32 blocks of the same power of two size.
+ *
+ * Area records come from a slab rather than malloc, so that splitting and
+ * merging areas does not churn the heap and the records of the list stay
+ * close together in memory.  The slab functions are also used by the
+ * driver for its pixmap records.
+ *
+ * When built with IMX_EXA_OFFSCREEN_TRACE, every allocation, free, eviction
+ * and move is written to the file named by the IMX_OFFSCREEN_TRACE
+ * environment variable, so that tools/imx_offscreen_replay can replay the
+ * allocations of a real session against a changed allocator.
+ *
+ * Counters of allocations, frees, evictions and bytes in use are always
+ * kept, and IMX_EXA_OffscreenGetMap describes every area for the imx-ext
+ * extension and tools/imx_offscreen_map.
  */
 
 
 #include "xf86.h"
 #include "exa.h"
 #include "imx_type.h"
+#include "imx_ext.h"
 
 #include <limits.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/fb.h>
 
 #if (IMX_EXA_VERSION_COMPILED >= IMX_EXA_VERSION(2,5,0))
 
@@ -73,26 +113,586 @@
 #define DBG_OFFSCREEN(a)
 #endif
 
+#ifndef IMX_EXA_OFFSCREEN_TRACE
+#define	IMX_EXA_OFFSCREEN_TRACE	0
+#endif
+
+#if IMX_EXA_OFFSCREEN_TRACE
+#define TRACE_OFFSCREEN(a) IMX_EXA_TraceRecord a
+#else
+#define TRACE_OFFSCREEN(a)
+#endif
+
+/*
+ * Each area handed out by this allocator is the first member of an
+ * IMXOffscreenAreaRec, which adds the links for the free area index.
+ * Callers only ever see the embedded ExaOffscreenArea.
+ */
+typedef struct _IMXOffscreenArea {
+    ExaOffscreenArea		area;
+    IMXOffscreenHeapPtr		heap;
+    struct _IMXOffscreenArea	*freeLeft;
+    struct _IMXOffscreenArea	*freeRight;
+    int				freeHeight;	/* 0 if not in the free index */
+    int				freeMinBase;	/* lowest offset in subtree */
+    int				freeMaxBase;	/* highest offset in subtree */
+    unsigned			allocCounter;	/* offScreenCounter at alloc */
+} IMXOffscreenAreaRec, *IMXOffscreenAreaPtr;
+
+#define IMX_EXA_AREA(a)		((IMXOffscreenAreaPtr)(a))
+#define IMX_EXA_HEAP(a)		(IMX_EXA_AREA(a)->heap)
+#define IMX_EXA_FREE_HEIGHT(n)	((n) ? (n)->freeHeight : 0)
+
+/* area records allocated at once when the slab runs out */
+#define IMX_EXA_AREAS_PER_CHUNK	64
+
+/* records and chunk headers are padded to keep records aligned */
+#define IMX_EXA_SLAB_ALIGN(n)	(((n) + sizeof (double) - 1) & \
+				 ~(sizeof (double) - 1))
+
+typedef union _IMXSlabChunk {
+    union _IMXSlabChunk	*next;
+    double		align;
+} IMXSlabChunkRec, *IMXSlabChunkPtr;
+
+/* freed records hold the link to the next free record */
+typedef struct _IMXSlabFree {
+    struct _IMXSlabFree	*next;
+} IMXSlabFreeRec, *IMXSlabFreePtr;
+
+/**
+ * IMX_EXA_SlabInit sets up an empty slab for records of recordSize bytes,
+ * allocated recordsPerChunk at a time.
+ */
+void
+IMX_EXA_SlabInit (IMXSlabPtr slab, int recordSize, int recordsPerChunk)
+{
+    if (recordSize < sizeof (IMXSlabFreeRec))
+	recordSize = sizeof (IMXSlabFreeRec);
+
+    slab->recordSize = IMX_EXA_SLAB_ALIGN(recordSize);
+    slab->recordsPerChunk = recordsPerChunk;
+    slab->chunkList = NULL;
+    slab->freeList = NULL;
+    slab->numInUse = 0;
+}
+
+/**
+ * IMX_EXA_SlabAlloc returns an uninitialized record, or NULL if a new
+ * chunk was needed and could not be allocated.
+ */
+pointer
+IMX_EXA_SlabAlloc (IMXSlabPtr slab)
+{
+    IMXSlabFreePtr record = slab->freeList;
+
+    if (!record)
+    {
+	IMXSlabChunkPtr chunk;
+	char *records;
+	int i;
+
+	chunk = malloc (sizeof (IMXSlabChunkRec) +
+			slab->recordSize * slab->recordsPerChunk);
+	if (!chunk)
+	    return NULL;
+	chunk->next = slab->chunkList;
+	slab->chunkList = chunk;
+
+	/* thread the records so the lowest addressed one is used first */
+	records = (char *) (chunk + 1);
+	for (i = slab->recordsPerChunk - 1; i >= 0; i--)
+	{
+	    record = (IMXSlabFreePtr) (records + i * slab->recordSize);
+	    record->next = slab->freeList;
+	    slab->freeList = record;
+	}
+	record = slab->freeList;
+    }
+
+    slab->freeList = record->next;
+    slab->numInUse++;
+    return record;
+}
+
+/**
+ * IMX_EXA_SlabFree returns a record allocated by IMX_EXA_SlabAlloc to its
+ * slab, where it is the next record to be reused.
+ */
+void
+IMX_EXA_SlabFree (IMXSlabPtr slab, pointer p)
+{
+    IMXSlabFreePtr record = p;
+
+    assert (slab->numInUse > 0);
+    record->next = slab->freeList;
+    slab->freeList = record;
+    slab->numInUse--;
+}
+
+/**
+ * IMX_EXA_SlabFini releases the memory of all records of the slab, which
+ * must no longer be in use.
+ */
+void
+IMX_EXA_SlabFini (IMXSlabPtr slab)
+{
+    IMXSlabChunkPtr chunk;
+
+    assert (slab->numInUse == 0);
+    while ((chunk = slab->chunkList))
+    {
+	slab->chunkList = chunk->next;
+	free (chunk);
+    }
+    slab->freeList = NULL;
+}
+
+#if IMX_EXA_OFFSCREEN_TRACE
+
+/* trace records buffered before they are written out */
+#define IMX_EXA_TRACE_BUFFER_RECORDS	512
+
+static void
+IMX_EXA_TraceFlush (IMXPtr imxPtr)
+{
+    size_t len = imxPtr->offScreenTraceCount * sizeof (IMXOffscreenTraceRecord);
+
+    if (len > 0 &&
+	write (imxPtr->offScreenTraceFd, imxPtr->offScreenTraceBuf, len) !=
+	(ssize_t) len)
+	ErrorF ("IMX offscreen trace: write failed: %s\n", strerror (errno));
+    imxPtr->offScreenTraceCount = 0;
+}
+
+static void
+IMX_EXA_TraceRecord (IMXPtr imxPtr, int op, int flags, int size, int align,
+		     CARD32 offset)
+{
+    IMXOffscreenTraceRecord *rec;
+
+    if (!imxPtr->offScreenTraceBuf)
+	return;
+
+    rec = &imxPtr->offScreenTraceBuf[imxPtr->offScreenTraceCount++];
+    rec->time = GetTimeInMillis ();
+    rec->size = size;
+    rec->align = align;
+    rec->offset = offset;
+    rec->op = op;
+    rec->flags = flags;
+    rec->pad = 0;
+
+    if (imxPtr->offScreenTraceCount == IMX_EXA_TRACE_BUFFER_RECORDS)
+	IMX_EXA_TraceFlush (imxPtr);
+}
+
+/* start tracing if IMX_OFFSCREEN_TRACE is set; traces are appended to */
+static void
+IMX_EXA_TraceOpen (ScrnInfoPtr pScrn, IMXPtr imxPtr)
+{
+    const char *path = getenv ("IMX_OFFSCREEN_TRACE");
+    IMXOffscreenTraceHeaderRec header;
+    int fd;
+
+    if (!path || !*path || imxPtr->offScreenTraceBuf)
+	return;
+
+    fd = open (path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+    {
+	xf86DrvMsg (pScrn->scrnIndex, X_WARNING,
+		    "Cannot open offscreen trace %s: %s\n",
+		    path, strerror (errno));
+	return;
+    }
+
+    /* a new file gets the header, an old one is continued */
+    if (lseek (fd, 0, SEEK_END) == 0)
+    {
+	header.magic = IMX_EXA_TRACE_MAGIC;
+	header.version = IMX_EXA_TRACE_VERSION;
+	header.recordSize = sizeof (IMXOffscreenTraceRecord);
+	header.pad = 0;
+	if (write (fd, &header, sizeof (header)) != sizeof (header))
+	{
+	    close (fd);
+	    return;
+	}
+    }
+
+    imxPtr->offScreenTraceBuf = malloc (IMX_EXA_TRACE_BUFFER_RECORDS *
+					sizeof (IMXOffscreenTraceRecord));
+    if (!imxPtr->offScreenTraceBuf)
+    {
+	close (fd);
+	return;
+    }
+    imxPtr->offScreenTraceFd = fd;
+    imxPtr->offScreenTraceCount = 0;
+
+    xf86DrvMsg (pScrn->scrnIndex, X_INFO,
+		"Tracing offscreen allocations to %s\n", path);
+}
+
+static void
+IMX_EXA_TraceClose (IMXPtr imxPtr)
+{
+    if (!imxPtr->offScreenTraceBuf)
+	return;
+
+    IMX_EXA_TraceFlush (imxPtr);
+    close (imxPtr->offScreenTraceFd);
+    free (imxPtr->offScreenTraceBuf);
+    imxPtr->offScreenTraceBuf = NULL;
+}
+
+#endif
+
+static ExaOffscreenArea *
+IMX_EXA_OffscreenNewArea (IMXOffscreenHeapPtr heap)
+{
+    IMXOffscreenAreaPtr node = IMX_EXA_SlabAlloc (heap->areaSlab);
+
+    if (!node)
+	return NULL;
+
+    node->heap = heap;
+    node->freeLeft = NULL;
+    node->freeRight = NULL;
+    node->freeHeight = 0;
+    return &node->area;
+}
+
+static void
+IMX_EXA_OffscreenDeleteArea (ExaOffscreenArea *area)
+{
+    IMX_EXA_SlabFree (IMX_EXA_HEAP(area)->areaSlab, IMX_EXA_AREA(area));
+}
+
+/* order free areas by size, and by offset for areas of the same size */
+static int
+IMX_EXA_FreeCompare (IMXOffscreenAreaPtr a, IMXOffscreenAreaPtr b)
+{
+    if (a->area.size != b->area.size)
+	return (a->area.size < b->area.size) ? -1 : 1;
+    if (a->area.base_offset != b->area.base_offset)
+	return (a->area.base_offset < b->area.base_offset) ? -1 : 1;
+    return 0;
+}
+
+/* recompute the height and offset bounds of a node from its children */
+static IMXOffscreenAreaPtr
+IMX_EXA_FreeFixHeight (IMXOffscreenAreaPtr node)
+{
+    int left = IMX_EXA_FREE_HEIGHT(node->freeLeft);
+    int right = IMX_EXA_FREE_HEIGHT(node->freeRight);
+
+    node->freeHeight = ((left > right) ? left : right) + 1;
+
+    node->freeMinBase = node->freeMaxBase = node->area.base_offset;
+    if (node->freeLeft)
+    {
+	if (node->freeLeft->freeMinBase < node->freeMinBase)
+	    node->freeMinBase = node->freeLeft->freeMinBase;
+	if (node->freeLeft->freeMaxBase > node->freeMaxBase)
+	    node->freeMaxBase = node->freeLeft->freeMaxBase;
+    }
+    if (node->freeRight)
+    {
+	if (node->freeRight->freeMinBase < node->freeMinBase)
+	    node->freeMinBase = node->freeRight->freeMinBase;
+	if (node->freeRight->freeMaxBase > node->freeMaxBase)
+	    node->freeMaxBase = node->freeRight->freeMaxBase;
+    }
+    return node;
+}
+
+static IMXOffscreenAreaPtr
+IMX_EXA_FreeRotateRight (IMXOffscreenAreaPtr node)
+{
+    IMXOffscreenAreaPtr left = node->freeLeft;
+
+    node->freeLeft = left->freeRight;
+    left->freeRight = IMX_EXA_FreeFixHeight (node);
+    return IMX_EXA_FreeFixHeight (left);
+}
+
+static IMXOffscreenAreaPtr
+IMX_EXA_FreeRotateLeft (IMXOffscreenAreaPtr node)
+{
+    IMXOffscreenAreaPtr right = node->freeRight;
+
+    node->freeRight = right->freeLeft;
+    right->freeLeft = IMX_EXA_FreeFixHeight (node);
+    return IMX_EXA_FreeFixHeight (right);
+}
+
+static IMXOffscreenAreaPtr
+IMX_EXA_FreeBalance (IMXOffscreenAreaPtr node)
+{
+    int diff = IMX_EXA_FREE_HEIGHT(node->freeLeft) -
+	       IMX_EXA_FREE_HEIGHT(node->freeRight);
+
+    if (diff > 1)
+    {
+	IMXOffscreenAreaPtr left = node->freeLeft;
+	if (IMX_EXA_FREE_HEIGHT(left->freeLeft) <
+	    IMX_EXA_FREE_HEIGHT(left->freeRight))
+	    node->freeLeft = IMX_EXA_FreeRotateLeft (left);
+	return IMX_EXA_FreeRotateRight (node);
+    }
+
+    if (diff < -1)
+    {
+	IMXOffscreenAreaPtr right = node->freeRight;
+	if (IMX_EXA_FREE_HEIGHT(right->freeRight) <
+	    IMX_EXA_FREE_HEIGHT(right->freeLeft))
+	    node->freeRight = IMX_EXA_FreeRotateRight (right);
+	return IMX_EXA_FreeRotateLeft (node);
+    }
+
+    return IMX_EXA_FreeFixHeight (node);
+}
+
+static IMXOffscreenAreaPtr
+IMX_EXA_FreeInsertNode (IMXOffscreenAreaPtr root, IMXOffscreenAreaPtr node)
+{
+    if (!root)
+    {
+	node->freeLeft = NULL;
+	node->freeRight = NULL;
+	return IMX_EXA_FreeFixHeight (node);
+    }
+
+    if (IMX_EXA_FreeCompare (node, root) < 0)
+	root->freeLeft = IMX_EXA_FreeInsertNode (root->freeLeft, node);
+    else
+	root->freeRight = IMX_EXA_FreeInsertNode (root->freeRight, node);
+
+    return IMX_EXA_FreeBalance (root);
+}
+
+static IMXOffscreenAreaPtr
+IMX_EXA_FreeRemoveMin (IMXOffscreenAreaPtr root, IMXOffscreenAreaPtr *pMin)
+{
+    if (!root->freeLeft)
+    {
+	*pMin = root;
+	return root->freeRight;
+    }
+
+    root->freeLeft = IMX_EXA_FreeRemoveMin (root->freeLeft, pMin);
+    return IMX_EXA_FreeBalance (root);
+}
+
+static IMXOffscreenAreaPtr
+IMX_EXA_FreeRemoveNode (IMXOffscreenAreaPtr root, IMXOffscreenAreaPtr node)
+{
+    int cmp;
+
+    if (!root)
+	return NULL;
+
+    cmp = IMX_EXA_FreeCompare (node, root);
+    if (cmp < 0)
+	root->freeLeft = IMX_EXA_FreeRemoveNode (root->freeLeft, node);
+    else if (cmp > 0)
+	root->freeRight = IMX_EXA_FreeRemoveNode (root->freeRight, node);
+    else
+    {
+	IMXOffscreenAreaPtr left = root->freeLeft;
+	IMXOffscreenAreaPtr right = root->freeRight;
+	IMXOffscreenAreaPtr min;
+
+	root->freeLeft = NULL;
+	root->freeRight = NULL;
+	root->freeHeight = 0;
+
+	if (!right)
+	    return left;
+
+	right = IMX_EXA_FreeRemoveMin (right, &min);
+	min->freeLeft = left;
+	min->freeRight = right;
+	return IMX_EXA_FreeBalance (min);
+    }
+
+    return IMX_EXA_FreeBalance (root);
+}
+
+/* add a free area to the index; its size and offset must not change
+ * until it is removed again */
+static void
+IMX_EXA_FreeInsert (IMXOffscreenHeapPtr heap, ExaOffscreenArea *area)
+{
+    heap->freeRoot = IMX_EXA_FreeInsertNode (heap->freeRoot, IMX_EXA_AREA(area));
+}
+
+static void
+IMX_EXA_FreeRemove (IMXOffscreenHeapPtr heap, ExaOffscreenArea *area)
+{
+    heap->freeRoot = IMX_EXA_FreeRemoveNode (heap->freeRoot, IMX_EXA_AREA(area));
+}
+
+/*
+ * Find the smallest free area that can hold size bytes with the requested
+ * alignment.  Any area of at least size + align - 1 bytes fits, so only the
+ * few candidates just above size ever need to be skipped.
+ */
+static ExaOffscreenArea *
+IMX_EXA_FreeFindBest (IMXOffscreenHeapPtr heap, int size, int align)
+{
+    IMXOffscreenAreaPtr node, best;
+    int minSize = size;
+    int minBase = INT_MIN;
+    int real_size;
+
+    for (;;)
+    {
+	/* smallest area ordered at or after (minSize, minBase) */
+	best = NULL;
+	node = heap->freeRoot;
+	while (node)
+	{
+	    if ((node->area.size > minSize) ||
+		((node->area.size == minSize) &&
+		 (node->area.base_offset >= minBase)))
+	    {
+		best = node;
+		node = node->freeLeft;
+	    }
+	    else
+		node = node->freeRight;
+	}
+
+	if (!best)
+	    return NULL;
+
+	/* adjust size to match alignment requirement */
+	real_size = size + (best->area.base_offset + best->area.size - size) % align;
+	if (real_size <= best->area.size)
+	    return &best->area;
+
+	minSize = best->area.size;
+	minBase = best->area.base_offset + 1;
+    }
+}
+
+/*
+ * Find the free area with the lowest (or highest) offset of those holding
+ * at least size bytes.  Every node right of a node that is large enough is
+ * large enough too, so the offset bounds of those subtrees are used whole.
+ */
+static ExaOffscreenArea *
+IMX_EXA_FreeFindEdge (IMXOffscreenHeapPtr heap, int size, Bool highest)
+{
+    IMXOffscreenAreaPtr node = heap->freeRoot;
+    IMXOffscreenAreaPtr best = NULL, subtree = NULL;
+    int bestBase = 0;
+
+    while (node)
+    {
+	if (node->area.size < size)
+	{
+	    node = node->freeRight;
+	    continue;
+	}
+
+	if ((!best && !subtree) ||
+	    (highest ? node->area.base_offset > bestBase :
+		       node->area.base_offset < bestBase))
+	{
+	    best = node;
+	    subtree = NULL;
+	    bestBase = node->area.base_offset;
+	}
+	if (node->freeRight &&
+	    (highest ? node->freeRight->freeMaxBase > bestBase :
+		       node->freeRight->freeMinBase < bestBase))
+	{
+	    best = NULL;
+	    subtree = node->freeRight;
+	    bestBase = highest ? subtree->freeMaxBase : subtree->freeMinBase;
+	}
+	node = node->freeLeft;
+    }
+
+    /* find the node holding the bound within the subtree */
+    node = subtree;
+    while (node && node->area.base_offset != bestBase)
+    {
+	IMXOffscreenAreaPtr left = node->freeLeft;
+
+	if (left && (highest ? left->freeMaxBase : left->freeMinBase) == bestBase)
+	    node = left;
+	else
+	    node = node->freeRight;
+    }
+    if (node)
+	best = node;
+
+    return best ? &best->area : NULL;
+}
+
 #if DEBUG_OFFSCREEN
+static int
+IMX_EXA_FreeValidateNode (IMXOffscreenAreaPtr node)
+{
+    if (!node)
+	return 0;
+
+    assert (node->area.state == ExaOffscreenAvail);
+    {
+	int height = node->freeHeight;
+	int minBase = node->freeMinBase, maxBase = node->freeMaxBase;
+
+	IMX_EXA_FreeFixHeight (node);
+	assert (height == node->freeHeight);
+	assert (minBase == node->freeMinBase && maxBase == node->freeMaxBase);
+    }
+    if (node->freeLeft)
+	assert (IMX_EXA_FreeCompare (node->freeLeft, node) < 0);
+    if (node->freeRight)
+	assert (IMX_EXA_FreeCompare (node->freeRight, node) > 0);
+
+    return 1 + IMX_EXA_FreeValidateNode (node->freeLeft) +
+	       IMX_EXA_FreeValidateNode (node->freeRight);
+}
+
 static void
 IMX_EXA_OffscreenValidate (ScreenPtr pScreen)
 {
     /* Access the driver specific data. */
     ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
     IMXPtr imxPtr = IMXPTR(pScrn);
-    ExaOffscreenArea *prev = 0, *area;
+    int i;
 
-    assert (imxPtr->offScreenAreas->base_offset == 
-	    imxPtr->exaDriverPtr->offScreenBase);
-    for (area = imxPtr->offScreenAreas; area; area = area->next)
+    for (i = 0; i < imxPtr->numOffscreenHeaps; i++)
     {
-	assert (area->offset >= area->base_offset &&
-		area->offset < (area->base_offset + area->size));
-	if (prev)
-	    assert (prev->base_offset + prev->size == area->base_offset);
-	prev = area;
+	IMXOffscreenHeapPtr heap = &imxPtr->offScreenHeaps[i];
+	ExaOffscreenArea *prev = 0, *area;
+	unsigned numAvail = 0;
+
+	assert (heap->areas->base_offset == heap->baseOffset);
+	for (area = heap->areas; area; area = area->next)
+	{
+	    assert (IMX_EXA_HEAP(area) == heap);
+	    assert (area->offset >= area->base_offset &&
+		    area->offset < (area->base_offset + area->size));
+	    if (prev)
+		assert (prev->base_offset + prev->size == area->base_offset);
+	    if (area->state == ExaOffscreenAvail)
+	    {
+		assert (IMX_EXA_AREA(area)->freeHeight > 0);
+		numAvail++;
+	    }
+	    prev = area;
+	}
+	assert (prev->base_offset + prev->size == heap->endOffset);
+	assert (numAvail == heap->numAvailable);
+	assert (numAvail == IMX_EXA_FreeValidateNode (heap->freeRoot));
     }
-    assert (prev->base_offset + prev->size == imxPtr->exaDriverPtr->memorySize);
 }
 #else
 #define IMX_EXA_OffscreenValidate(s)
@@ -100,10 +700,13 @@ IMX_EXA_OffscreenValidate (ScreenPtr pScreen)
 
 /* merge the next free area into this one */
 static void
-IMX_EXA_OffscreenMerge (IMXPtr imxPtr, ExaOffscreenArea *area)
+IMX_EXA_OffscreenMerge (IMXOffscreenHeapPtr heap, ExaOffscreenArea *area)
 {
     ExaOffscreenArea	*next = area->next;
 
+    /* the next area is absorbed, so drop it from the free index */
+    IMX_EXA_FreeRemove (heap, next);
+
     /* account for space */
     area->size += next->size;
     /* frob pointer */
@@ -111,30 +714,18 @@ IMX_EXA_OffscreenMerge (IMXPtr imxPtr, ExaOffscreenArea *area)
     if (area->next)
 	area->next->prev = area;
     else
-	imxPtr->offScreenAreas->prev = area;
-    free (next);
+	heap->areas->prev = area;
+    IMX_EXA_OffscreenDeleteArea (next);
 
-    imxPtr->numOffscreenAvailable--;
+    heap->numAvailable--;
 }
 
-/**
- * IMX_EXA_OffscreenFree frees an allocation.
- *
- * @param pScreen current screen
- * @param area offscreen area to free
- *
- * IMX_EXA_OffscreenFree frees an allocation created by IMX_EXA_OffscreenAlloc.  Note that
- * the save callback of the area is not called, and it is up to the driver to
- * do any cleanup necessary as a result.
- *
- * @return pointer to the newly freed area. This behavior should not be relied
- * on.
- */
-ExaOffscreenArea *
-IMX_EXA_OffscreenFree (ScreenPtr pScreen, ExaOffscreenArea *area)
+/* return an area to its heap, merging it with free neighbours */
+static ExaOffscreenArea *
+IMX_EXA_OffscreenRelease (ScreenPtr pScreen, ExaOffscreenArea *area)
 {
-    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
-    IMXPtr imxPtr = IMXPTR(pScrn);
+    IMXPtr imxPtr = IMXPTR(xf86Screens[pScreen->myNum]);
+    IMXOffscreenHeapPtr heap = IMX_EXA_HEAP(area);
     ExaOffscreenArea	*next = area->next;
     ExaOffscreenArea	*prev;
 
@@ -142,6 +733,9 @@ IMX_EXA_OffscreenFree (ScreenPtr pScreen, ExaOffscreenArea *area)
                     area->size, area->base_offset, area->offset));
     IMX_EXA_OffscreenValidate (pScreen);
 
+    imxPtr->offScreenStats.numAreasInUse--;
+    imxPtr->offScreenStats.bytesInUse -= area->size;
+
     area->state = ExaOffscreenAvail;
     area->save = NULL;
     area->last_use = 0;
@@ -149,43 +743,187 @@ IMX_EXA_OffscreenFree (ScreenPtr pScreen, ExaOffscreenArea *area)
     /*
      * Find previous area
      */
-    if (area == imxPtr->offScreenAreas)
+    if (area == heap->areas)
 	prev = NULL;
     else
 	prev = area->prev;
 
-    imxPtr->numOffscreenAvailable++;
+    heap->numAvailable++;
 
     /* link with next area if free */
     if (next && next->state == ExaOffscreenAvail)
-	IMX_EXA_OffscreenMerge (imxPtr, area);
+	IMX_EXA_OffscreenMerge (heap, area);
 
     /* link with prev area if free */
     if (prev && prev->state == ExaOffscreenAvail)
     {
 	area = prev;
-	IMX_EXA_OffscreenMerge (imxPtr, area);
+	IMX_EXA_FreeRemove (heap, area);
+	IMX_EXA_OffscreenMerge (heap, area);
     }
 
+    IMX_EXA_FreeInsert (heap, area);
+
     IMX_EXA_OffscreenValidate (pScreen);
     return area;
 }
 
-static ExaOffscreenArea *
-IMX_EXA_OffscreenKickOut (ScreenPtr pScreen, ExaOffscreenArea *area)
-{
-    if (area->save)
-	(*area->save) (pScreen, area);
-    return IMX_EXA_OffscreenFree (pScreen, area);
-}
-
-static void
-IMX_EXA_UpdateEvictionCost(ExaOffscreenArea *area, unsigned offScreenCounter)
-{
-    static unsigned max_age = UINT_MAX/2;
-    unsigned age;
-
-    if (area->state == ExaOffscreenAvail)
+/**
+ * IMX_EXA_OffscreenFree frees an allocation.
+ *
+ * @param pScreen current screen
+ * @param area offscreen area to free
+ *
+ * IMX_EXA_OffscreenFree frees an allocation created by IMX_EXA_OffscreenAlloc.  Note that
+ * the save callback of the area is not called, and it is up to the driver to
+ * do any cleanup necessary as a result.
+ *
+ * @return pointer to the newly freed area. This behavior should not be relied
+ * on.
+ */
+ExaOffscreenArea *
+IMX_EXA_OffscreenFree (ScreenPtr pScreen, ExaOffscreenArea *area)
+{
+    IMXPtr imxPtr = IMXPTR(xf86Screens[pScreen->myNum]);
+
+    imxPtr->offScreenStats.numFrees++;
+    TRACE_OFFSCREEN ((imxPtr, IMX_EXA_TRACE_FREE, 0, 0, 0, area->offset));
+    return IMX_EXA_OffscreenRelease (pScreen, area);
+}
+
+/**
+ * IMX_EXA_OffscreenLargestAvail returns the size in bytes of the largest
+ * free area of the main heap and the pools, without evicting anything.
+ */
+int
+IMX_EXA_OffscreenLargestAvail (ScreenPtr pScreen)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    IMXPtr imxPtr = IMXPTR(pScrn);
+    int largest = 0;
+    int i;
+
+    for (i = 0; i < imxPtr->numOffscreenHeaps; i++)
+    {
+	IMXOffscreenAreaPtr node = imxPtr->offScreenHeaps[i].freeRoot;
+
+	if (imxPtr->offScreenHeaps[i].kind == IMX_EXA_OFFSCREEN_HEAP_GLYPH ||
+	    !node)
+	    continue;
+
+	while (node->freeRight)
+	    node = node->freeRight;
+
+	if (node->area.size > largest)
+	    largest = node->area.size;
+    }
+
+    return largest;
+}
+
+/**
+ * IMX_EXA_OffscreenGetStats copies the allocator counters and works out
+ * how much memory is free in the main heap and the pools, the largest free
+ * area there and a fragmentation index: the part of the free memory in
+ * areas other than the largest one, in units of 1/1000.
+ */
+void
+IMX_EXA_OffscreenGetStats (ScreenPtr pScreen, IMXOffscreenStatsPtr pStats)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    IMXPtr imxPtr = IMXPTR(pScrn);
+    unsigned long bytesFree = 0;
+    int i;
+
+    *pStats = imxPtr->offScreenStats;
+
+    for (i = 0; i < imxPtr->numOffscreenHeaps; i++)
+    {
+	IMXOffscreenHeapPtr heap = &imxPtr->offScreenHeaps[i];
+	ExaOffscreenArea *area;
+
+	if (heap->kind == IMX_EXA_OFFSCREEN_HEAP_GLYPH)
+	    continue;
+
+	for (area = heap->areas; area; area = area->next)
+	    if (area->state == ExaOffscreenAvail)
+		bytesFree += area->size;
+    }
+
+    pStats->bytesFree = bytesFree;
+    pStats->largestFree = IMX_EXA_OffscreenLargestAvail (pScreen);
+    pStats->fragmentation = bytesFree ?
+	1000 - (int) (1000.0 * pStats->largestFree / bytesFree) : 0;
+}
+
+/**
+ * IMX_EXA_OffscreenVirtAddr returns the CPU address of an offset within an
+ * allocated area.
+ */
+pointer
+IMX_EXA_OffscreenVirtAddr (ExaOffscreenArea *area, int offset)
+{
+    IMXOffscreenHeapPtr heap = IMX_EXA_HEAP(area);
+
+    return heap->virtAddr + (offset - heap->baseOffset);
+}
+
+/**
+ * IMX_EXA_OffscreenPhysAddr looks up the GPU address of a CPU address.
+ *
+ * @return FALSE if the address is neither in frame buffer memory nor in a
+ * pool the GPU can address.
+ */
+Bool
+IMX_EXA_OffscreenPhysAddr (ScreenPtr pScreen, pointer ptr,
+			   unsigned long *pPhysAddr)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    IMXPtr imxPtr = IMXPTR(pScrn);
+    unsigned char *addr = ptr;
+    unsigned char *fbBase = imxPtr->exaDriverPtr->memoryBase;
+    int i;
+
+    if (fbBase <= addr && addr < fbBase + imxPtr->exaDriverPtr->memorySize)
+    {
+	*pPhysAddr = (unsigned long) pScrn->memPhysBase + (addr - fbBase);
+	return TRUE;
+    }
+
+    for (i = 0; i < imxPtr->numOffscreenPools; i++)
+    {
+	IMXOffscreenPoolPtr pool = &imxPtr->offScreenPools[i];
+
+	if (pool->gpuAddressable &&
+	    pool->virtAddr <= addr && addr < pool->virtAddr + pool->size)
+	{
+	    *pPhysAddr = pool->physAddr + (addr - pool->virtAddr);
+	    return TRUE;
+	}
+    }
+
+    return FALSE;
+}
+
+static ExaOffscreenArea *
+IMX_EXA_OffscreenKickOut (ScreenPtr pScreen, ExaOffscreenArea *area)
+{
+    IMXPtr imxPtr = IMXPTR(xf86Screens[pScreen->myNum]);
+
+    imxPtr->offScreenStats.numEvictions++;
+    TRACE_OFFSCREEN ((imxPtr, IMX_EXA_TRACE_EVICT, 0, 0, 0, area->offset));
+    if (area->save)
+	(*area->save) (pScreen, area);
+    return IMX_EXA_OffscreenRelease (pScreen, area);
+}
+
+static void
+IMX_EXA_UpdateEvictionCost(ExaOffscreenArea *area, unsigned offScreenCounter)
+{
+    static unsigned max_age = UINT_MAX/2;
+    unsigned age;
+
+    if (area->state == ExaOffscreenAvail)
 	return;
 
     age = offScreenCounter - area->last_use;
@@ -198,257 +936,1038 @@ IMX_EXA_UpdateEvictionCost(ExaOffscreenArea *area, unsigned offScreenCounter)
 	area->last_use = offScreenCounter - age;
     }*/
 
-    area->eviction_cost = area->size / age;
+    area->eviction_cost = area->size / age;
+}
+
+static ExaOffscreenArea *
+IMX_EXA_FindAreaToEvict(IMXPtr imxPtr, IMXOffscreenHeapPtr heap, int size, int align)
+{
+    ExaOffscreenArea *begin, *end, *best;
+    unsigned cost, best_cost;
+    int avail, real_size;
+
+    best_cost = UINT_MAX;
+    begin = end = heap->areas;
+    avail = 0;
+    cost = 0;
+    best = 0;
+
+    while (end != NULL)
+    {
+	restart:
+	while (begin != NULL && begin->state == ExaOffscreenLocked)
+	    begin = end = begin->next;
+
+	if (begin == NULL)
+	    break;
+
+	/* adjust size needed to account for alignment loss for this area */
+	real_size = size + (begin->base_offset + begin->size - size) % align;
+
+	while (avail < real_size && end != NULL)
+	{
+	    if (end->state == ExaOffscreenLocked) {
+		/* Can't more room here, restart after this locked area */
+		avail = 0;
+		cost = 0;
+		begin = end;
+		goto restart;
+	    }
+	    avail += end->size;
+	    IMX_EXA_UpdateEvictionCost(end, imxPtr->offScreenCounter);
+	    cost += end->eviction_cost;
+	    end = end->next;
+	}
+
+	/* Check the cost, update best */
+	if (avail >= real_size && cost < best_cost) {
+	    best = begin;
+	    best_cost = cost;
+	}
+
+	avail -= begin->size;
+	cost -= begin->eviction_cost;
+	begin = begin->next;
+    }
+
+    return best;
+}
+
+/**
+ * IMX_EXA_OffscreenAreaHeapKind returns the kind of heap, one of the
+ * IMX_EXA_OFFSCREEN_HEAP_* kinds, an allocated area is in.
+ */
+int
+IMX_EXA_OffscreenAreaHeapKind (ExaOffscreenArea *area)
+{
+    return IMX_EXA_HEAP(area)->kind;
+}
+
+/**
+ * IMX_EXA_OffscreenMarkUsed records a use of an allocated area, which makes
+ * it more costly to evict.
+ */
+void
+IMX_EXA_OffscreenMarkUsed (ScreenPtr pScreen, ExaOffscreenArea *area)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    IMXPtr imxPtr = IMXPTR(pScrn);
+
+    if (!area || area->state == ExaOffscreenAvail)
+	return;
+
+    area->last_use = imxPtr->offScreenCounter++;
+}
+
+#define AREA_SCORE(area) (area->size / (double)(imxPtr->offScreenCounter - area->last_use))
+
+/* pick the heaps to try, in order, for a placement, leaving out those the */
+/* GPU cannot address if IMX_EXA_OFFSCREEN_GPU_ONLY is or'ed in */
+static int
+IMX_EXA_OffscreenPlacementHeaps (IMXPtr imxPtr, int placement,
+				 IMXOffscreenHeapPtr *heaps)
+{
+    Bool gpuOnly = (placement & IMX_EXA_OFFSCREEN_GPU_ONLY) != 0;
+    int numHeaps = 0;
+    int i;
+
+    placement &= IMX_EXA_OFFSCREEN_PLACEMENT_MASK;
+    if (placement == IMX_EXA_OFFSCREEN_GLYPH &&
+	imxPtr->numOffscreenHeaps > IMX_EXA_OFFSCREEN_HEAP_GLYPH &&
+	imxPtr->offScreenHeaps[IMX_EXA_OFFSCREEN_HEAP_GLYPH].kind ==
+	IMX_EXA_OFFSCREEN_HEAP_GLYPH)
+	heaps[numHeaps++] = &imxPtr->offScreenHeaps[IMX_EXA_OFFSCREEN_HEAP_GLYPH];
+    heaps[numHeaps++] = &imxPtr->offScreenHeaps[IMX_EXA_OFFSCREEN_HEAP_MAIN];
+
+    /* the pools take what does not fit in frame buffer memory */
+    for (i = 0; i < imxPtr->numOffscreenHeaps; i++)
+	if (imxPtr->offScreenHeaps[i].kind == IMX_EXA_OFFSCREEN_HEAP_POOL &&
+	    (imxPtr->offScreenHeaps[i].gpuAddressable || !gpuOnly))
+	    heaps[numHeaps++] = &imxPtr->offScreenHeaps[i];
+
+    return numHeaps;
+}
+
+/* find a free area for the placement, without evicting anything */
+static ExaOffscreenArea *
+IMX_EXA_OffscreenFindFree (IMXOffscreenHeapPtr heap, int size, int align,
+			   int placement, Bool *pAtStart)
+{
+    ExaOffscreenArea *area = NULL;
+
+    *pAtStart = FALSE;
+    switch (placement)
+    {
+    case IMX_EXA_OFFSCREEN_SHORT_LIVED:
+	/* lowest area which fits whatever its alignment loss */
+	area = IMX_EXA_FreeFindEdge (heap, size + align - 1, FALSE);
+	*pAtStart = (area != NULL);
+	break;
+    case IMX_EXA_OFFSCREEN_LONG_LIVED:
+	area = IMX_EXA_FreeFindEdge (heap, size + align - 1, TRUE);
+	break;
+    }
+
+    if (!area)
+	area = IMX_EXA_FreeFindBest (heap, size, align);
+
+    return area;
+}
+
+/* make room in a heap by evicting the cheapest run of removable areas */
+static ExaOffscreenArea *
+IMX_EXA_OffscreenEvict (ScreenPtr pScreen, IMXOffscreenHeapPtr heap,
+			int size, int align)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    IMXPtr imxPtr = IMXPTR(pScrn);
+    ExaOffscreenArea *area, *begin, *best;
+    double best_score;
+    int real_size = 0;
+
+    /*
+     * Kick out existing users to make space.
+     *
+     * First, locate a region which can hold the desired object.
+     */
+
+    /* prev points at the first object to boot */
+    best = NULL;
+    best_score = UINT_MAX;
+    for (begin = heap->areas; begin != NULL; begin = begin->next)
+    {
+	int avail;
+	double score;
+	ExaOffscreenArea *scan;
+
+	if (begin->state == ExaOffscreenLocked)
+	    continue;
+
+	avail = 0;
+	score = 0;
+	/* now see if we can make room here, and how "costly" it'll be. */
+	for (scan = begin; scan != NULL; scan = scan->next)
+	{
+	    if (scan->state == ExaOffscreenLocked) {
+		/* Can't make room here, start after this locked area. */
+		begin = scan;
+		break;
+	    }
+	    score += AREA_SCORE(scan);
+	    avail += scan->size;
+	    /* the allocation is placed at the end of the run, so */
+	    /* the alignment loss depends on where the run ends */
+	    real_size = size + (begin->base_offset + avail - size) % align;
+	    if (avail >= size && avail >= real_size)
+		break;
+	}
+	/* Is it the best option we've found so far? */
+	if (avail >= size && avail >= real_size && score < best_score) {
+	    best = begin;
+	    best_score = score;
+	}
+    }
+    area = best;
+    if (!area)
+	return NULL;
+
+    /*
+     * Kick out first area if in use
+     */
+    if (area->state != ExaOffscreenAvail)
+	area = IMX_EXA_OffscreenKickOut (pScreen, area);
+    /*
+     * Now get the system to merge the other needed areas together,
+     * accounting for alignment loss at the end of the merged area
+     */
+    for (;;)
+    {
+	real_size = size + (area->base_offset + area->size - size) % align;
+	if (area->size >= size && area->size >= real_size)
+	    break;
+	assert (area->next && area->next->state == ExaOffscreenRemovable);
+	(void) IMX_EXA_OffscreenKickOut (pScreen, area->next);
+    }
+
+    return area;
+}
+
+/**
+ * IMX_EXA_OffscreenAllocPlaced allocates offscreen memory like
+ * IMX_EXA_OffscreenAlloc, placed according to how long it is expected to
+ * live.
+ *
+ * @param placement one of the IMX_EXA_OFFSCREEN_* placements, optionally
+ *	  or'ed with IMX_EXA_OFFSCREEN_NO_EVICT to only use free memory and
+ *	  with IMX_EXA_OFFSCREEN_GPU_ONLY to leave out pools the GPU cannot
+ *	  address
+ *
+ * Short lived allocations take the start of the lowest free area that fits
+ * and long lived ones the end of the highest, so that the two grow towards
+ * each other from opposite ends of the main heap.  Glyph allocations come
+ * from the glyph heap while it has room, and otherwise from the main heap.
+ * Other allocations take the smallest free area that fits.  When nothing
+ * fits, the cheapest areas to evict are kicked out and the allocation is
+ * placed at the end of the space made.
+ */
+ExaOffscreenArea *
+IMX_EXA_OffscreenAllocPlaced (ScreenPtr pScreen, int size, int align,
+			      Bool locked,
+			      ExaOffscreenSaveProc save,
+			      pointer privData,
+			      int placement)
+{
+    ExaOffscreenArea *area, *new_area;
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    IMXPtr imxPtr = IMXPTR(pScrn);
+    IMXOffscreenHeapPtr heaps[IMX_EXA_OFFSCREEN_MAX_HEAPS], heap = NULL;
+    int numHeaps, i;
+    int real_size = 0;
+    Bool atStart = FALSE;
+    Bool evict = !(placement & IMX_EXA_OFFSCREEN_NO_EVICT);
+#if IMX_EXA_OFFSCREEN_TRACE
+    int traceFlags = placement | (locked ? IMX_EXA_TRACE_LOCKED : 0);
+#endif
+
+    IMX_EXA_OffscreenValidate (pScreen);
+    numHeaps = IMX_EXA_OffscreenPlacementHeaps (imxPtr, placement, heaps);
+    placement &= IMX_EXA_OFFSCREEN_PLACEMENT_MASK;
+    if (!align)
+	align = 1;
+
+    if (!size)
+    {
+	DBG_OFFSCREEN (("Alloc 0x%x -> EMPTY\n", size));
+	TRACE_OFFSCREEN ((imxPtr, IMX_EXA_TRACE_ALLOC, traceFlags, size, align,
+			  IMX_EXA_TRACE_NO_OFFSET));
+	return NULL;
+    }
+
+    /* throw out requests that cannot fit */
+    for (i = 0; i < numHeaps; i++)
+	if (size <= heaps[i]->endOffset - heaps[i]->baseOffset)
+	    break;
+    if (i == numHeaps)
+    {
+	DBG_OFFSCREEN (("Alloc 0x%x -> TOBIG\n", size));
+	imxPtr->offScreenStats.numAllocFailures++;
+	TRACE_OFFSCREEN ((imxPtr, IMX_EXA_TRACE_ALLOC, traceFlags, size, align,
+			  IMX_EXA_TRACE_NO_OFFSET));
+	return NULL;
+    }
+
+    /* Try to find free space that'll fit. */
+    area = NULL;
+    for (i = 0; !area && i < numHeaps; i++)
+    {
+	heap = heaps[i];
+	area = IMX_EXA_OffscreenFindFree (heap, size, align, placement,
+					  &atStart);
+    }
+
+    /* Otherwise kick out existing users to make space. */
+    for (i = 0; !area && evict && i < numHeaps; i++)
+    {
+	heap = heaps[i];
+	area = IMX_EXA_OffscreenEvict (pScreen, heap, size, align);
+    }
+
+    if (!area)
+    {
+	DBG_OFFSCREEN (("Alloc 0x%x -> NOSPACE\n", size));
+	imxPtr->offScreenStats.numAllocFailures++;
+	TRACE_OFFSCREEN ((imxPtr, IMX_EXA_TRACE_ALLOC, traceFlags, size, align,
+			  IMX_EXA_TRACE_NO_OFFSET));
+	/* Could not allocate memory */
+	IMX_EXA_OffscreenValidate (pScreen);
+	return NULL;
+    }
+
+    if (atStart)
+    {
+	real_size = area->base_offset + align - 1;
+	real_size -= real_size % align;
+	real_size += size - area->base_offset;
+    }
+    else
+	real_size = size + (area->base_offset + area->size - size) % align;
+
+    /* get the record for any extra space before touching the index */
+    new_area = NULL;
+    if (real_size < area->size)
+    {
+	new_area = IMX_EXA_OffscreenNewArea (heap);
+	if (!new_area)
+	{
+	    imxPtr->offScreenStats.numAllocFailures++;
+	    TRACE_OFFSCREEN ((imxPtr, IMX_EXA_TRACE_ALLOC, traceFlags, size,
+			      align, IMX_EXA_TRACE_NO_OFFSET));
+	    return NULL;
+	}
+    }
+
+    /* the area is about to change or be used, so it leaves the index */
+    IMX_EXA_FreeRemove (heap, area);
+
+    /* save extra space in new area */
+    if (new_area && atStart)
+    {
+	new_area->base_offset = area->base_offset + real_size;
+
+	new_area->offset = new_area->base_offset;
+	new_area->align = 0;
+	new_area->size = area->size - real_size;
+	new_area->state = ExaOffscreenAvail;
+	new_area->save = NULL;
+	new_area->last_use = 0;
+	new_area->eviction_cost = 0;
+	new_area->prev = area;
+	new_area->next = area->next;
+	if (area->next)
+	    area->next->prev = new_area;
+	else
+	    heap->areas->prev = new_area;
+	area->next = new_area;
+	area->size = real_size;
+	IMX_EXA_FreeInsert (heap, new_area);
+    }
+    else if (new_area)
+    {
+	new_area->base_offset = area->base_offset;
+
+	new_area->offset = new_area->base_offset;
+	new_area->align = 0;
+	new_area->size = area->size - real_size;
+	new_area->state = ExaOffscreenAvail;
+	new_area->save = NULL;
+	new_area->last_use = 0;
+	new_area->eviction_cost = 0;
+	new_area->next = area;
+	new_area->prev = area->prev;
+	if (area->prev->next)
+	    area->prev->next = new_area;
+	else
+	    heap->areas = new_area;
+	area->prev = new_area;
+	area->base_offset = new_area->base_offset + new_area->size;
+	area->size = real_size;
+	IMX_EXA_FreeInsert (heap, new_area);
+    } else
+	heap->numAvailable--;
+
+    /*
+     * Mark this area as in use
+     */
+    if (locked)
+	area->state = ExaOffscreenLocked;
+    else
+	area->state = ExaOffscreenRemovable;
+    area->privData = privData;
+    area->save = save;
+    area->last_use = imxPtr->offScreenCounter++;
+    area->offset = (area->base_offset + align - 1);
+    area->offset -= area->offset % align;
+    area->align = align;
+    IMX_EXA_AREA(area)->allocCounter = area->last_use;
+
+    imxPtr->offScreenStats.numAllocs++;
+    imxPtr->offScreenStats.numAreasInUse++;
+    imxPtr->offScreenStats.bytesInUse += area->size;
+    if (imxPtr->offScreenStats.bytesInUse >
+	imxPtr->offScreenStats.peakBytesInUse)
+	imxPtr->offScreenStats.peakBytesInUse =
+	    imxPtr->offScreenStats.bytesInUse;
+
+    IMX_EXA_OffscreenValidate (pScreen);
+
+    DBG_OFFSCREEN (("Alloc (%d) 0x%x -> 0x%x (0x%x)\n", area->last_use,
+                    size, area->base_offset, area->offset));
+    TRACE_OFFSCREEN ((imxPtr, IMX_EXA_TRACE_ALLOC, traceFlags, size, align,
+		      area->offset));
+    return area;
+}
+
+/**
+ * exaOffscreenAlloc allocates offscreen memory
+ *
+ * @param pScreen current screen
+ * @param size size in bytes of the allocation
+ * @param align byte alignment requirement for the offset of the allocated area
+ * @param locked whether the allocated area is locked and can't be kicked out
+ * @param save callback for when the area is evicted from memory
+ * @param privdata private data for the save callback.
+ *
+ * Allocates offscreen memory from the device associated with pScreen.  size
+ * and align deteremine where and how large the allocated area is, and locked
+ * will mark whether it should be held in card memory.  privdata may be any
+ * pointer for the save callback when the area is removed.
+ *
+ * Note that locked areas do get evicted on VT switch unless the driver
+ * requested version 2.1 or newer behavior.  In that case, the save callback is
+ * still called.
+ */
+ExaOffscreenArea *
+IMX_EXA_OffscreenAlloc (ScreenPtr pScreen, int size, int align,
+                   Bool locked,
+                   ExaOffscreenSaveProc save,
+                   pointer privData)
+{
+    return IMX_EXA_OffscreenAllocPlaced (pScreen, size, align, locked,
+					 save, privData,
+					 IMX_EXA_OFFSCREEN_BEST_FIT);
+}
+
+/* swap a free area with the used area following it, which moves down */
+static void
+IMX_EXA_OffscreenSlide (IMXOffscreenHeapPtr heap, ExaOffscreenArea *free_area,
+			ExaOffscreenArea *area, int offset, int size)
+{
+    ExaOffscreenArea	*next = area->next;
+    int			base = free_area->base_offset;
+    int			total = free_area->size + area->size;
+
+    /* the free area changes size, so it leaves the index */
+    IMX_EXA_FreeRemove (heap, free_area);
+
+    /* relink as prev -> area -> free_area -> next */
+    if (free_area == heap->areas)
+	heap->areas = area;
+    else
+	free_area->prev->next = area;
+    area->prev = free_area->prev;
+    area->next = free_area;
+    free_area->prev = area;
+    free_area->next = next;
+    if (next)
+	next->prev = free_area;
+    else
+	heap->areas->prev = free_area;
+
+    /* the area takes the bottom of the space, the rest stays free */
+    area->base_offset = base;
+    area->offset = offset;
+    area->size = size;
+    free_area->base_offset = base + size;
+    free_area->offset = free_area->base_offset;
+    free_area->size = total - size;
+
+    /* link with next area if free */
+    if (next && next->state == ExaOffscreenAvail)
+	IMX_EXA_OffscreenMerge (heap, free_area);
+
+    IMX_EXA_FreeInsert (heap, free_area);
+}
+
+/* defragment one heap, until at least maxBytes have been moved */
+static int
+IMX_EXA_OffscreenDefragmentHeap (ScreenPtr pScreen, IMXOffscreenHeapPtr heap,
+				 int maxBytes, IMXOffscreenMoveProc move)
+{
+    ExaOffscreenArea *free_area, *area;
+    int moved = 0;
+    IMXPtr imxPtr = IMXPTR(xf86Screens[pScreen->myNum]);
+
+    for (free_area = heap->areas; free_area; free_area = free_area->next)
+    {
+	int used, offset, size, align;
+
+	if (free_area->state != ExaOffscreenAvail)
+	    continue;
+
+	area = free_area->next;
+	if (!area || area->state != ExaOffscreenRemovable)
+	    continue;
+
+	/* where the area would start at the bottom of the free area */
+	align = area->align ? area->align : 1;
+	used = area->base_offset + area->size - area->offset;
+	offset = free_area->base_offset + align - 1;
+	offset -= offset % align;
+	size = offset - free_area->base_offset + used;
+	if (size > free_area->size)
+	    continue;
+
+	if (moved >= maxBytes)
+	    break;
+
+	if (!(*move) (pScreen, area, offset))
+	    continue;
+
+	DBG_OFFSCREEN (("Move 0x%x (0x%x) -> 0x%x (0x%x)\n", area->base_offset,
+			area->offset, free_area->base_offset, offset));
+	TRACE_OFFSCREEN ((imxPtr, IMX_EXA_TRACE_MOVE, 0, offset, 0,
+			  area->offset));
+
+	imxPtr->offScreenStats.numMoves++;
+	imxPtr->offScreenStats.bytesInUse += size - area->size;
+
+	IMX_EXA_OffscreenSlide (heap, free_area, area, offset, size);
+	moved += used;
+
+	/* the free space now follows the moved area, look at it again */
+	free_area = area;
+    }
+
+    return moved;
+}
+
+/**
+ * IMX_EXA_OffscreenDefragment moves removable areas down into the free
+ * area just below them, so that free space coalesces.
+ *
+ * @param pScreen current screen
+ * @param maxBytes stop once at least this many bytes have been moved
+ * @param move callback which copies the contents of an area to its new offset
+ *
+ * An area is only moved when it fits entirely within the free area below
+ * it, so the copy made by the callback never overlaps itself.  Locked areas
+ * are never moved.  The callback may refuse to move an area by returning
+ * FALSE, in which case the area is left alone.  Areas never move from one
+ * heap to another.
+ *
+ * @return number of bytes moved; 0 when there is nothing left to move.
+ */
+int
+IMX_EXA_OffscreenDefragment (ScreenPtr pScreen, int maxBytes,
+			     IMXOffscreenMoveProc move)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    IMXPtr imxPtr = IMXPTR(pScrn);
+    int moved = 0;
+    int i;
+
+    IMX_EXA_OffscreenValidate (pScreen);
+
+    for (i = 0; i < imxPtr->numOffscreenHeaps && moved < maxBytes; i++)
+	moved += IMX_EXA_OffscreenDefragmentHeap (pScreen,
+						  &imxPtr->offScreenHeaps[i],
+						  maxBytes - moved, move);
+
+    IMX_EXA_OffscreenValidate (pScreen);
+    return moved;
+}
+
+/*
+ * A page of equally sized blocks sub-allocated from one offscreen area.
+ * Pages with free blocks are kept on a list per block size.
+ */
+#define IMX_EXA_SUB_BLOCKS_PER_PAGE	32
+
+typedef struct _IMXOffscreenSubPage {
+    ExaOffscreenArea		*area;
+    int				size;		/* block size */
+    int				sizeIndex;
+    CARD32			freeMask;	/* bit set for each free block */
+    int				lockCount;
+    IMXOffscreenSubSaveProc	save[IMX_EXA_SUB_BLOCKS_PER_PAGE];
+    pointer			privData[IMX_EXA_SUB_BLOCKS_PER_PAGE];
+    struct _IMXOffscreenSubPage	*next;
+    struct _IMXOffscreenSubPage	*prev;
+} IMXOffscreenSubPageRec, *IMXOffscreenSubPagePtr;
+
+#define IMX_EXA_SUB_ALL_FREE	0xFFFFFFFF
+
+static int
+IMX_EXA_SubSizeIndex (int size)
+{
+    int index;
+
+    for (index = 0; index < IMX_EXA_OFFSCREEN_SUB_NUM_SIZES; index++)
+	if (size == (IMX_EXA_OFFSCREEN_SUB_MIN_SIZE << index))
+	    return index;
+    return -1;
+}
+
+static void
+IMX_EXA_SubLinkPage (IMXOffscreenSubPagePtr page)
+{
+    IMXOffscreenHeapPtr heap = IMX_EXA_HEAP(page->area);
+    IMXOffscreenSubPagePtr *head = &heap->subPages[page->sizeIndex];
+
+    page->prev = NULL;
+    page->next = *head;
+    if (*head)
+	(*head)->prev = page;
+    *head = page;
+}
+
+static void
+IMX_EXA_SubUnlinkPage (IMXOffscreenSubPagePtr page)
+{
+    IMXOffscreenHeapPtr heap = IMX_EXA_HEAP(page->area);
+
+    if (page->prev)
+	page->prev->next = page->next;
+    else if (heap->subPages[page->sizeIndex] == page)
+	heap->subPages[page->sizeIndex] = page->next;
+    if (page->next)
+	page->next->prev = page->prev;
+    page->next = page->prev = NULL;
+}
+
+/* save callback of a page area: evict every block, then drop the page */
+static void
+IMX_EXA_SubPageSave (ScreenPtr pScreen, ExaOffscreenArea *area)
+{
+    IMXOffscreenSubPagePtr page = area->privData;
+    int block;
+
+    for (block = 0; block < IMX_EXA_SUB_BLOCKS_PER_PAGE; block++)
+    {
+	if (page->freeMask & (1U << block))
+	    continue;
+	if (page->save[block])
+	    (*page->save[block]) (pScreen, page->privData[block]);
+    }
+
+    if (page->freeMask)
+	IMX_EXA_SubUnlinkPage (page);
+    area->privData = NULL;
+    free (page);
+}
+
+/**
+ * IMX_EXA_OffscreenSubAlloc allocates a small block from a shared page.
+ *
+ * @param pScreen current screen
+ * @param size size in bytes, a power of two starting at
+ *	  IMX_EXA_OFFSCREEN_SUB_MIN_SIZE; blocks are aligned to their size
+ * @param placement where a new page is placed, as for
+ *	  IMX_EXA_OffscreenAllocPlaced; pages with a free block are reused
+ *	  from the heaps the placement would allocate from
+ * @param save callback for when the block is evicted with its page
+ * @param privData private data for the save callback
+ * @param pOffset returns the offset of the block
+ *
+ * @return the area of the page holding the block, to be passed to
+ * IMX_EXA_OffscreenSubFree, or NULL if no block could be allocated.
+ */
+ExaOffscreenArea *
+IMX_EXA_OffscreenSubAlloc (ScreenPtr pScreen, int size, int placement,
+			   IMXOffscreenSubSaveProc save, pointer privData,
+			   int *pOffset)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    IMXPtr imxPtr = IMXPTR(pScrn);
+    IMXOffscreenHeapPtr heaps[IMX_EXA_OFFSCREEN_MAX_HEAPS];
+    IMXOffscreenSubPagePtr page = NULL;
+    int numHeaps, index, block, i;
+
+    index = IMX_EXA_SubSizeIndex (size);
+    if (index < 0)
+	return NULL;
+
+    /* any page on the lists has a free block */
+    numHeaps = IMX_EXA_OffscreenPlacementHeaps (imxPtr, placement, heaps);
+    for (i = 0; !page && i < numHeaps; i++)
+	page = heaps[i]->subPages[index];
+    if (!page)
+    {
+	int pageSize = size * IMX_EXA_SUB_BLOCKS_PER_PAGE;
+	ExaOffscreenArea *area;
+
+	page = malloc (sizeof (IMXOffscreenSubPageRec));
+	if (!page)
+	    return NULL;
+
+	area = IMX_EXA_OffscreenAllocPlaced (pScreen, pageSize, size, FALSE,
+					     IMX_EXA_SubPageSave, page,
+					     placement);
+	if (!area)
+	{
+	    free (page);
+	    return NULL;
+	}
+
+	page->area = area;
+	page->size = size;
+	page->sizeIndex = index;
+	page->freeMask = IMX_EXA_SUB_ALL_FREE;
+	page->lockCount = 0;
+	IMX_EXA_SubLinkPage (page);
+    }
+
+    /* take the lowest free block */
+    for (block = 0; !(page->freeMask & (1U << block)); block++)
+	;
+    page->freeMask &= ~(1U << block);
+    page->save[block] = save;
+    page->privData[block] = privData;
+
+    /* full pages leave the list */
+    if (!page->freeMask)
+	IMX_EXA_SubUnlinkPage (page);
+
+    *pOffset = page->area->offset + block * size;
+    DBG_OFFSCREEN (("SubAlloc 0x%x -> 0x%x\n", size, *pOffset));
+    return page->area;
 }
 
-static ExaOffscreenArea *
-IMX_EXA_FindAreaToEvict(IMXPtr imxPtr, int size, int align)
+/**
+ * IMX_EXA_OffscreenSubFree frees a block allocated by
+ * IMX_EXA_OffscreenSubAlloc.  The save callback is not called.
+ */
+void
+IMX_EXA_OffscreenSubFree (ScreenPtr pScreen, ExaOffscreenArea *area,
+			  int offset)
 {
-    ExaOffscreenArea *begin, *end, *best;
-    unsigned cost, best_cost;
-    int avail, real_size;
+    IMXOffscreenSubPagePtr page = area->privData;
+    int block = (offset - area->offset) / page->size;
 
-    best_cost = UINT_MAX;
-    begin = end = imxPtr->offScreenAreas;
-    avail = 0;
-    cost = 0;
-    best = 0;
+    DBG_OFFSCREEN (("SubFree 0x%x -> 0x%x\n", page->size, offset));
+    assert (!(page->freeMask & (1U << block)));
 
-    while (end != NULL)
-    {
-	restart:
-	while (begin != NULL && begin->state == ExaOffscreenLocked)
-	    begin = end = begin->next;
+    /* a full page goes back on the list */
+    if (!page->freeMask)
+	IMX_EXA_SubLinkPage (page);
 
-	if (begin == NULL)
-	    break;
+    page->freeMask |= 1U << block;
+    page->save[block] = NULL;
+    page->privData[block] = NULL;
 
-	/* adjust size needed to account for alignment loss for this area */
-	real_size = size + (begin->base_offset + begin->size - size) % align;
+    /* release an empty page, unless it is the only one with free blocks */
+    if (page->freeMask == IMX_EXA_SUB_ALL_FREE &&
+	(page->prev || page->next))
+    {
+	IMX_EXA_SubUnlinkPage (page);
+	IMX_EXA_OffscreenFree (pScreen, area);
+	free (page);
+    }
+}
 
-	while (avail < real_size && end != NULL)
-	{
-	    if (end->state == ExaOffscreenLocked) {
-		/* Can't more room here, restart after this locked area */
-		avail = 0;
-		cost = 0;
-		begin = end;
-		goto restart;
-	    }
-	    avail += end->size;
-	    IMX_EXA_UpdateEvictionCost(end, imxPtr->offScreenCounter);
-	    cost += end->eviction_cost;
-	    end = end->next;
-	}
+/**
+ * IMX_EXA_OffscreenSubLock keeps the page holding a block from being
+ * evicted until the matching IMX_EXA_OffscreenSubUnlock.
+ */
+void
+IMX_EXA_OffscreenSubLock (ExaOffscreenArea *area)
+{
+    IMXOffscreenSubPagePtr page = area->privData;
 
-	/* Check the cost, update best */
-	if (avail >= real_size && cost < best_cost) {
-	    best = begin;
-	    best_cost = cost;
-	}
+    if (page->lockCount++ == 0)
+	area->state = ExaOffscreenLocked;
+}
 
-	avail -= begin->size;
-	cost -= begin->eviction_cost;
-	begin = begin->next;
-    }
+void
+IMX_EXA_OffscreenSubUnlock (ExaOffscreenArea *area)
+{
+    IMXOffscreenSubPagePtr page = area->privData;
 
-    return best;
+    assert (page->lockCount > 0);
+    if (--page->lockCount == 0)
+	area->state = ExaOffscreenRemovable;
 }
 
-#define AREA_SCORE(area) (area->size / (double)(imxPtr->offScreenCounter - area->last_use))
-
 /**
- * exaOffscreenAlloc allocates offscreen memory
+ * IMX_EXA_OffscreenGetMap describes the heaps and every area in them.
  *
  * @param pScreen current screen
- * @param size size in bytes of the allocation
- * @param align byte alignment requirement for the offset of the allocated area
- * @param locked whether the allocated area is locked and can't be kicked out
- * @param save callback for when the area is evicted from memory
- * @param privdata private data for the save callback.
- *
- * Allocates offscreen memory from the device associated with pScreen.  size
- * and align deteremine where and how large the allocated area is, and locked
- * will mark whether it should be held in card memory.  privdata may be any
- * pointer for the save callback when the area is removed.
+ * @param owner callback naming the owner of allocated areas other than
+ *	  shared pages, or NULL to report them all as IMX_EXT_AreaOther
+ * @param heaps returns IMX_EXA_OFFSCREEN_MAX_HEAPS heaps at most
+ * @param pNumHeaps returns the number of heaps
+ * @param areas returns maxAreas areas at most, in address order
+ *	  within each heap
+ * @param maxAreas size of the areas array, may be 0 to count areas
  *
- * Note that locked areas do get evicted on VT switch unless the driver
- * requested version 2.1 or newer behavior.  In that case, the save callback is
- * still called.
+ * @return the number of areas there are, which may be more than maxAreas.
  */
-ExaOffscreenArea *
-IMX_EXA_OffscreenAlloc (ScreenPtr pScreen, int size, int align,
-                   Bool locked,
-                   ExaOffscreenSaveProc save,
-                   pointer privData)
+int
+IMX_EXA_OffscreenGetMap (ScreenPtr pScreen, IMXOffscreenOwnerProc owner,
+			 IMXOffscreenHeapInfoPtr heaps, int *pNumHeaps,
+			 IMXOffscreenAreaInfoPtr areas, int maxAreas)
 {
-    ExaOffscreenArea *area, *begin, *best;
     ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
     IMXPtr imxPtr = IMXPTR(pScrn);
-    int real_size = 0, largest_avail = 0, tmp;
+    int numAreas = 0;
+    int i;
 
-    IMX_EXA_OffscreenValidate (pScreen);
-    if (!align)
-	align = 1;
+    for (i = 0; i < imxPtr->numOffscreenHeaps; i++)
+    {
+	IMXOffscreenHeapPtr heap = &imxPtr->offScreenHeaps[i];
+	ExaOffscreenArea *area;
 
-    if (!size)
+	heaps[i].kind = heap->kind;
+	heaps[i].baseOffset = heap->baseOffset;
+	heaps[i].endOffset = heap->endOffset;
+	heaps[i].gpuAddressable = heap->gpuAddressable;
+
+	for (area = heap->areas; area; area = area->next, numAreas++)
+	{
+	    IMXOffscreenAreaInfoPtr info;
+
+	    if (numAreas >= maxAreas)
+		continue;
+
+	    info = &areas[numAreas];
+	    info->heap = i;
+	    info->offset = area->base_offset;
+	    info->size = area->size;
+	    info->locked = area->state == ExaOffscreenLocked;
+
+	    if (area->state == ExaOffscreenAvail)
+	    {
+		info->owner = IMX_EXT_AreaFree;
+		info->age = 0;
+		info->idle = 0;
+		continue;
+	    }
+
+	    if (area->save == IMX_EXA_SubPageSave)
+		info->owner = IMX_EXT_AreaSubPage;
+	    else if (owner)
+		info->owner = (*owner) (area);
+	    else
+		info->owner = IMX_EXT_AreaOther;
+	    info->age = imxPtr->offScreenCounter -
+			IMX_EXA_AREA(area)->allocCounter;
+	    info->idle = imxPtr->offScreenCounter - area->last_use;
+	}
+    }
+
+    *pNumHeaps = imxPtr->numOffscreenHeaps;
+    return numAreas;
+}
+
+/* map the memory of a frame buffer device which is not displayed */
+static Bool
+IMX_EXA_OpenFbPool (ScrnInfoPtr pScrn, IMXOffscreenPoolPtr pool,
+		    const char *path)
+{
+    struct fb_fix_screeninfo fix;
+    void *addr;
+    int fd;
+
+    fd = open (path, O_RDWR);
+    if (fd < 0)
     {
-	DBG_OFFSCREEN (("Alloc 0x%x -> EMPTY\n", size));
-	return NULL;
+	xf86DrvMsg (pScrn->scrnIndex, X_ERROR,
+		    "Offscreen pool %s: open failed: %s\n",
+		    path, strerror (errno));
+	return FALSE;
     }
 
-    /* throw out requests that cannot fit */
-    if (size > (imxPtr->exaDriverPtr->memorySize - imxPtr->exaDriverPtr->offScreenBase))
+    if (ioctl (fd, FBIOGET_FSCREENINFO, &fix) < 0 || fix.smem_len == 0)
     {
-	DBG_OFFSCREEN (("Alloc 0x%x vs (0x%lx) -> TOBIG\n", size,
-			imxPtr->exaDriverPtr->memorySize -
-			imxPtr->exaDriverPtr->offScreenBase));
-	return NULL;
+	xf86DrvMsg (pScrn->scrnIndex, X_ERROR,
+		    "Offscreen pool %s: no frame buffer memory\n", path);
+	close (fd);
+	return FALSE;
     }
 
-    /* Try to find a free space that'll fit. */
-    for (area = imxPtr->offScreenAreas; area; area = area->next)
+    addr = mmap (NULL, fix.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		 fd, 0);
+    if (addr == MAP_FAILED)
     {
-	/* skip allocated areas */
-	if (area->state != ExaOffscreenAvail)
-	    continue;
+	xf86DrvMsg (pScrn->scrnIndex, X_ERROR,
+		    "Offscreen pool %s: mmap failed: %s\n",
+		    path, strerror (errno));
+	close (fd);
+	return FALSE;
+    }
 
-	/* adjust size to match alignment requirement */
-	real_size = size + (area->base_offset + area->size - size) % align;
+    pool->fd = fd;
+    pool->size = fix.smem_len;
+    pool->virtAddr = addr;
+    pool->physAddr = fix.smem_start;
+    pool->gpuAddressable = TRUE;
+    return TRUE;
+}
 
-	/* does it fit? */
-	if (real_size <= area->size)
-	    break;
+/*
+ * Ordinary memory standing in for a contiguous pool, to exercise the
+ * allocator without extra hardware.  The GPU cannot address it, so
+ * pixmaps placed there are not accelerated.
+ */
+static Bool
+IMX_EXA_OpenMemfdPool (ScrnInfoPtr pScrn, IMXOffscreenPoolPtr pool,
+		       int size)
+{
+    void *addr;
+    int fd;
 
-	if (area->size > largest_avail)
-	    largest_avail = area->size;
+#ifdef __NR_memfd_create
+    fd = syscall (__NR_memfd_create, "imx-offscreen-pool", 0);
+#else
+    fd = -1;
+    errno = ENOSYS;
+#endif
+    if (fd < 0 || ftruncate (fd, size) < 0)
+    {
+	xf86DrvMsg (pScrn->scrnIndex, X_ERROR,
+		    "Offscreen pool memfd: %s\n", strerror (errno));
+	if (fd >= 0)
+	    close (fd);
+	return FALSE;
     }
 
-    if (!area)
+    addr = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
     {
-        double best_score;
-        /*
-         * Kick out existing users to make space.
-         *
-         * First, locate a region which can hold the desired object.
-         */
-
-       /* prev points at the first object to boot */
-        best = NULL;
-        best_score = UINT_MAX;
-        for (begin = imxPtr->offScreenAreas; begin != NULL;
-             begin = begin->next)
-        {
-            int avail;
-            double score;
-            ExaOffscreenArea *scan;
-
-            if (begin->state == ExaOffscreenLocked)
-                continue;
-
-            /* adjust size needed to account for alignment loss for this area */
-            real_size = size;
-            tmp = begin->base_offset % align;
-            if (tmp)
-                real_size += (align - tmp);
-
-            avail = 0;
-            score = 0;
-            /* now see if we can make room here, and how "costly" it'll be. */
-            for (scan = begin; scan != NULL; scan = scan->next)
-            {
-                if (scan->state == ExaOffscreenLocked) {
-                    /* Can't make room here, start after this locked area. */
-                    begin = scan;
-                    break;
-                }
-                score += AREA_SCORE(scan);
-                avail += scan->size;
-                if (avail >= real_size)
-                    break;
-            }
-            /* Is it the best option we've found so far? */
-            if (avail >= real_size && score < best_score) {
-                best = begin;
-                best_score = score;
-            }
-        }
-        area = best;
-	if (!area)
-	{
-	    DBG_OFFSCREEN (("Alloc 0x%x -> NOSPACE\n", size));
-	    /* Could not allocate memory */
-	    IMX_EXA_OffscreenValidate (pScreen);
-	    return NULL;
-	}
-
-        /* adjust size needed to account for alignment loss for this area */
-        real_size = size;
-        tmp = area->base_offset % align;
-        if (tmp)
-            real_size += (align - tmp);
-
-        /*
-         * Kick out first area if in use
-         */
-        if (area->state != ExaOffscreenAvail)
-	    area = IMX_EXA_OffscreenKickOut (pScreen, area);
-        /*
-         * Now get the system to merge the other needed areas together
-         */
-        while (area->size < real_size)
-        {
-            assert (area->next && area->next->state == ExaOffscreenRemovable);
-	    (void) IMX_EXA_OffscreenKickOut (pScreen, area->next);
-        }
+	xf86DrvMsg (pScrn->scrnIndex, X_ERROR,
+		    "Offscreen pool memfd: mmap failed: %s\n",
+		    strerror (errno));
+	close (fd);
+	return FALSE;
     }
 
-    /* save extra space in new area */
-    if (real_size < area->size)
+    pool->fd = fd;
+    pool->size = size;
+    pool->virtAddr = addr;
+    pool->physAddr = 0;
+    pool->gpuAddressable = FALSE;
+    return TRUE;
+}
+
+/**
+ * IMX_EXA_OffscreenOpenPools maps the extra memory pools listed in the
+ * OffscreenPools option, to be managed along with frame buffer memory by
+ * IMX_EXA_OffscreenInit.
+ *
+ * The option is a list of pools separated by commas or spaces, each either
+ * the path of a frame buffer device whose memory is not displayed, or
+ * "memfd:" followed by a size in KB for a pool of ordinary memory.  Each
+ * pool is given the offsets following those of the previous pool, starting
+ * after frame buffer memory.  Pools which cannot be opened are skipped.
+ */
+void
+IMX_EXA_OffscreenOpenPools (ScreenPtr pScreen)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    IMXPtr imxPtr = IMXPTR(pScrn);
+    const char *spec = imxPtr->offScreenPoolSpec;
+    unsigned long nextOffset;
+
+    imxPtr->numOffscreenPools = 0;
+    if (!spec)
+	return;
+
+    /* pool offsets keep the page alignment of their addresses */
+    nextOffset = (imxPtr->exaDriverPtr->memorySize + 4095) & ~4095;
+
+    while (*spec && imxPtr->numOffscreenPools < IMX_EXA_OFFSCREEN_MAX_POOLS)
     {
-	ExaOffscreenArea   *new_area = malloc (sizeof (ExaOffscreenArea));
-	if (!new_area)
-	    return NULL;
-	new_area->base_offset = area->base_offset;
+	IMXOffscreenPoolPtr pool =
+	    &imxPtr->offScreenPools[imxPtr->numOffscreenPools];
+	char entry[256];
+	int len = strcspn (spec, ", ");
+	Bool opened;
 
-	new_area->offset = new_area->base_offset;
-	new_area->align = 0;
-	new_area->size = area->size - real_size;
-	new_area->state = ExaOffscreenAvail;
-	new_area->save = NULL;
-	new_area->last_use = 0;
-	new_area->eviction_cost = 0;
-	new_area->next = area;
-	new_area->prev = area->prev;
-	if (area->prev->next)
-	    area->prev->next = new_area;
+	if (len == 0 || len >= sizeof (entry))
+	{
+	    spec += len ? len : 1;
+	    continue;
+	}
+	memcpy (entry, spec, len);
+	entry[len] = '\0';
+	spec += len;
+
+	if (!strncmp (entry, "memfd:", 6))
+	    opened = IMX_EXA_OpenMemfdPool (pScrn, pool,
+					    (atoi (entry + 6) * 1024) & ~4095);
 	else
-	    imxPtr->offScreenAreas = new_area;
-	area->prev = new_area;
-	area->base_offset = new_area->base_offset + new_area->size;
-	area->size = real_size;
-    } else
-	imxPtr->numOffscreenAvailable--;
+	    opened = IMX_EXA_OpenFbPool (pScrn, pool, entry);
+	if (!opened)
+	    continue;
 
-    /*
-     * Mark this area as in use
-     */
-    if (locked)
-	area->state = ExaOffscreenLocked;
-    else
-	area->state = ExaOffscreenRemovable;
-    area->privData = privData;
-    area->save = save;
-    area->last_use = imxPtr->offScreenCounter++;
-    area->offset = (area->base_offset + align - 1);
-    area->offset -= area->offset % align;
-    area->align = align;
+	if (pool->size <= 0 || nextOffset + pool->size > INT_MAX)
+	{
+	    xf86DrvMsg (pScrn->scrnIndex, X_ERROR,
+			"Offscreen pool %s: too large\n", entry);
+	    munmap (pool->virtAddr, pool->size);
+	    close (pool->fd);
+	    continue;
+	}
 
-    IMX_EXA_OffscreenValidate (pScreen);
+	pool->baseOffset = nextOffset;
+	nextOffset = (nextOffset + pool->size + 4095) & ~4095;
+	imxPtr->numOffscreenPools++;
 
-    DBG_OFFSCREEN (("Alloc (%d) 0x%x -> 0x%x (0x%x)\n", area->last_use,
-                    size, area->base_offset, area->offset));
-    return area;
+	xf86DrvMsg (pScrn->scrnIndex, X_INFO,
+		    "Offscreen pool %s: %dK%s\n", entry, pool->size / 1024,
+		    pool->gpuAddressable ? "" : ", not accelerated");
+    }
+}
+
+/**
+ * IMX_EXA_OffscreenClosePools unmaps the pools, once the offscreen memory
+ * manager is finished.
+ */
+void
+IMX_EXA_OffscreenClosePools (ScreenPtr pScreen)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    IMXPtr imxPtr = IMXPTR(pScrn);
+    int i;
+
+    for (i = 0; i < imxPtr->numOffscreenPools; i++)
+    {
+	IMXOffscreenPoolPtr pool = &imxPtr->offScreenPools[i];
+
+	munmap (pool->virtAddr, pool->size);
+	close (pool->fd);
+    }
+    imxPtr->numOffscreenPools = 0;
 }
 
 void
@@ -457,33 +1976,31 @@ IMX_EXA_OffscreenSwapIn (ScreenPtr pScreen)
     IMX_EXA_OffscreenInit (pScreen);
 }
 
-/**
- * IMX_EXA_OffscreenInit initializes the offscreen memory manager.
- *
- * @param pScreen current screen
- *
- * IMX_EXA_OffscreenInit is called by exaDriverInit to set up the memory manager for
- * the screen, if any offscreen memory is available.
- */
-Bool
-IMX_EXA_OffscreenInit (ScreenPtr pScreen)
+/* set up a heap as a single free area covering [base, end) */
+static Bool
+IMX_EXA_OffscreenHeapInit (IMXOffscreenHeapPtr heap, IMXSlabPtr areaSlab,
+			   int kind, int base, int end)
 {
-    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
-    IMXPtr imxPtr = IMXPTR(pScrn);
     ExaOffscreenArea *area;
 
+    memset (heap, 0, sizeof (*heap));
+    heap->kind = kind;
+    heap->baseOffset = base;
+    heap->endOffset = end;
+    heap->areaSlab = areaSlab;
+
     /* Allocate a big free area */
 
-    area = malloc (sizeof (ExaOffscreenArea));
+    area = IMX_EXA_OffscreenNewArea (heap);
 
     if (!area)
 	return FALSE;
 
     area->state = ExaOffscreenAvail;
-    area->base_offset = imxPtr->exaDriverPtr->offScreenBase;
+    area->base_offset = base;
     area->offset = area->base_offset;
     area->align = 0;
-    area->size = imxPtr->exaDriverPtr->memorySize - area->base_offset;
+    area->size = end - base;
     area->save = NULL;
     area->next = NULL;
     area->prev = area;
@@ -491,9 +2008,102 @@ IMX_EXA_OffscreenInit (ScreenPtr pScreen)
     area->eviction_cost = 0;
 
     /* Add it to the free areas */
-    imxPtr->offScreenAreas = area;
+    heap->areas = area;
+    heap->numAvailable = 1;
+    IMX_EXA_FreeInsert (heap, area);
+
+    return TRUE;
+}
+
+/**
+ * IMX_EXA_OffscreenInit initializes the offscreen memory manager.
+ *
+ * @param pScreen current screen
+ *
+ * IMX_EXA_OffscreenInit is called by exaDriverInit to set up the memory manager for
+ * the screen, if any offscreen memory is available.
+ *
+ * The glyph heap takes offScreenGlyphSize bytes at the bottom of offscreen
+ * memory, 1/32 of it by default, and the main heap the rest.  There is no
+ * glyph heap when its size is 0 or would leave too little for the main heap.
+ * Each pool opened by IMX_EXA_OffscreenOpenPools gets a heap of its own.
+ */
+Bool
+IMX_EXA_OffscreenInit (ScreenPtr pScreen)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    IMXPtr imxPtr = IMXPTR(pScrn);
+    IMXOffscreenHeapPtr heap;
+    unsigned char *fbBase = imxPtr->exaDriverPtr->memoryBase;
+    int base = imxPtr->exaDriverPtr->offScreenBase;
+    int end = imxPtr->exaDriverPtr->memorySize;
+    int glyphSize = imxPtr->offScreenGlyphSize;
+    int i;
+
+    if (glyphSize < 0)
+	glyphSize = ((end - base) / 32) & ~4095;
+    else
+	glyphSize = (glyphSize + 4095) & ~4095;
+    if (glyphSize > (end - base) / 2)
+	glyphSize = 0;
+
     imxPtr->offScreenCounter = 1;
-    imxPtr->numOffscreenAvailable = 1;
+    imxPtr->numOffscreenHeaps = 0;
+    memset (&imxPtr->offScreenStats, 0, sizeof (imxPtr->offScreenStats));
+    IMX_EXA_SlabInit (&imxPtr->offScreenAreaSlab,
+		      sizeof (IMXOffscreenAreaRec), IMX_EXA_AREAS_PER_CHUNK);
+
+    heap = &imxPtr->offScreenHeaps[IMX_EXA_OFFSCREEN_HEAP_MAIN];
+    if (!IMX_EXA_OffscreenHeapInit (heap, &imxPtr->offScreenAreaSlab,
+				    IMX_EXA_OFFSCREEN_HEAP_MAIN,
+				    base + glyphSize, end))
+	return FALSE;
+    heap->virtAddr = fbBase + heap->baseOffset;
+    heap->physAddr = (unsigned long) pScrn->memPhysBase + heap->baseOffset;
+    heap->gpuAddressable = TRUE;
+    imxPtr->numOffscreenHeaps = 1;
+
+    /* glyphs share the main heap if their own cannot be set up */
+    heap = &imxPtr->offScreenHeaps[imxPtr->numOffscreenHeaps];
+    if (glyphSize > 0 &&
+	IMX_EXA_OffscreenHeapInit (heap, &imxPtr->offScreenAreaSlab,
+				   IMX_EXA_OFFSCREEN_HEAP_GLYPH,
+				   base, base + glyphSize))
+    {
+	heap->virtAddr = fbBase + heap->baseOffset;
+	heap->physAddr = (unsigned long) pScrn->memPhysBase + heap->baseOffset;
+	heap->gpuAddressable = TRUE;
+	imxPtr->numOffscreenHeaps++;
+    }
+
+    /* pools which cannot be set up are left unused */
+    for (i = 0; i < imxPtr->numOffscreenPools; i++)
+    {
+	IMXOffscreenPoolPtr pool = &imxPtr->offScreenPools[i];
+
+	heap = &imxPtr->offScreenHeaps[imxPtr->numOffscreenHeaps];
+	if (!IMX_EXA_OffscreenHeapInit (heap, &imxPtr->offScreenAreaSlab,
+					IMX_EXA_OFFSCREEN_HEAP_POOL,
+					pool->baseOffset,
+					pool->baseOffset + pool->size))
+	    continue;
+	heap->virtAddr = pool->virtAddr;
+	heap->physAddr = pool->physAddr;
+	heap->gpuAddressable = pool->gpuAddressable;
+	imxPtr->numOffscreenHeaps++;
+    }
+
+#if IMX_EXA_OFFSCREEN_TRACE
+    /* each trace session starts with the layout of the heaps */
+    IMX_EXA_TraceOpen (pScrn, imxPtr);
+    for (i = 0; i < imxPtr->numOffscreenHeaps; i++)
+    {
+	heap = &imxPtr->offScreenHeaps[i];
+	IMX_EXA_TraceRecord (imxPtr, IMX_EXA_TRACE_HEAP, heap->kind,
+			     heap->endOffset - heap->baseOffset,
+			     heap->gpuAddressable, heap->baseOffset);
+    }
+#endif
 
     IMX_EXA_OffscreenValidate (pScreen);
 
@@ -506,13 +2116,29 @@ IMX_EXA_OffscreenFini (ScreenPtr pScreen)
     ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
     IMXPtr imxPtr = IMXPTR(pScrn);
     ExaOffscreenArea *area;
+    int i;
 
-    /* just free all of the area records */
-    while ((area = imxPtr->offScreenAreas))
+    /* just free all of the area records, and the pages */
+    for (i = 0; i < imxPtr->numOffscreenHeaps; i++)
     {
-	imxPtr->offScreenAreas = area->next;
-	free (area);
+	IMXOffscreenHeapPtr heap = &imxPtr->offScreenHeaps[i];
+
+	while ((area = heap->areas))
+	{
+	    heap->areas = area->next;
+	    if (area->state != ExaOffscreenAvail &&
+		area->save == IMX_EXA_SubPageSave)
+		free (area->privData);
+	    IMX_EXA_OffscreenDeleteArea (area);
+	}
+	memset (heap, 0, sizeof (*heap));
     }
+    imxPtr->numOffscreenHeaps = 0;
+    IMX_EXA_SlabFini (&imxPtr->offScreenAreaSlab);
+
+#if IMX_EXA_OFFSCREEN_TRACE
+    IMX_EXA_TraceClose (imxPtr);
+#endif
 }
 
 /**
@@ -523,24 +2149,30 @@ IMX_EXA_OffscreenSwapOut (ScreenPtr pScreen)
 {
     ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
     IMXPtr imxPtr = IMXPTR(pScrn);
+    int i;
 
     IMX_EXA_OffscreenValidate (pScreen);
-    /* loop until a single free area spans the space */
-    for (;;)
+    for (i = 0; i < imxPtr->numOffscreenHeaps; i++)
     {
-	ExaOffscreenArea *area = imxPtr->offScreenAreas;
+	IMXOffscreenHeapPtr heap = &imxPtr->offScreenHeaps[i];
 
-	if (!area)
-	    break;
-	if (area->state == ExaOffscreenAvail)
+	/* loop until a single free area spans the heap */
+	for (;;)
 	{
-	    area = area->next;
+	    ExaOffscreenArea *area = heap->areas;
+
 	    if (!area)
 		break;
+	    if (area->state == ExaOffscreenAvail)
+	    {
+		area = area->next;
+		if (!area)
+		    break;
+	    }
+	    assert (area->state != ExaOffscreenAvail);
+	    (void) IMX_EXA_OffscreenKickOut (pScreen, area);
+	    IMX_EXA_OffscreenValidate (pScreen);
 	}
-	assert (area->state != ExaOffscreenAvail);
-	(void) IMX_EXA_OffscreenKickOut (pScreen, area);
-	IMX_EXA_OffscreenValidate (pScreen);
     }
     IMX_EXA_OffscreenValidate (pScreen);
     IMX_EXA_OffscreenFini (pScreen);
@@ -26,28 +26,147 @@
 #include "xf86_OSproc.h"
 #include "fbdevhw.h"
 #include "exa.h"
+#include "damage.h"
 #include "imx_type.h"
+#include "imx_ext.h"
 #include "z160.h"
 
 
 /* Set if handles pixmap allocation and migration, i.e, EXA_HANDLES_PIXMAPS */
 #define	IMX_EXA_ENABLE_HANDLES_PIXMAPS	(1 && (IMX_EXA_VERSION_COMPILED >= IMX_EXA_VERSION(2,5,0)))
 
+/* Set if a thread waits for GPU work flushed when the server goes idle */
+/* with freed memory still fenced, and wakes the server through an */
+/* eventfd when it is complete.  The Z160 library has no fences, only */
+/* z160_sync on the context, so the server blocks on its next use of */
+/* the GPU until that wait is over; completion is not non-blocking. */
+#define	IMX_EXA_ENABLE_COMPLETION_THREAD	(1 && IMX_EXA_ENABLE_HANDLES_PIXMAPS)
+
+/* Set if that thread also owns the Z160 context, and the server only */
+/* queues batches of rectangles for it in a ring.  Built with */
+/* --enable-submit-thread. */
+#ifndef IMX_EXA_SUBMIT_THREAD
+#define	IMX_EXA_SUBMIT_THREAD	0
+#endif
+#define	IMX_EXA_ENABLE_SUBMIT_THREAD	(IMX_EXA_SUBMIT_THREAD && IMX_EXA_ENABLE_COMPLETION_THREAD)
+
+/* Set if glyphs are drawn by the driver from an atlas in offscreen */
+/* memory rather than by EXA, whose glyph pictures then stay in system */
+/* memory. */
+#define	IMX_EXA_ENABLE_GLYPH_ATLAS	(1 && IMX_EXA_ENABLE_HANDLES_PIXMAPS)
+
+/* Set if Render fills of rectangles with a color are blended by the */
+/* driver in one batch rather than composited one at a time. */
+#define	IMX_EXA_ENABLE_COMPOSITE_RECTS	(1 && IMX_EXA_ENABLE_HANDLES_PIXMAPS)
+
 /* Set minimum size (pixel area) for accelerating operations. */
 #define	IMX_EXA_MIN_PIXEL_AREA_SOLID		64
 #define	IMX_EXA_MIN_PIXEL_AREA_COPY		64
 #define	IMX_EXA_MIN_PIXEL_AREA_COMPOSITE	64
 
+/* The areas actually used are measured when the screen is initialized, */
+/* by timing operations on rectangles of the small and large size on */
+/* the GPU and the CPU, the fastest of a few runs each.  They are kept */
+/* between the minimum areas above and the maximum area.  One in so */
+/* many accelerated operations is timed afterwards to measure the time */
+/* the server takes to queue each rectangle, which is added to them. */
+#define	IMX_EXA_CALIBRATE_SMALL_SIZE		8
+#define	IMX_EXA_CALIBRATE_LARGE_SIZE		256
+#define	IMX_EXA_CALIBRATE_RUNS			4
+#define	IMX_EXA_MAX_PIXEL_AREA			4096
+#define	IMX_EXA_REFINE_INTERVAL			16
+#define	IMX_EXA_REFINE_WEIGHT			8
+
+/* Promotion of system memory pixmaps into offscreen memory: the number */
+/* of unaccelerated operations before a pixmap is considered, the cap */
+/* on that count, and the most pixmaps moved by one promotion pass. */
+#define	IMX_EXA_PROMOTE_MIN_HEAT		4
+#define	IMX_EXA_PROMOTE_MAX_HEAT		1024
+#define	IMX_EXA_PROMOTE_MAX_PIXMAPS		4
+
+/* Pixmaps up to 32 pixels wide and this many rows high are packed into */
+/* shared offscreen pages, with heights rounded to a power of two. */
+#define	IMX_EXA_SUBALLOC_MIN_HEIGHT		4
+#define	IMX_EXA_SUBALLOC_MAX_HEIGHT		16
+
+/* Most bytes of offscreen memory moved by one defragmentation pass. */
+#define	IMX_EXA_DEFRAG_MAX_BYTES		(1024 * 1024)
+
+/* Offscreen areas of destroyed pixmaps kept for reuse by new pixmaps */
+/* of the same aligned size, and the number of hash buckets for them. */
+#define	IMX_EXA_RECYCLE_MAX_AREAS		16
+#define	IMX_EXA_RECYCLE_NUM_BUCKETS		32
+
+/* Pixmap private data structures allocated at once from their slab. */
+#define	IMX_EXA_PIXMAPS_PER_CHUNK		64
+
+/* Snapshots of offscreen pixmaps taken when the VT is left are run */
+/* length encoded.  Each run starts with a 16-bit count, with the top */
+/* bit set when one pixel repeats count times, and otherwise followed */
+/* by count pixels.  Shorter repeats are kept in literal runs. */
+#define	IMX_EXA_SNAPSHOT_MIN_REPEAT		3
+#define	IMX_EXA_SNAPSHOT_MAX_RUN		0x7FFF
+#define	IMX_EXA_SNAPSHOT_REPEAT			0x8000
+
+/* Rectangles of a solid, copy or composite operation are queued and */
+/* submitted to the Z160 in one loop when the queue fills up or when */
+/* the operation is done.  Setting this to 1 submits each one at once. */
+#define	IMX_EXA_BATCH_MAX_RECTS			256
+
+/* Batches queued for the submission thread, a power of two. */
+#define	IMX_EXA_SUBMIT_RING_SIZE		8
+
+/* A finished fill is held back until the next batch is submitted, */
+/* and its rectangles which that batch draws over are dropped.  The */
+/* check is skipped when it would compare more rectangles than this. */
+#define	IMX_EXA_PEEPHOLE_MAX_COMPARES		4096
+
+/* Source pictures without a drawable are drawn from GPU memory: solid */
+/* colors from the rows of a pixmap, and linear gradients along an axis */
+/* from strips one pixel wide or high, so many of each kept for reuse. */
+/* A strip holds one period of a repeating gradient, or the ramp of */
+/* another between this many pixels of the colors beyond its ends. */
+#define	IMX_EXA_SOLID_CACHE_SIZE		64
+#define	IMX_EXA_GRADIENT_CACHE_SIZE		16
+#define	IMX_EXA_GRADIENT_PAD_LENGTH		256
+
+/* The glyph atlas has up to this many square pages for A8 glyphs and */
+/* as many for ARGB glyphs, packed into shelves whose heights are */
+/* rounded up to a multiple of the shelf rows.  The shelf used least */
+/* recently is emptied when no room is left, or the whole page if no */
+/* shelf is tall enough.  Larger glyphs are left to EXA. */
+#define	IMX_EXA_GLYPH_PAGE_SIZE			256
+#define	IMX_EXA_GLYPH_MAX_PAGES			4
+#define	IMX_EXA_GLYPH_SHELF_ROWS		4
+#define	IMX_EXA_GLYPH_MAX_SIZE			64
+#define	IMX_EXA_GLYPH_HASH_SIZE			1024
+#define	IMX_EXA_GLYPHS_PER_CHUNK		256
+
+/* Boxes of the glyphs drawn through a mask are checked for overlaps */
+/* on the stack up to this many glyphs, and in allocated memory above. */
+#define	IMX_EXA_GLYPH_STACK_BOXES		256
+
+/* Finished operations are flushed to the GPU from the block handler, */
+/* or once this many rectangles or milliseconds have gone unflushed. */
+#define	IMX_EXA_FLUSH_MAX_RECTS			1024
+#define	IMX_EXA_FLUSH_MAX_DELAY			10
+
+/* The scratch pixmap of composites done in passes, as large as the */
+/* largest target, is freed once unused for this many milliseconds. */
+#define	IMX_EXA_SCRATCH_IDLE_DELAY		2000
+
 /* This flag must be enabled to perform any debug logging */
 #define IMX_EXA_DEBUG_MASTER		0
 
 #define	IMX_EXA_DEBUG_INSTRUMENT_SYNCS	(0 && IMX_EXA_DEBUG_MASTER)
+#define	IMX_EXA_DEBUG_INSTRUMENT_BATCHES	(0 && IMX_EXA_DEBUG_MASTER)
 #define IMX_EXA_DEBUG_INSTRUMENT_SIZES	(0 && IMX_EXA_DEBUG_MASTER)
 #define	IMX_EXA_DEBUG_PREPARE_SOLID	(0 && IMX_EXA_DEBUG_MASTER)
 #define	IMX_EXA_DEBUG_SOLID		(0 && IMX_EXA_DEBUG_MASTER)
 #define	IMX_EXA_DEBUG_PREPARE_COPY	(0 && IMX_EXA_DEBUG_MASTER)
 #define	IMX_EXA_DEBUG_COPY		(0 && IMX_EXA_DEBUG_MASTER)
 #define	IMX_EXA_DEBUG_CHECK_COMPOSITE	(0 && IMX_EXA_DEBUG_MASTER)
+#define	IMX_EXA_DEBUG_THRESHOLDS	(0 && IMX_EXA_DEBUG_MASTER)
 
 #if IMX_EXA_DEBUG_MASTER
 #include <errno.h>
@@ -58,6 +177,276 @@
 #include <unistd.h>
 #endif
 
+#include <math.h>
+#include <time.h>
+
+#if IMX_EXA_ENABLE_HANDLES_PIXMAPS
+#include <stdio.h>
+#include <unistd.h>
+#endif
+
+#if IMX_EXA_ENABLE_COMPLETION_THREAD
+#include <pthread.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+#include <semaphore.h>
+#endif
+
+
+#if IMX_EXA_ENABLE_HANDLES_PIXMAPS
+/* Offscreen area of a destroyed pixmap kept for reuse.  Entries are on */
+/* a hash chain by size and on a list from most to least recently freed. */
+typedef struct _IMXEXARecycleRec {
+
+	ExaOffscreenArea*		area;
+	int				heapKind;	/* IMX_EXA_OFFSCREEN_HEAP_* */
+	int				widthAligned;
+	int				heightAligned;
+	int				bitsPerPixel;
+
+	struct _IMXEXARecycleRec*	hashNext;
+	struct _IMXEXARecycleRec*	lruNext;	/* less recently freed */
+	struct _IMXEXARecycleRec*	lruPrev;	/* more recently freed */
+
+} IMXEXARecycleRec, *IMXEXARecyclePtr;
+#endif
+
+/* Kind of operation whose rectangles are queued. */
+typedef enum _IMXEXABatchKind {
+
+	IMX_EXA_BATCH_SOLID,
+	IMX_EXA_BATCH_COPY,
+	IMX_EXA_BATCH_COMPOSITE,
+	IMX_EXA_BATCH_NUM_KINDS
+
+} IMXEXABatchKind;
+
+/* Rectangle queued for the current solid, copy or composite operation. */
+/* Solid fills only use the target position and size. */
+typedef struct _IMXEXABatchRect {
+
+	int				dstX;
+	int				dstY;
+	int				width;
+	int				height;
+	int				srcX;
+	int				srcY;
+	int				maskX;
+	int				maskY;
+
+} IMXEXABatchRectRec, *IMXEXABatchRectPtr;
+
+/* Z160 setup used for a composite operation. */
+typedef enum _IMXEXABlendKind {
+
+	IMX_EXA_BLEND_IMAGE,
+	IMX_EXA_BLEND_IMAGE_MASKED,
+	IMX_EXA_BLEND_CONST,
+	IMX_EXA_BLEND_CONST_MASKED,
+	IMX_EXA_BLEND_PATTERN,
+	IMX_EXA_BLEND_PATTERN_MASKED
+
+} IMXEXABlendKind;
+
+/* Render ops, from PictOpClear to PictOpSaturate. */
+#define	IMX_EXA_NUM_PICT_OPS		(PictOpMaximum + 1)
+
+/* Picture which a pass of a composite done in several passes reads */
+/* or draws: the source (IN the mask), the target, or the scratch */
+/* pixmap, which is drawn at the same positions as the target. */
+typedef enum _IMXEXAPassPicture {
+
+	IMX_EXA_PASS_SOURCE,
+	IMX_EXA_PASS_TARGET,
+	IMX_EXA_PASS_SCRATCH
+
+} IMXEXAPassPicture;
+
+/* One pass: a blend of the src picture onto the dst picture, or a */
+/* fill of the dst picture with zero when the blend is unknown. */
+typedef struct _IMXEXACompositePass {
+
+	IMXEXAPassPicture		dst;
+	IMXEXAPassPicture		src;
+	Z160_BLEND			blendOp;
+
+} IMXEXACompositePassRec, *IMXEXACompositePassPtr;
+
+#define	IMX_EXA_COMPOSITE_MAX_PASSES	4
+
+/* Render op the Z160 cannot blend, done as a sequence of passes. */
+typedef struct _IMXEXACompositePlan {
+
+	int				numPasses;
+	Bool				usesScratch;
+	IMXEXACompositePassRec		passes[IMX_EXA_COMPOSITE_MAX_PASSES];
+
+} IMXEXACompositePlanRec, *IMXEXACompositePlanPtr;
+
+/* Solid color in one row of the solid color pixmap. */
+typedef struct _IMXEXASolidCache {
+
+	Bool				valid;
+	CARD32				color;		/* premultiplied */
+	unsigned long			lastUsed;
+
+} IMXEXASolidCacheRec, *IMXEXASolidCachePtr;
+
+/* Linear gradient drawn into a strip along its axis.  The first pixel */
+/* of the strip is at origin along the axis, in picture coordinates. */
+/* The strip of a repeating gradient is one period long, and period is */
+/* 0 for the others, whose strip ends with the colors beyond the ramp. */
+typedef struct _IMXEXAGradientCache {
+
+	PixmapPtr			pPixmap;	/* NULL if unused */
+	unsigned long			lastUsed;
+
+	/* Gradient drawn, with a copy of its stops. */
+	xPointFixed			p1;
+	xPointFixed			p2;
+	int				repeatType;
+	int				numStops;
+	PictGradientStopPtr		stops;
+
+	/* Layout of the strip. */
+	Bool				vertical;
+	int				origin;
+	int				length;
+	int				period;
+
+} IMXEXAGradientCacheRec, *IMXEXAGradientCachePtr;
+
+#if IMX_EXA_ENABLE_GLYPH_ATLAS
+/* Glyphs are A8 or ARGB, each in pages of their own. */
+#define	IMX_EXA_GLYPH_NUM_FORMATS	2
+
+/* Row of glyphs in an atlas page, filled from the left.  The run count */
+/* gives the last glyph run drawing from it, and gpuSeq the last GPU */
+/* operation reading it. */
+typedef struct _IMXEXAGlyphShelf {
+
+	int				y;
+	int				height;
+	int				x;		/* first free column */
+	unsigned long			lastRun;
+	CARD32				gpuSeq;
+	struct _IMXEXAGlyphEntry*	entries;
+
+} IMXEXAGlyphShelfRec, *IMXEXAGlyphShelfPtr;
+
+/* Atlas page, with its shelves from the top down. */
+typedef struct _IMXEXAGlyphPage {
+
+	PicturePtr			pPicture;	/* NULL until needed */
+	unsigned long			lastRun;
+	int				top;		/* first row below the shelves */
+	int				numShelves;
+	IMXEXAGlyphShelfRec		shelves[IMX_EXA_GLYPH_PAGE_SIZE /
+							IMX_EXA_GLYPH_SHELF_ROWS];
+
+} IMXEXAGlyphPageRec, *IMXEXAGlyphPagePtr;
+
+/* Glyph copied into the atlas at x, y of a page. */
+typedef struct _IMXEXAGlyphEntry {
+
+	GlyphPtr			pGlyph;
+	IMXEXAGlyphPagePtr		pPage;
+	IMXEXAGlyphShelfPtr		pShelf;
+	int				x;
+	int				y;
+	struct _IMXEXAGlyphEntry*	hashNext;
+	struct _IMXEXAGlyphEntry*	shelfNext;
+
+} IMXEXAGlyphEntryRec, *IMXEXAGlyphEntryPtr;
+#endif
+
+/* Rectangles of an operation to submit to the Z160 together, with the */
+/* setup to do first if they start the operation. */
+typedef struct _IMXEXABatch {
+
+	IMXEXABatchKind			kind;
+	Bool				setup;
+
+	/* Setup of the operation. */
+	Z160Buffer			target;
+	Z160Buffer			src;
+	Z160Buffer			mask;
+	unsigned long			color;
+	int				dirX;
+	int				dirY;
+	IMXEXABlendKind			blend;
+	Z160_BLEND			blendOp;
+
+	/* Flush the GPU after the rectangles, and wait for it to */
+	/* complete the operation with sequence number seq. */
+	Bool				flush;
+	Bool				sync;
+	CARD32				seq;
+
+	int				numRects;
+	IMXEXABatchRectRec		rects[IMX_EXA_BATCH_MAX_RECTS];
+
+} IMXEXABatchRec, *IMXEXABatchPtr;
+
+/* Operations are accelerated on pixmaps of 8, 16 and 32 bits per pixel. */
+#define	IMX_EXA_NUM_BPP		3
+
+/* Z160 setup last done, so that an operation with the same target */
+/* or the same setup does not do it again.  Only used by whichever */
+/* thread owns the Z160 context. */
+typedef struct _IMXEXAGpuState {
+
+	Bool				targetValid;
+	Z160Buffer			target;
+
+	Bool				setupValid;
+	IMXEXABatchKind			kind;
+	Z160Buffer			src;
+	Z160Buffer			mask;
+	unsigned long			color;
+	int				dirX;
+	int				dirY;
+	IMXEXABlendKind			blend;
+	Z160_BLEND			blendOp;
+
+} IMXEXAGpuStateRec, *IMXEXAGpuStatePtr;
+
+/* Cost model of one kind of operation at one number of bits per pixel. */
+/* The GPU takes a fixed setup time plus a time per pixel, and the CPU */
+/* only a time per pixel, so the GPU is faster above some pixel area. */
+/* The setup time is measured once, and the time the server takes to */
+/* queue a rectangle of the operation is refined while running. */
+typedef struct _IMXEXAThreshold {
+
+	unsigned			minPixelArea;
+	unsigned			calibratedPixelArea;	/* 0 if not */
+	unsigned long			gpuSetupNs;
+	unsigned long			submitRectNs;
+	unsigned long			gpuPixelPs;		/* picoseconds */
+	unsigned long			cpuPixelPs;
+
+	/* Operations large enough and too small, and timings used. */
+	unsigned long			numAccepted;
+	unsigned long			numRefused;
+	unsigned long			numRefinements;
+
+} IMXEXAThresholdRec, *IMXEXAThresholdPtr;
+
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+/* One side of the ring sleeping until the other side makes progress. */
+typedef struct _IMXEXARingWait {
+
+	volatile Bool			sleeping;
+	sem_t				sem;
+
+} IMXEXARingWaitRec, *IMXEXARingWaitPtr;
+#endif
 
 /* This is private data for the EXA driver to use */
 
@@ -69,6 +458,12 @@ typedef struct _IMXEXARec {
 	void*				gpuContext;
 	Bool				gpuSynced;
 
+	/* Setup done in the Z160 context, and how many target and */
+	/* operation setups were skipped because they were done already. */
+	IMXEXAGpuStateRec		gpuState;
+	unsigned long			numTargetSetupsSkipped;
+	unsigned long			numOpSetupsSkipped;
+
 	void*				savePixmapPtr[3];
 
 	/* Parameters passed into PrepareSolid */
@@ -96,6 +491,210 @@ typedef struct _IMXEXARec {
 	/* Graphics context for software fallback in solid/copy/composite */
 	GCPtr				pGC;
 
+#if IMX_EXA_ENABLE_HANDLES_PIXMAPS
+	/* Pixmaps which live in system memory and may be promoted into */
+	/* offscreen memory, and flag set when a promotion pass is due. */
+	struct _IMXEXAPixmapRec*	sysPixmapList;
+	Bool				promoteWanted;
+
+	/* Flag set when an allocation did not fit in free offscreen */
+	/* memory, so moving areas together may be worthwhile. */
+	Bool				defragWanted;
+
+	/* Cache of offscreen areas of destroyed pixmaps.  Unused entries */
+	/* are linked through hashNext on recycleFreeList. */
+	IMXEXARecycleRec		recycle[IMX_EXA_RECYCLE_MAX_AREAS];
+	IMXEXARecyclePtr		recycleHash[IMX_EXA_RECYCLE_NUM_BUCKETS];
+	IMXEXARecyclePtr		recycleNewest;
+	IMXEXARecyclePtr		recycleOldest;
+	IMXEXARecyclePtr		recycleFreeList;
+
+	/* Cache statistics: reused areas, allocations which found no */
+	/* area to reuse, and areas released from the cache. */
+	unsigned long			numRecycleHits;
+	unsigned long			numRecycleMisses;
+	unsigned long			numRecycleDrains;
+
+	/* Slab the pixmap private data structures are allocated from. */
+	IMXSlabRec			pixmapSlab;
+
+	/* All pixmaps with driver private data. */
+	struct _IMXEXAPixmapRec*	pixmapList;
+
+	/* Snapshots not yet restored and their compressed size, and */
+	/* when the VT was last entered. */
+	int				numSnapshots;
+	unsigned long			numSnapshotBytes;
+	CARD32				enterVTTime;
+
+	/* Snapshot statistics: pixmaps restored in place, and pixmaps */
+	/* moved to system memory because they were used while away. */
+	unsigned long			numSnapshotRestores;
+	unsigned long			numSnapshotMoves;
+#endif
+
+	/* Batch of rectangles queued for the current operation.  With */
+	/* the submission thread it is the slot at the tail of the ring, */
+	/* and the thread takes batches from the head. */
+	IMXEXABatchPtr			batch;
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+	IMXEXABatchRec			ring[IMX_EXA_SUBMIT_RING_SIZE];
+	volatile unsigned		ringHead;
+	volatile unsigned		ringTail;
+	IMXEXARingWaitRec		ringWork;	/* thread waits for batches */
+	IMXEXARingWaitRec		ringSpace;	/* server waits for a slot */
+	IMXEXARingWaitRec		ringDone;	/* server waits for a sync */
+#else
+	IMXEXABatchRec			batchRecs[2];
+#endif
+
+	/* Finished fill not yet submitted, or NULL.  The current batch */
+	/* is the next ring slot, or the other batch record. */
+	IMXEXABatchPtr			heldBatch;
+
+	/* Plan of the composite being done in several passes, or NULL, */
+	/* and the pictures of its passes.  The rectangles queued are */
+	/* kept aside while each pass uses the batch. */
+	const IMXEXACompositePlanRec*	compositePlan;
+	IMXEXABlendKind			planBlend;
+	Z160Buffer			planTarget;
+	Z160Buffer			planSrc;
+	Z160Buffer			planMask;
+	Z160Buffer			planScratch;
+	IMXEXABatchRectRec		planRects[IMX_EXA_BATCH_MAX_RECTS];
+
+	/* Scratch pixmap for the passes, kept for later composites */
+	/* until it has gone unused for a while, and when it was last used. */
+	PixmapPtr			pScratchPixmap;
+	CARD32				scratchUsedTime;
+
+	/* Solid colors and gradient strips for source pictures without */
+	/* a drawable, the use count giving when each was last used, and */
+	/* the strip read by the current composite or NULL. */
+	PixmapPtr			pSolidPixmap;
+	IMXEXASolidCacheRec		solidCache[IMX_EXA_SOLID_CACHE_SIZE];
+	IMXEXAGradientCacheRec		gradientCache[IMX_EXA_GRADIENT_CACHE_SIZE];
+	unsigned long			sourceCacheUses;
+	IMXEXAGradientCachePtr		compositeGradient;
+
+#if IMX_EXA_ENABLE_GLYPH_ATLAS
+	/* Glyph atlas pages for each format, the glyphs copied into them */
+	/* hashed on the glyph, and a count of the glyph runs drawn. */
+	IMXEXAGlyphPageRec		glyphPages[IMX_EXA_GLYPH_NUM_FORMATS]
+						[IMX_EXA_GLYPH_MAX_PAGES];
+	IMXEXAGlyphEntryPtr		glyphHash[IMX_EXA_GLYPH_HASH_SIZE];
+	IMXSlabRec			glyphSlab;
+	unsigned long			glyphRuns;
+#endif
+
+	/* Operations submitted but not yet flushed to the GPU, how */
+	/* many rectangles they drew and when the first one finished. */
+	Bool				gpuFlushPending;
+	int				numUnflushedRects;
+	CARD32				unflushedTime;
+
+	/* Sequence number of the last GPU operation, and of the last */
+	/* one known to be complete.  Also the newest sequence number of */
+	/* any pixmap whose offscreen memory was released. */
+	CARD32				gpuSeq;
+	CARD32				gpuRetiredSeq;
+	CARD32				gpuFreedSeq;
+
+#if IMX_EXA_ENABLE_COMPLETION_THREAD
+	/* Thread which waits for the GPU while the server sleeps, when */
+	/* memory freed while the GPU may still use it awaits reuse.  The */
+	/* lock serializes all use of the Z160 context, so the server's */
+	/* first use of the GPU after waking waits for the thread.  The */
+	/* server holds the lock from then until it is idle again.  The */
+	/* thread is asked to wait for the request sequence number and */
+	/* signals the eventfd when it is done. */
+	pthread_t			completionThread;
+	pthread_mutex_t			gpuLock;
+	pthread_cond_t			completionCond;
+	int				completionFd;
+	Bool				completionRunning;
+	Bool				completionQuit;
+	Bool				gpuLocked;
+	CARD32				completionRequestSeq;
+	volatile CARD32			completionDoneSeq;
+
+	/* Number of times GPU work was found complete by the thread. */
+	unsigned long			numAsyncRetires;
+#endif
+
+	/* Fence statistics: CPU accesses which had to wait for the GPU */
+	/* and those which did not. */
+	unsigned long			numFenceWaits;
+	unsigned long			numFenceSkips;
+
+	/* Flush statistics: flushes from the block handler, because */
+	/* of the rectangle or time limit, and before CPU access. */
+	unsigned long			numIdleFlushes;
+	unsigned long			numLimitFlushes;
+	unsigned long			numSyncFlushes;
+
+	/* Peephole statistics: held fills dropped whole, and their */
+	/* rectangles and pixels drawn over, fills which joined the held */
+	/* one of the same color, and rectangles merged with the one */
+	/* queued before them. */
+	unsigned long			numOverdrawnOps;
+	unsigned long			numOverdrawnRects;
+	unsigned long long		numOverdrawnPixels;
+	unsigned long			numJoinedFills;
+	unsigned long			numMergedRects;
+
+	/* Composite statistics for each Render op: done by one Z160 */
+	/* blend, in passes or as a simpler op, and left to software. */
+	unsigned long			numCompositeDirect[IMX_EXA_NUM_PICT_OPS];
+	unsigned long			numCompositeDecomposed[IMX_EXA_NUM_PICT_OPS];
+	unsigned long			numCompositeFallbacks[IMX_EXA_NUM_PICT_OPS];
+
+	/* Source cache statistics: solid colors and gradients found in */
+	/* GPU memory, and those which had to be drawn there. */
+	unsigned long			numSolidHits;
+	unsigned long			numSolidMisses;
+	unsigned long			numGradientHits;
+	unsigned long			numGradientMisses;
+
+#if IMX_EXA_ENABLE_GLYPH_ATLAS
+	/* Glyph atlas statistics: glyph runs drawn from the atlas and */
+	/* left to EXA, glyphs drawn, glyphs copied into the atlas, and */
+	/* shelves emptied to make room for them. */
+	unsigned long			numGlyphRuns;
+	unsigned long			numGlyphRunFallbacks;
+	unsigned long			numGlyphsDrawn;
+	unsigned long			numGlyphUploads;
+	unsigned long			numGlyphShelfEvictions;
+#endif
+
+#if IMX_EXA_ENABLE_COMPOSITE_RECTS
+	/* Render fills of rectangles blended in a batch and left to */
+	/* the server. */
+	unsigned long			numRectFills;
+	unsigned long			numRectFillFallbacks;
+#endif
+
+	/* Pixel areas above which operations are accelerated.  The */
+	/* threshold of the operation being prepared is remembered so */
+	/* that the operation can be timed to refine it. */
+	IMXEXAThresholdRec		thresholds[IMX_EXA_BATCH_NUM_KINDS][IMX_EXA_NUM_BPP];
+	IMXEXAThresholdPtr		opThreshold;
+	IMXEXAThresholdPtr		timedThreshold;
+	struct timespec			timedStartTime;
+	unsigned long			timedStartRects;
+	unsigned long			numQueuedRects;
+	unsigned			numUntimedOps;
+
+	/* Wrapped screen functions */
+	ScreenBlockHandlerProcPtr	BlockHandler;
+#if IMX_EXA_ENABLE_GLYPH_ATLAS
+	GlyphsProcPtr			Glyphs;
+	UnrealizeGlyphProcPtr		UnrealizeGlyph;
+#endif
+#if IMX_EXA_ENABLE_COMPOSITE_RECTS
+	CompositeRectsProcPtr		CompositeRects;
+#endif
+
 #if IMX_EXA_DEBUG_INSTRUMENT_SIZES
 	unsigned long			numSolidFillRect100;
 	unsigned long			numSolidFillRect1000;
@@ -115,6 +714,15 @@ typedef struct _IMXEXARec {
 	unsigned long			numCompositeBeforeSync;
 #endif
 
+#if IMX_EXA_DEBUG_INSTRUMENT_BATCHES
+	/* Time from Prepare* to the end of Done*, rectangles drawn and */
+	/* times the queue was submitted, for each kind of operation. */
+	struct timespec			batchStartTime;
+	unsigned long long		batchNanoseconds[IMX_EXA_BATCH_NUM_KINDS];
+	unsigned long			numBatchedRects[IMX_EXA_BATCH_NUM_KINDS];
+	unsigned long			numBatchSubmits[IMX_EXA_BATCH_NUM_KINDS];
+#endif
+
 } IMXEXARec, *IMXEXAPtr;
 
 #define IMXEXAPTR(p) ((IMXEXAPtr)((p)->exaDriverPrivate))
@@ -142,25 +750,164 @@ typedef struct _IMXEXAPixmapRec {
 	int			heightAligned;	/* aligned to 32 pixel vert */
 	ExaOffscreenArea	*area;		/* ptr to GPU FB memory alloc */
 
+	/* Small pixmaps are packed into a shared page; area is then */
+	/* the page and subOffset the offset of the pixmap within. */
+	Bool			subAlloc;
+	int			subOffset;
+
+	/* Where in offscreen memory to place the pixmap, derived from */
+	/* the usage hint it was created with. */
+	int			placement;
+
 	/* Properties for pixmap allocated from system memory. */
 	int			sysAllocSize;	/* size of sys memory alloc */
 	void*			sysPtr;		/* ptr to sys memory alloc */
 
+	/* Pixmap this private belongs to, set in ModifyPixmapHeader. */
+	PixmapPtr		pPixmap;
+
+	/* Number of outstanding CPU accesses (PrepareAccess calls). */
+	/* The offscreen area cannot be evicted while this is non-zero. */
+	int			accessCount;
+
+	/* Set once the GPU address was handed out by the extension. */
+	/* The offscreen area is then locked for the pixmap lifetime. */
+	Bool			pinned;
+
+	/* Set for pixmaps only ever read by the CPU, such as glyph */
+	/* pictures copied into the glyph atlas, which are kept in */
+	/* system memory. */
+	Bool			sysOnly;
+
+	/* Number of recent operations which could have been accelerated */
+	/* if the pixmap were not in system memory. */
+	unsigned		heat;
+
+	/* Sequence number of the last GPU operation which read or wrote */
+	/* the pixmap, which the CPU must wait for before accessing it. */
+	CARD32			gpuSeq;
+
+	/* Links in the list of pixmaps allocated from system memory. */
+	struct _IMXEXAPixmapRec	*sysNext;
+	struct _IMXEXAPixmapRec	*sysPrev;
+
+	/* Compressed contents of an offscreen pixmap saved when the VT */
+	/* was left, until the pixmap is next used. */
+	void*			snapshot;
+	int			snapshotSize;
+
+	/* Links in the list of all pixmaps. */
+	struct _IMXEXAPixmapRec	*next;
+	struct _IMXEXAPixmapRec	*prev;
+
 } IMXEXAPixmapRec, *IMXEXAPixmapPtr;
 
 
 /* Definitions for functions defined in imx_exa_offscreen.c */
+extern void IMX_EXA_SlabInit(
+				IMXSlabPtr slab, int recordSize,
+				int recordsPerChunk);
+extern pointer IMX_EXA_SlabAlloc(IMXSlabPtr slab);
+extern void IMX_EXA_SlabFree(IMXSlabPtr slab, pointer record);
+extern void IMX_EXA_SlabFini(IMXSlabPtr slab);
 extern Bool IMX_EXA_OffscreenInit(ScreenPtr pScreen);
 extern ExaOffscreenArea* IMX_EXA_OffscreenAlloc(
 				ScreenPtr pScreen, int size, int align,
                   		Bool locked, ExaOffscreenSaveProc save,
                   		pointer privData);
+extern ExaOffscreenArea* IMX_EXA_OffscreenAllocPlaced(
+				ScreenPtr pScreen, int size, int align,
+				Bool locked, ExaOffscreenSaveProc save,
+				pointer privData, int placement);
 extern ExaOffscreenArea* IMX_EXA_OffscreenFree(
 				ScreenPtr pScreen, ExaOffscreenArea* area);
 extern void IMX_EXA_OffscreenFini(ScreenPtr pScreen);
+extern void IMX_EXA_OffscreenMarkUsed(
+				ScreenPtr pScreen, ExaOffscreenArea* area);
+extern int IMX_EXA_OffscreenAreaHeapKind(ExaOffscreenArea* area);
+extern int IMX_EXA_OffscreenLargestAvail(ScreenPtr pScreen);
+extern void IMX_EXA_OffscreenGetStats(
+				ScreenPtr pScreen, IMXOffscreenStatsPtr pStats);
+extern int IMX_EXA_OffscreenGetMap(
+				ScreenPtr pScreen, IMXOffscreenOwnerProc owner,
+				IMXOffscreenHeapInfoPtr heaps, int* pNumHeaps,
+				IMXOffscreenAreaInfoPtr areas, int maxAreas);
+extern pointer IMX_EXA_OffscreenVirtAddr(
+				ExaOffscreenArea* area, int offset);
+extern Bool IMX_EXA_OffscreenPhysAddr(
+				ScreenPtr pScreen, pointer ptr,
+				unsigned long* pPhysAddr);
+extern void IMX_EXA_OffscreenOpenPools(ScreenPtr pScreen);
+extern void IMX_EXA_OffscreenClosePools(ScreenPtr pScreen);
+extern int IMX_EXA_OffscreenDefragment(
+				ScreenPtr pScreen, int maxBytes,
+				IMXOffscreenMoveProc move);
+extern ExaOffscreenArea* IMX_EXA_OffscreenSubAlloc(
+				ScreenPtr pScreen, int size, int placement,
+				IMXOffscreenSubSaveProc save, pointer privData,
+				int* pOffset);
+extern void IMX_EXA_OffscreenSubFree(
+				ScreenPtr pScreen, ExaOffscreenArea* area,
+				int offset);
+extern void IMX_EXA_OffscreenSubLock(ExaOffscreenArea* area);
+extern void IMX_EXA_OffscreenSubUnlock(ExaOffscreenArea* area);
+
+/* The offscreen memory of a pixmap cannot be evicted or moved while */
+/* the CPU is accessing it or after its GPU address was handed out. */
+static inline Bool
+Z160EXAIsPixmapAreaLocked(IMXEXAPixmapPtr fPixmapPtr)
+{
+	return (0 < fPixmapPtr->accessCount) || fPixmapPtr->pinned;
+}
+
+static void
+Z160EXALockPixmapArea(IMXEXAPixmapPtr fPixmapPtr)
+{
+	if (fPixmapPtr->subAlloc) {
+		IMX_EXA_OffscreenSubLock(fPixmapPtr->area);
+	} else {
+		fPixmapPtr->area->state = ExaOffscreenLocked;
+	}
+}
+
+static void
+Z160EXAUnlockPixmapArea(IMXEXAPixmapPtr fPixmapPtr)
+{
+	if (fPixmapPtr->subAlloc) {
+		IMX_EXA_OffscreenSubUnlock(fPixmapPtr->area);
+	} else {
+		fPixmapPtr->area->state = ExaOffscreenRemovable;
+	}
+}
+
+static void Z160EXARestoreSnapshot(
+				ScreenPtr pScreen,
+				IMXEXAPixmapPtr fPixmapPtr);
+
+/* The contents of offscreen pixmaps are saved in snapshots when the */
+/* VT is left, and put back before each pixmap is next used. */
+static inline void
+Z160EXARestorePixmap(PixmapPtr pPixmap)
+{
+	IMXEXAPixmapPtr fPixmapPtr =
+		(IMXEXAPixmapPtr)(exaGetPixmapDriverPrivate(pPixmap));
+
+	if ((NULL != fPixmapPtr) && (NULL != fPixmapPtr->snapshot)) {
+		Z160EXARestoreSnapshot(pPixmap->drawable.pScreen, fPixmapPtr);
+	}
+}
+
+#else
+
+static inline void
+Z160EXARestorePixmap(PixmapPtr pPixmap)
+{
+	/* Pixmap memory is managed by EXA, so nothing to do. */
+}
 
 #endif
 
+static void Z160EXAWaitPixmap(PixmapPtr pPixmap);
 
 static
 PixmapPtr
@@ -194,6 +941,18 @@ Z160EXAGetPicturePixmap(PicturePtr pPicture)
 }
 
 
+/* Fixed minimum pixel areas and names of each kind of operation, and */
+/* the bits per pixel thresholds are kept for. */
+static const unsigned Z160MinPixelAreas[IMX_EXA_BATCH_NUM_KINDS] = {
+	IMX_EXA_MIN_PIXEL_AREA_SOLID,
+	IMX_EXA_MIN_PIXEL_AREA_COPY,
+	IMX_EXA_MIN_PIXEL_AREA_COMPOSITE
+};
+
+static const char* const Z160BatchKindNames[IMX_EXA_BATCH_NUM_KINDS] =
+	{ "solid", "copy", "composite" };
+
+static const int Z160ThresholdBitsPerPixel[IMX_EXA_NUM_BPP] = { 8, 16, 32 };
 
 /* Called by IMXGetRec */
 void IMX_EXA_GetRec(ScrnInfoPtr pScrn)
@@ -209,6 +968,10 @@ void IMX_EXA_GetRec(ScrnInfoPtr pScrn)
 	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
 
 	fPtr->gpuContext = NULL;
+	fPtr->gpuState.targetValid = FALSE;
+	fPtr->gpuState.setupValid = FALSE;
+	fPtr->numTargetSetupsSkipped = 0;
+	fPtr->numOpSetupsSkipped = 0;
 
 	fPtr->gpuSynced = FALSE;
 	fPtr->gpuOpSetup = FALSE;
@@ -219,6 +982,147 @@ void IMX_EXA_GetRec(ScrnInfoPtr pScrn)
 
 	fPtr->pGC = NULL;
 
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+	fPtr->batch = &fPtr->ring[0];
+	fPtr->ringHead = 0;
+	fPtr->ringTail = 0;
+#else
+	fPtr->batch = &fPtr->batchRecs[0];
+#endif
+	fPtr->heldBatch = NULL;
+	fPtr->compositePlan = NULL;
+	fPtr->pScratchPixmap = NULL;
+	fPtr->scratchUsedTime = 0;
+	fPtr->pSolidPixmap = NULL;
+	memset(fPtr->solidCache, 0, sizeof(fPtr->solidCache));
+	memset(fPtr->gradientCache, 0, sizeof(fPtr->gradientCache));
+	fPtr->sourceCacheUses = 0;
+	fPtr->compositeGradient = NULL;
+#if IMX_EXA_ENABLE_GLYPH_ATLAS
+	memset(fPtr->glyphPages, 0, sizeof(fPtr->glyphPages));
+	memset(fPtr->glyphHash, 0, sizeof(fPtr->glyphHash));
+	IMX_EXA_SlabInit(&fPtr->glyphSlab, sizeof(IMXEXAGlyphEntryRec),
+				IMX_EXA_GLYPHS_PER_CHUNK);
+	fPtr->glyphRuns = 0;
+#endif
+	fPtr->batch->kind = IMX_EXA_BATCH_SOLID;
+	fPtr->batch->setup = FALSE;
+	fPtr->batch->flush = FALSE;
+	fPtr->batch->sync = FALSE;
+	fPtr->batch->numRects = 0;
+
+	fPtr->gpuFlushPending = FALSE;
+	fPtr->numUnflushedRects = 0;
+	fPtr->unflushedTime = 0;
+	fPtr->numIdleFlushes = 0;
+	fPtr->numLimitFlushes = 0;
+	fPtr->numSyncFlushes = 0;
+	fPtr->numOverdrawnOps = 0;
+	fPtr->numOverdrawnRects = 0;
+	fPtr->numOverdrawnPixels = 0;
+	fPtr->numJoinedFills = 0;
+	fPtr->numMergedRects = 0;
+	memset(fPtr->numCompositeDirect, 0, sizeof(fPtr->numCompositeDirect));
+	memset(fPtr->numCompositeDecomposed, 0,
+		sizeof(fPtr->numCompositeDecomposed));
+	memset(fPtr->numCompositeFallbacks, 0,
+		sizeof(fPtr->numCompositeFallbacks));
+	fPtr->numSolidHits = 0;
+	fPtr->numSolidMisses = 0;
+	fPtr->numGradientHits = 0;
+	fPtr->numGradientMisses = 0;
+#if IMX_EXA_ENABLE_GLYPH_ATLAS
+	fPtr->numGlyphRuns = 0;
+	fPtr->numGlyphRunFallbacks = 0;
+	fPtr->numGlyphsDrawn = 0;
+	fPtr->numGlyphUploads = 0;
+	fPtr->numGlyphShelfEvictions = 0;
+#endif
+#if IMX_EXA_ENABLE_COMPOSITE_RECTS
+	fPtr->numRectFills = 0;
+	fPtr->numRectFillFallbacks = 0;
+#endif
+
+	fPtr->gpuSeq = 0;
+	fPtr->gpuRetiredSeq = 0;
+	fPtr->gpuFreedSeq = 0;
+	fPtr->numFenceWaits = 0;
+	fPtr->numFenceSkips = 0;
+
+	IMXEXABatchKind kind;
+	int bpp;
+	for (kind = 0; kind < IMX_EXA_BATCH_NUM_KINDS; ++kind) {
+		for (bpp = 0; bpp < IMX_EXA_NUM_BPP; ++bpp) {
+
+			IMXEXAThresholdPtr t = &fPtr->thresholds[kind][bpp];
+			t->minPixelArea = Z160MinPixelAreas[kind];
+			t->calibratedPixelArea = 0;
+			t->gpuSetupNs = 0;
+			t->submitRectNs = 0;
+			t->gpuPixelPs = 0;
+			t->cpuPixelPs = 0;
+			t->numAccepted = 0;
+			t->numRefused = 0;
+			t->numRefinements = 0;
+		}
+	}
+	fPtr->opThreshold = NULL;
+	fPtr->timedThreshold = NULL;
+	fPtr->timedStartRects = 0;
+	fPtr->numQueuedRects = 0;
+	fPtr->numUntimedOps = 0;
+
+#if IMX_EXA_ENABLE_COMPLETION_THREAD
+	fPtr->completionFd = -1;
+	fPtr->completionRunning = FALSE;
+	fPtr->completionQuit = FALSE;
+	fPtr->gpuLocked = FALSE;
+	fPtr->completionRequestSeq = 0;
+	fPtr->completionDoneSeq = 0;
+	fPtr->numAsyncRetires = 0;
+#endif
+
+#if IMX_EXA_ENABLE_HANDLES_PIXMAPS
+	fPtr->sysPixmapList = NULL;
+	fPtr->promoteWanted = FALSE;
+	fPtr->defragWanted = FALSE;
+
+	int i;
+	for (i = 0; i < IMX_EXA_RECYCLE_NUM_BUCKETS; ++i) {
+		fPtr->recycleHash[i] = NULL;
+	}
+	fPtr->recycleFreeList = NULL;
+	for (i = 0; i < IMX_EXA_RECYCLE_MAX_AREAS; ++i) {
+		fPtr->recycle[i].area = NULL;
+		fPtr->recycle[i].hashNext = fPtr->recycleFreeList;
+		fPtr->recycleFreeList = &fPtr->recycle[i];
+	}
+	fPtr->recycleNewest = NULL;
+	fPtr->recycleOldest = NULL;
+	fPtr->numRecycleHits = 0;
+	fPtr->numRecycleMisses = 0;
+	fPtr->numRecycleDrains = 0;
+
+	IMX_EXA_SlabInit(&fPtr->pixmapSlab, sizeof(IMXEXAPixmapRec),
+				IMX_EXA_PIXMAPS_PER_CHUNK);
+
+	fPtr->pixmapList = NULL;
+	fPtr->numSnapshots = 0;
+	fPtr->numSnapshotBytes = 0;
+	fPtr->enterVTTime = 0;
+	fPtr->numSnapshotRestores = 0;
+	fPtr->numSnapshotMoves = 0;
+#endif
+
+	fPtr->BlockHandler = NULL;
+#if IMX_EXA_ENABLE_GLYPH_ATLAS
+	fPtr->Glyphs = NULL;
+	fPtr->UnrealizeGlyph = NULL;
+#endif
+#if IMX_EXA_ENABLE_COMPOSITE_RECTS
+	fPtr->CompositeRects = NULL;
+#endif
+
 #if IMX_EXA_DEBUG_INSTRUMENT_SIZES
 	fPtr->numSolidFillRect100 = 0;
 	fPtr->numSolidFillRect1000 = 0;
@@ -238,6 +1142,12 @@ void IMX_EXA_GetRec(ScrnInfoPtr pScrn)
 	fPtr->numCopyBeforeSync = 0;
 	fPtr->numCompositeBeforeSync = 0;
 #endif
+
+#if IMX_EXA_DEBUG_INSTRUMENT_BATCHES
+	memset(fPtr->batchNanoseconds, 0, sizeof(fPtr->batchNanoseconds));
+	memset(fPtr->numBatchedRects, 0, sizeof(fPtr->numBatchedRects));
+	memset(fPtr->numBatchSubmits, 0, sizeof(fPtr->numBatchSubmits));
+#endif
 }
 
 /* Called by IMXFreeRec */
@@ -249,6 +1159,15 @@ void IMX_EXA_FreeRec(ScrnInfoPtr pScrn)
 		return;
 	}
 
+#if IMX_EXA_ENABLE_HANDLES_PIXMAPS
+	/* All pixmaps are gone by now, including the screen pixmap. */
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+	IMX_EXA_SlabFini(&fPtr->pixmapSlab);
+#endif
+#if IMX_EXA_ENABLE_GLYPH_ATLAS
+	IMX_EXA_SlabFini(&fPtr->glyphSlab);
+#endif
+
 	free(imxPtr->exaDriverPrivate);
 	imxPtr->exaDriverPrivate = NULL;
 }
@@ -326,8 +1245,10 @@ Z160EXAGetPixmapAddress(PixmapPtr pPixmap)
 #endif
 }
 
-Bool
-IMX_EXA_GetPixmapProperties(
+/* Physical address and pitch of a pixmap in GPU memory.  The GPU does */
+/* operations in order, so it may be given them without waiting. */
+static Bool
+Z160EXAGetPixmapGpuAddress(
 	PixmapPtr pPixmap,
 	void** pPhysAddr,
 	int* pPitch)
@@ -350,6 +1271,11 @@ IMX_EXA_GetPixmapProperties(
 		return FALSE;
 	}
 
+	/* The client will use the contents. */
+	if (NULL != fPixmapPtr->snapshot) {
+		Z160EXARestoreSnapshot(pPixmap->drawable.pScreen, fPixmapPtr);
+	}
+
 	/* Make sure pixmap is in GPU memory. */
 	if (!fPixmapPtr->canAccel) {
 		return FALSE;
@@ -378,6 +1304,51 @@ IMX_EXA_GetPixmapProperties(
 	return TRUE;
 }
 
+Bool
+IMX_EXA_GetPixmapProperties(
+	PixmapPtr pPixmap,
+	void** pPhysAddr,
+	int* pPitch)
+{
+	if (!Z160EXAGetPixmapGpuAddress(pPixmap, pPhysAddr, pPitch)) {
+		return FALSE;
+	}
+
+#if IMX_EXA_ENABLE_HANDLES_PIXMAPS
+	/* The client may access the contents as soon as it knows where */
+	/* they are. */
+	Z160EXAWaitPixmap(pPixmap);
+#endif
+
+	return TRUE;
+}
+
+/* Called when the GPU address of a pixmap is handed out to a client. */
+void
+IMX_EXA_PinPixmap(PixmapPtr pPixmap)
+{
+#if IMX_EXA_ENABLE_HANDLES_PIXMAPS
+	/* Is there a pixmap? */
+	if (NULL == pPixmap) {
+		return;
+	}
+
+	/* Access driver private data structure associated with pixmap. */
+	IMXEXAPixmapPtr fPixmapPtr =
+		(IMXEXAPixmapPtr)(exaGetPixmapDriverPrivate(pPixmap));
+	if ((NULL == fPixmapPtr) || (NULL == fPixmapPtr->area)) {
+		return;
+	}
+
+	/* The client may keep using the physical address, so the */
+	/* offscreen area must never be evicted from now on. */
+	if (!Z160EXAIsPixmapAreaLocked(fPixmapPtr)) {
+		Z160EXALockPixmapArea(fPixmapPtr);
+	}
+	fPixmapPtr->pinned = TRUE;
+#endif
+}
+
 static inline Bool
 Z160IsDrawablePixelOnly(DrawablePtr pDrawable)
 {
@@ -398,6 +1369,11 @@ Z160CanAcceleratePixmapRectangles(PixmapPtr pPixmap)
 		return FALSE;
 	}
 
+	/* The GPU belongs to another VT while ours is away. */
+	if (!xf86Screens[pPixmap->drawable.pScreen->myNum]->vtSema) {
+		return FALSE;
+	}
+
 #if IMX_EXA_ENABLE_HANDLES_PIXMAPS
 
 	/* Access driver private data structure associated with pixmap. */
@@ -407,6 +1383,11 @@ Z160CanAcceleratePixmapRectangles(PixmapPtr pPixmap)
 		return FALSE;
 	}
 
+	/* The GPU is about to use the contents. */
+	if (NULL != fPixmapPtr->snapshot) {
+		Z160EXARestoreSnapshot(pPixmap->drawable.pScreen, fPixmapPtr);
+	}
+
 	/* Make sure pixmap is in GPU memory. */
 	if (!fPixmapPtr->canAccel) {
 		return FALSE;
@@ -471,6 +1452,13 @@ Z160CanAcceleratePixmap(PixmapPtr pPixmap)
 	return Z160CanAcceleratePixmapRectangles(pPixmap);
 }
 
+static inline Bool
+Z160EXAIsBitsPerPixelSupported(int bitsPerPixel)
+{
+	/* Only 8, 16, and 32-bit pixmaps are supported. */
+	return (8 == bitsPerPixel) || (16 == bitsPerPixel) || (32 == bitsPerPixel);
+}
+
 static Bool 
 Z160GetPixmapConfig(PixmapPtr pPixmap, Z160Buffer* pBuffer)
 {
@@ -485,7 +1473,7 @@ Z160GetPixmapConfig(PixmapPtr pPixmap, Z160Buffer* pBuffer)
 	}
 
 	/* Get frame buffer properties about the pixmap. */
-	if (!IMX_EXA_GetPixmapProperties(pPixmap, &pBuffer->base, &pBuffer->pitch)) {
+	if (!Z160EXAGetPixmapGpuAddress(pPixmap, &pBuffer->base, &pBuffer->pitch)) {
 		return FALSE;
 	}
 
@@ -498,7 +1486,7 @@ Z160GetPixmapConfig(PixmapPtr pPixmap, Z160Buffer* pBuffer)
 }
 
 static Bool 
-Z160GetPictureConfig(ScrnInfoPtr pScrn, PicturePtr pPicture, Z160Buffer* pBuffer)
+Z160GetPictureFormat(PicturePtr pPicture, Z160Buffer* pBuffer)
 {
 	/* Is there a picture? */
 	if (NULL == pPicture) {
@@ -510,17 +1498,6 @@ Z160GetPictureConfig(ScrnInfoPtr pScrn, PicturePtr pPicture, Z160Buffer* pBuffer
 		return FALSE;
 	}
 
-	/* Access the pixmap associated with this picture. */
-	PixmapPtr pPixmap = Z160EXAGetDrawablePixmap(pPicture->pDrawable);
-	if (NULL == pPixmap) {
-		return FALSE;
-	}
-
-	/* Setup information from pixmap */
-	if (!Z160GetPixmapConfig(pPixmap, pBuffer)) {
-		return FALSE;
-	}
-
 	/* Setup based on the picture format. */
 	switch (pPicture->format) {
 
@@ -637,6 +1614,34 @@ Z160GetPictureConfig(ScrnInfoPtr pScrn, PicturePtr pPicture, Z160Buffer* pBuffer
 	return TRUE;
 }
 
+static Bool 
+Z160GetPictureConfig(ScrnInfoPtr pScrn, PicturePtr pPicture, Z160Buffer* pBuffer)
+{
+	/* Is there a picture? */
+	if (NULL == pPicture) {
+		return FALSE;
+	}
+
+	/* Is there a buffer to store the results? */
+	if (NULL == pBuffer) {
+		return FALSE;
+	}
+
+	/* Access the pixmap associated with this picture. */
+	PixmapPtr pPixmap = Z160EXAGetDrawablePixmap(pPicture->pDrawable);
+	if (NULL == pPixmap) {
+		return FALSE;
+	}
+
+	/* Setup information from pixmap */
+	if (!Z160GetPixmapConfig(pPixmap, pBuffer)) {
+		return FALSE;
+	}
+
+	/* Setup based on the picture format. */
+	return Z160GetPictureFormat(pPicture, pBuffer);
+}
+
 #if 0
 static unsigned long
 Z160ConvertScreenColor(ScrnInfoPtr pScrn, Pixel color)
@@ -670,1315 +1675,4780 @@ Z160ConvertScreenColor(ScrnInfoPtr pScrn, Pixel color)
 }
 #endif
 
-static void
-Z160ContextRelease(IMXEXAPtr fPtr)
+/* Has the GPU operation with this sequence number completed?  The */
+/* comparison allows for the sequence numbers wrapping around. */
+static inline Bool
+Z160IsSeqRetired(IMXEXAPtr fPtr, CARD32 seq)
 {
-	/* Destroy the GPU context? */
-	if ((NULL != fPtr) && (NULL != fPtr->gpuContext)) {
+	return (INT32)(seq - fPtr->gpuRetiredSeq) <= 0;
+}
 
-		z160_sync(fPtr->gpuContext);
-		z160_disconnect(fPtr->gpuContext);
-		fPtr->gpuContext = NULL;
+#if IMX_EXA_ENABLE_COMPLETION_THREAD && !IMX_EXA_ENABLE_SUBMIT_THREAD
+
+/* Take the lock on the Z160 context before using it, unless the */
+/* server already holds it. */
+static void
+Z160Lock(IMXEXAPtr fPtr)
+{
+	if (fPtr->completionRunning && !fPtr->gpuLocked) {
+		pthread_mutex_lock(&fPtr->gpuLock);
+		fPtr->gpuLocked = TRUE;
 	}
 }
 
-static void*
-Z160ContextGet(IMXEXAPtr fPtr)
+static void
+Z160Unlock(IMXEXAPtr fPtr)
 {
-	/* If no connection, attempt to establish it. */
-	if (NULL == fPtr->gpuContext) {
-
-		/* Get context to access the GPU. */
-		fPtr->gpuContext = z160_connect();
-		if (NULL == fPtr->gpuContext) {
+	if (fPtr->gpuLocked) {
+		fPtr->gpuLocked = FALSE;
+		pthread_mutex_unlock(&fPtr->gpuLock);
+	}
+}
 
-			xf86DrvMsg(fPtr->scrnIndex, X_ERROR,
-				"Unable to access Z160 GPU\n");
-			Z160ContextRelease(fPtr);
-			return NULL;
-		}
+#else
 
-		/* Other initialization. */
-		fPtr->gpuSynced = FALSE;
-		fPtr->gpuOpSetup = FALSE;
-	}
+static inline void
+Z160Lock(IMXEXAPtr fPtr)
+{
+	/* Only one thread uses the Z160 context, so nothing to do. */
+}
 
-	return fPtr->gpuContext;
+static inline void
+Z160Unlock(IMXEXAPtr fPtr)
+{
+	/* Only one thread uses the Z160 context, so nothing to do. */
 }
 
+#endif
+
+#if IMX_EXA_ENABLE_COMPLETION_THREAD
+
+/* Note the GPU work which the completion thread found complete. */
+/* Must be called with the lock held. */
 static void
-Z160Sync(IMXEXAPtr fPtr)
+Z160RetireCompleted(IMXEXAPtr fPtr)
 {
-	if (NULL == fPtr) {
-		return;
-	}
+	const CARD32 seq = fPtr->completionDoneSeq;
 
-	/* If there is no GPU context, then no reason to sync. */
-	/* Do not use Z160ContextGet because it will regain */
-	/* access if we currently do not have it (because idle). */
-	if (NULL == fPtr->gpuContext) {
+	if (Z160IsSeqRetired(fPtr, seq)) {
 		return;
 	}
 
-	/* Was there a GPU operation since the last sync? */
-	if (!fPtr->gpuSynced) {
+	fPtr->gpuRetiredSeq = seq;
+	++(fPtr->numAsyncRetires);
 
-#if IMX_EXA_DEBUG_INSTRUMENT_SYNCS
+	/* Nothing was issued since the thread was asked to wait? */
+	if ((seq == fPtr->gpuSeq) && !fPtr->gpuFlushPending) {
+		fPtr->gpuSynced = TRUE;
+	}
+}
 
-		/* Log how many calls were made to solid, copy, and composite before sync called. */
-		xf86DrvMsg(pScrn->scrnIndex, X_INFO,
-			"Z160EXAWaitMarker called after solid=%lu copy=%lu composite=%lu\n",
-				fPtr->numSolidBeforeSync,
-				fPtr->numCopyBeforeSync,
-				fPtr->numCompositeBeforeSync);
+#else
+
+static inline void
+Z160RetireCompleted(IMXEXAPtr fPtr)
+{
+	/* GPU work is only found complete by Z160Sync. */
+}
 
-		/* Reset counters */
-		fPtr->numSolidBeforeSync = 0;
-		fPtr->numCopyBeforeSync = 0;
-		fPtr->numCompositeBeforeSync = 0;
 #endif
 
-		/* Do the wait */
-		z160_sync(fPtr->gpuContext);
+static Bool
+Z160EXASameBuffer(const Z160Buffer* a, const Z160Buffer* b)
+{
+	return (a->base == b->base) && (a->pitch == b->pitch) &&
+		(a->width == b->width) && (a->height == b->height) &&
+		(a->format == b->format) && (a->bpp == b->bpp) &&
+		(a->swapRB == b->swapRB) && (a->opaque == b->opaque) &&
+		(a->alpha4 == b->alpha4);
+}
 
-		/* Update state */
-		fPtr->gpuSynced = TRUE;
+/* Whether the Z160 context already has the operation setup of the */
+/* batch, comparing only what its kind of operation uses. */
+static Bool
+Z160EXAIsSetupDone(IMXEXAGpuStatePtr state, IMXEXABatchPtr batch)
+{
+	if (!state->setupValid || (state->kind != batch->kind)) {
+		return FALSE;
+	}
+
+	switch (batch->kind) {
+
+		case IMX_EXA_BATCH_SOLID:
+			return state->color == batch->color;
+
+		case IMX_EXA_BATCH_COPY:
+			return (state->dirX == batch->dirX) &&
+				(state->dirY == batch->dirY) &&
+				Z160EXASameBuffer(&state->src, &batch->src);
+
+		case IMX_EXA_BATCH_COMPOSITE:
+			if ((state->blend != batch->blend) ||
+				(state->blendOp != batch->blendOp) ||
+				!Z160EXASameBuffer(&state->src, &batch->src)) {
+				return FALSE;
+			}
+			switch (batch->blend) {
+
+				case IMX_EXA_BLEND_IMAGE_MASKED:
+				case IMX_EXA_BLEND_CONST_MASKED:
+				case IMX_EXA_BLEND_PATTERN_MASKED:
+					return Z160EXASameBuffer(&state->mask,
+								&batch->mask);
+
+				default:
+					return TRUE;
+			}
+
+		default:
+			return FALSE;
 	}
 }
 
+/* Do the setup of the operation of a batch, after that of its target. */
 static void
-Z160EXAPreparePipelinedAccess(PixmapPtr pPixmap, int index)
+Z160EXASetupOperation(void* gpuContext, IMXEXABatchPtr batch)
 {
-	/* Access screen associated with this pixmap. */
-	ScrnInfoPtr pScrn = xf86Screens[pPixmap->drawable.pScreen->myNum];
+	switch (batch->kind) {
 
-	/* Access driver specific data */
-	IMXPtr imxPtr = IMXPTR(pScrn);
-	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+		case IMX_EXA_BATCH_SOLID:
+			z160_setup_fill_solid(gpuContext, batch->color);
+			break;
 
-	/* Remember previous setting so it can be restored in *FinishPipelinedAccess */
-	fPtr->savePixmapPtr[index] = pPixmap->devPrivate.ptr;
+		case IMX_EXA_BATCH_COPY:
+			z160_setup_copy(gpuContext, &batch->src,
+						batch->dirX, batch->dirY);
+			break;
 
-	/* Forces a real devPrivate.ptr for hidden pixmaps, so that they */
-	/* can be passed down into fb* funtions. */
-	if (NULL == pPixmap->devPrivate.ptr) {
+		case IMX_EXA_BATCH_COMPOSITE:
+			switch (batch->blend) {
+
+				case IMX_EXA_BLEND_IMAGE:
+					z160_setup_blend_image(gpuContext,
+						batch->blendOp, &batch->src);
+					break;
+
+				case IMX_EXA_BLEND_IMAGE_MASKED:
+					z160_setup_blend_image_masked(gpuContext,
+						batch->blendOp, &batch->src,
+						&batch->mask);
+					break;
+
+				case IMX_EXA_BLEND_CONST:
+					z160_setup_blend_const(gpuContext,
+						batch->blendOp, &batch->src);
+					break;
+
+				case IMX_EXA_BLEND_CONST_MASKED:
+					z160_setup_blend_const_masked(gpuContext,
+						batch->blendOp, &batch->src,
+						&batch->mask);
+					break;
+
+				case IMX_EXA_BLEND_PATTERN:
+					z160_setup_blend_pattern(gpuContext,
+						batch->blendOp, &batch->src);
+					break;
+
+				case IMX_EXA_BLEND_PATTERN_MASKED:
+					z160_setup_blend_pattern_masked(gpuContext,
+						batch->blendOp, &batch->src,
+						&batch->mask);
+					break;
+			}
+			break;
 
-		pPixmap->devPrivate.ptr = Z160EXAGetPixmapAddress(pPixmap);
+		default:
+			break;
 	}
 }
 
+/* Do the Z160 setup for a batch that starts an operation, skipping */
+/* what the context has already, and draw its rectangles with one */
+/* dispatch on the kind of operation for the whole batch.  Called by */
+/* whichever thread owns the Z160 context. */
 static void
-Z160EXAFinishPipelinedAccess(PixmapPtr pPixmap, int index)
+Z160EXARunBatch(IMXEXAPtr fPtr, IMXEXABatchPtr batch)
 {
-	/* Access screen associated with this pixmap. */
-	ScrnInfoPtr pScrn = xf86Screens[pPixmap->drawable.pScreen->myNum];
+	void* gpuContext = fPtr->gpuContext;
+	IMXEXAGpuStatePtr state = &fPtr->gpuState;
+	const int numRects = batch->numRects;
+	IMXEXABatchRectPtr pRect = batch->rects;
+	int i;
 
-	/* Access driver specific data */
-	IMXPtr imxPtr = IMXPTR(pScrn);
-	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+	if (batch->setup && (0 < numRects)) {
 
-	/* Restore to previous setting before call to *PreparePipelinedAccess */
-	pPixmap->devPrivate.ptr = fPtr->savePixmapPtr[index];
-	fPtr->savePixmapPtr[index] = NULL;
-}
+		/* A new target takes a new operation setup too. */
+		if (state->targetValid &&
+			Z160EXASameBuffer(&state->target, &batch->target)) {
 
-#if IMX_EXA_ENABLE_HANDLES_PIXMAPS
+			++(fPtr->numTargetSetupsSkipped);
+		} else {
+			z160_setup_buffer_target(gpuContext, &batch->target);
+			state->target = batch->target;
+			state->targetValid = TRUE;
+			state->setupValid = FALSE;
+		}
 
-/* BEGIN Functions for driver to handle pixmap allocation and migraion. */
+		if (Z160EXAIsSetupDone(state, batch)) {
 
-/* Align an offset to an arbitrary alignment */
-#define IMX_EXA_ALIGN(offset, align) (((offset) + (align) - 1) - \
-	(((offset) + (align) - 1) % (align)))
+			++(fPtr->numOpSetupsSkipped);
+		} else {
+			Z160EXASetupOperation(gpuContext, batch);
+			state->kind = batch->kind;
+			state->src = batch->src;
+			state->mask = batch->mask;
+			state->color = batch->color;
+			state->dirX = batch->dirX;
+			state->dirY = batch->dirY;
+			state->blend = batch->blend;
+			state->blendOp = batch->blendOp;
+			state->setupValid = TRUE;
+		}
+	}
 
-static inline Bool
-Z160EXAPrepareAccess(PixmapPtr pPixmap, int index)
-{
-	/* Since EXA_HANDLES_PIXMAPS flag is set, then there nothing to do. */
-	/* But this callback has to be implemented. */
 
-	return TRUE;
+	switch (batch->kind) {
+
+		case IMX_EXA_BATCH_SOLID:
+			for (i = 0; i < numRects; ++i, ++pRect) {
+				z160_fill_solid_rect(gpuContext,
+					pRect->dstX, pRect->dstY,
+					pRect->width, pRect->height);
+			}
+			break;
+
+		case IMX_EXA_BATCH_COPY:
+			for (i = 0; i < numRects; ++i, ++pRect) {
+				z160_copy_rect(gpuContext,
+					pRect->dstX, pRect->dstY,
+					pRect->width, pRect->height,
+					pRect->srcX, pRect->srcY);
+			}
+			break;
+
+		case IMX_EXA_BATCH_COMPOSITE:
+			switch (batch->blend) {
+
+				case IMX_EXA_BLEND_IMAGE:
+					for (i = 0; i < numRects; ++i, ++pRect) {
+						z160_blend_image_rect(gpuContext,
+							pRect->dstX, pRect->dstY,
+							pRect->width, pRect->height,
+							pRect->srcX, pRect->srcY);
+					}
+					break;
+
+				case IMX_EXA_BLEND_IMAGE_MASKED:
+					for (i = 0; i < numRects; ++i, ++pRect) {
+						z160_blend_image_masked_rect(gpuContext,
+							pRect->dstX, pRect->dstY,
+							pRect->width, pRect->height,
+							pRect->srcX, pRect->srcY,
+							pRect->maskX, pRect->maskY);
+					}
+					break;
+
+				case IMX_EXA_BLEND_CONST:
+					for (i = 0; i < numRects; ++i, ++pRect) {
+						z160_blend_const_rect(gpuContext,
+							pRect->dstX, pRect->dstY,
+							pRect->width, pRect->height);
+					}
+					break;
+
+				case IMX_EXA_BLEND_CONST_MASKED:
+					for (i = 0; i < numRects; ++i, ++pRect) {
+						z160_blend_const_masked_rect(gpuContext,
+							pRect->dstX, pRect->dstY,
+							pRect->width, pRect->height,
+							pRect->maskX, pRect->maskY);
+					}
+					break;
+
+				case IMX_EXA_BLEND_PATTERN:
+					for (i = 0; i < numRects; ++i, ++pRect) {
+						z160_blend_pattern_rect(gpuContext,
+							pRect->dstX, pRect->dstY,
+							pRect->width, pRect->height,
+							pRect->srcX, pRect->srcY);
+					}
+					break;
+
+				case IMX_EXA_BLEND_PATTERN_MASKED:
+					for (i = 0; i < numRects; ++i, ++pRect) {
+						z160_blend_pattern_masked_rect(gpuContext,
+							pRect->dstX, pRect->dstY,
+							pRect->width, pRect->height,
+							pRect->srcX, pRect->srcY,
+							pRect->maskX, pRect->maskY);
+					}
+					break;
+
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	if (batch->flush) {
+		z160_flush(gpuContext);
+	}
+	if (batch->sync) {
+		z160_sync(gpuContext);
+	}
 }
 
-static inline void
-Z160EXAFinishAccess(PixmapPtr pPixmap, int index)
+/* Start the next batch with the setup of the one before it. */
+static void
+Z160EXAContinueBatch(IMXEXABatchPtr next, IMXEXABatchPtr batch)
 {
-	/* Since EXA_HANDLES_PIXMAPS flag is set, then there nothing to do. */
-	/* But this callback has to be implemented. */
+	next->kind = batch->kind;
+	next->setup = batch->setup && (0 == batch->numRects);
+	next->target = batch->target;
+	next->src = batch->src;
+	next->mask = batch->mask;
+	next->color = batch->color;
+	next->dirX = batch->dirX;
+	next->dirY = batch->dirY;
+	next->blend = batch->blend;
+	next->blendOp = batch->blendOp;
+	next->flush = FALSE;
+	next->sync = FALSE;
+	next->numRects = 0;
 }
 
-static inline int
-Z160EXAComputeSystemMemoryPitch(int width, int bitsPerPixel)
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+
+/* Sleep until ready() holds.  Each wait has one sleeper and one */
+/* waker, which checks the flag after it has made progress, so the */
+/* flag is set before ready() is checked the last time. */
+static void
+Z160RingWait(IMXEXAPtr fPtr, IMXEXARingWaitPtr wait,
+		Bool (*ready)(IMXEXAPtr, CARD32), CARD32 arg)
 {
-	return ((width * bitsPerPixel + FB_MASK) >> FB_SHIFT) * sizeof(FbBits);
+	while (!ready(fPtr, arg)) {
+
+		wait->sleeping = TRUE;
+		__sync_synchronize();
+
+		if (ready(fPtr, arg)) {
+			wait->sleeping = FALSE;
+			break;
+		}
+
+		/* Interrupted or woken early, check again. */
+		sem_wait(&wait->sem);
+	}
 }
 
-static void*
-Z160EXACreatePixmap2(ScreenPtr pScreen, int width, int height,
-			int depth, int usage_hint, int bitsPerPixel,
-			int *pPitch)
+static void
+Z160RingWake(IMXEXARingWaitPtr wait)
 {
-	/* Allocate the private data structure to be stored with pixmap. */
-	IMXEXAPixmapPtr fPixmapPtr =
-		(IMXEXAPixmapPtr)xnfalloc(sizeof(IMXEXAPixmapRec));
+	__sync_synchronize();
 
-	if (NULL == fPixmapPtr) {
-		return NULL;
+	if (wait->sleeping) {
+		wait->sleeping = FALSE;
+		sem_post(&wait->sem);
 	}
+}
 
-	/* Initialize pixmap properties passed in. */
-	fPixmapPtr->width = width;
-	fPixmapPtr->height = height;
-	fPixmapPtr->depth = depth;
-	fPixmapPtr->bitsPerPixel = bitsPerPixel;
+static Bool
+Z160RingHasWork(IMXEXAPtr fPtr, CARD32 arg)
+{
+	return (fPtr->ringHead != fPtr->ringTail) || fPtr->completionQuit;
+}
 
-	/* Initialize common properties. */
-	fPixmapPtr->pitchBytes = 0;
-	fPixmapPtr->ptr = NULL;
-	fPixmapPtr->canAccel = FALSE;
-	fPixmapPtr->gpuAddr = NULL;
+/* Whether the slot arg places after the tail is free. */
+static Bool
+Z160RingHasSpace(IMXEXAPtr fPtr, CARD32 arg)
+{
+	return fPtr->ringTail + arg - fPtr->ringHead < IMX_EXA_SUBMIT_RING_SIZE;
+}
 
-	/* Initialize properties for GPU frame buffer allocated memory. */
-	fPixmapPtr->widthAligned = 0;
-	fPixmapPtr->heightAligned = 0;
-	fPixmapPtr->area = NULL;
+static Bool
+Z160RingIsDone(IMXEXAPtr fPtr, CARD32 seq)
+{
+	return (INT32)(seq - fPtr->completionDoneSeq) <= 0;
+}
 
-	/* Initialize properties for system allocated memory. */
-	fPixmapPtr->sysAllocSize = 0;
-	fPixmapPtr->sysPtr = NULL;
+/* Hand the batch at the tail of the ring to the submission thread, */
+/* and move on to the next slot, which continues the same operation. */
+static void
+Z160QueueBatch(IMXEXAPtr fPtr)
+{
+	IMXEXABatchPtr batch = fPtr->batch;
+	IMXEXABatchPtr next;
 
-	/* Nothing more to do if the width or height have no dimensions. */
-	if ((0 == width) || (0 == height)) {
-		*pPitch = 0;
-		return fPixmapPtr;
-	}
+	/* Publish the batch once all of it is written. */
+	__sync_synchronize();
+	fPtr->ringTail = fPtr->ringTail + 1;
+	Z160RingWake(&fPtr->ringWork);
 
-	/* Access the driver specific data. */
-	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
-	IMXPtr imxPtr = IMXPTR(pScrn);
-	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
-	
-	/* What is the start of screen (and offscreen) memory. */
-	CARD8* screenMemoryBegin = (CARD8*)(imxPtr->exaDriverPtr->memoryBase);
+	/* Wait until the thread is done with the next slot. */
+	Z160RingWait(fPtr, &fPtr->ringSpace, Z160RingHasSpace, 0);
 
-	/* First try to allocate pixmap memory from GPU memory but */
-	/* can only when bits per pixel >= 8. */
-	if (bitsPerPixel >= 8) {
+	next = &fPtr->ring[fPtr->ringTail & (IMX_EXA_SUBMIT_RING_SIZE - 1)];
+	Z160EXAContinueBatch(next, batch);
 
-		/* Z160 has 32 pixel width and height alignment. */
-		const int gpuAlignedWidth = IMX_EXA_ALIGN(width, 32);
-		const int gpuAlignedHeight = IMX_EXA_ALIGN(height, 32);
+	fPtr->batch = next;
+}
 
-		/* Compute number of pitch bytes for GPU allocated memory. */
-		const int gpuPitchBytes = gpuAlignedWidth * bitsPerPixel / 8;
+#endif
 
-		/* Compute how much memory to allocate for GPU memory. */
-		const int gpuAllocSize = gpuAlignedHeight * gpuPitchBytes;
+/* Whether the rectangles of the batch can be drawn in any order, */
+/* which also means that adjacent ones can be drawn as one. */
+static Bool
+Z160EXAIsBatchUnordered(IMXEXABatchPtr batch)
+{
+	switch (batch->kind) {
 
-		/* Attemp to allocate from GPU (offscreen) FB memory pool. */
-		ExaOffscreenArea* area =
-			IMX_EXA_OffscreenAlloc(
-				pScreen,		/* ScreenPtr */
-				gpuAllocSize,		/* size */
-				Z160_ALIGN_OFFSET,	/* align */
-				TRUE,			/* locked? */
-				NULL,			/* save */
-				NULL);			/* privData */
+		case IMX_EXA_BATCH_SOLID:
+			return TRUE;
 
-		/* If memory allocated, then assign values to private */
-		/* data structure and return. */
-		if (NULL != area) {
+		case IMX_EXA_BATCH_COPY:
+			return batch->src.base != batch->target.base;
 
-			fPixmapPtr->widthAligned = gpuAlignedWidth;
-			fPixmapPtr->heightAligned = gpuAlignedHeight;
-			fPixmapPtr->area = area;
+		default:
+			return FALSE;
+	}
+}
 
-			fPixmapPtr->canAccel = TRUE;
-			fPixmapPtr->pitchBytes = gpuPitchBytes;
-			fPixmapPtr->ptr = screenMemoryBegin + area->offset;
-			fPixmapPtr->gpuAddr =
-				(void*)((unsigned char*)pScrn->memPhysBase +
-					area->offset);
+/* Merge each rectangle of a solid or copy batch into the one before */
+/* it when they share a whole edge, and their sources line up too. */
+static void
+Z160EXAMergeBatchRects(IMXEXAPtr fPtr, IMXEXABatchPtr batch)
+{
+	const Bool isCopy = (IMX_EXA_BATCH_COPY == batch->kind);
+	IMXEXABatchRectPtr pLast = batch->rects;
+	int i;
 
-			*pPitch = gpuPitchBytes;
-		}
+	if ((2 > batch->numRects) || !Z160EXAIsBatchUnordered(batch)) {
+		return;
 	}
 
-	/* If we could not allocate pixmap memory from GPU memory, */
-	/* then must try allocating from system memory. */
-	if (NULL == fPixmapPtr->ptr) {
+	for (i = 1; i < batch->numRects; ++i) {
 
-		/* Compute number of pitch bytes for system allocated memory. */
-		/* The number of pitch bytes is passed in as the mis-named */
-		/* "devKind" parameter. */
-		const int sysPitchBytes =
-			Z160EXAComputeSystemMemoryPitch(width, bitsPerPixel);
+		const IMXEXABatchRectPtr pRect = &batch->rects[i];
 
-		/* Compute how much memory to allocate for system memory. */
-		const int sysAllocSize = height * sysPitchBytes;
+		if ((pLast->dstY == pRect->dstY) &&
+			(pLast->height == pRect->height) &&
+			(pLast->dstX + pLast->width == pRect->dstX) &&
+			(!isCopy || ((pLast->srcY == pRect->srcY) &&
+				(pLast->srcX + pLast->width == pRect->srcX)))) {
 
-		/* Attempt to allocate pixmap memory from system memory. */
-		void* sysPtr = xnfalloc(sysAllocSize);
-		
-		/* If memory allocated, then assign values to private */
-		/* data structure and return. */
-		if (NULL != sysPtr) {
+			pLast->width += pRect->width;
+			++(fPtr->numMergedRects);
 
-			fPixmapPtr->sysAllocSize = sysAllocSize;
-			fPixmapPtr->sysPtr = sysPtr;
+		} else if ((pLast->dstX == pRect->dstX) &&
+			(pLast->width == pRect->width) &&
+			(pLast->dstY + pLast->height == pRect->dstY) &&
+			(!isCopy || ((pLast->srcX == pRect->srcX) &&
+				(pLast->srcY + pLast->height == pRect->srcY)))) {
 
-			fPixmapPtr->pitchBytes = sysPitchBytes;
-			fPixmapPtr->ptr = sysPtr;
-			fPixmapPtr->canAccel = FALSE;
+			pLast->height += pRect->height;
+			++(fPtr->numMergedRects);
 
-			*pPitch = sysPitchBytes;
-		}
-	}
+		} else {
 
-	/* If we got here and still have no pixmap memory, then cleanup */
-	/* and setup to return failure. */
-	if (NULL == fPixmapPtr->ptr) {
-		free(fPixmapPtr);
-		fPixmapPtr = NULL;
+			*(++pLast) = *pRect;
+		}
 	}
 
-	return fPixmapPtr;
+	batch->numRects = pLast - batch->rects + 1;
 }
 
+/* Drop the rectangles of the held fill which are each inside one */
+/* rectangle of the batch drawn after it, if that batch overwrites */
+/* its target without reading it. */
 static void
-Z160EXADestroyPixmap(ScreenPtr pScreen, void *driverPriv)
+Z160EXADropOverdrawn(IMXEXAPtr fPtr, IMXEXABatchPtr held, IMXEXABatchPtr batch)
 {
-	/* Nothing to do if driver private pointer not defined. */
-	if (NULL == driverPriv) {
+	int i, j, numKept;
+
+	if ((0 == batch->numRects) ||
+		!Z160EXAIsBatchUnordered(batch) ||
+		!Z160EXASameBuffer(&held->target, &batch->target) ||
+		(held->numRects * batch->numRects > IMX_EXA_PEEPHOLE_MAX_COMPARES)) {
+
 		return;
 	}
 
-	/* Cast pointer to driver private data structure. */
-	IMXEXAPixmapPtr fPixmapPtr = (IMXEXAPixmapPtr)driverPriv;
+	numKept = 0;
+	for (i = 0; i < held->numRects; ++i) {
 
-	/* Is pixmap allocated in offscreen frame buffer memory? */
-	if (NULL != fPixmapPtr->area) {
+		const IMXEXABatchRectPtr pRect = &held->rects[i];
 
-		IMX_EXA_OffscreenFree(pScreen, fPixmapPtr->area);
+		for (j = 0; j < batch->numRects; ++j) {
 
-	/* Is pixmap allocated in system memory? */
-	} else if (NULL != fPixmapPtr->sysPtr) {
+			const IMXEXABatchRectPtr pOver = &batch->rects[j];
+			if ((pOver->dstX <= pRect->dstX) &&
+				(pOver->dstY <= pRect->dstY) &&
+				(pOver->dstX + pOver->width >=
+					pRect->dstX + pRect->width) &&
+				(pOver->dstY + pOver->height >=
+					pRect->dstY + pRect->height)) {
+				break;
+			}
+		}
 
-		free(fPixmapPtr->sysPtr);
+		if (j < batch->numRects) {
+			++(fPtr->numOverdrawnRects);
+			fPtr->numOverdrawnPixels +=
+				(unsigned long long)pRect->width * pRect->height;
+		} else {
+			held->rects[numKept++] = *pRect;
+		}
 	}
 
-	/* Free the driver private data structure associated with pixmap. */
-	free(fPixmapPtr);
+	if ((0 == numKept) && (0 < held->numRects)) {
+		++(fPtr->numOverdrawnOps);
+	}
+	held->numRects = numKept;
 }
 
+/* Whether a finished fill can be held back.  Without the thread the */
+/* ring batches are run in place, so nothing is held. */
 static Bool
-Z160EXAModifyPixmapHeader(PixmapPtr pPixmap, int width, int height,
-		int depth, int bitsPerPixel, int devKind, pointer pPixData)
+Z160EXACanHoldBatch(IMXEXAPtr fPtr)
 {
-	/* Make sure the pixmap is defined. */
-	if (NULL == pPixmap) {
-		return FALSE;
-	}
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+	return fPtr->completionRunning;
+#else
+	return TRUE;
+#endif
+}
 
-	/* Access driver private data structure associated with pixmap. */
-	IMXEXAPixmapPtr fPixmapPtr =
-		(IMXEXAPixmapPtr)(exaGetPixmapDriverPrivate(pPixmap));
-	if (NULL == fPixmapPtr) {
-		return FALSE;
-	}
+/* Keep the current batch, which finished a fill, from being submitted */
+/* until the next batch is, and start the next one after it. */
+static void
+Z160EXAHoldBatch(IMXEXAPtr fPtr)
+{
+	IMXEXABatchPtr batch = fPtr->batch;
+	IMXEXABatchPtr next;
 
-	/* Access screen associated with this pixmap */
-	ScrnInfoPtr pScrn = xf86Screens[pPixmap->drawable.pScreen->myNum];
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+	Z160RingWait(fPtr, &fPtr->ringSpace, Z160RingHasSpace, 1);
+	next = &fPtr->ring[(fPtr->ringTail + 1) & (IMX_EXA_SUBMIT_RING_SIZE - 1)];
+#else
+	next = (batch == &fPtr->batchRecs[0]) ?
+		&fPtr->batchRecs[1] : &fPtr->batchRecs[0];
+#endif
+	Z160EXAContinueBatch(next, batch);
 
-	/* Access driver specific data */
-	IMXPtr imxPtr = IMXPTR(pScrn);
-	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+	/* Counts as submitted for flushing and fencing. */
+	fPtr->gpuOpSetup = TRUE;
 
-	/* What is the start of screen (and offscreen) memory and its size. */
-	CARD8* screenMemoryBegin = (CARD8*)(imxPtr->exaDriverPtr->memoryBase);
-	CARD8* screenMemoryEnd =
-		screenMemoryBegin + imxPtr->exaDriverPtr->memorySize;
+	fPtr->heldBatch = batch;
+	fPtr->batch = next;
+}
 
-	/* Update the width if specified. */
-	if (0 < width) {
-		fPixmapPtr->width = width;
-	}
+/* Submit the held fill, less what the current batch draws over. */
+static void
+Z160EXAReleaseHeld(IMXEXAPtr fPtr)
+{
+	IMXEXABatchPtr held = fPtr->heldBatch;
 
-	/* Update the height if specified. */
-	if (0 < height) {
-		fPixmapPtr->height = height;
+	if (NULL == held) {
+		return;
 	}
+	fPtr->heldBatch = NULL;
 
-	/* Update the bits per pixel if specified */
-	if (0 < bitsPerPixel) {
-		fPixmapPtr->bitsPerPixel = bitsPerPixel;
-	}
+	Z160EXADropOverdrawn(fPtr, held, fPtr->batch);
+	Z160EXAMergeBatchRects(fPtr, held);
 
-	/* Update the bits per pixel if specified */
-	if (0 < depth) {
-		fPixmapPtr->depth = depth;
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+	/* The held batch is at the tail, just ahead of the current one. */
+	__sync_synchronize();
+	fPtr->ringTail = fPtr->ringTail + 1;
+	Z160RingWake(&fPtr->ringWork);
+#else
+	if (NULL != fPtr->gpuContext) {
+		Z160Lock(fPtr);
+		Z160EXARunBatch(fPtr, held);
 	}
+#endif
+}
 
-	/* Update the pointer to pixel data if specified. */
-	if (0 != pPixData) {
-
-		fPixmapPtr->ptr = pPixData;
+/* A fill of the same color on the same target as the held one adds */
+/* its rectangles to it, and so needs no setup of its own. */
+static void
+Z160EXAJoinHeldFill(IMXEXAPtr fPtr)
+{
+	IMXEXABatchPtr held = fPtr->heldBatch;
+	IMXEXABatchPtr batch = fPtr->batch;
 
-		if ((screenMemoryBegin <= (CARD8*)(fPixmapPtr->ptr)) &&
-			((CARD8*)(fPixmapPtr->ptr) < screenMemoryEnd)) {
+	if ((NULL == held) ||
+		(IMX_EXA_BATCH_SOLID != batch->kind) ||
+		(0 != batch->numRects) ||
+		(held->color != batch->color) ||
+		!Z160EXASameBuffer(&held->target, &batch->target)) {
 
-			fPixmapPtr->canAccel = TRUE;
+		return;
+	}
 
-			/* Compute address relative to begin of FB memory. */
-			const unsigned long offset =
-				(CARD8*)(fPixmapPtr->ptr) - screenMemoryBegin;
+	/* In the ring the current slot just goes back to being free. */
+	fPtr->heldBatch = NULL;
+	fPtr->batch = held;
+	++(fPtr->numJoinedFills);
+}
 
-			/* Store GPU address. */
-			fPixmapPtr->gpuAddr =
-				(void*)((unsigned char*)pScrn->memPhysBase +
-					offset);
+/* Submit the current batch to the Z160, through the submission */
+/* thread if it is running, and reset it to continue the operation. */
+static void
+Z160SubmitBatch(IMXEXAPtr fPtr)
+{
+	IMXEXABatchPtr batch = fPtr->batch;
 
-		} else {
+	/* A held fill goes first. */
+	Z160EXAReleaseHeld(fPtr);
+	Z160EXAMergeBatchRects(fPtr, batch);
 
-			fPixmapPtr->canAccel = FALSE;
-		}
+	if (0 < batch->numRects) {
+		fPtr->gpuOpSetup = TRUE;
+	}
 
-		/* If the pixel buffer changed and the pitch was not */
-		/* specified, then recompute the pitch. */
-		if (0 >= devKind) {
-			devKind =
-				Z160EXAComputeSystemMemoryPitch(
-					fPixmapPtr->width,
-					fPixmapPtr->bitsPerPixel);
-		}
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+	if (fPtr->completionRunning) {
+		Z160QueueBatch(fPtr);
+		return;
 	}
+#endif
 
-	/* Update the pitch bytes if specified, or if recomputed. */
-	if (0 < devKind) {
-		fPixmapPtr->pitchBytes = devKind;
+	if (NULL != fPtr->gpuContext) {
+		Z160Lock(fPtr);
+		Z160EXARunBatch(fPtr, batch);
+	}
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+	if (batch->sync) {
+		fPtr->completionDoneSeq = batch->seq;
 	}
+#endif
 
-	/* Update the pixmap header with our info. */
-	pPixmap->drawable.width = fPixmapPtr->width;
-	pPixmap->drawable.height = fPixmapPtr->height;
-	pPixmap->drawable.bitsPerPixel = fPixmapPtr->bitsPerPixel;
-	pPixmap->drawable.depth = fPixmapPtr->depth;
-	pPixmap->devPrivate.ptr = fPixmapPtr->ptr;
-	pPixmap->devKind = fPixmapPtr->pitchBytes;
+	batch->setup = batch->setup && (0 == batch->numRects);
+	batch->flush = FALSE;
+	batch->sync = FALSE;
+	batch->numRects = 0;
+}
 
-	return TRUE;
+/* Flush the Z160 command buffer to the GPU. */
+static void
+Z160GpuFlush(IMXEXAPtr fPtr)
+{
+	fPtr->batch->flush = TRUE;
+	Z160SubmitBatch(fPtr);
+}
+
+/* Wait for the GPU to complete all the work flushed to it. */
+static void
+Z160GpuSync(IMXEXAPtr fPtr)
+{
+	fPtr->batch->sync = TRUE;
+	fPtr->batch->seq = fPtr->gpuSeq;
+	Z160SubmitBatch(fPtr);
+
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+	Z160RingWait(fPtr, &fPtr->ringDone, Z160RingIsDone, fPtr->gpuSeq);
+#endif
 }
 
+/* Flush operations whose flush was deferred.  Returns TRUE if there */
+/* were any. */
 static Bool
-Z160EXAPixmapIsOffscreen(PixmapPtr pPixmap)
+Z160FlushPending(IMXEXAPtr fPtr)
 {
-	/* Make sure pixmap is defined. */
-	if (NULL == pPixmap) {
+	if (!fPtr->gpuFlushPending) {
 		return FALSE;
 	}
 
-	/* Access driver private data structure associated with pixmap. */
-	IMXEXAPixmapPtr fPixmapPtr =
-		(IMXEXAPixmapPtr)(exaGetPixmapDriverPrivate(pPixmap));
-	if (NULL == fPixmapPtr) {
-		return FALSE;
+	if (NULL != fPtr->gpuContext) {
+		Z160GpuFlush(fPtr);
 	}
 
-	return fPixmapPtr->canAccel;
+	fPtr->gpuFlushPending = FALSE;
+	fPtr->numUnflushedRects = 0;
+
+	return TRUE;
 }
 
-/* END Functions for driver to handle pixmap allocation and migraion. */
+static void
+Z160ContextRelease(IMXEXAPtr fPtr)
+{
+	/* Destroy the GPU context? */
+	if ((NULL != fPtr) && (NULL != fPtr->gpuContext)) {
 
-#else
+		Z160Lock(fPtr);
+		Z160FlushPending(fPtr);
+		z160_sync(fPtr->gpuContext);
+		z160_disconnect(fPtr->gpuContext);
+		fPtr->gpuContext = NULL;
+	}
+}
 
-static inline Bool
-Z160EXAPrepareAccess(PixmapPtr pPixmap, int index)
+static void*
+Z160ContextGet(IMXEXAPtr fPtr)
 {
-	/* Frame buffer memory is not allocated through Z160, so nothing to do. */
-	/* But this callback has to be implemented since the offscreen pixmap test */
-	/* callback has been overridden. */
+	/* If no connection, attempt to establish it. */
+	if (NULL == fPtr->gpuContext) {
 
-	return TRUE;
+		/* Get context to access the GPU. */
+		fPtr->gpuContext = z160_connect();
+		if (NULL == fPtr->gpuContext) {
+
+			xf86DrvMsg(fPtr->scrnIndex, X_ERROR,
+				"Unable to access Z160 GPU\n");
+			Z160ContextRelease(fPtr);
+			return NULL;
+		}
+
+		/* Other initialization. */
+		fPtr->gpuSynced = FALSE;
+		fPtr->gpuOpSetup = FALSE;
+		fPtr->gpuState.targetValid = FALSE;
+		fPtr->gpuState.setupValid = FALSE;
+	}
+
+	/* The caller goes on to use the context. */
+	Z160Lock(fPtr);
+
+	return fPtr->gpuContext;
 }
 
-static inline void
-Z160EXAFinishAccess(PixmapPtr pPixmap, int index)
+static void
+Z160Sync(IMXEXAPtr fPtr)
 {
-	/* Nothing to do, but this callback has to be implemented */
-	/* if the prepare access callback is overridden. */
-}
+	if (NULL == fPtr) {
+		return;
+	}
 
-#endif
+	/* If there is no GPU context, then no reason to sync. */
+	/* Do not use Z160ContextGet because it will regain */
+	/* access if we currently do not have it (because idle). */
+	if (NULL == fPtr->gpuContext) {
+		return;
+	}
 
-static Bool
-Z160EXAPrepareSolid(PixmapPtr pPixmap, int alu, Pixel planemask, Pixel fg)
-{
-	/* Make sure pixmap is defined. */
-	if (NULL == pPixmap) {
-		return FALSE;
+	/* The completion thread may have seen the work complete. */
+	Z160Lock(fPtr);
+	Z160RetireCompleted(fPtr);
+
+	/* The CPU is about to access memory, so operations whose */
+	/* flush was deferred must be sent to the GPU now. */
+	if (Z160FlushPending(fPtr)) {
+		++(fPtr->numSyncFlushes);
 	}
 
-	/* Make sure operations can be accelerated on this pixmap. */
-	if (!Z160CanAcceleratePixmap(pPixmap)) {
-		return FALSE;
+	/* Was there a GPU operation since the last sync? */
+	if (!fPtr->gpuSynced) {
+
+#if IMX_EXA_DEBUG_INSTRUMENT_SYNCS
+
+		/* Log how many calls were made to solid, copy, and composite before sync called. */
+		xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+			"Z160EXAWaitMarker called after solid=%lu copy=%lu composite=%lu\n",
+				fPtr->numSolidBeforeSync,
+				fPtr->numCopyBeforeSync,
+				fPtr->numCompositeBeforeSync);
+
+		/* Reset counters */
+		fPtr->numSolidBeforeSync = 0;
+		fPtr->numCopyBeforeSync = 0;
+		fPtr->numCompositeBeforeSync = 0;
+#endif
+
+		/* Do the wait */
+		Z160GpuSync(fPtr);
+
+		/* Update state */
+		fPtr->gpuSynced = TRUE;
 	}
 
-	/* Determine number of pixels in target pixmap. */
-	unsigned pixmapArea = pPixmap->drawable.width * pPixmap->drawable.height;
+	/* Every operation issued so far is complete. */
+	fPtr->gpuRetiredSeq = fPtr->gpuSeq;
+}
 
-	/* Can't accelerate solid fill unless pixmap has minimum number of pixels. */
-	if (pixmapArea < IMX_EXA_MIN_PIXEL_AREA_SOLID) {
-		return FALSE;
+/* Wait for the GPU operation with this sequence number, and those */
+/* before it, to complete.  Z160 cannot wait for part of the work */
+/* submitted, so a wait is for all of it, but none is needed at all */
+/* once the operation is known to be complete. */
+static void
+Z160WaitSeq(IMXEXAPtr fPtr, CARD32 seq)
+{
+	if (Z160IsSeqRetired(fPtr, seq)) {
+		++(fPtr->numFenceSkips);
+		return;
 	}
 
-	/* Access screen associated with this pixmap */
+	++(fPtr->numFenceWaits);
+	Z160Sync(fPtr);
+}
+
+static void
+Z160EXAPreparePipelinedAccess(PixmapPtr pPixmap, int index)
+{
+	/* Access screen associated with this pixmap. */
 	ScrnInfoPtr pScrn = xf86Screens[pPixmap->drawable.pScreen->myNum];
 
 	/* Access driver specific data */
 	IMXPtr imxPtr = IMXPTR(pScrn);
 	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
 
-	/* Check the number of entities, and fail if it isn't one. */
-	if (pScrn->numEntities != 1) {
+	/* The CPU is about to use the contents. */
+	Z160EXARestorePixmap(pPixmap);
 
-		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
-			"Z160EXAPrepareSolid called with number of screen entities (%d) not 1\n",
-			pScrn->numEntities);
-		return FALSE;
-	}
+	/* Remember previous setting so it can be restored in *FinishPipelinedAccess */
+	fPtr->savePixmapPtr[index] = pPixmap->devPrivate.ptr;
 
-	/* Make sure that the input planemask specifies a solid */
-	if (!EXA_PM_IS_SOLID(&pPixmap->drawable, planemask)) {
+	/* Forces a real devPrivate.ptr for hidden pixmaps, so that they */
+	/* can be passed down into fb* funtions. */
+	if (NULL == pPixmap->devPrivate.ptr) {
 
-#if DEBUG_PREPARE_SOLID
-		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
-			"Z160EXAPrepareSolid called with planemask=0x%08x which is not solid\n",
-			(unsigned)planemask);
-#endif
-		return FALSE;
+		pPixmap->devPrivate.ptr = Z160EXAGetPixmapAddress(pPixmap);
 	}
+}
 
-	/* Make sure that only GXcopy is only raster op called for. */
-	if (GXcopy != alu) {
+static void
+Z160EXAFinishPipelinedAccess(PixmapPtr pPixmap, int index)
+{
+	/* Access screen associated with this pixmap. */
+	ScrnInfoPtr pScrn = xf86Screens[pPixmap->drawable.pScreen->myNum];
 
-#if DEBUG_PREPARE_SOLID
-		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
-			"Z160EXAPrepareSolid called with rop=0x%08x which is not GXcopy\n",
-			(unsigned)alu);
-#endif
-		return FALSE;
-	}
+	/* Access driver specific data */
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
 
-	/* Only 8, 16, and 32-bit pixmaps are supported. */
-	/* Associate a pixel format which is required for configuring */
-	/* the Z160.  It does not matter what format is chosen as long as it */
-	/* is one that matchs the bitsPerPixel.  The format of the input */
-	/* foreground color matches the format of the target pixmap, but */
-	/* we will shift the bits around to match the chosen format. */
-	if (!Z160GetPixmapConfig(pPixmap, &fPtr->z160BufferDst)) {
-		return FALSE;
-	}
-	switch (pPixmap->drawable.bitsPerPixel) {
+	/* Restore to previous setting before call to *PreparePipelinedAccess */
+	pPixmap->devPrivate.ptr = fPtr->savePixmapPtr[index];
+	fPtr->savePixmapPtr[index] = NULL;
+}
 
-	case 8:
-		fPtr->z160BufferDst.format = Z160_FORMAT_8;	/* value goes in blue channel */
-		fPtr->z160BufferDst.swapRB = FALSE;
-		fPtr->z160Color = fg & 0x000000FF;
-		break;
+/* Align an offset to an arbitrary alignment */
+#define IMX_EXA_ALIGN(offset, align) (((offset) + (align) - 1) - \
+	(((offset) + (align) - 1) % (align)))
 
-	case 16:
-		fPtr->z160BufferDst.format = Z160_FORMAT_4444;	/* upper nibble */
-		fPtr->z160BufferDst.swapRB = FALSE;
-		fPtr->z160Color =	((fg & 0x0000F000) << 16) |
-					((fg & 0x00000F00) << 12) |
-					((fg & 0x000000F0) <<  8) |
-					((fg & 0x0000000F) <<  4);
-		break;
+#if IMX_EXA_ENABLE_HANDLES_PIXMAPS
 
-	case 32:
-		fPtr->z160BufferDst.format = Z160_FORMAT_8888;	/* ARGB */
-		fPtr->z160BufferDst.swapRB = FALSE;
-		fPtr->z160Color = fg;
-		break;
+/* BEGIN Functions for driver to handle pixmap allocation and migraion. */
 
-	default:
-#if DEBUG_PREPARE_SOLID
-		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
-			"Z160EXAPrepareSolid called with unsupported pixmap bitsPerPixel=%d\n",
-			pPixmap>bitsPerPixel);
-#endif
-		return FALSE;
+static void
+Z160EXAMarkPixmapUsed(PixmapPtr pPixmap)
+{
+	/* Make sure pixmap is defined. */
+	if (NULL == pPixmap) {
+		return;
 	}
 
-	/* GPU setup deferred */
-	fPtr->gpuOpSetup = FALSE;
-
-	/* Remember the parameters passed in */
-	fPtr->pPixmapDst = pPixmap;
-	fPtr->solidALU = alu;
-	fPtr->solidPlaneMask = planemask;
-	fPtr->solidColor = fg;
+	/* Access driver private data structure associated with pixmap. */
+	IMXEXAPixmapPtr fPixmapPtr =
+		(IMXEXAPixmapPtr)(exaGetPixmapDriverPrivate(pPixmap));
+	if ((NULL == fPixmapPtr) || (NULL == fPixmapPtr->area)) {
+		return;
+	}
 
-	return TRUE;
+	/* Recently used areas are the most costly to evict. */
+	IMX_EXA_OffscreenMarkUsed(pPixmap->drawable.pScreen, fPixmapPtr->area);
 }
 
+/* Record that the current GPU operation reads or writes the pixmap. */
 static void
-Z160EXASolid(PixmapPtr pPixmap, int x1, int y1, int x2, int y2)
+Z160EXAFencePixmap(IMXEXAPtr fPtr, PixmapPtr pPixmap)
 {
-	/* Access screen associated with this pixmap */
-	ScrnInfoPtr pScrn = xf86Screens[pPixmap->drawable.pScreen->myNum];
-
-	/* Access driver specific data */
-	IMXPtr imxPtr = IMXPTR(pScrn);
-	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+	/* Make sure pixmap is defined. */
+	if (NULL == pPixmap) {
+		return;
+	}
 
-	/* Nothing to unless rectangle has area. */
-	if ((x1 >= x2) || (y1 >= y2)) {
+	/* Access driver private data structure associated with pixmap. */
+	IMXEXAPixmapPtr fPixmapPtr =
+		(IMXEXAPixmapPtr)(exaGetPixmapDriverPrivate(pPixmap));
+	if (NULL == fPixmapPtr) {
 		return;
 	}
 
-	/* Compute the width and height of the rectangle to fill. */
-	int width = x2 - x1;
-	int height = y2 - y1;
+	fPixmapPtr->gpuSeq = fPtr->gpuSeq;
+}
 
-	if (!fPtr->gpuOpSetup) {
-		z160_setup_buffer_target(fPtr->gpuContext, &fPtr->z160BufferDst);
-		z160_setup_fill_solid(fPtr->gpuContext, fPtr->z160Color);
+/* Wait for the GPU operations which use the pixmap to complete, */
+/* before the CPU accesses it. */
+static void
+Z160EXAWaitPixmap(PixmapPtr pPixmap)
+{
+	/* Access driver private data structure associated with pixmap. */
+	IMXEXAPixmapPtr fPixmapPtr =
+		(IMXEXAPixmapPtr)(exaGetPixmapDriverPrivate(pPixmap));
 
-		fPtr->gpuOpSetup = TRUE;
+	/* The GPU never uses a pixmap it cannot access. */
+	if ((NULL == fPixmapPtr) || !fPixmapPtr->canAccel) {
+		return;
 	}
-	z160_fill_solid_rect(fPtr->gpuContext, x1, y1, width, height);
 
-#if IMX_EXA_DEBUG_SOLID
-	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
-		"Z160EXASolid called with rect=(%d-%d,%d-%d)\n",
-		x1, x2, y1, y2);
-#endif
+	/* Access the driver specific data. */
+	ScrnInfoPtr pScrn = xf86Screens[pPixmap->drawable.pScreen->myNum];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
 
-#if IMX_EXA_DEBUG_INSTRUMENT_SIZES
-	const unsigned long size =
-		(unsigned long)(z160DstRect.width) * z160DstRect.height;
+	Z160WaitSeq(fPtr, fPixmapPtr->gpuSeq);
+}
 
-	if (size < 100) {
+static inline Bool
+Z160EXAPrepareAccess(PixmapPtr pPixmap, int index)
+{
+	/* Access driver private data structure associated with pixmap. */
+	IMXEXAPixmapPtr fPixmapPtr =
+		(IMXEXAPixmapPtr)(exaGetPixmapDriverPrivate(pPixmap));
 
-		++(fPtr->numSolidFillRect100);
+	/* Put back contents saved when the VT was left.  While the VT */
+	/* is away this moves the pixmap to system memory. */
+	if ((NULL != fPixmapPtr) && (NULL != fPixmapPtr->snapshot)) {
+		Z160EXARestoreSnapshot(pPixmap->drawable.pScreen, fPixmapPtr);
+	}
 
-	} else if (size < 1000) {
+	/* Lock the offscreen area while the CPU is accessing it */
+	/* so that it cannot be evicted behind its back. */
+	if ((NULL != fPixmapPtr) && (NULL != fPixmapPtr->area)) {
 
-		++(fPtr->numSolidFillRect1000);
+		if (!Z160EXAIsPixmapAreaLocked(fPixmapPtr)) {
+			Z160EXALockPixmapArea(fPixmapPtr);
+		}
+		++(fPixmapPtr->accessCount);
 
-	} else if (size < 10000) {
+		Z160EXAMarkPixmapUsed(pPixmap);
+	}
 
-		++(fPtr->numSolidFillRect10000);
+	/* EXA does not wait for the GPU before calling this, only for */
+	/* the operations on this pixmap need to be complete. */
+	Z160EXAWaitPixmap(pPixmap);
 
-	} else if (size < 100000) {
+	return TRUE;
+}
 
-		++(fPtr->numSolidFillRect100000);
+static inline void
+Z160EXAFinishAccess(PixmapPtr pPixmap, int index)
+{
+	/* Access driver private data structure associated with pixmap. */
+	IMXEXAPixmapPtr fPixmapPtr =
+		(IMXEXAPixmapPtr)(exaGetPixmapDriverPrivate(pPixmap));
 
-	} else {
+	/* Make the offscreen area evictable again after the last access, */
+	/* unless its address was handed out. */
+	if ((NULL != fPixmapPtr) && (NULL != fPixmapPtr->area) &&
+		(0 < fPixmapPtr->accessCount)) {
 
-		++(fPtr->numSolidFillRectLarge);
+		--(fPixmapPtr->accessCount);
+		if (!Z160EXAIsPixmapAreaLocked(fPixmapPtr)) {
+			Z160EXAUnlockPixmapArea(fPixmapPtr);
+		}
 	}
-#endif
+}
 
-#if IMX_EXA_DEBUG_INSTRUMENT_SYNCS
+static inline int
+Z160EXAComputeSystemMemoryPitch(int width, int bitsPerPixel)
+{
+	return ((width * bitsPerPixel + FB_MASK) >> FB_SHIFT) * sizeof(FbBits);
+}
 
-	++(fPtr->numSolidBeforeSync);
+/* Set the pixel pointer of a pixmap, and whether the GPU can access */
+/* it and at which address. */
+static void
+Z160EXASetPixmapPtr(ScreenPtr pScreen, IMXEXAPixmapPtr fPixmapPtr, void* ptr)
+{
+	unsigned long physAddr;
 
-#endif
+	fPixmapPtr->ptr = ptr;
+	fPixmapPtr->canAccel =
+		IMX_EXA_OffscreenPhysAddr(pScreen, ptr, &physAddr);
+	if (fPixmapPtr->canAccel) {
+		fPixmapPtr->gpuAddr = (void*)physAddr;
+	}
 }
 
 static void
-Z160EXADoneSolid(PixmapPtr pPixmap)
+Z160EXARebindPixmap(
+	ScreenPtr pScreen,
+	IMXEXAPixmapPtr fPixmapPtr,
+	void* ptr,
+	int pitchBytes)
 {
-	/* Access screen associated with this pixmap */
-	ScrnInfoPtr pScrn = xf86Screens[pPixmap->drawable.pScreen->myNum];
+	PixmapPtr pPixmap = fPixmapPtr->pPixmap;
 
-	/* Access driver specific data */
-	IMXPtr imxPtr = IMXPTR(pScrn);
-	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+	/* Until ModifyPixmapHeader has been called there is no pixmap */
+	/* header to update, so just update the private data. */
+	if (NULL == pPixmap) {
 
-	/* Finalize any GPU operations if any where used */
-	if (fPtr->gpuOpSetup) {
+		Z160EXASetPixmapPtr(pScreen, fPixmapPtr, ptr);
+		fPixmapPtr->pitchBytes = pitchBytes;
+		return;
+	}
 
-		/* Flush pending operations to the GPU. */
-		z160_flush(fPtr->gpuContext);
+	/* Go through the screen hook so that EXA also picks up the new */
+	/* pixel pointer and pitch; this ends up in ModifyPixmapHeader */
+	/* below which updates canAccel and gpuAddr. */
+	(*pScreen->ModifyPixmapHeader)(pPixmap, 0, 0, 0, 0, pitchBytes, ptr);
+}
 
-		/* Update state. */
-		fPtr->gpuSynced = FALSE;
-		fPtr->gpuOpSetup = FALSE;
+static void
+Z160EXALinkSystemPixmap(IMXEXAPtr fPtr, IMXEXAPixmapPtr fPixmapPtr)
+{
+	fPixmapPtr->sysPrev = NULL;
+	fPixmapPtr->sysNext = fPtr->sysPixmapList;
+	if (NULL != fPtr->sysPixmapList) {
+		fPtr->sysPixmapList->sysPrev = fPixmapPtr;
 	}
+	fPtr->sysPixmapList = fPixmapPtr;
+}
 
-	/* Release graphics context used for software fallback? */
-	if (NULL != fPtr->pGC) {
-
-		FreeScratchGC(fPtr->pGC);
-		fPtr->pGC = NULL;
+static void
+Z160EXAUnlinkSystemPixmap(IMXEXAPtr fPtr, IMXEXAPixmapPtr fPixmapPtr)
+{
+	if (NULL != fPixmapPtr->sysPrev) {
+		fPixmapPtr->sysPrev->sysNext = fPixmapPtr->sysNext;
+	} else if (fPtr->sysPixmapList == fPixmapPtr) {
+		fPtr->sysPixmapList = fPixmapPtr->sysNext;
+	}
 
-		Z160EXAFinishPipelinedAccess(fPtr->pPixmapDst, EXA_PREPARE_DEST);
+	if (NULL != fPixmapPtr->sysNext) {
+		fPixmapPtr->sysNext->sysPrev = fPixmapPtr->sysPrev;
 	}
+
+	fPixmapPtr->sysNext = NULL;
+	fPixmapPtr->sysPrev = NULL;
 }
 
-static Bool
-Z160EXAPrepareCopy(
-	PixmapPtr pPixmapSrc,
-	PixmapPtr pPixmapDst,
-	int xdir,
-	int ydir,
-	int alu,
-	Pixel planemask)
+static void
+Z160EXALinkPixmap(IMXEXAPtr fPtr, IMXEXAPixmapPtr fPixmapPtr)
 {
-	/* Make sure source and target pixmaps are defined. */
-	if ((NULL == pPixmapDst) || (NULL == pPixmapSrc)) {
-		return FALSE;
+	fPixmapPtr->prev = NULL;
+	fPixmapPtr->next = fPtr->pixmapList;
+	if (NULL != fPtr->pixmapList) {
+		fPtr->pixmapList->prev = fPixmapPtr;
 	}
+	fPtr->pixmapList = fPixmapPtr;
+}
 
-	/* Make sure operations can be accelerated on the source and target */
-	/* pixmaps.  As long as rectangles are within z160 size bounds */
-	/* EXA will accelerate copy even if pixmaps are bigger than */
-	/* size bounds.  EXA only does this for copies. */
-	if (!Z160CanAcceleratePixmapRectangles(pPixmapDst) ||
-		!Z160CanAcceleratePixmapRectangles(pPixmapSrc)) {
+static void
+Z160EXAUnlinkPixmap(IMXEXAPtr fPtr, IMXEXAPixmapPtr fPixmapPtr)
+{
+	if (NULL != fPixmapPtr->prev) {
+		fPixmapPtr->prev->next = fPixmapPtr->next;
+	} else if (fPtr->pixmapList == fPixmapPtr) {
+		fPtr->pixmapList = fPixmapPtr->next;
+	}
 
-		return FALSE;
+	if (NULL != fPixmapPtr->next) {
+		fPixmapPtr->next->prev = fPixmapPtr->prev;
 	}
 
-	/* Determine number of pixels in target and source pixmaps. */
-	unsigned pixmapAreaDst = pPixmapDst->drawable.width * pPixmapDst->drawable.height;
-	unsigned pixmapAreaSrc = pPixmapSrc->drawable.width * pPixmapSrc->drawable.height;
+	fPixmapPtr->next = NULL;
+	fPixmapPtr->prev = NULL;
+}
+
+/* Bytes of pixel data in each row of a pixmap, without padding. */
+static inline int
+Z160EXAGetPixmapRowBytes(IMXEXAPixmapPtr fPixmapPtr)
+{
+	return (fPixmapPtr->width * fPixmapPtr->bitsPerPixel + 7) / 8;
+}
 
-	/* Can't accelerate copy unless pixmaps have minimum number of pixels. */
-	if ((pixmapAreaDst < IMX_EXA_MIN_PIXEL_AREA_COPY) || 
-		(pixmapAreaSrc < IMX_EXA_MIN_PIXEL_AREA_COPY)) {
+/* Snapshots are encoded in whole pixels when pixels are whole bytes. */
+static inline int
+Z160EXAGetSnapshotUnit(IMXEXAPixmapPtr fPixmapPtr)
+{
+	switch (fPixmapPtr->bitsPerPixel) {
 
-		return FALSE;
+	case 16:
+		return 2;
+
+	case 32:
+		return 4;
+
+	default:
+		return 1;
 	}
+}
 
-	/* Access the screen associated with this pixmap. */
-	ScrnInfoPtr pScrn = xf86Screens[pPixmapDst->drawable.pScreen->myNum];
+static inline CARD32
+Z160EXAGetSnapshotPixel(const CARD8* p, int unit)
+{
+	switch (unit) {
 
-	/* Access driver specific data */
-	IMXPtr imxPtr = IMXPTR(pScrn);
-	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+	case 2:
+		return *(const CARD16*)p;
 
-	/* Determine the bits-per-pixels for src and dst pixmaps. */
-	int dstPixmapBitsPerPixel = pPixmapDst->drawable.bitsPerPixel;
-	int srcPixmapBitsPerPixel = pPixmapSrc->drawable.bitsPerPixel;
+	case 4:
+		return *(const CARD32*)p;
 
-	/* Cannot perform copy unless these src and dst pixmaps have the same bits-per-pixel. */
-	if (dstPixmapBitsPerPixel != srcPixmapBitsPerPixel) {
-		return FALSE;
+	default:
+		return *p;
 	}
+}
 
-	/* Check the number of entities, and fail if it isn't one. */
-	if (pScrn->numEntities != 1) {
+/* Number of equal pixels at the start of a row, up to maxRun. */
+static int
+Z160EXAGetSnapshotRun(const CARD8* pSrc, int numUnits, int unit, int maxRun)
+{
+	const CARD32 pixel = Z160EXAGetSnapshotPixel(pSrc, unit);
 
-		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
-			"Z160EXAPrepareCopy called with number of screen entities (%d) not 1\n",
-			pScrn->numEntities);
-		return FALSE;
+	if (maxRun > numUnits) {
+		maxRun = numUnits;
 	}
 
-	/* Make sure that the input planemask specifies a solid */
-	if (!EXA_PM_IS_SOLID(&pPixmapDst->drawable, planemask)) {
+	int run = 1;
+	while ((run < maxRun) &&
+		(pixel == Z160EXAGetSnapshotPixel(pSrc + run * unit, unit))) {
 
-#if IMX_EXA_DEBUG_COPY
-		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
-			"Z160EXAPrepareCopy called with planemask=0x%08x which is not solid\n",
-			(unsigned)planemask);
-#endif
-		return FALSE;
+		++run;
 	}
 
-	/* Make sure that only GXcopy is only raster op called for. */
-	if (GXcopy != alu) {
+	return run;
+}
 
-#if IMX_EXA_DEBUG_COPY
-		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
-			"Z160EXAPrepareCopy called with rop=0x%08x which is not GXcopy\n",
-			(unsigned)alu);
-#endif
-		return FALSE;
-	}
+/* Encode one row of a snapshot; returns the end of the encoded data. */
+static CARD8*
+Z160EXAEncodeSnapshotRow(CARD8* pDst, const CARD8* pSrc, int numUnits, int unit)
+{
+	while (0 < numUnits) {
 
-	/* Setup buffer parameters based on target pixmap. */
-	if (!Z160GetPixmapConfig(pPixmapDst, &fPtr->z160BufferDst)) {
-		return FALSE;
-	}
+		int run = Z160EXAGetSnapshotRun(pSrc, numUnits, unit,
+						IMX_EXA_SNAPSHOT_MAX_RUN);
+		CARD16 count;
 
-	/* Setup buffer parameters based on source pixmap. */
-	if (!Z160GetPixmapConfig(pPixmapSrc, &fPtr->z160BufferSrc)) {
-		return FALSE;
-	}
+		if (IMX_EXA_SNAPSHOT_MIN_REPEAT <= run) {
 
-	/* Only 8, 16, and 32-bit pixmaps are supported. */
-	/* Associate a pixel format which is required for configuring */
-	/* the Z160.  It does not matter what format is chosen as long as it */
-	/* is one that matchs the bitsPerPixel. */
-	Z160_FORMAT z160Format;
-	switch (dstPixmapBitsPerPixel) {
-
-		case 8:
-			z160Format = Z160_FORMAT_8;	/* value goes in alpha channel */
-			break;
+			count = IMX_EXA_SNAPSHOT_REPEAT | run;
+			memcpy(pDst, &count, sizeof(count));
+			memcpy(pDst + sizeof(count), pSrc, unit);
+			pDst += sizeof(count) + unit;
 
-		case 16:
-			z160Format = Z160_FORMAT_4444;	/* upper nibble */
-			break;
+		} else {
 
-		case 32:
-			z160Format = Z160_FORMAT_8888;	/* ARGB */
-			break;
+			/* Literal pixels up to the next repeat worth */
+			/* encoding as such. */
+			while ((run < numUnits) &&
+				(run < IMX_EXA_SNAPSHOT_MAX_RUN) &&
+				(IMX_EXA_SNAPSHOT_MIN_REPEAT >
+					Z160EXAGetSnapshotRun(pSrc + run * unit,
+						numUnits - run, unit,
+						IMX_EXA_SNAPSHOT_MIN_REPEAT))) {
 
-		default:
-#if IMX_EXA_DEBUG_COPY
-			xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
-				"Z160EXAPrepareCopy unsupported pixmap bits per pixel %dy\n",
-				dstPixmapBitsPerPixel);
-#endif
-			return FALSE;
-	}
-	fPtr->z160BufferDst.format = fPtr->z160BufferSrc.format = z160Format;
-	fPtr->z160BufferDst.swapRB = fPtr->z160BufferSrc.swapRB = FALSE;
+				++run;
+			}
 
-	/* GPU setup deferred */
-	fPtr->gpuOpSetup = FALSE;
+			count = run;
+			memcpy(pDst, &count, sizeof(count));
+			memcpy(pDst + sizeof(count), pSrc, run * unit);
+			pDst += sizeof(count) + run * unit;
+		}
 
-	/* Remember the parameters passed in */
-	fPtr->pPixmapDst = pPixmapDst;
-	fPtr->pPixmapSrc = pPixmapSrc;
-	fPtr->copyALU = alu;
-	fPtr->copyPlaneMask = planemask;
-	fPtr->copyDirX = xdir;
-	fPtr->copyDirY = ydir;
+		pSrc += run * unit;
+		numUnits -= run;
+	}
 
-	return TRUE;
+	return pDst;
 }
 
-static void
-Z160EXACopy(PixmapPtr pPixmapDst, int srcX, int srcY, int dstX, int dstY, int width, int height)
+/* Decode one row of a snapshot; returns the start of the next row. */
+static const CARD8*
+Z160EXADecodeSnapshotRow(CARD8* pDst, const CARD8* pSrc, int numUnits, int unit)
 {
-	/* Access screen associated with dst pixmap */
-	ScrnInfoPtr pScrn = xf86Screens[pPixmapDst->drawable.pScreen->myNum];
+	while (0 < numUnits) {
 
-	/* Access driver specific data */
-	IMXPtr imxPtr = IMXPTR(pScrn);
-	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+		CARD16 count;
+		memcpy(&count, pSrc, sizeof(count));
+		pSrc += sizeof(count);
 
+		const int run = count & IMX_EXA_SNAPSHOT_MAX_RUN;
 
-	if (!fPtr->gpuOpSetup) {
-		z160_setup_buffer_target(fPtr->gpuContext, &fPtr->z160BufferDst);
-		z160_setup_copy(fPtr->gpuContext, &fPtr->z160BufferSrc,
-					fPtr->copyDirX, fPtr->copyDirY);
+		if (0 != (count & IMX_EXA_SNAPSHOT_REPEAT)) {
 
-		fPtr->gpuOpSetup = TRUE;
-	}
+			int i;
+			switch (unit) {
 
-	z160_copy_rect(fPtr->gpuContext, dstX, dstY, width, height, srcX, srcY);
+			case 2: {
+				CARD16 pixel;
+				memcpy(&pixel, pSrc, sizeof(pixel));
+				for (i = 0; i < run; ++i) {
+					((CARD16*)pDst)[i] = pixel;
+				}
+				break;
+			}
 
-#if IMX_EXA_DEBUG_INSTRUMENT_SIZES
-	const unsigned long size =
-		(unsigned long)(z160DstRect.width) * z160DstRect.height;
+			case 4: {
+				CARD32 pixel;
+				memcpy(&pixel, pSrc, sizeof(pixel));
+				for (i = 0; i < run; ++i) {
+					((CARD32*)pDst)[i] = pixel;
+				}
+				break;
+			}
 
-	if (size < 100) {
+			default:
+				memset(pDst, *pSrc, run);
+				break;
+			}
+			pSrc += unit;
 
-		++(fPtr->numScreenCopyRect100);
+		} else {
 
-	} else if (size < 1000) {
+			memcpy(pDst, pSrc, run * unit);
+			pSrc += run * unit;
+		}
 
-		++(fPtr->numScreenCopyRect1000);
+		pDst += run * unit;
+		numUnits -= run;
+	}
 
-	} else if (size < 10000) {
+	return pSrc;
+}
 
-		++(fPtr->numScreenCopyRect10000);
+/* Compress the contents of an offscreen pixmap into a snapshot. */
+/* Returns FALSE if there is not enough memory for it. */
+static Bool
+Z160EXATakeSnapshot(IMXEXAPtr fPtr, IMXEXAPixmapPtr fPixmapPtr)
+{
+	const int unit = Z160EXAGetSnapshotUnit(fPixmapPtr);
+	const int numUnits = Z160EXAGetPixmapRowBytes(fPixmapPtr) / unit;
 
-	} else if (size < 100000) {
+	/* Each run adds a two byte count, so a row grows by at most two */
+	/* bytes per pixel.  Start out expecting good compression. */
+	const int maxRowSize = numUnits * (unit + 2);
+	int capacity = maxRowSize + numUnits * unit * fPixmapPtr->height / 8;
+	int size = 0;
 
-		++(fPtr->numScreenCopyRect100000);
+	CARD8* snapshot = malloc(capacity);
+	if (NULL == snapshot) {
+		return FALSE;
+	}
 
-	} else {
+	const CARD8* pSrc = (const CARD8*)fPixmapPtr->ptr;
+	int row;
+	for (row = 0; row < fPixmapPtr->height; ++row) {
 
-		++(fPtr->numScreenCopyRectLarge);
+		if (capacity - size < maxRowSize) {
+
+			capacity = 2 * capacity + maxRowSize;
+			CARD8* newSnapshot = realloc(snapshot, capacity);
+			if (NULL == newSnapshot) {
+				free(snapshot);
+				return FALSE;
+			}
+			snapshot = newSnapshot;
+		}
+
+		size = Z160EXAEncodeSnapshotRow(snapshot + size, pSrc,
+						numUnits, unit) - snapshot;
+		pSrc += fPixmapPtr->pitchBytes;
 	}
-#endif
 
-#if IMX_EXA_DEBUG_INSTRUMENT_SYNCS
+	/* Give back what the encoding did not use. */
+	CARD8* newSnapshot = realloc(snapshot, size);
+	if (NULL != newSnapshot) {
+		snapshot = newSnapshot;
+	}
 
-	++(fPtr->numCopyBeforeSync);
+	fPixmapPtr->snapshot = snapshot;
+	fPixmapPtr->snapshotSize = size;
+	++(fPtr->numSnapshots);
+	fPtr->numSnapshotBytes += size;
 
-#endif
+	return TRUE;
+}
 
-#if IMX_EXA_DEBUG_COPY
-	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
-		"Z160EXACopy called with src=(%d-%d,%d-%d) dst=(%d-%d,%d-%d)\n",
-		srcX, srcX+width, srcY, srcY+height, dstX, dstX+width, dstY, dstY+height);
-#endif
+/* Decode the snapshot of a pixmap into pixel memory of the given pitch. */
+static void
+Z160EXADecodeSnapshot(IMXEXAPixmapPtr fPixmapPtr, CARD8* pDst, int pitchBytes)
+{
+	const int unit = Z160EXAGetSnapshotUnit(fPixmapPtr);
+	const int numUnits = Z160EXAGetPixmapRowBytes(fPixmapPtr) / unit;
+	const CARD8* pSrc = (const CARD8*)fPixmapPtr->snapshot;
+
+	int row;
+	for (row = 0; row < fPixmapPtr->height; ++row) {
+
+		pSrc = Z160EXADecodeSnapshotRow(pDst, pSrc, numUnits, unit);
+		pDst += pitchBytes;
+	}
 }
 
 static void
-Z160EXADoneCopy(PixmapPtr pPixmapDst)
+Z160EXAFreeSnapshot(IMXEXAPtr fPtr, IMXEXAPixmapPtr fPixmapPtr)
 {
-	/* Access screen associated with this pixmap */
-	ScrnInfoPtr pScrn = xf86Screens[pPixmapDst->drawable.pScreen->myNum];
+	--(fPtr->numSnapshots);
+	fPtr->numSnapshotBytes -= fPixmapPtr->snapshotSize;
 
-	/* Access driver specific data */
+	free(fPixmapPtr->snapshot);
+	fPixmapPtr->snapshot = NULL;
+	fPixmapPtr->snapshotSize = 0;
+}
+
+/* Move a pixmap whose offscreen memory is being evicted into system */
+/* memory.  The offscreen memory is released by the caller. */
+static void
+Z160EXASavePixmap(ScreenPtr pScreen, IMXEXAPixmapPtr fPixmapPtr)
+{
+	/* Access the driver specific data. */
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
 	IMXPtr imxPtr = IMXPTR(pScrn);
 	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
 
-	/* Finalize any GPU operations if any where used */
-	if (fPtr->gpuOpSetup) {
+	/* The GPU may still be rendering into or out of the area. */
+	Z160WaitSeq(fPtr, fPixmapPtr->gpuSeq);
 
-		/* Flush pending operations to the GPU. */
-		z160_flush(fPtr->gpuContext);
+	/* Compute layout of the system memory copy. */
+	const int sysPitchBytes =
+		Z160EXAComputeSystemMemoryPitch(
+			fPixmapPtr->width, fPixmapPtr->bitsPerPixel);
+	const int sysAllocSize = fPixmapPtr->height * sysPitchBytes;
 
-		/* Update state */
-		fPtr->gpuSynced = FALSE;
-		fPtr->gpuOpSetup = FALSE;
-	}
+	/* Copy the pixmap contents out of the offscreen area, or out of */
+	/* the snapshot taken when the VT was left. */
+	CARD8* sysPtr = xnfalloc(sysAllocSize);
+	if (NULL != fPixmapPtr->snapshot) {
 
-	/* Release graphics context used for software fallback? */
-	if (NULL != fPtr->pGC) {
+		Z160EXADecodeSnapshot(fPixmapPtr, sysPtr, sysPitchBytes);
+		Z160EXAFreeSnapshot(fPtr, fPixmapPtr);
 
-		FreeScratchGC(fPtr->pGC);
-		fPtr->pGC = NULL;
+	} else {
 
-		Z160EXAFinishPipelinedAccess(fPtr->pPixmapDst, EXA_PREPARE_DEST);
-		Z160EXAFinishPipelinedAccess(fPtr->pPixmapSrc, EXA_PREPARE_SRC);
+		CARD8* pSrc = (CARD8*)fPixmapPtr->ptr;
+		CARD8* pDst = sysPtr;
+		int row;
+		for (row = 0; row < fPixmapPtr->height; ++row) {
+
+			memcpy(pDst, pSrc, sysPitchBytes);
+			pSrc += fPixmapPtr->pitchBytes;
+			pDst += sysPitchBytes;
+		}
 	}
+
+	/* Pixmap no longer owns offscreen memory. */
+	fPixmapPtr->area = NULL;
+	fPixmapPtr->subAlloc = FALSE;
+	fPixmapPtr->widthAligned = 0;
+	fPixmapPtr->heightAligned = 0;
+	fPixmapPtr->accessCount = 0;
+
+	/* Pixmap now lives in system memory. */
+	fPixmapPtr->sysAllocSize = sysAllocSize;
+	fPixmapPtr->sysPtr = sysPtr;
+	fPixmapPtr->heat = 0;
+	Z160EXALinkSystemPixmap(fPtr, fPixmapPtr);
+	Z160EXARebindPixmap(pScreen, fPixmapPtr, sysPtr, sysPitchBytes);
 }
 
-static Z160_BLEND Z160SetupBlendOpTable[] = {
-	Z160_BLEND_UNKNOWN,	/* 0 = PictOpMinimum, PictOpClear */
-	Z160_BLEND_SRC,		/* 1 = PictOpSrc */
-	Z160_BLEND_UNKNOWN,	/* 2 = PictOpDst */
-	Z160_BLEND_OVER,	/* 3 = PictOpOver */
-	Z160_BLEND_UNKNOWN,	/* 4 = PictOpOverReverse */
-	Z160_BLEND_IN,		/* 5 = PictOpIn */
-	Z160_BLEND_IN_REVERSE,	/* 6 = PictOpInReverse */
-	Z160_BLEND_UNKNOWN,	/* 7 = PictOpOut */
-	Z160_BLEND_OUT_REVERSE,	/* 8 = PictOpOutReverse */
-	Z160_BLEND_UNKNOWN,	/* 9 = PictOpAtop */
-	Z160_BLEND_UNKNOWN,	/* 10 = PictOpAtopReverse */
-	Z160_BLEND_UNKNOWN,	/* 11 = PictOpXor */
-	Z160_BLEND_ADD,		/* 12 = PictOpAdd */
-	Z160_BLEND_UNKNOWN	/* 13 = PictOpSaturate, PictOpMaximum */
-};
-static int NumZ160SetupBlendOps =
-	sizeof(Z160SetupBlendOpTable) / sizeof(Z160SetupBlendOpTable[0]);
+/* Save callback for offscreen areas allocated for pixmaps.  Called by */
+/* the offscreen allocator when the area is evicted to make room for */
+/* another allocation; the area is freed once this returns. */
+static void
+Z160EXAPixmapSave(ScreenPtr pScreen, ExaOffscreenArea* area)
+{
+	IMXEXAPixmapPtr fPixmapPtr = (IMXEXAPixmapPtr)area->privData;
+	if (NULL == fPixmapPtr) {
+		return;
+	}
 
-#if IMX_EXA_DEBUG_CHECK_COMPOSITE
+	Z160EXASavePixmap(pScreen, fPixmapPtr);
+}
 
-static const char*
-Z160GetPictureTypeName(PicturePtr pPicture)
+/* Save callback for pixmaps packed into a shared offscreen page, */
+/* called for each of them when the page is evicted. */
+static void
+Z160EXASubPixmapSave(ScreenPtr pScreen, pointer privData)
 {
-	switch(PICT_FORMAT_TYPE(pPicture->format)) {
-		case PICT_TYPE_OTHER:	return "other";
-		case PICT_TYPE_A:	return "alpha";
-		case PICT_TYPE_ARGB:	return "argb";
-		case PICT_TYPE_ABGR:	return "abgr";
-		case PICT_TYPE_COLOR:	return "color";
-		case PICT_TYPE_GRAY:	return "gray";
-		case PICT_TYPE_BGRA:	return "bgra";
-		default:		return "???";
+	IMXEXAPixmapPtr fPixmapPtr = (IMXEXAPixmapPtr)privData;
+	if (NULL == fPixmapPtr) {
+		return;
 	}
+
+	Z160EXASavePixmap(pScreen, fPixmapPtr);
 }
 
-#endif
+/* Put back the contents of an offscreen pixmap from the snapshot taken */
+/* when the VT was left.  While the VT is away the frame buffer is not */
+/* ours, so the pixmap moves to system memory instead, from where it */
+/* may be promoted again later. */
+static void
+Z160EXARestoreSnapshot(ScreenPtr pScreen, IMXEXAPixmapPtr fPixmapPtr)
+{
+	/* Access the driver specific data. */
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
 
+	if (pScrn->vtSema) {
 
+		Z160EXADecodeSnapshot(fPixmapPtr, (CARD8*)fPixmapPtr->ptr,
+					fPixmapPtr->pitchBytes);
+		Z160EXAFreeSnapshot(fPtr, fPixmapPtr);
+		++(fPtr->numSnapshotRestores);
 
-/*
- * From /usr/include/xorg/exa.h:
- *
- * Notes on interpreting Picture structures:
- * - The Picture structures will always have a valid pDrawable.
- * - The Picture structures will never have alphaMap set.
- * - The mask Picture (and therefore pMask) may be NULL, in which case the
- *   operation is simply src OP dst instead of src IN mask OP dst, and
- *   mask coordinates should be ignored.
- * - pMarkPicture may have componentAlpha set, which greatly changes
- *   the behavior of the Composite operation.  componentAlpha has no effect
- *   when set on pSrcPicture or pDstPicture.
- * - The source and mask Pictures may have a transformation set
- *   (Picture->transform != NULL), which means that the source coordinates
- *   should be transformed by that transformation, resulting in scaling,
- *   rotation, etc.  The PictureTransformPoint() call can transform
- *   coordinates for you.  Transforms have no effect on Pictures when used
- *   as a destination.
- * - The source and mask pictures may have a filter set.  PictFilterNearest
- *   and PictFilterBilinear are defined in the Render protocol, but others
- *   may be encountered, and must be handled correctly (usually by
- *   PrepareComposite failing, and falling back to software).  Filters have
- *   no effect on Pictures when used as a destination.
- * - The source and mask Pictures may have repeating set, which must be
- *   respected.  Many chipsets will be unable to support repeating on
- *   pixmaps that have a width or height that is not a power of two.
- */
+		if (0 == fPtr->numSnapshots) {
 
-static Bool
-Z160EXACheckComposite(int op, PicturePtr pPictureSrc, PicturePtr pPictureMask, PicturePtr pPictureDst)
-{
-	/* Pictures for src and dst must be defined. */
-	if ((NULL == pPictureSrc) || (NULL == pPictureDst)) {
-		return FALSE;
+			xf86DrvMsgVerb(pScrn->scrnIndex, X_INFO, 3,
+				"All offscreen pixmaps restored %u ms after "
+				"entering VT\n",
+				(unsigned)(GetTimeInMillis() - fPtr->enterVTTime));
+		}
+		return;
 	}
 
-	/* Access the pixmap associated with each picture */
-	PixmapPtr pPixmapDst = Z160EXAGetPicturePixmap(pPictureDst);
-	PixmapPtr pPixmapSrc = Z160EXAGetPicturePixmap(pPictureSrc);
-	PixmapPtr pPixmapMask = Z160EXAGetPicturePixmap(pPictureMask);
+	ExaOffscreenArea* area = fPixmapPtr->area;
+	const Bool subAlloc = fPixmapPtr->subAlloc;
+	const int subOffset = fPixmapPtr->subOffset;
 
-	/* Cannot perform blend if there is no target pixmap. */
-	if (NULL == pPixmapDst) {
-		return FALSE;
+	/* The area is released whatever kept it in place. */
+	if (Z160EXAIsPixmapAreaLocked(fPixmapPtr)) {
+		Z160EXAUnlockPixmapArea(fPixmapPtr);
 	}
+	fPixmapPtr->pinned = FALSE;
 
-	/* Access screen associated with dst pixmap (same screen as for src pixmap). */
-	ScrnInfoPtr pScrn = xf86Screens[pPixmapDst->drawable.pScreen->myNum];
-
-	/* Check the number of entities, and fail if it isn't one. */
-	if (pScrn->numEntities != 1) {
+	Z160EXASavePixmap(pScreen, fPixmapPtr);
 
-		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
-			"Z160EXACheckComposite called with number of screen entities (%d) not 1\n",
-			pScrn->numEntities);
-		return FALSE;
+	if (subAlloc) {
+		IMX_EXA_OffscreenSubFree(pScreen, area, subOffset);
+	} else {
+		IMX_EXA_OffscreenFree(pScreen, area);
 	}
+	++(fPtr->numSnapshotMoves);
+}
 
-	/* Cannot perform blend if there is no source pixmap. */
-	if (NULL == pPixmapSrc) {
-		return FALSE;
-	}
+static unsigned
+Z160EXARecycleHash(int widthAligned, int heightAligned, int bitsPerPixel)
+{
+	const unsigned hash =
+		((unsigned)widthAligned / 32) * 31 +
+		((unsigned)heightAligned / 32) * 7 +
+		(unsigned)bitsPerPixel;
 
-	/* Cannot perform blend unless screens associated with src and dst pictures are same. */
-	if ((pPixmapSrc->drawable.pScreen->myNum !=
-		pPixmapDst->drawable.pScreen->myNum)) {
-		return FALSE;
-	}
+	return hash % IMX_EXA_RECYCLE_NUM_BUCKETS;
+}
 
-	/* Make sure operations can be accelerated on the target pixmap. */
-	if (!Z160CanAcceleratePixmap(pPixmapDst)) {
-		return FALSE;
+/* Take an entry out of the recycle cache and make it unused. */
+/* The area it held is not freed. */
+static void
+Z160EXARecycleRemove(IMXEXAPtr fPtr, IMXEXARecyclePtr entry)
+{
+	/* Unlink from the hash chain. */
+	IMXEXARecyclePtr* pLink =
+		&fPtr->recycleHash[Z160EXARecycleHash(entry->widthAligned,
+			entry->heightAligned, entry->bitsPerPixel)];
+	while (*pLink != entry) {
+		pLink = &(*pLink)->hashNext;
 	}
+	*pLink = entry->hashNext;
 
-	/* Make sure operations can be accelerated on the source pixmap. */
-	if (!Z160CanAcceleratePixmap(pPixmapSrc)) {
-		return FALSE;
+	/* Unlink from the list ordered by when the area was freed. */
+	if (NULL != entry->lruPrev) {
+		entry->lruPrev->lruNext = entry->lruNext;
+	} else {
+		fPtr->recycleNewest = entry->lruNext;
 	}
-
-	/* Make sure operations can be accelerated on the optional mask pixmap. */
-	if ((NULL != pPixmapMask) && !Z160CanAcceleratePixmap(pPixmapMask)) {
-		return FALSE;
+	if (NULL != entry->lruNext) {
+		entry->lruNext->lruPrev = entry->lruPrev;
+	} else {
+		fPtr->recycleOldest = entry->lruPrev;
 	}
 
-	/* Can't accelerate composite unless target pixmap has minimum number of pixels. */
-	unsigned pixmapAreaDst = pPixmapDst->drawable.width * pPixmapDst->drawable.height;
-	if (pixmapAreaDst < IMX_EXA_MIN_PIXEL_AREA_COMPOSITE) {
-		return FALSE;
-	}
+	entry->area = NULL;
+	entry->hashNext = fPtr->recycleFreeList;
+	fPtr->recycleFreeList = entry;
+}
 
-	/* Can't accelerate composite unless pixmap from non-repeating source picture */
-	/* has a minimum number of pixels. */
-	if (! pPictureSrc->repeat) {
+/* Save callback for areas in the recycle cache.  There is nothing to */
+/* save, the allocator evicting the area only drops it from the cache. */
+static void
+Z160EXARecycleSave(ScreenPtr pScreen, ExaOffscreenArea* area)
+{
+	/* Access the driver specific data. */
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
 
-		unsigned pixmapArea = pPixmapSrc->drawable.width * pPixmapSrc->drawable.height;
-		if (pixmapArea < IMX_EXA_MIN_PIXEL_AREA_COMPOSITE) {
-			return FALSE;
-		}
+	IMXEXARecyclePtr entry = (IMXEXARecyclePtr)area->privData;
+	if (NULL == entry) {
+		return;
 	}
 
-	/* Can't accelerate composite unless pixmap from defined non-repeating mask picture */
-	/* has a minimum number of pixels. */
-	if ((NULL != pPictureMask) && !pPictureMask->repeat) {
-
-		unsigned pixmapArea = pPixmapMask->drawable.width * pPixmapMask->drawable.height;
-		if (pixmapArea < IMX_EXA_MIN_PIXEL_AREA_COMPOSITE) {
-			return FALSE;
-		}
-	}
+	Z160EXARecycleRemove(fPtr, entry);
+	++(fPtr->numRecycleDrains);
+}
 
-	/* Reset this variable if cannot support composite. */
-	Bool canComposite = TRUE;
-
-	/* Check if blending operation is supported. */
-	if ((0 > op) || (NumZ160SetupBlendOps <= op) ||
-		(Z160_BLEND_UNKNOWN == Z160SetupBlendOpTable[op])) {
+/* Free the least recently cached areas until at most maxAreas remain. */
+static void
+Z160EXARecycleDrain(ScreenPtr pScreen, int maxAreas)
+{
+	/* Access the driver specific data. */
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
 
-		canComposite = FALSE;
+	int numAreas = 0;
+	IMXEXARecyclePtr entry;
+	for (entry = fPtr->recycleNewest; NULL != entry; entry = entry->lruNext) {
+		++numAreas;
 	}
 
-	/* Determine Z160 config that matches color format used in target picture. */
-	Z160Buffer z160BufferDst;
-	Bool z160BufferDstDefined = Z160GetPictureConfig(pScrn, pPictureDst, &z160BufferDst);
-	if (!z160BufferDstDefined) {
-		canComposite = FALSE;
-	}
+	while (numAreas > maxAreas) {
 
-	/* Determine Z160 config that matches color format used in source picture. */
-	Z160Buffer z160BufferSrc;
-	Bool z160BufferSrcDefined = Z160GetPictureConfig(pScrn, pPictureSrc, &z160BufferSrc);
-	if (!z160BufferSrcDefined) {
-		canComposite = FALSE;
-	}
+		entry = fPtr->recycleOldest;
+		ExaOffscreenArea* area = entry->area;
 
-	/* Determine Z160 config that matches color format used in mask picture. */
-	Z160Buffer z160BufferMask;
-	Bool z160BufferMaskDefined = FALSE;
-	if (NULL != pPictureMask) {
+		Z160EXARecycleRemove(fPtr, entry);
+		IMX_EXA_OffscreenFree(pScreen, area);
 
-		z160BufferMaskDefined = Z160GetPictureConfig(pScrn, pPictureMask, &z160BufferMask);
-		if (!z160BufferMaskDefined) {
-			canComposite = FALSE;
-		}
+		++(fPtr->numRecycleDrains);
+		--numAreas;
 	}
+}
 
-	/* Do not accelerate masks that do not have an alpha channel. */
-	if (z160BufferMaskDefined) {
-		if (0 == PICT_FORMAT_A(pPictureMask->format)) {
-			canComposite = FALSE;
-		}
-	}
+/* Keep the offscreen area of a pixmap being destroyed for reuse. */
+/* The area stays removable, so the allocator still evicts it when */
+/* memory runs short, and is marked as not recently used to make it */
+/* the first choice for eviction.  Areas in pools are only used when */
+/* the main heap is full, so they are freed instead. */
+static void
+Z160EXARecyclePut(ScreenPtr pScreen, IMXEXAPixmapPtr fPixmapPtr)
+{
+	/* Access the driver specific data. */
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
 
-	/* Do not accelerate sources with a transform. */
-	if (NULL != pPictureSrc->transform) {
-		canComposite = FALSE;
+	ExaOffscreenArea* area = fPixmapPtr->area;
+	const int heapKind = IMX_EXA_OffscreenAreaHeapKind(area);
+	if (IMX_EXA_OFFSCREEN_HEAP_POOL == heapKind) {
+		IMX_EXA_OffscreenFree(pScreen, area);
+		return;
 	}
 
-	/* Do not accelerate masks, if defined, that have a transform. */
-	if ((NULL != pPictureMask) && (NULL != pPictureMask->transform)) {
-		canComposite = FALSE;
+	/* Make room by releasing the least recently cached area. */
+	if (NULL == fPtr->recycleFreeList) {
+		Z160EXARecycleDrain(pScreen, IMX_EXA_RECYCLE_MAX_AREAS - 1);
 	}
 
-	/* Do not accelerate when mask, if defined, is repeating. */
-	if ((NULL != pPictureMask) && pPictureMask->repeat) {
-		canComposite = FALSE;
+	IMXEXARecyclePtr entry = fPtr->recycleFreeList;
+	fPtr->recycleFreeList = entry->hashNext;
+
+	entry->area = area;
+	entry->heapKind = heapKind;
+	entry->widthAligned = fPixmapPtr->widthAligned;
+	entry->heightAligned = fPixmapPtr->heightAligned;
+	entry->bitsPerPixel = fPixmapPtr->bitsPerPixel;
+
+	IMXEXARecyclePtr* pBucket =
+		&fPtr->recycleHash[Z160EXARecycleHash(entry->widthAligned,
+			entry->heightAligned, entry->bitsPerPixel)];
+	entry->hashNext = *pBucket;
+	*pBucket = entry;
+
+	entry->lruPrev = NULL;
+	entry->lruNext = fPtr->recycleNewest;
+	if (NULL != fPtr->recycleNewest) {
+		fPtr->recycleNewest->lruPrev = entry;
+	} else {
+		fPtr->recycleOldest = entry;
 	}
+	fPtr->recycleNewest = entry;
 
-#if IMX_EXA_DEBUG_CHECK_COMPOSITE
+	area->state = ExaOffscreenRemovable;
+	area->save = Z160EXARecycleSave;
+	area->privData = entry;
+	area->last_use = 0;
+}
 
-	/* Check whether logging of parameter data when composite is rejected. */
-	if (! canComposite) {
+/* Take a cached offscreen area of exactly the given aligned size for */
+/* a new pixmap, or return NULL if there is none.  Only areas in the */
+/* heap the allocator tries first for the placement of the pixmap are */
+/* taken, so that other pixmaps do not fill the glyph heap. */
+static ExaOffscreenArea*
+Z160EXARecycleGet(
+	ScreenPtr pScreen,
+	IMXEXAPixmapPtr fPixmapPtr,
+	int widthAligned,
+	int heightAligned)
+{
+	/* Access the driver specific data. */
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
 
-		/* Source OP Target */
-		if (NULL == pPictureMask) {
+	const int bitsPerPixel = fPixmapPtr->bitsPerPixel;
 
-			xf86DrvMsg(pScrn->scrnIndex, X_INFO,
-				"Z160EXACheckComposite not support: SRC(%s%dx%d,%s%d%s:%d%d%d%d) op=%d DST(%d%s:%d%d%d%d)\n",
-				pPictureSrc->repeat ? "R" : "",
-				pPictureSrc->pDrawable->width,
-				pPictureSrc->pDrawable->height,
-				(NULL != pPictureSrc->transform) ? "T" : "",
-				PICT_FORMAT_BPP(pPictureSrc->format),
-				Z160GetPictureTypeName(pPictureSrc),
-				PICT_FORMAT_A(pPictureSrc->format),
-				PICT_FORMAT_R(pPictureSrc->format),
-				PICT_FORMAT_G(pPictureSrc->format),
-				PICT_FORMAT_B(pPictureSrc->format),
-				op,
-				PICT_FORMAT_BPP(pPictureDst->format),
-				Z160GetPictureTypeName(pPictureDst),
-				PICT_FORMAT_A(pPictureDst->format),
-				PICT_FORMAT_R(pPictureDst->format),
-				PICT_FORMAT_G(pPictureDst->format),
-				PICT_FORMAT_B(pPictureDst->format));
+	int heapKind = IMX_EXA_OFFSCREEN_HEAP_MAIN;
+	if ((IMX_EXA_OFFSCREEN_GLYPH ==
+			(fPixmapPtr->placement & IMX_EXA_OFFSCREEN_PLACEMENT_MASK)) &&
+		(imxPtr->numOffscreenHeaps > IMX_EXA_OFFSCREEN_HEAP_GLYPH) &&
+		(IMX_EXA_OFFSCREEN_HEAP_GLYPH ==
+			imxPtr->offScreenHeaps[IMX_EXA_OFFSCREEN_HEAP_GLYPH].kind)) {
 
+		heapKind = IMX_EXA_OFFSCREEN_HEAP_GLYPH;
+	}
 
-		/* (Source IN Mask) OP Target */
-		} else {
+	IMXEXARecyclePtr entry =
+		fPtr->recycleHash[Z160EXARecycleHash(widthAligned,
+			heightAligned, bitsPerPixel)];
+	while ((NULL != entry) &&
+		((entry->heapKind != heapKind) ||
+		 (entry->widthAligned != widthAligned) ||
+		 (entry->heightAligned != heightAligned) ||
+		 (entry->bitsPerPixel != bitsPerPixel))) {
 
-			xf86DrvMsg(pScrn->scrnIndex, X_INFO,
-				"Z160EXACheckComposite not support: SRC(%s%dx%d,%s%d%s:%d%d%d%d) MASK(%s%dx%d,%s%d%s:%s%d%d%d%d) op=%d DST(%d%s:%d%d%d%d)\n",
-				pPictureSrc->repeat ? "R" : "",
-				pPictureSrc->pDrawable->width,
-				pPictureSrc->pDrawable->height,
-				(NULL != pPictureSrc->transform) ? "T" : "",
-				PICT_FORMAT_BPP(pPictureSrc->format),
-				Z160GetPictureTypeName(pPictureSrc),
-				PICT_FORMAT_A(pPictureSrc->format),
-				PICT_FORMAT_R(pPictureSrc->format),
-				PICT_FORMAT_G(pPictureSrc->format),
-				PICT_FORMAT_B(pPictureSrc->format),
-				pPictureMask->repeat ? "R" : "",
-				pPictureMask->pDrawable->width,
-				pPictureMask->pDrawable->height,
-				(NULL != pPictureMask->transform) ? "T" : "",
-				PICT_FORMAT_BPP(pPictureMask->format),
-				Z160GetPictureTypeName(pPictureMask),
-				pPictureMask->componentAlpha ? "C" : "",
-				PICT_FORMAT_A(pPictureMask->format),
-				PICT_FORMAT_R(pPictureMask->format),
-				PICT_FORMAT_G(pPictureMask->format),
-				PICT_FORMAT_B(pPictureMask->format),
-				op,
-				PICT_FORMAT_BPP(pPictureDst->format),
-				Z160GetPictureTypeName(pPictureDst),
-				PICT_FORMAT_A(pPictureDst->format),
-				PICT_FORMAT_R(pPictureDst->format),
-				PICT_FORMAT_G(pPictureDst->format),
-				PICT_FORMAT_B(pPictureDst->format));
-		}
+		entry = entry->hashNext;
+	}
 
+	if (NULL == entry) {
+		++(fPtr->numRecycleMisses);
+		return NULL;
 	}
 
-#endif
+	ExaOffscreenArea* area = entry->area;
+	Z160EXARecycleRemove(fPtr, entry);
+	++(fPtr->numRecycleHits);
 
-	return canComposite;
+	area->save = Z160EXAPixmapSave;
+	area->privData = fPixmapPtr;
+	IMX_EXA_OffscreenMarkUsed(pScreen, area);
+
+	return area;
 }
 
+static void Z160EXABeginBatch(IMXEXAPtr fPtr, IMXEXABatchKind kind);
+static void Z160EXAFlushBatch(IMXEXAPtr fPtr);
+static IMXEXABatchRectPtr Z160EXAQueueBatchRect(IMXEXAPtr fPtr);
+
+/* Move callback for offscreen defragmentation.  Copies the contents of */
+/* a pixmap area to the new offset using the GPU and rebinds the pixmap */
+/* there.  The offscreen allocator updates the area afterwards. */
 static Bool
-Z160EXAPrepareComposite(
-	int op,
-	PicturePtr pPictureSrc,
-	PicturePtr pPictureMask,
-	PicturePtr pPictureDst,
-	PixmapPtr pPixmapSrc,
-	PixmapPtr pPixmapMask,
-	PixmapPtr pPixmapDst)
+Z160EXAMovePixmapArea(ScreenPtr pScreen, ExaOffscreenArea* area, int offset)
 {
-	/* Access screen associated with dst pixmap (same screen as for src pixmap). */
-	ScrnInfoPtr pScrn = xf86Screens[pPixmapDst->drawable.pScreen->myNum];
+	/* Only areas allocated for pixmaps can be moved. */
+	if (Z160EXAPixmapSave != area->save) {
+		return FALSE;
+	}
 
-	/* NOTE - many preconditions were already verified in the CheckComposite callback. */
+	IMXEXAPixmapPtr fPixmapPtr = (IMXEXAPixmapPtr)area->privData;
+	if ((NULL == fPixmapPtr) || (NULL == fPixmapPtr->pPixmap)) {
+		return FALSE;
+	}
 
-	/* Determine Z160 config that matches pixel format used in target picture. */
-	Z160Buffer z160BufferDst;
-	if (!Z160GetPictureConfig(pScrn, pPictureDst, &z160BufferDst)) {
+	/* Never move pixmaps being accessed or whose GPU address was */
+	/* handed out; their areas are locked, but be defensive. */
+	if (fPixmapPtr->pinned || (0 < fPixmapPtr->accessCount)) {
 		return FALSE;
 	}
 
-	/* Determine Z160 config that matches pixel format used in source picture. */
-	Z160Buffer z160BufferSrc;
-	if (!Z160GetPictureConfig(pScrn, pPictureSrc, &z160BufferSrc)) {
+	/* The GPU does the copy, so it must be able to access the pixmap. */
+	if (!fPixmapPtr->canAccel) {
 		return FALSE;
 	}
 
-	/* Access driver specific data */
+	/* Pixmap must be within the z160 limits for the copy. */
+	if ((fPixmapPtr->width > Z160_MAX_WIDTH) ||
+		(fPixmapPtr->height > Z160_MAX_HEIGHT) ||
+		(fPixmapPtr->pitchBytes > Z160_MAX_PITCH_BYTES)) {
+
+		return FALSE;
+	}
+
+	/* Associate a pixel format which matches the bitsPerPixel. */
+	Z160_FORMAT z160Format;
+	switch (fPixmapPtr->bitsPerPixel) {
+
+		case 8:
+			z160Format = Z160_FORMAT_8;
+			break;
+
+		case 16:
+			z160Format = Z160_FORMAT_4444;
+			break;
+
+		case 32:
+			z160Format = Z160_FORMAT_8888;
+			break;
+
+		default:
+			return FALSE;
+	}
+
+	/* Access the driver specific data. */
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
 	IMXPtr imxPtr = IMXPTR(pScrn);
 	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
 
-	/* Map the Xrender blend op into the Z160 blend op. */
-	Z160_BLEND z160BlendOp = Z160SetupBlendOpTable[op];
+	void* gpuContext = Z160ContextGet(fPtr);
+	if (NULL == gpuContext) {
+		return FALSE;
+	}
 
-	/* Setup the target buffer */
-	z160_setup_buffer_target(fPtr->gpuContext, &z160BufferDst);
+	/* Source is the current location of the pixmap. */
+	Z160Buffer z160BufferSrc;
+	z160BufferSrc.base = fPixmapPtr->gpuAddr;
+	z160BufferSrc.width = fPixmapPtr->width;
+	z160BufferSrc.height = fPixmapPtr->height;
+	z160BufferSrc.pitch = fPixmapPtr->pitchBytes;
+	z160BufferSrc.bpp = fPixmapPtr->bitsPerPixel;
+	z160BufferSrc.format = z160Format;
+	z160BufferSrc.swapRB = FALSE;
+	z160BufferSrc.opaque = FALSE;
+	z160BufferSrc.alpha4 = FALSE;
+
+	/* Target is the same layout at the new location, which is in */
+	/* the same heap and so also GPU addressable. */
+	CARD8* newPtr = IMX_EXA_OffscreenVirtAddr(area, offset);
+	unsigned long newPhysAddr;
+	if (!IMX_EXA_OffscreenPhysAddr(pScreen, newPtr, &newPhysAddr)) {
+		return FALSE;
+	}
 
-	/* Mask blend? */
-	fPtr->gpuOpSetup = FALSE;
-	if (NULL != pPictureMask) {
-		/* Determine Z160 config that matches pixel format used in mask picture */
-		Z160Buffer z160BufferMask;
-		if (!Z160GetPictureConfig(pScrn, pPictureMask, &z160BufferMask)) {
-			return FALSE;
-		}
+	/* Contents still waiting in a snapshot are not in the area, so */
+	/* there is nothing to copy. */
+	if (NULL != fPixmapPtr->snapshot) {
+		Z160EXARebindPixmap(pScreen, fPixmapPtr, newPtr,
+					fPixmapPtr->pitchBytes);
+		return TRUE;
+	}
 
-		/* Blend repeating source using a mask */
-		if (pPictureSrc->repeat) {
-			/* Source is 1x1 (constant) repeat pattern? */
-			if (Z160IsDrawablePixelOnly(pPictureSrc->pDrawable)) {
+	Z160Buffer z160BufferDst = z160BufferSrc;
+	z160BufferDst.base = (void*)newPhysAddr;
 
-				z160_setup_blend_const_masked(
-					fPtr->gpuContext,
-					z160BlendOp,
-					&z160BufferSrc,
-					&z160BufferMask);
+	/* The copy never overlaps, see IMX_EXA_OffscreenDefragment. */
+	Z160EXABeginBatch(fPtr, IMX_EXA_BATCH_COPY);
+	fPtr->batch->target = z160BufferDst;
+	fPtr->batch->src = z160BufferSrc;
+	fPtr->batch->dirX = 1;
+	fPtr->batch->dirY = 1;
 
-				fPtr->gpuOpSetup = TRUE;
-			/* Source is arbitrary sized repeat pattern? */
-			} else {
+	IMXEXABatchRectPtr pRect = Z160EXAQueueBatchRect(fPtr);
+	pRect->dstX = 0;
+	pRect->dstY = 0;
+	pRect->width = fPixmapPtr->width;
+	pRect->height = fPixmapPtr->height;
+	pRect->srcX = 0;
+	pRect->srcY = 0;
 
-				z160_setup_blend_pattern_masked(
-					fPtr->gpuContext,
- 					z160BlendOp,
- 					&z160BufferSrc,
- 					&z160BufferMask);
+	/* Flush it along with any earlier deferred operations. */
+	fPtr->batch->flush = TRUE;
+	Z160EXAFlushBatch(fPtr);
+	fPixmapPtr->gpuSeq = fPtr->gpuSeq;
 
- 				fPtr->gpuOpSetup = TRUE;
- 			}
+	fPtr->gpuFlushPending = FALSE;
+	fPtr->numUnflushedRects = 0;
 
-		/* Simple (source IN mask) blend */
-		} else {
-			z160_setup_blend_image_masked(
-				fPtr->gpuContext,
-				z160BlendOp,
-				&z160BufferSrc,
-				&z160BufferMask);
+	/* Update state. */
+	fPtr->gpuSynced = FALSE;
+	fPtr->gpuOpSetup = FALSE;
 
-			fPtr->gpuOpSetup = TRUE;
-		}
-	/* Source only (no mask) blend */
-	} else {
-		/* Repeating source (pattern)? */
-		if (pPictureSrc->repeat) {
-			/* Source is 1x1 (constant) repeat pattern? */
-			if (Z160IsDrawablePixelOnly(pPictureSrc->pDrawable)) {
+	/* Pixmap now lives at the new offset. */
+	Z160EXARebindPixmap(pScreen, fPixmapPtr, newPtr, fPixmapPtr->pitchBytes);
 
-				z160_setup_blend_const(
-					fPtr->gpuContext,
-					z160BlendOp,
-					&z160BufferSrc);
+	return TRUE;
+}
 
-				fPtr->gpuOpSetup = TRUE;
-			/* Source is arbitrary sized repeat pattern? */
-			} else {
-				z160_setup_blend_pattern(
-					fPtr->gpuContext,
-					z160BlendOp,
-					&z160BufferSrc);
+/* Move pixmaps in offscreen memory together so that free memory */
+/* coalesces into larger areas.  Called from the block handler, the */
+/* amount of memory moved each time is limited. */
+static void
+Z160EXADefragment(ScreenPtr pScreen)
+{
+	/* Access the driver specific data. */
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
 
-				fPtr->gpuOpSetup = TRUE;
-			}
-		/* Simple source blend */
-		} else {
-			z160_setup_blend_image(fPtr->gpuContext, z160BlendOp, &z160BufferSrc);
-			fPtr->gpuOpSetup = TRUE;
+	/* Is anything worth doing? */
+	if (!fPtr->defragWanted || (NULL == imxPtr->exaDriverPtr)) {
+		return;
+	}
+
+	/* Cached areas of destroyed pixmaps cannot be moved, and memory */
+	/* is short, so release them first. */
+	Z160EXARecycleDrain(pScreen, 0);
+
+	/* Nothing to gain unless free memory of a heap is in more than */
+	/* one piece. */
+	int i;
+	for (i = 0; i < imxPtr->numOffscreenHeaps; ++i) {
+		if (imxPtr->offScreenHeaps[i].numAvailable >= 2) {
+			break;
 		}
 	}
+	if (i == imxPtr->numOffscreenHeaps) {
+		fPtr->defragWanted = FALSE;
+		return;
+	}
 
-	/* Note if the composite operation is being accelerated. */
-	if (fPtr->gpuOpSetup) {
-		return TRUE;
+	const int largestAvailBefore = IMX_EXA_OffscreenLargestAvail(pScreen);
+
+	const int numBytesMoved =
+		IMX_EXA_OffscreenDefragment(pScreen,
+			IMX_EXA_DEFRAG_MAX_BYTES, Z160EXAMovePixmapArea);
+
+	/* Done once there is nothing left to move. */
+	if (0 == numBytesMoved) {
+		fPtr->defragWanted = FALSE;
+		return;
 	}
 
-#if IMX_EXA_DEBUG_CHECK_COMPOSITE
+	/* The memory the pixmaps moved from is free for the CPU to use */
+	/* and EXA does not know about these copies. */
+	Z160Sync(fPtr);
 
-	/* Log info about which operations were not accelerated. */
+	const int largestAvailAfter = IMX_EXA_OffscreenLargestAvail(pScreen);
 
-	/* Source OP Target */
-	if (NULL == pPictureMask) {
+	xf86DrvMsgVerb(pScrn->scrnIndex, X_INFO, 3,
+		"Offscreen defragment moved %dK, largest free area %dK -> %dK\n",
+		numBytesMoved / 1024,
+		largestAvailBefore / 1024,
+		largestAvailAfter / 1024);
 
-		xf86DrvMsg(pScrn->scrnIndex, X_INFO,
-			"Z160EXAPrepareComposite not support: SRC(%s%dx%d,%s%d%s:%d%d%d%d) op=%d DST(%d%s:%d%d%d%d)\n",
-			pPictureSrc->repeat ? "R" : "",
-			pPictureSrc->pDrawable->width,
-			pPictureSrc->pDrawable->height,
-			(NULL != pPictureSrc->transform) ? "T" : "",
-			PICT_FORMAT_BPP(pPictureSrc->format),
-			Z160GetPictureTypeName(pPictureSrc),
-			PICT_FORMAT_A(pPictureSrc->format),
-			PICT_FORMAT_R(pPictureSrc->format),
-			PICT_FORMAT_G(pPictureSrc->format),
-			PICT_FORMAT_B(pPictureSrc->format),
-			op,
-			PICT_FORMAT_BPP(pPictureDst->format),
-			Z160GetPictureTypeName(pPictureDst),
-			PICT_FORMAT_A(pPictureDst->format),
-			PICT_FORMAT_R(pPictureDst->format),
-			PICT_FORMAT_G(pPictureDst->format),
-			PICT_FORMAT_B(pPictureDst->format));
+	/* A system memory pixmap may fit now. */
+	if (NULL != fPtr->sysPixmapList) {
+		fPtr->promoteWanted = TRUE;
+	}
+}
 
+/* Returns TRUE if the pixmap is only kept from being accelerated */
+/* because its memory was allocated from system memory. */
+static Bool
+Z160EXAIsPixmapPromotable(PixmapPtr pPixmap)
+{
+	/* Make sure pixmap is defined. */
+	if (NULL == pPixmap) {
+		return FALSE;
+	}
 
-	/* (Source IN Mask) OP Target */
-	} else {
+	/* Access driver private data structure associated with pixmap. */
+	IMXEXAPixmapPtr fPixmapPtr =
+		(IMXEXAPixmapPtr)(exaGetPixmapDriverPrivate(pPixmap));
+	if (NULL == fPixmapPtr) {
+		return FALSE;
+	}
 
-		xf86DrvMsg(pScrn->scrnIndex, X_INFO,
-			"Z160EXAPrepareComposite not support: SRC(%s%dx%d,%s%d%s:%d%d%d%d) MASK(%s%dx%d,%s%d%s:%s%d%d%d%d) op=%d DST(%d%s:%d%d%d%d)\n",
-			pPictureSrc->repeat ? "R" : "",
-			pPictureSrc->pDrawable->width,
-			pPictureSrc->pDrawable->height,
-			(NULL != pPictureSrc->transform) ? "T" : "",
-			PICT_FORMAT_BPP(pPictureSrc->format),
-			Z160GetPictureTypeName(pPictureSrc),
-			PICT_FORMAT_A(pPictureSrc->format),
-			PICT_FORMAT_R(pPictureSrc->format),
+	/* Pixmaps only read by the CPU gain nothing from being moved. */
+	if (fPixmapPtr->sysOnly) {
+		return FALSE;
+	}
+
+	/* Only pixmaps using the system memory allocated by the driver */
+	/* can be moved; pixel data supplied through ModifyPixmapHeader */
+	/* (e.g. shared memory pixmaps) is owned by someone else. */
+	if ((NULL == fPixmapPtr->sysPtr) ||
+		(fPixmapPtr->ptr != fPixmapPtr->sysPtr)) {
+
+		return FALSE;
+	}
+
+	/* Z160 cannot access pixmaps less than 8 bits per pixel. */
+	if (fPixmapPtr->bitsPerPixel < 8) {
+		return FALSE;
+	}
+
+	/* Pixmap size must be within z160 limits */
+	if ((fPixmapPtr->width > Z160_MAX_WIDTH) ||
+		(fPixmapPtr->height > Z160_MAX_HEIGHT)) {
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Called when an operation on the pixmap was not accelerated only */
+/* because the pixmap is in system memory. */
+static void
+Z160EXAHeatPixmap(PixmapPtr pPixmap)
+{
+	/* Access driver private data structure associated with pixmap. */
+	IMXEXAPixmapPtr fPixmapPtr =
+		(IMXEXAPixmapPtr)(exaGetPixmapDriverPrivate(pPixmap));
+	if (NULL == fPixmapPtr) {
+		return;
+	}
+
+	/* Access the driver specific data. */
+	ScrnInfoPtr pScrn = xf86Screens[pPixmap->drawable.pScreen->myNum];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	if (fPixmapPtr->heat < IMX_EXA_PROMOTE_MAX_HEAT) {
+		++(fPixmapPtr->heat);
+	}
+
+	fPtr->promoteWanted = TRUE;
+}
+
+/* Allocate offscreen memory for a pixmap of the size recorded in its */
+/* private data.  Only free memory the GPU can address is used unless */
+/* canEvict is set. */
+/* Returns the GPU pitch of the allocation, or 0 on failure, and the */
+/* offset of the pixmap in offscreen memory through pOffset. */
+static int
+Z160EXAAllocPixmapArea(
+	ScreenPtr pScreen,
+	IMXEXAPixmapPtr fPixmapPtr,
+	Bool canEvict,
+	int* pOffset)
+{
+	/* Access the driver specific data. */
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	/* The memory may have been released by a pixmap which the GPU */
+	/* is still using, so CPU access must wait as for that pixmap. */
+	fPixmapPtr->gpuSeq = fPtr->gpuFreedSeq;
+
+	/* Only use free memory the GPU can address unless eviction is */
+	/* allowed. */
+	const int placement = canEvict ? fPixmapPtr->placement :
+		(fPixmapPtr->placement | IMX_EXA_OFFSCREEN_NO_EVICT |
+			IMX_EXA_OFFSCREEN_GPU_ONLY);
+
+	/* Small pixmaps are packed into shared pages.  They keep the */
+	/* pitch of a 32 pixel wide pixmap, but only round the height up */
+	/* to a power of two rather than to 32 rows. */
+	if ((fPixmapPtr->width <= 32) &&
+		(fPixmapPtr->height <= IMX_EXA_SUBALLOC_MAX_HEIGHT)) {
+
+		int subHeight = IMX_EXA_SUBALLOC_MIN_HEIGHT;
+		while (subHeight < fPixmapPtr->height) {
+			subHeight *= 2;
+		}
+
+		const int subPitchBytes = 32 * fPixmapPtr->bitsPerPixel / 8;
+		const int subAllocSize = subHeight * subPitchBytes;
+
+		/* Each pixmap in a page must still be offset aligned. */
+		if ((0 == (subAllocSize & (Z160_ALIGN_OFFSET-1))) &&
+			(0 == (subPitchBytes & (Z160_ALIGN_PITCH-1)))) {
+
+			int offset;
+			ExaOffscreenArea* page =
+				IMX_EXA_OffscreenSubAlloc(
+					pScreen,		/* ScreenPtr */
+					subAllocSize,		/* size */
+					placement,		/* placement */
+					Z160EXASubPixmapSave,	/* save */
+					fPixmapPtr,		/* privData */
+					&offset);
+
+			if (NULL != page) {
+
+				fPixmapPtr->widthAligned = 32;
+				fPixmapPtr->heightAligned = subHeight;
+				fPixmapPtr->area = page;
+				fPixmapPtr->subAlloc = TRUE;
+				fPixmapPtr->subOffset = offset;
+
+				*pOffset = offset;
+				return subPitchBytes;
+			}
+		}
+	}
+
+	/* Z160 has 32 pixel width and height alignment. */
+	const int gpuAlignedWidth = IMX_EXA_ALIGN(fPixmapPtr->width, 32);
+	const int gpuAlignedHeight = IMX_EXA_ALIGN(fPixmapPtr->height, 32);
+
+	/* Compute number of pitch bytes for GPU allocated memory. */
+	const int gpuPitchBytes = gpuAlignedWidth * fPixmapPtr->bitsPerPixel / 8;
+
+	/* Compute how much memory to allocate for GPU memory. */
+	const int gpuAllocSize = gpuAlignedHeight * gpuPitchBytes;
+
+	/* Reuse the area of a destroyed pixmap of the same size. */
+	ExaOffscreenArea* area =
+		Z160EXARecycleGet(pScreen, fPixmapPtr,
+			gpuAlignedWidth, gpuAlignedHeight);
+	if (NULL != area) {
+
+		fPixmapPtr->widthAligned = gpuAlignedWidth;
+		fPixmapPtr->heightAligned = gpuAlignedHeight;
+		fPixmapPtr->area = area;
+		fPixmapPtr->subAlloc = FALSE;
+
+		*pOffset = area->offset;
+		return gpuPitchBytes;
+	}
+
+	/* Does the largest free area hold the pixmap, even in the */
+	/* worst case of alignment padding?  The areas kept for reuse */
+	/* are free memory as well, so they are released first, as the */
+	/* allocator only evicts them when eviction is allowed. */
+	if (IMX_EXA_OffscreenLargestAvail(pScreen) <
+		gpuAllocSize + Z160_ALIGN_OFFSET - 1) {
+
+		Z160EXARecycleDrain(pScreen, 0);
+
+		/* Free memory may be too fragmented. */
+		if (IMX_EXA_OffscreenLargestAvail(pScreen) <
+			gpuAllocSize + Z160_ALIGN_OFFSET - 1) {
+
+			fPtr->defragWanted = TRUE;
+		}
+	}
+
+	/* Attemp to allocate from GPU (offscreen) FB memory pool. */
+	/* The area may be evicted later to make room for other */
+	/* pixmaps, in which case its contents are saved to system */
+	/* memory by the save callback. */
+	area =
+		IMX_EXA_OffscreenAllocPlaced(
+			pScreen,		/* ScreenPtr */
+			gpuAllocSize,		/* size */
+			Z160_ALIGN_OFFSET,	/* align */
+			FALSE,			/* locked? */
+			Z160EXAPixmapSave,	/* save */
+			fPixmapPtr,		/* privData */
+			placement);		/* placement */
+
+	if (NULL == area) {
+		return 0;
+	}
+
+	fPixmapPtr->widthAligned = gpuAlignedWidth;
+	fPixmapPtr->heightAligned = gpuAlignedHeight;
+	fPixmapPtr->area = area;
+	fPixmapPtr->subAlloc = FALSE;
+
+	*pOffset = area->offset;
+	return gpuPitchBytes;
+}
+
+/* Move a pixmap from system memory into free offscreen memory. */
+static Bool
+Z160EXAPromotePixmap(ScreenPtr pScreen, IMXEXAPixmapPtr fPixmapPtr)
+{
+	/* Access the driver specific data. */
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	/* Never evict other pixmaps to make room. */
+	int offset;
+	const int gpuPitchBytes =
+		Z160EXAAllocPixmapArea(pScreen, fPixmapPtr, FALSE, &offset);
+	if (0 >= gpuPitchBytes) {
+		return FALSE;
+	}
+
+	/* The area may have just been released by a pixmap which */
+	/* the GPU is still rendering into. */
+	Z160Sync(fPtr);
+
+	/* Copy the pixmap contents into the offscreen area. */
+	CARD8* gpuPtr = IMX_EXA_OffscreenVirtAddr(fPixmapPtr->area, offset);
+	CARD8* pSrc = (CARD8*)fPixmapPtr->sysPtr;
+	CARD8* pDst = gpuPtr;
+	int row;
+	for (row = 0; row < fPixmapPtr->height; ++row) {
+
+		memcpy(pDst, pSrc, fPixmapPtr->pitchBytes);
+		pSrc += fPixmapPtr->pitchBytes;
+		pDst += gpuPitchBytes;
+	}
+
+	/* Pixmap no longer owns system memory. */
+	Z160EXAUnlinkSystemPixmap(fPtr, fPixmapPtr);
+	free(fPixmapPtr->sysPtr);
+	fPixmapPtr->sysPtr = NULL;
+	fPixmapPtr->sysAllocSize = 0;
+	fPixmapPtr->heat = 0;
+
+	/* Pixmap now lives in offscreen memory. */
+	Z160EXARebindPixmap(pScreen, fPixmapPtr, gpuPtr, gpuPitchBytes);
+
+	return TRUE;
+}
+
+/* Move the most used system memory pixmaps into offscreen memory */
+/* that has become free.  Called from the block handler so that */
+/* the pixmaps are not moved in the middle of an operation. */
+static void
+Z160EXAPromotePixmaps(ScreenPtr pScreen)
+{
+	/* Access the driver specific data. */
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	/* Is anything worth doing? */
+	if (!fPtr->promoteWanted || (NULL == imxPtr->exaDriverPtr)) {
+		return;
+	}
+	fPtr->promoteWanted = FALSE;
+
+	/* Select the hottest pixmaps, hottest first, and age the heat */
+	/* of all of them so that only recent use counts. */
+	IMXEXAPixmapPtr hottest[IMX_EXA_PROMOTE_MAX_PIXMAPS];
+	unsigned hottestHeat[IMX_EXA_PROMOTE_MAX_PIXMAPS];
+	int numHottest = 0;
+	IMXEXAPixmapPtr fPixmapPtr;
+	for (fPixmapPtr = fPtr->sysPixmapList; NULL != fPixmapPtr;
+		fPixmapPtr = fPixmapPtr->sysNext) {
+
+		const unsigned heat = fPixmapPtr->heat;
+		fPixmapPtr->heat = heat / 2;
+
+		if (heat < IMX_EXA_PROMOTE_MIN_HEAT) {
+			continue;
+		}
+
+		/* Insertion into the short sorted list of candidates. */
+		int i = numHottest;
+		if (IMX_EXA_PROMOTE_MAX_PIXMAPS == i) {
+			if (heat <= hottestHeat[i-1]) {
+				continue;
+			}
+			--i;
+		} else {
+			++numHottest;
+		}
+		while ((0 < i) && (heat > hottestHeat[i-1])) {
+			hottest[i] = hottest[i-1];
+			hottestHeat[i] = hottestHeat[i-1];
+			--i;
+		}
+		hottest[i] = fPixmapPtr;
+		hottestHeat[i] = heat;
+	}
+
+	/* Promote as many as there is free memory for.  A pixmap that */
+	/* does not fit keeps its heat for the next pass. */
+	int i;
+	for (i = 0; i < numHottest; ++i) {
+
+		if (!Z160EXAPromotePixmap(pScreen, hottest[i])) {
+
+			hottest[i]->heat = hottestHeat[i];
+		}
+	}
+}
+
+/* Usage hint of the glyph atlas pages. */
+#define	IMX_EXA_CREATE_PIXMAP_USAGE_GLYPH_PAGE	0x10000000
+
+/* Scratch pixmaps are short lived and window backing pixmaps long */
+/* lived, so they are placed at opposite ends of offscreen memory. */
+/* Glyph pictures, or the atlas pages they are copied into, have their */
+/* own part of offscreen memory. */
+static int
+Z160EXAGetPixmapPlacement(int usage_hint)
+{
+	switch (usage_hint) {
+
+	case IMX_EXA_CREATE_PIXMAP_USAGE_GLYPH_PAGE:
+		return IMX_EXA_OFFSCREEN_GLYPH;
+
+	case CREATE_PIXMAP_USAGE_SCRATCH:
+		return IMX_EXA_OFFSCREEN_SHORT_LIVED;
+
+	case CREATE_PIXMAP_USAGE_BACKING_PIXMAP:
+		return IMX_EXA_OFFSCREEN_LONG_LIVED;
+
+	case CREATE_PIXMAP_USAGE_GLYPH_PICTURE:
+		return IMX_EXA_OFFSCREEN_GLYPH;
+
+	default:
+		return IMX_EXA_OFFSCREEN_BEST_FIT;
+	}
+}
+
+static void*
+Z160EXACreatePixmap2(ScreenPtr pScreen, int width, int height,
+			int depth, int usage_hint, int bitsPerPixel,
+			int *pPitch)
+{
+	/* Access the driver specific data. */
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	/* Allocate the private data structure to be stored with pixmap. */
+	IMXEXAPixmapPtr fPixmapPtr =
+		(IMXEXAPixmapPtr)IMX_EXA_SlabAlloc(&fPtr->pixmapSlab);
+
+	if (NULL == fPixmapPtr) {
+		return NULL;
+	}
+
+	/* Initialize pixmap properties passed in. */
+	fPixmapPtr->width = width;
+	fPixmapPtr->height = height;
+	fPixmapPtr->depth = depth;
+	fPixmapPtr->bitsPerPixel = bitsPerPixel;
+
+	/* Initialize common properties. */
+	fPixmapPtr->pitchBytes = 0;
+	fPixmapPtr->ptr = NULL;
+	fPixmapPtr->canAccel = FALSE;
+	fPixmapPtr->gpuAddr = NULL;
+
+	/* Initialize properties for GPU frame buffer allocated memory. */
+	fPixmapPtr->widthAligned = 0;
+	fPixmapPtr->heightAligned = 0;
+	fPixmapPtr->area = NULL;
+	fPixmapPtr->subAlloc = FALSE;
+	fPixmapPtr->subOffset = 0;
+	fPixmapPtr->placement = Z160EXAGetPixmapPlacement(usage_hint);
+
+	/* Initialize properties for system allocated memory. */
+	fPixmapPtr->sysAllocSize = 0;
+	fPixmapPtr->sysPtr = NULL;
+
+	/* Pixmap header is not known until ModifyPixmapHeader. */
+	fPixmapPtr->pPixmap = NULL;
+	fPixmapPtr->accessCount = 0;
+	fPixmapPtr->pinned = FALSE;
+	fPixmapPtr->gpuSeq = 0;
+
+	/* Glyph pictures are only read to copy them into the atlas. */
+	fPixmapPtr->sysOnly = IMX_EXA_ENABLE_GLYPH_ATLAS &&
+		(CREATE_PIXMAP_USAGE_GLYPH_PICTURE == usage_hint);
+
+	/* Not in system memory pixmap list until allocated there. */
+	fPixmapPtr->heat = 0;
+	fPixmapPtr->sysNext = NULL;
+	fPixmapPtr->sysPrev = NULL;
+
+	/* No contents saved across a VT switch yet. */
+	fPixmapPtr->snapshot = NULL;
+	fPixmapPtr->snapshotSize = 0;
+
+	/* Nothing more to do if the width or height have no dimensions. */
+	if ((0 == width) || (0 == height)) {
+		Z160EXALinkPixmap(fPtr, fPixmapPtr);
+		*pPitch = 0;
+		return fPixmapPtr;
+	}
+
+	/* First try to allocate pixmap memory from GPU memory but */
+	/* can only when bits per pixel >= 8, and not while the VT */
+	/* is away since the frame buffer is not ours then. */
+	if ((bitsPerPixel >= 8) && pScrn->vtSema && !fPixmapPtr->sysOnly) {
+
+		int offset;
+		const int gpuPitchBytes =
+			Z160EXAAllocPixmapArea(pScreen, fPixmapPtr, TRUE, &offset);
+
+		/* If memory allocated, then assign values to private */
+		/* data structure and return. */
+		if (0 < gpuPitchBytes) {
+
+			fPixmapPtr->pitchBytes = gpuPitchBytes;
+			Z160EXASetPixmapPtr(pScreen, fPixmapPtr,
+				IMX_EXA_OffscreenVirtAddr(fPixmapPtr->area,
+								offset));
+
+			*pPitch = gpuPitchBytes;
+		}
+	}
+
+	/* If we could not allocate pixmap memory from GPU memory, */
+	/* then must try allocating from system memory. */
+	if (NULL == fPixmapPtr->ptr) {
+
+		/* Compute number of pitch bytes for system allocated memory. */
+		/* The number of pitch bytes is passed in as the mis-named */
+		/* "devKind" parameter. */
+		const int sysPitchBytes =
+			Z160EXAComputeSystemMemoryPitch(width, bitsPerPixel);
+
+		/* Compute how much memory to allocate for system memory. */
+		const int sysAllocSize = height * sysPitchBytes;
+
+		/* Attempt to allocate pixmap memory from system memory. */
+		void* sysPtr = xnfalloc(sysAllocSize);
+		
+		/* If memory allocated, then assign values to private */
+		/* data structure and return. */
+		if (NULL != sysPtr) {
+
+			fPixmapPtr->sysAllocSize = sysAllocSize;
+			fPixmapPtr->sysPtr = sysPtr;
+
+			fPixmapPtr->pitchBytes = sysPitchBytes;
+			fPixmapPtr->ptr = sysPtr;
+			fPixmapPtr->canAccel = FALSE;
+
+			/* Candidate for promotion once it gets used. */
+			Z160EXALinkSystemPixmap(fPtr, fPixmapPtr);
+
+			*pPitch = sysPitchBytes;
+		}
+	}
+
+	/* If we got here and still have no pixmap memory, then cleanup */
+	/* and setup to return failure. */
+	if (NULL == fPixmapPtr->ptr) {
+		IMX_EXA_SlabFree(&fPtr->pixmapSlab, fPixmapPtr);
+		return NULL;
+	}
+
+	Z160EXALinkPixmap(fPtr, fPixmapPtr);
+
+	return fPixmapPtr;
+}
+
+static void
+Z160EXADestroyPixmap(ScreenPtr pScreen, void *driverPriv)
+{
+	/* Nothing to do if driver private pointer not defined. */
+	if (NULL == driverPriv) {
+		return;
+	}
+
+	/* Cast pointer to driver private data structure. */
+	IMXEXAPixmapPtr fPixmapPtr = (IMXEXAPixmapPtr)driverPriv;
+
+	/* Access the driver specific data. */
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	/* Contents saved across a VT switch are no longer wanted. */
+	if (NULL != fPixmapPtr->snapshot) {
+		Z160EXAFreeSnapshot(fPtr, fPixmapPtr);
+	}
+	Z160EXAUnlinkPixmap(fPtr, fPixmapPtr);
+
+	/* Whoever gets the memory next must wait for the GPU to finish */
+	/* with this pixmap. */
+	if ((NULL != fPixmapPtr->area) &&
+		((INT32)(fPixmapPtr->gpuSeq - fPtr->gpuFreedSeq) > 0)) {
+
+		fPtr->gpuFreedSeq = fPixmapPtr->gpuSeq;
+	}
+
+	/* Is pixmap packed into a shared offscreen page? */
+	if (fPixmapPtr->subAlloc) {
+
+		/* The page may be shared, so drop the lock of this pixmap. */
+		if (Z160EXAIsPixmapAreaLocked(fPixmapPtr)) {
+			Z160EXAUnlockPixmapArea(fPixmapPtr);
+		}
+
+		IMX_EXA_OffscreenSubFree(pScreen, fPixmapPtr->area,
+						fPixmapPtr->subOffset);
+
+	/* Is pixmap allocated in offscreen frame buffer memory? */
+	} else if (NULL != fPixmapPtr->area) {
+
+		/* Keep the area for a new pixmap of the same size. */
+		Z160EXARecyclePut(pScreen, fPixmapPtr);
+
+		/* The area may now hold a system memory pixmap. */
+		if (NULL != fPtr->sysPixmapList) {
+			fPtr->promoteWanted = TRUE;
+		}
+
+	/* Is pixmap allocated in system memory? */
+	} else if (NULL != fPixmapPtr->sysPtr) {
+
+		Z160EXAUnlinkSystemPixmap(fPtr, fPixmapPtr);
+		free(fPixmapPtr->sysPtr);
+	}
+
+	/* Free the driver private data structure associated with pixmap. */
+	IMX_EXA_SlabFree(&fPtr->pixmapSlab, fPixmapPtr);
+}
+
+static Bool
+Z160EXAModifyPixmapHeader(PixmapPtr pPixmap, int width, int height,
+		int depth, int bitsPerPixel, int devKind, pointer pPixData)
+{
+	/* Make sure the pixmap is defined. */
+	if (NULL == pPixmap) {
+		return FALSE;
+	}
+
+	/* Access driver private data structure associated with pixmap. */
+	IMXEXAPixmapPtr fPixmapPtr =
+		(IMXEXAPixmapPtr)(exaGetPixmapDriverPrivate(pPixmap));
+	if (NULL == fPixmapPtr) {
+		return FALSE;
+	}
+
+	/* Remember the pixmap so its header can be updated if the */
+	/* pixmap memory is moved. */
+	fPixmapPtr->pPixmap = pPixmap;
+
+	/* Access screen associated with this pixmap */
+	ScreenPtr pScreen = pPixmap->drawable.pScreen;
+
+	/* Update the width if specified. */
+	if (0 < width) {
+		fPixmapPtr->width = width;
+	}
+
+	/* Update the height if specified. */
+	if (0 < height) {
+		fPixmapPtr->height = height;
+	}
+
+	/* Update the bits per pixel if specified */
+	if (0 < bitsPerPixel) {
+		fPixmapPtr->bitsPerPixel = bitsPerPixel;
+	}
+
+	/* Update the bits per pixel if specified */
+	if (0 < depth) {
+		fPixmapPtr->depth = depth;
+	}
+
+	/* Update the pointer to pixel data if specified. */
+	if (0 != pPixData) {
+
+		/* The GPU can access frame buffer memory and the */
+		/* offscreen pools it can address. */
+		Z160EXASetPixmapPtr(pScreen, fPixmapPtr, pPixData);
+
+		/* If the pixel buffer changed and the pitch was not */
+		/* specified, then recompute the pitch. */
+		if (0 >= devKind) {
+			devKind =
+				Z160EXAComputeSystemMemoryPitch(
+					fPixmapPtr->width,
+					fPixmapPtr->bitsPerPixel);
+		}
+	}
+
+	/* Update the pitch bytes if specified, or if recomputed. */
+	if (0 < devKind) {
+		fPixmapPtr->pitchBytes = devKind;
+	}
+
+	/* Update the pixmap header with our info. */
+	pPixmap->drawable.width = fPixmapPtr->width;
+	pPixmap->drawable.height = fPixmapPtr->height;
+	pPixmap->drawable.bitsPerPixel = fPixmapPtr->bitsPerPixel;
+	pPixmap->drawable.depth = fPixmapPtr->depth;
+	pPixmap->devPrivate.ptr = fPixmapPtr->ptr;
+	pPixmap->devKind = fPixmapPtr->pitchBytes;
+
+	return TRUE;
+}
+
+static Bool
+Z160EXAPixmapIsOffscreen(PixmapPtr pPixmap)
+{
+	/* Make sure pixmap is defined. */
+	if (NULL == pPixmap) {
+		return FALSE;
+	}
+
+	/* Access driver private data structure associated with pixmap. */
+	IMXEXAPixmapPtr fPixmapPtr =
+		(IMXEXAPixmapPtr)(exaGetPixmapDriverPrivate(pPixmap));
+	if (NULL == fPixmapPtr) {
+		return FALSE;
+	}
+
+	return fPixmapPtr->canAccel;
+}
+
+/* END Functions for driver to handle pixmap allocation and migraion. */
+
+#else
+
+static inline void
+Z160EXAMarkPixmapUsed(PixmapPtr pPixmap)
+{
+	/* Pixmap memory is managed by EXA, so nothing to do. */
+}
+
+static inline void
+Z160EXAFencePixmap(IMXEXAPtr fPtr, PixmapPtr pPixmap)
+{
+	/* Pixmaps have no driver private, WaitMarker waits for the */
+	/* marker EXA passes instead. */
+}
+
+static void
+Z160EXAWaitPixmap(PixmapPtr pPixmap)
+{
+	/* Access the driver specific data. */
+	ScrnInfoPtr pScrn = xf86Screens[pPixmap->drawable.pScreen->myNum];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	/* Nothing is known about which operations use the pixmap. */
+	Z160WaitSeq(fPtr, fPtr->gpuSeq);
+}
+
+static inline Bool
+Z160EXAIsPixmapPromotable(PixmapPtr pPixmap)
+{
+	/* Pixmap migration is handled by EXA. */
+	return FALSE;
+}
+
+static inline void
+Z160EXAHeatPixmap(PixmapPtr pPixmap)
+{
+	/* Pixmap migration is handled by EXA, so nothing to do. */
+}
+
+static inline Bool
+Z160EXAPrepareAccess(PixmapPtr pPixmap, int index)
+{
+	/* Frame buffer memory is not allocated through Z160, so nothing to do. */
+	/* But this callback has to be implemented since the offscreen pixmap test */
+	/* callback has been overridden. */
+
+	return TRUE;
+}
+
+static inline void
+Z160EXAFinishAccess(PixmapPtr pPixmap, int index)
+{
+	/* Nothing to do, but this callback has to be implemented */
+	/* if the prepare access callback is overridden. */
+}
+
+#endif
+
+static unsigned long long
+Z160EXAElapsedNanoseconds(const struct timespec* pStartTime)
+{
+	struct timespec endTime;
+	clock_gettime(CLOCK_MONOTONIC, &endTime);
+
+	return (endTime.tv_sec - pStartTime->tv_sec) * 1000000000LL +
+		(endTime.tv_nsec - pStartTime->tv_nsec);
+}
+
+/* Work out the pixel area above which the GPU is faster than the CPU, */
+/* kept between the fixed minimum and the maximum areas. */
+static void
+Z160EXAUpdateThreshold(IMXEXAThresholdPtr t, IMXEXABatchKind kind)
+{
+	unsigned long long area = IMX_EXA_MAX_PIXEL_AREA;
+	if (t->cpuPixelPs > t->gpuPixelPs) {
+		area = (unsigned long long)(t->gpuSetupNs + t->submitRectNs) * 1000 /
+				(t->cpuPixelPs - t->gpuPixelPs);
+	}
+
+	if (area < Z160MinPixelAreas[kind]) {
+		area = Z160MinPixelAreas[kind];
+	} else if (area > IMX_EXA_MAX_PIXEL_AREA) {
+		area = IMX_EXA_MAX_PIXEL_AREA;
+	}
+
+	t->minPixelArea = area;
+}
+
+/* The threshold of operations of a kind on pixmaps of a depth, or */
+/* NULL for depths without one. */
+static IMXEXAThresholdPtr
+Z160EXAGetThreshold(IMXEXAPtr fPtr, IMXEXABatchKind kind, int bitsPerPixel)
+{
+	int bpp;
+	for (bpp = 0; bpp < IMX_EXA_NUM_BPP; ++bpp) {
+		if (Z160ThresholdBitsPerPixel[bpp] == bitsPerPixel) {
+			return &fPtr->thresholds[kind][bpp];
+		}
+	}
+
+	return NULL;
+}
+
+/* Decide if an operation on pixmaps of this many pixels is worth */
+/* accelerating, and count the refusals.  Acceptance is counted by */
+/* Z160EXAAcceptArea once the operation is prepared. */
+static Bool
+Z160EXAIsAreaAccelerated(IMXEXAPtr fPtr, IMXEXABatchKind kind,
+				int bitsPerPixel, unsigned pixmapArea)
+{
+	IMXEXAThresholdPtr t = Z160EXAGetThreshold(fPtr, kind, bitsPerPixel);
+
+	/* Other depths are refused later on, use the fixed minimum. */
+	if (NULL == t) {
+		return pixmapArea >= Z160MinPixelAreas[kind];
+	}
+
+	if (pixmapArea < t->minPixelArea) {
+		++(t->numRefused);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Count a prepared operation as accepted, and remember its threshold */
+/* for the batch begun next, so that it can be timed.  Operations */
+/* refused after their area was accepted leave no threshold behind to */
+/* be taken for that of another batch. */
+static void
+Z160EXAAcceptArea(IMXEXAPtr fPtr, IMXEXABatchKind kind, int bitsPerPixel)
+{
+	IMXEXAThresholdPtr t = Z160EXAGetThreshold(fPtr, kind, bitsPerPixel);
+
+	fPtr->opThreshold = NULL;
+	if (NULL == t) {
+		return;
+	}
+
+	++(t->numAccepted);
+
+	/* Only calibrated thresholds are refined. */
+	if (0 != t->calibratedPixelArea) {
+		fPtr->opThreshold = t;
+	}
+}
+
+/* Refine the threshold of a timed operation from the time the server */
+/* took to queue each of its rectangles, which calibration did not */
+/* measure.  The calibrated setup time, which includes waiting for the */
+/* GPU, is kept as it is. */
+static void
+Z160EXARefineThreshold(IMXEXAPtr fPtr, IMXEXABatchKind kind)
+{
+	IMXEXAThresholdPtr t = fPtr->timedThreshold;
+	const unsigned long long ns =
+		Z160EXAElapsedNanoseconds(&fPtr->timedStartTime);
+	const unsigned long numRects =
+		fPtr->numQueuedRects - fPtr->timedStartRects;
+
+	fPtr->timedThreshold = NULL;
+	if (0 == numRects) {
+		return;
+	}
+
+	t->submitRectNs = t->submitRectNs -
+				t->submitRectNs / IMX_EXA_REFINE_WEIGHT +
+				ns / numRects / IMX_EXA_REFINE_WEIGHT;
+	++(t->numRefinements);
+
+#if IMX_EXA_DEBUG_THRESHOLDS
+	const unsigned oldPixelArea = t->minPixelArea;
+#endif
+
+	Z160EXAUpdateThreshold(t, kind);
+
+#if IMX_EXA_DEBUG_THRESHOLDS
+	if (t->minPixelArea != oldPixelArea) {
+		xf86DrvMsg(fPtr->scrnIndex, X_INFO,
+			"Accelerating %s from %u pixels, was %u, setup %luns + %luns/rect\n",
+			Z160BatchKindNames[kind], t->minPixelArea,
+			oldPixelArea, t->gpuSetupNs, t->submitRectNs);
+	}
+#endif
+}
+
+/* Time an operation of one kind on a size by size rectangle on the */
+/* GPU, waiting for it to complete, keeping the fastest of a few runs. */
+static unsigned long
+Z160EXACalibrateGpu(IMXEXAPtr fPtr, IMXEXABatchPtr batch, int size)
+{
+	IMXEXABatchRectPtr pRect = &batch->rects[0];
+	pRect->dstX = 0;
+	pRect->dstY = 0;
+	pRect->width = size;
+	pRect->height = size;
+	pRect->srcX = 0;
+	pRect->srcY = 0;
+	pRect->maskX = 0;
+	pRect->maskY = 0;
+
+	unsigned long long best = ~0ULL;
+	int i;
+	for (i = 0; i < IMX_EXA_CALIBRATE_RUNS; ++i) {
+
+		struct timespec startTime;
+		clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+		batch->setup = TRUE;
+		batch->flush = TRUE;
+		batch->sync = TRUE;
+		batch->numRects = 1;
+
+		/* Time the setup along with the rest. */
+		fPtr->gpuState.targetValid = FALSE;
+		fPtr->gpuState.setupValid = FALSE;
+		Z160EXARunBatch(fPtr, batch);
+
+		const unsigned long long ns =
+			Z160EXAElapsedNanoseconds(&startTime);
+		if (ns < best) {
+			best = ns;
+		}
+	}
+
+	return best;
+}
+
+/* Time the same operation done by the CPU, as pixman would fill with */
+/* memset, copy with memcpy and blend each byte against the source. */
+static unsigned long
+Z160EXACalibrateCpu(IMXEXABatchKind kind, CARD8* dst, CARD8* src,
+			int pitch, int size, int bytesPerPixel)
+{
+	const int numBytes = size * bytesPerPixel;
+
+	unsigned long long best = ~0ULL;
+	int i, y, x;
+	for (i = 0; i < IMX_EXA_CALIBRATE_RUNS; ++i) {
+
+		struct timespec startTime;
+		clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+		for (y = 0; y < size; ++y) {
+
+			CARD8* pDst = dst + y * pitch;
+			CARD8* pSrc = src + y * pitch;
+
+			switch (kind) {
+
+				case IMX_EXA_BATCH_SOLID:
+					memset(pDst, 0x5A, numBytes);
+					break;
+
+				case IMX_EXA_BATCH_COPY:
+					memcpy(pDst, pSrc, numBytes);
+					break;
+
+				case IMX_EXA_BATCH_COMPOSITE:
+					for (x = 0; x < numBytes; ++x) {
+						pDst[x] = pSrc[x] +
+							((pDst[x] * (255 - pSrc[x]) + 128) >> 8);
+					}
+					break;
+
+				default:
+					break;
+			}
+		}
+
+		const unsigned long long ns =
+			Z160EXAElapsedNanoseconds(&startTime);
+		if (ns < best) {
+			best = ns;
+		}
+	}
+
+	return best;
+}
+
+/* Measure the GPU and CPU costs of each kind of operation at each */
+/* number of bits per pixel, and set the thresholds from them.  Uses */
+/* the start of offscreen memory, which no pixmap uses yet. */
+static void
+Z160EXACalibrate(ScreenPtr pScreen)
+{
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+	ExaDriverPtr exaDriverPtr = imxPtr->exaDriverPtr;
+
+	/* Target and source buffers for the largest pixels. */
+	const int size = IMX_EXA_CALIBRATE_LARGE_SIZE;
+	const int pitch = size * 4;
+	const unsigned long offset =
+		IMX_EXA_ALIGN(exaDriverPtr->offScreenBase, Z160_ALIGN_OFFSET);
+	if (offset + 2 * pitch * size > exaDriverPtr->memorySize) {
+
+		xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+			"Not enough offscreen memory to calibrate acceleration\n");
+		return;
+	}
+	CARD8* dst = (CARD8*)exaDriverPtr->memoryBase + offset;
+	CARD8* src = dst + pitch * size;
+
+	void* gpuContext = Z160ContextGet(fPtr);
+	if (NULL == gpuContext) {
+		return;
+	}
+
+	IMXEXABatchPtr batch = calloc(1, sizeof(IMXEXABatchRec));
+	if (NULL == batch) {
+		return;
+	}
+
+	Z160Buffer z160Buffer;
+	z160Buffer.base = (void*)(pScrn->memPhysBase + offset);
+	z160Buffer.width = size;
+	z160Buffer.height = size;
+	z160Buffer.pitch = pitch;
+	z160Buffer.swapRB = FALSE;
+	z160Buffer.opaque = FALSE;
+	z160Buffer.alpha4 = FALSE;
+
+	const unsigned long smallArea =
+		IMX_EXA_CALIBRATE_SMALL_SIZE * IMX_EXA_CALIBRATE_SMALL_SIZE;
+	const unsigned long largeArea = size * size;
+
+	IMXEXABatchKind kind;
+	int bpp;
+	for (kind = 0; kind < IMX_EXA_BATCH_NUM_KINDS; ++kind) {
+		for (bpp = 0; bpp < IMX_EXA_NUM_BPP; ++bpp) {
+
+			const int bitsPerPixel = Z160ThresholdBitsPerPixel[bpp];
+
+			/* Same formats as Prepare{Solid,Copy}, and typical */
+			/* picture formats for composite. */
+			z160Buffer.bpp = bitsPerPixel;
+			switch (bitsPerPixel) {
+				case 8:
+					z160Buffer.format =
+						(IMX_EXA_BATCH_COMPOSITE == kind) ?
+							Z160_FORMAT_A8 : Z160_FORMAT_8;
+					break;
+				case 16:
+					z160Buffer.format =
+						(IMX_EXA_BATCH_COMPOSITE == kind) ?
+							Z160_FORMAT_0565 : Z160_FORMAT_4444;
+					break;
+				default:
+					z160Buffer.format = Z160_FORMAT_8888;
+					break;
+			}
+
+			batch->kind = kind;
+			batch->target = z160Buffer;
+			batch->src = z160Buffer;
+			batch->src.base = (CARD8*)z160Buffer.base + pitch * size;
+			batch->color = 0xFF808080;
+			batch->dirX = 1;
+			batch->dirY = 1;
+			batch->blend = IMX_EXA_BLEND_IMAGE;
+			batch->blendOp = Z160_BLEND_OVER;
+
+			const unsigned long smallNs = Z160EXACalibrateGpu(fPtr,
+				batch, IMX_EXA_CALIBRATE_SMALL_SIZE);
+			const unsigned long largeNs = Z160EXACalibrateGpu(fPtr,
+				batch, size);
+			const unsigned long cpuNs = Z160EXACalibrateCpu(kind,
+				dst, src, pitch, size, bitsPerPixel / 8);
+
+			IMXEXAThresholdPtr t = &fPtr->thresholds[kind][bpp];
+			t->gpuPixelPs = (largeNs > smallNs) ?
+				(largeNs - smallNs) * 1000ULL / (largeArea - smallArea) : 0;
+			const unsigned long smallPixelNs =
+				t->gpuPixelPs * smallArea / 1000;
+			t->gpuSetupNs = (smallNs > smallPixelNs) ?
+				smallNs - smallPixelNs : 0;
+			t->cpuPixelPs = cpuNs * 1000ULL / largeArea;
+
+			Z160EXAUpdateThreshold(t, kind);
+			t->calibratedPixelArea = t->minPixelArea;
+
+			xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+				"Accelerating %s at %d bpp from %u pixels "
+				"(GPU %luns + %lups/pixel, CPU %lups/pixel)\n",
+				Z160BatchKindNames[kind], bitsPerPixel,
+				t->minPixelArea, t->gpuSetupNs, t->gpuPixelPs,
+				t->cpuPixelPs);
+		}
+	}
+
+	free(batch);
+}
+
+static void
+Z160EXABeginBatch(IMXEXAPtr fPtr, IMXEXABatchKind kind)
+{
+	IMXEXABatchPtr batch = fPtr->batch;
+
+	/* The setup is done when the first rectangles are submitted. */
+	batch->kind = kind;
+	batch->setup = TRUE;
+	batch->numRects = 0;
+
+	/* Each operation gets the next sequence number. */
+	++(fPtr->gpuSeq);
+	fPtr->compositePlan = NULL;
+	fPtr->compositeGradient = NULL;
+
+	/* Time one in so many operations to refine their threshold. */
+	fPtr->timedThreshold = NULL;
+	if ((NULL != fPtr->opThreshold) &&
+		(++(fPtr->numUntimedOps) >= IMX_EXA_REFINE_INTERVAL)) {
+
+		fPtr->numUntimedOps = 0;
+		fPtr->timedThreshold = fPtr->opThreshold;
+		fPtr->timedStartRects = fPtr->numQueuedRects;
+		clock_gettime(CLOCK_MONOTONIC, &fPtr->timedStartTime);
+	}
+	fPtr->opThreshold = NULL;
+
+#if IMX_EXA_DEBUG_INSTRUMENT_BATCHES
+	clock_gettime(CLOCK_MONOTONIC, &fPtr->batchStartTime);
+#endif
+}
+
+static Z160Buffer*
+Z160EXAGetPassPicture(IMXEXAPtr fPtr, IMXEXAPassPicture picture)
+{
+	switch (picture) {
+
+		case IMX_EXA_PASS_TARGET:
+			return &fPtr->planTarget;
+
+		case IMX_EXA_PASS_SCRATCH:
+			return &fPtr->planScratch;
+
+		default:
+			return &fPtr->planSrc;
+	}
+}
+
+/* Draw the queued rectangles of a composite done in several passes, */
+/* submitting one batch with its own setup for each pass. */
+static void
+Z160EXARunCompositePlan(IMXEXAPtr fPtr)
+{
+	const IMXEXACompositePlanRec* plan = fPtr->compositePlan;
+	const int numRects = fPtr->batch->numRects;
+	int pass, i;
+
+	memcpy(fPtr->planRects, fPtr->batch->rects,
+		numRects * sizeof(IMXEXABatchRectRec));
+
+	for (pass = 0; pass < plan->numPasses; ++pass) {
+
+		const IMXEXACompositePassRec* pPass = &plan->passes[pass];
+		IMXEXABatchPtr batch = fPtr->batch;
+
+		batch->setup = TRUE;
+		batch->target = *Z160EXAGetPassPicture(fPtr, pPass->dst);
+
+		if (Z160_BLEND_UNKNOWN == pPass->blendOp) {
+
+			batch->kind = IMX_EXA_BATCH_SOLID;
+			batch->color = 0;
+
+		} else if (IMX_EXA_PASS_SOURCE == pPass->src) {
+
+			batch->kind = IMX_EXA_BATCH_COMPOSITE;
+			batch->blend = fPtr->planBlend;
+			batch->blendOp = pPass->blendOp;
+			batch->src = fPtr->planSrc;
+			batch->mask = fPtr->planMask;
+
+		} else {
+
+			batch->kind = IMX_EXA_BATCH_COMPOSITE;
+			batch->blend = IMX_EXA_BLEND_IMAGE;
+			batch->blendOp = pPass->blendOp;
+			batch->src = *Z160EXAGetPassPicture(fPtr, pPass->src);
+		}
+
+		/* The target and scratch pixmap are read where they are */
+		/* drawn. */
+		for (i = 0; i < numRects; ++i) {
+
+			IMXEXABatchRectPtr pRect = &batch->rects[i];
+			*pRect = fPtr->planRects[i];
+			if (IMX_EXA_PASS_SOURCE != pPass->src) {
+				pRect->srcX = pRect->dstX;
+				pRect->srcY = pRect->dstY;
+			}
+		}
+		batch->numRects = numRects;
+
+		Z160SubmitBatch(fPtr);
+	}
+
+	/* Rectangles queued next start with the first pass again. */
+	fPtr->batch->kind = IMX_EXA_BATCH_COMPOSITE;
+	fPtr->batch->numRects = 0;
+}
+
+/* Submit the queued rectangles, doing the setup of the operation */
+/* first if they are the first ones submitted for it. */
+static void
+Z160EXAFlushBatch(IMXEXAPtr fPtr)
+{
+	IMXEXABatchPtr batch = fPtr->batch;
+
+	if (0 == batch->numRects) {
+		return;
+	}
+
+#if IMX_EXA_DEBUG_INSTRUMENT_BATCHES
+	fPtr->numBatchedRects[batch->kind] += batch->numRects;
+	++(fPtr->numBatchSubmits[batch->kind]);
+#endif
+
+	if (NULL != fPtr->compositePlan) {
+		Z160EXARunCompositePlan(fPtr);
+		return;
+	}
+
+	Z160SubmitBatch(fPtr);
+}
+
+/* Queue one rectangle, submitting the queue first if it is full. */
+static IMXEXABatchRectPtr
+Z160EXAQueueBatchRect(IMXEXAPtr fPtr)
+{
+	IMXEXABatchPtr batch = fPtr->batch;
+
+	if (IMX_EXA_BATCH_MAX_RECTS == batch->numRects) {
+		Z160EXAFlushBatch(fPtr);
+		batch = fPtr->batch;
+	}
+
+	++(fPtr->numQueuedRects);
+	return &batch->rects[(batch->numRects)++];
+}
+
+/* Submit whatever is still queued.  The flush to the GPU is left to */
+/* the block handler so that the operations of one X request, and of */
+/* all requests handled before the server goes idle, are flushed */
+/* together, unless too much has gone unflushed already. */
+static void
+Z160EXAEndBatch(IMXEXAPtr fPtr)
+{
+	const int numRects = fPtr->batch->numRects;
+
+	/* Hold a fill back, in case the next operation draws over it. */
+	if ((IMX_EXA_BATCH_SOLID == fPtr->batch->kind) && (0 < numRects) &&
+		Z160EXACanHoldBatch(fPtr)) {
+
+		Z160EXAReleaseHeld(fPtr);
+#if IMX_EXA_DEBUG_INSTRUMENT_BATCHES
+		fPtr->numBatchedRects[IMX_EXA_BATCH_SOLID] += numRects;
+		++(fPtr->numBatchSubmits[IMX_EXA_BATCH_SOLID]);
+#endif
+		Z160EXAHoldBatch(fPtr);
+	} else {
+		Z160EXAFlushBatch(fPtr);
+	}
+
+	/* Finalize any GPU operations if any where used */
+	if (fPtr->gpuOpSetup) {
+
+		if (!fPtr->gpuFlushPending) {
+			fPtr->gpuFlushPending = TRUE;
+			fPtr->unflushedTime = GetTimeInMillis();
+		}
+		fPtr->numUnflushedRects += numRects;
+
+		if ((fPtr->numUnflushedRects >= IMX_EXA_FLUSH_MAX_RECTS) ||
+			(GetTimeInMillis() - fPtr->unflushedTime >=
+				IMX_EXA_FLUSH_MAX_DELAY)) {
+
+			Z160FlushPending(fPtr);
+			++(fPtr->numLimitFlushes);
+		}
+
+		/* Update state. */
+		fPtr->gpuSynced = FALSE;
+		fPtr->gpuOpSetup = FALSE;
+	}
+
+	if (NULL != fPtr->timedThreshold) {
+		Z160EXARefineThreshold(fPtr, fPtr->batch->kind);
+	}
+
+#if IMX_EXA_DEBUG_INSTRUMENT_BATCHES
+	fPtr->batchNanoseconds[fPtr->batch->kind] +=
+		Z160EXAElapsedNanoseconds(&fPtr->batchStartTime);
+#endif
+}
+
+static Bool
+Z160EXAPrepareSolid(PixmapPtr pPixmap, int alu, Pixel planemask, Pixel fg)
+{
+	/* Make sure pixmap is defined. */
+	if (NULL == pPixmap) {
+		return FALSE;
+	}
+
+	/* Make sure operations can be accelerated on this pixmap.  A */
+	/* pixmap only held back by being in system memory goes through */
+	/* the remaining checks so that it can be considered for promotion. */
+	Bool inSystemMemory = FALSE;
+	if (!Z160CanAcceleratePixmap(pPixmap)) {
+		if (!Z160EXAIsPixmapPromotable(pPixmap)) {
+			return FALSE;
+		}
+		inSystemMemory = TRUE;
+	}
+
+	/* Access screen associated with this pixmap */
+	ScrnInfoPtr pScrn = xf86Screens[pPixmap->drawable.pScreen->myNum];
+
+	/* Access driver specific data */
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	/* Determine number of pixels in target pixmap. */
+	unsigned pixmapArea = pPixmap->drawable.width * pPixmap->drawable.height;
+
+	/* Can't accelerate solid fill unless pixmap has enough pixels */
+	/* for the GPU to be faster. */
+	if (!Z160EXAIsAreaAccelerated(fPtr, IMX_EXA_BATCH_SOLID,
+			pPixmap->drawable.bitsPerPixel, pixmapArea)) {
+		return FALSE;
+	}
+
+	/* Check the number of entities, and fail if it isn't one. */
+	if (pScrn->numEntities != 1) {
+
+		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+			"Z160EXAPrepareSolid called with number of screen entities (%d) not 1\n",
+			pScrn->numEntities);
+		return FALSE;
+	}
+
+	/* Make sure that the input planemask specifies a solid */
+	if (!EXA_PM_IS_SOLID(&pPixmap->drawable, planemask)) {
+
+#if DEBUG_PREPARE_SOLID
+		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+			"Z160EXAPrepareSolid called with planemask=0x%08x which is not solid\n",
+			(unsigned)planemask);
+#endif
+		return FALSE;
+	}
+
+	/* Make sure that only GXcopy is only raster op called for. */
+	if (GXcopy != alu) {
+
+#if DEBUG_PREPARE_SOLID
+		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+			"Z160EXAPrepareSolid called with rop=0x%08x which is not GXcopy\n",
+			(unsigned)alu);
+#endif
+		return FALSE;
+	}
+
+	/* Would have been accelerated if the pixmap were in GPU memory? */
+	if (inSystemMemory) {
+		if (Z160EXAIsBitsPerPixelSupported(pPixmap->drawable.bitsPerPixel)) {
+			Z160EXAHeatPixmap(pPixmap);
+		}
+		return FALSE;
+	}
+
+	/* Only 8, 16, and 32-bit pixmaps are supported. */
+	/* Associate a pixel format which is required for configuring */
+	/* the Z160.  It does not matter what format is chosen as long as it */
+	/* is one that matchs the bitsPerPixel.  The format of the input */
+	/* foreground color matches the format of the target pixmap, but */
+	/* we will shift the bits around to match the chosen format. */
+	if (!Z160GetPixmapConfig(pPixmap, &fPtr->z160BufferDst)) {
+		return FALSE;
+	}
+	switch (pPixmap->drawable.bitsPerPixel) {
+
+	case 8:
+		fPtr->z160BufferDst.format = Z160_FORMAT_8;	/* value goes in blue channel */
+		fPtr->z160BufferDst.swapRB = FALSE;
+		fPtr->z160Color = fg & 0x000000FF;
+		break;
+
+	case 16:
+		fPtr->z160BufferDst.format = Z160_FORMAT_4444;	/* upper nibble */
+		fPtr->z160BufferDst.swapRB = FALSE;
+		fPtr->z160Color =	((fg & 0x0000F000) << 16) |
+					((fg & 0x00000F00) << 12) |
+					((fg & 0x000000F0) <<  8) |
+					((fg & 0x0000000F) <<  4);
+		break;
+
+	case 32:
+		fPtr->z160BufferDst.format = Z160_FORMAT_8888;	/* ARGB */
+		fPtr->z160BufferDst.swapRB = FALSE;
+		fPtr->z160Color = fg;
+		break;
+
+	default:
+#if DEBUG_PREPARE_SOLID
+		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+			"Z160EXAPrepareSolid called with unsupported pixmap bitsPerPixel=%d\n",
+			pPixmap>bitsPerPixel);
+#endif
+		return FALSE;
+	}
+
+	/* GPU setup deferred */
+	fPtr->gpuOpSetup = FALSE;
+
+	/* Remember the parameters passed in */
+	fPtr->pPixmapDst = pPixmap;
+	fPtr->solidALU = alu;
+	fPtr->solidPlaneMask = planemask;
+	fPtr->solidColor = fg;
+
+	Z160EXAAcceptArea(fPtr, IMX_EXA_BATCH_SOLID,
+		pPixmap->drawable.bitsPerPixel);
+	Z160EXABeginBatch(fPtr, IMX_EXA_BATCH_SOLID);
+	fPtr->batch->target = fPtr->z160BufferDst;
+	fPtr->batch->color = fPtr->z160Color;
+	Z160EXAJoinHeldFill(fPtr);
+
+	Z160EXAMarkPixmapUsed(pPixmap);
+	Z160EXAFencePixmap(fPtr, pPixmap);
+
+	return TRUE;
+}
+
+static void
+Z160EXASolid(PixmapPtr pPixmap, int x1, int y1, int x2, int y2)
+{
+	/* Access screen associated with this pixmap */
+	ScrnInfoPtr pScrn = xf86Screens[pPixmap->drawable.pScreen->myNum];
+
+	/* Access driver specific data */
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	/* Nothing to unless rectangle has area. */
+	if ((x1 >= x2) || (y1 >= y2)) {
+		return;
+	}
+
+	/* Compute the width and height of the rectangle to fill. */
+	int width = x2 - x1;
+	int height = y2 - y1;
+
+	IMXEXABatchRectPtr pRect = Z160EXAQueueBatchRect(fPtr);
+	pRect->dstX = x1;
+	pRect->dstY = y1;
+	pRect->width = width;
+	pRect->height = height;
+
+#if IMX_EXA_DEBUG_SOLID
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		"Z160EXASolid called with rect=(%d-%d,%d-%d)\n",
+		x1, x2, y1, y2);
+#endif
+
+#if IMX_EXA_DEBUG_INSTRUMENT_SIZES
+	const unsigned long size =
+		(unsigned long)width * height;
+
+	if (size < 100) {
+
+		++(fPtr->numSolidFillRect100);
+
+	} else if (size < 1000) {
+
+		++(fPtr->numSolidFillRect1000);
+
+	} else if (size < 10000) {
+
+		++(fPtr->numSolidFillRect10000);
+
+	} else if (size < 100000) {
+
+		++(fPtr->numSolidFillRect100000);
+
+	} else {
+
+		++(fPtr->numSolidFillRectLarge);
+	}
+#endif
+
+#if IMX_EXA_DEBUG_INSTRUMENT_SYNCS
+
+	++(fPtr->numSolidBeforeSync);
+
+#endif
+}
+
+static void
+Z160EXADoneSolid(PixmapPtr pPixmap)
+{
+	/* Access screen associated with this pixmap */
+	ScrnInfoPtr pScrn = xf86Screens[pPixmap->drawable.pScreen->myNum];
+
+	/* Access driver specific data */
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	/* Submit queued rectangles.  The flush to the GPU is deferred to */
+	/* the block handler, or to when too much has gone unflushed. */
+	Z160EXAEndBatch(fPtr);
+
+	/* Release graphics context used for software fallback? */
+	if (NULL != fPtr->pGC) {
+
+		FreeScratchGC(fPtr->pGC);
+		fPtr->pGC = NULL;
+
+		Z160EXAFinishPipelinedAccess(fPtr->pPixmapDst, EXA_PREPARE_DEST);
+	}
+}
+
+static Bool
+Z160EXAPrepareCopy(
+	PixmapPtr pPixmapSrc,
+	PixmapPtr pPixmapDst,
+	int xdir,
+	int ydir,
+	int alu,
+	Pixel planemask)
+{
+	/* Make sure source and target pixmaps are defined. */
+	if ((NULL == pPixmapDst) || (NULL == pPixmapSrc)) {
+		return FALSE;
+	}
+
+	/* Make sure operations can be accelerated on the source and target */
+	/* pixmaps.  As long as rectangles are within z160 size bounds */
+	/* EXA will accelerate copy even if pixmaps are bigger than */
+	/* size bounds.  EXA only does this for copies. */
+	/* Pixmaps only held back by being in system memory go through */
+	/* the remaining checks so they can be considered for promotion. */
+	Bool dstInSystemMemory = FALSE;
+	if (!Z160CanAcceleratePixmapRectangles(pPixmapDst)) {
+		if (!Z160EXAIsPixmapPromotable(pPixmapDst)) {
+			return FALSE;
+		}
+		dstInSystemMemory = TRUE;
+	}
+	Bool srcInSystemMemory = FALSE;
+	if (!Z160CanAcceleratePixmapRectangles(pPixmapSrc)) {
+		if (!Z160EXAIsPixmapPromotable(pPixmapSrc)) {
+			return FALSE;
+		}
+		srcInSystemMemory = TRUE;
+	}
+
+	/* Access the screen associated with this pixmap. */
+	ScrnInfoPtr pScrn = xf86Screens[pPixmapDst->drawable.pScreen->myNum];
+
+	/* Access driver specific data */
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	/* Determine number of pixels in target and source pixmaps. */
+	unsigned pixmapAreaDst = pPixmapDst->drawable.width * pPixmapDst->drawable.height;
+	unsigned pixmapAreaSrc = pPixmapSrc->drawable.width * pPixmapSrc->drawable.height;
+
+	/* Can't accelerate copy unless both pixmaps have enough pixels */
+	/* for the GPU to be faster. */
+	if (!Z160EXAIsAreaAccelerated(fPtr, IMX_EXA_BATCH_COPY,
+			pPixmapDst->drawable.bitsPerPixel,
+			(pixmapAreaDst < pixmapAreaSrc) ? pixmapAreaDst : pixmapAreaSrc)) {
+
+		return FALSE;
+	}
+
+	/* Determine the bits-per-pixels for src and dst pixmaps. */
+	int dstPixmapBitsPerPixel = pPixmapDst->drawable.bitsPerPixel;
+	int srcPixmapBitsPerPixel = pPixmapSrc->drawable.bitsPerPixel;
+
+	/* Cannot perform copy unless these src and dst pixmaps have the same bits-per-pixel. */
+	if (dstPixmapBitsPerPixel != srcPixmapBitsPerPixel) {
+		return FALSE;
+	}
+
+	/* Check the number of entities, and fail if it isn't one. */
+	if (pScrn->numEntities != 1) {
+
+		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+			"Z160EXAPrepareCopy called with number of screen entities (%d) not 1\n",
+			pScrn->numEntities);
+		return FALSE;
+	}
+
+	/* Make sure that the input planemask specifies a solid */
+	if (!EXA_PM_IS_SOLID(&pPixmapDst->drawable, planemask)) {
+
+#if IMX_EXA_DEBUG_COPY
+		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+			"Z160EXAPrepareCopy called with planemask=0x%08x which is not solid\n",
+			(unsigned)planemask);
+#endif
+		return FALSE;
+	}
+
+	/* Make sure that only GXcopy is only raster op called for. */
+	if (GXcopy != alu) {
+
+#if IMX_EXA_DEBUG_COPY
+		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+			"Z160EXAPrepareCopy called with rop=0x%08x which is not GXcopy\n",
+			(unsigned)alu);
+#endif
+		return FALSE;
+	}
+
+	/* Would have been accelerated if the pixmaps were in GPU memory? */
+	if (dstInSystemMemory || srcInSystemMemory) {
+		if (Z160EXAIsBitsPerPixelSupported(dstPixmapBitsPerPixel)) {
+			if (dstInSystemMemory) {
+				Z160EXAHeatPixmap(pPixmapDst);
+			}
+			if (srcInSystemMemory) {
+				Z160EXAHeatPixmap(pPixmapSrc);
+			}
+		}
+		return FALSE;
+	}
+
+	/* Setup buffer parameters based on target pixmap. */
+	if (!Z160GetPixmapConfig(pPixmapDst, &fPtr->z160BufferDst)) {
+		return FALSE;
+	}
+
+	/* Setup buffer parameters based on source pixmap. */
+	if (!Z160GetPixmapConfig(pPixmapSrc, &fPtr->z160BufferSrc)) {
+		return FALSE;
+	}
+
+	/* Only 8, 16, and 32-bit pixmaps are supported. */
+	/* Associate a pixel format which is required for configuring */
+	/* the Z160.  It does not matter what format is chosen as long as it */
+	/* is one that matchs the bitsPerPixel. */
+	Z160_FORMAT z160Format;
+	switch (dstPixmapBitsPerPixel) {
+
+		case 8:
+			z160Format = Z160_FORMAT_8;	/* value goes in alpha channel */
+			break;
+
+		case 16:
+			z160Format = Z160_FORMAT_4444;	/* upper nibble */
+			break;
+
+		case 32:
+			z160Format = Z160_FORMAT_8888;	/* ARGB */
+			break;
+
+		default:
+#if IMX_EXA_DEBUG_COPY
+			xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+				"Z160EXAPrepareCopy unsupported pixmap bits per pixel %dy\n",
+				dstPixmapBitsPerPixel);
+#endif
+			return FALSE;
+	}
+	fPtr->z160BufferDst.format = fPtr->z160BufferSrc.format = z160Format;
+	fPtr->z160BufferDst.swapRB = fPtr->z160BufferSrc.swapRB = FALSE;
+
+	/* GPU setup deferred */
+	fPtr->gpuOpSetup = FALSE;
+
+	/* Remember the parameters passed in */
+	fPtr->pPixmapDst = pPixmapDst;
+	fPtr->pPixmapSrc = pPixmapSrc;
+	fPtr->copyALU = alu;
+	fPtr->copyPlaneMask = planemask;
+	fPtr->copyDirX = xdir;
+	fPtr->copyDirY = ydir;
+
+	Z160EXAAcceptArea(fPtr, IMX_EXA_BATCH_COPY,
+		pPixmapDst->drawable.bitsPerPixel);
+	Z160EXABeginBatch(fPtr, IMX_EXA_BATCH_COPY);
+	fPtr->batch->target = fPtr->z160BufferDst;
+	fPtr->batch->src = fPtr->z160BufferSrc;
+	fPtr->batch->dirX = xdir;
+	fPtr->batch->dirY = ydir;
+
+	Z160EXAMarkPixmapUsed(pPixmapDst);
+	Z160EXAMarkPixmapUsed(pPixmapSrc);
+	Z160EXAFencePixmap(fPtr, pPixmapDst);
+	Z160EXAFencePixmap(fPtr, pPixmapSrc);
+
+	return TRUE;
+}
+
+static void
+Z160EXACopy(PixmapPtr pPixmapDst, int srcX, int srcY, int dstX, int dstY, int width, int height)
+{
+	/* Access screen associated with dst pixmap */
+	ScrnInfoPtr pScrn = xf86Screens[pPixmapDst->drawable.pScreen->myNum];
+
+	/* Access driver specific data */
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	IMXEXABatchRectPtr pRect = Z160EXAQueueBatchRect(fPtr);
+	pRect->dstX = dstX;
+	pRect->dstY = dstY;
+	pRect->width = width;
+	pRect->height = height;
+	pRect->srcX = srcX;
+	pRect->srcY = srcY;
+
+#if IMX_EXA_DEBUG_INSTRUMENT_SIZES
+	const unsigned long size =
+		(unsigned long)width * height;
+
+	if (size < 100) {
+
+		++(fPtr->numScreenCopyRect100);
+
+	} else if (size < 1000) {
+
+		++(fPtr->numScreenCopyRect1000);
+
+	} else if (size < 10000) {
+
+		++(fPtr->numScreenCopyRect10000);
+
+	} else if (size < 100000) {
+
+		++(fPtr->numScreenCopyRect100000);
+
+	} else {
+
+		++(fPtr->numScreenCopyRectLarge);
+	}
+#endif
+
+#if IMX_EXA_DEBUG_INSTRUMENT_SYNCS
+
+	++(fPtr->numCopyBeforeSync);
+
+#endif
+
+#if IMX_EXA_DEBUG_COPY
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		"Z160EXACopy called with src=(%d-%d,%d-%d) dst=(%d-%d,%d-%d)\n",
+		srcX, srcX+width, srcY, srcY+height, dstX, dstX+width, dstY, dstY+height);
+#endif
+}
+
+static void
+Z160EXADoneCopy(PixmapPtr pPixmapDst)
+{
+	/* Access screen associated with this pixmap */
+	ScrnInfoPtr pScrn = xf86Screens[pPixmapDst->drawable.pScreen->myNum];
+
+	/* Access driver specific data */
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	/* Submit queued rectangles.  The flush to the GPU is deferred to */
+	/* the block handler, or to when too much has gone unflushed. */
+	Z160EXAEndBatch(fPtr);
+
+	/* Release graphics context used for software fallback? */
+	if (NULL != fPtr->pGC) {
+
+		FreeScratchGC(fPtr->pGC);
+		fPtr->pGC = NULL;
+
+		Z160EXAFinishPipelinedAccess(fPtr->pPixmapDst, EXA_PREPARE_DEST);
+		Z160EXAFinishPipelinedAccess(fPtr->pPixmapSrc, EXA_PREPARE_SRC);
+	}
+}
+
+static Z160_BLEND Z160SetupBlendOpTable[] = {
+	Z160_BLEND_UNKNOWN,	/* 0 = PictOpMinimum, PictOpClear */
+	Z160_BLEND_SRC,		/* 1 = PictOpSrc */
+	Z160_BLEND_UNKNOWN,	/* 2 = PictOpDst */
+	Z160_BLEND_OVER,	/* 3 = PictOpOver */
+	Z160_BLEND_UNKNOWN,	/* 4 = PictOpOverReverse */
+	Z160_BLEND_IN,		/* 5 = PictOpIn */
+	Z160_BLEND_IN_REVERSE,	/* 6 = PictOpInReverse */
+	Z160_BLEND_UNKNOWN,	/* 7 = PictOpOut */
+	Z160_BLEND_OUT_REVERSE,	/* 8 = PictOpOutReverse */
+	Z160_BLEND_UNKNOWN,	/* 9 = PictOpAtop */
+	Z160_BLEND_UNKNOWN,	/* 10 = PictOpAtopReverse */
+	Z160_BLEND_UNKNOWN,	/* 11 = PictOpXor */
+	Z160_BLEND_ADD,		/* 12 = PictOpAdd */
+	Z160_BLEND_UNKNOWN	/* 13 = PictOpSaturate, PictOpMaximum */
+};
+static int NumZ160SetupBlendOps =
+	sizeof(Z160SetupBlendOpTable) / sizeof(Z160SetupBlendOpTable[0]);
+
+static const char* Z160PictOpNames[IMX_EXA_NUM_PICT_OPS] = {
+	"Clear", "Src", "Dst", "Over", "OverReverse", "In", "InReverse",
+	"Out", "OutReverse", "Atop", "AtopReverse", "Xor", "Add", "Saturate"
+};
+
+/* Op with the same result when the target has no alpha channel, so */
+/* that its alpha is one. */
+static const int Z160OpaqueTargetOpTable[IMX_EXA_NUM_PICT_OPS] = {
+	PictOpClear,		/* Clear */
+	PictOpSrc,		/* Src */
+	PictOpDst,		/* Dst */
+	PictOpOver,		/* Over */
+	PictOpDst,		/* OverReverse: dst + src * 0 */
+	PictOpIn,		/* In */
+	PictOpInReverse,	/* InReverse */
+	PictOpClear,		/* Out: src * 0 */
+	PictOpOutReverse,	/* OutReverse */
+	PictOpOver,		/* Atop: src + dst * (1 - srcA) */
+	PictOpInReverse,	/* AtopReverse: dst * srcA */
+	PictOpOutReverse,	/* Xor: dst * (1 - srcA) */
+	PictOpAdd,		/* Add */
+	PictOpDst		/* Saturate: dst + src * 0 */
+};
+
+/* Passes for the ops the Z160 cannot blend.  With s the source IN */
+/* the mask, d the target and t the scratch pixmap: */
+/* */
+/*	Clear:		d = 0 */
+/*	Dst:		nothing to draw */
+/*	OverReverse:	t = s, t = d OVER t, d = t */
+/*	Out:		t = s, t = t OUTREVERSE d, d = t */
+/*	Atop:		t = s, t = t INREVERSE d, d = d OUTREVERSE s, d += t */
+/*	AtopReverse:	t = s, t = t OUTREVERSE d, d = d INREVERSE s, d += t */
+/*	Xor:		t = s, t = t OUTREVERSE d, d = d OUTREVERSE s, d += t */
+/* */
+/* Saturate has no such sequence. */
+static const IMXEXACompositePlanRec Z160ClearPlan = { 1, FALSE, {
+	{ IMX_EXA_PASS_TARGET, IMX_EXA_PASS_TARGET, Z160_BLEND_UNKNOWN } } };
+
+static const IMXEXACompositePlanRec Z160DstPlan = { 0, FALSE, { } };
+
+static const IMXEXACompositePlanRec Z160OverReversePlan = { 3, TRUE, {
+	{ IMX_EXA_PASS_SCRATCH, IMX_EXA_PASS_SOURCE, Z160_BLEND_SRC },
+	{ IMX_EXA_PASS_SCRATCH, IMX_EXA_PASS_TARGET, Z160_BLEND_OVER },
+	{ IMX_EXA_PASS_TARGET, IMX_EXA_PASS_SCRATCH, Z160_BLEND_SRC } } };
+
+static const IMXEXACompositePlanRec Z160OutPlan = { 3, TRUE, {
+	{ IMX_EXA_PASS_SCRATCH, IMX_EXA_PASS_SOURCE, Z160_BLEND_SRC },
+	{ IMX_EXA_PASS_SCRATCH, IMX_EXA_PASS_TARGET, Z160_BLEND_OUT_REVERSE },
+	{ IMX_EXA_PASS_TARGET, IMX_EXA_PASS_SCRATCH, Z160_BLEND_SRC } } };
+
+static const IMXEXACompositePlanRec Z160AtopPlan = { 4, TRUE, {
+	{ IMX_EXA_PASS_SCRATCH, IMX_EXA_PASS_SOURCE, Z160_BLEND_SRC },
+	{ IMX_EXA_PASS_SCRATCH, IMX_EXA_PASS_TARGET, Z160_BLEND_IN_REVERSE },
+	{ IMX_EXA_PASS_TARGET, IMX_EXA_PASS_SOURCE, Z160_BLEND_OUT_REVERSE },
+	{ IMX_EXA_PASS_TARGET, IMX_EXA_PASS_SCRATCH, Z160_BLEND_ADD } } };
+
+static const IMXEXACompositePlanRec Z160AtopReversePlan = { 4, TRUE, {
+	{ IMX_EXA_PASS_SCRATCH, IMX_EXA_PASS_SOURCE, Z160_BLEND_SRC },
+	{ IMX_EXA_PASS_SCRATCH, IMX_EXA_PASS_TARGET, Z160_BLEND_OUT_REVERSE },
+	{ IMX_EXA_PASS_TARGET, IMX_EXA_PASS_SOURCE, Z160_BLEND_IN_REVERSE },
+	{ IMX_EXA_PASS_TARGET, IMX_EXA_PASS_SCRATCH, Z160_BLEND_ADD } } };
+
+static const IMXEXACompositePlanRec Z160XorPlan = { 4, TRUE, {
+	{ IMX_EXA_PASS_SCRATCH, IMX_EXA_PASS_SOURCE, Z160_BLEND_SRC },
+	{ IMX_EXA_PASS_SCRATCH, IMX_EXA_PASS_TARGET, Z160_BLEND_OUT_REVERSE },
+	{ IMX_EXA_PASS_TARGET, IMX_EXA_PASS_SOURCE, Z160_BLEND_OUT_REVERSE },
+	{ IMX_EXA_PASS_TARGET, IMX_EXA_PASS_SCRATCH, Z160_BLEND_ADD } } };
+
+/* Over with a component alpha mask needs the source alpha and color */
+/* each multiplied by the mask, which the Z160 does one at a time. */
+static const IMXEXACompositePlanRec Z160ComponentAlphaOverPlan = { 2, FALSE, {
+	{ IMX_EXA_PASS_TARGET, IMX_EXA_PASS_SOURCE, Z160_BLEND_OUT_REVERSE },
+	{ IMX_EXA_PASS_TARGET, IMX_EXA_PASS_SOURCE, Z160_BLEND_ADD } } };
+
+/* Plan for each op, NULL for those blended directly or left to software. */
+static const IMXEXACompositePlanRec* Z160CompositePlanTable[IMX_EXA_NUM_PICT_OPS] = {
+	&Z160ClearPlan,		/* Clear */
+	NULL,			/* Src */
+	&Z160DstPlan,		/* Dst */
+	NULL,			/* Over */
+	&Z160OverReversePlan,	/* OverReverse */
+	NULL,			/* In */
+	NULL,			/* InReverse */
+	&Z160OutPlan,		/* Out */
+	NULL,			/* OutReverse */
+	&Z160AtopPlan,		/* Atop */
+	&Z160AtopReversePlan,	/* AtopReverse */
+	&Z160XorPlan,		/* Xor */
+	NULL,			/* Add */
+	NULL			/* Saturate */
+};
+
+/* The op to do instead of op on the target picture, which has the */
+/* same result, or -1 if it is out of range. */
+static int
+Z160EXAResolveCompositeOp(int op, PicturePtr pPictureDst)
+{
+	if ((0 > op) || (NumZ160SetupBlendOps <= op)) {
+		return -1;
+	}
+
+	if (0 == PICT_FORMAT_A(pPictureDst->format)) {
+		return Z160OpaqueTargetOpTable[op];
+	}
+
+	return op;
+}
+
+/* The passes for an op resolved by Z160EXAResolveCompositeOp, or */
+/* NULL if it is blended directly or cannot be done. */
+static const IMXEXACompositePlanRec*
+Z160EXAGetCompositePlan(int resolvedOp, PicturePtr pPictureMask)
+{
+	if ((PictOpOver == resolvedOp) && (NULL != pPictureMask) &&
+		pPictureMask->componentAlpha) {
+
+		return &Z160ComponentAlphaOverPlan;
+	}
+
+	if (Z160_BLEND_UNKNOWN == Z160SetupBlendOpTable[resolvedOp]) {
+		return Z160CompositePlanTable[resolvedOp];
+	}
+
+	return NULL;
+}
+
+/* Whether a pass of the plan reads the source after an earlier pass */
+/* drew on the target, which then must not be the source or mask. */
+static Bool
+Z160EXAPlanRereadsSource(const IMXEXACompositePlanRec* plan)
+{
+	Bool targetDrawn = FALSE;
+	int pass;
+
+	for (pass = 0; pass < plan->numPasses; ++pass) {
+
+		const IMXEXACompositePassRec* pPass = &plan->passes[pass];
+		if (targetDrawn && (IMX_EXA_PASS_SOURCE == pPass->src)) {
+			return TRUE;
+		}
+		if (IMX_EXA_PASS_TARGET == pPass->dst) {
+			targetDrawn = TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static void
+Z160EXACountCompositeFallback(IMXEXAPtr fPtr, int op)
+{
+	if ((0 <= op) && (IMX_EXA_NUM_PICT_OPS > op)) {
+		++(fPtr->numCompositeFallbacks[op]);
+	}
+}
+
+/* Make sure the scratch pixmap for composites done in passes covers */
+/* a target of width by height pixels, replacing it with a larger one */
+/* if needed.  Returns FALSE if there is none in GPU memory. */
+static Bool
+Z160EXAGetCompositeScratch(ScreenPtr pScreen, IMXEXAPtr fPtr,
+				int width, int height)
+{
+	PixmapPtr pScratch = fPtr->pScratchPixmap;
+
+	if ((NULL != pScratch) &&
+		((pScratch->drawable.width < width) ||
+			(pScratch->drawable.height < height))) {
+
+		if (width < pScratch->drawable.width) {
+			width = pScratch->drawable.width;
+		}
+		if (height < pScratch->drawable.height) {
+			height = pScratch->drawable.height;
+		}
+
+		(*pScreen->DestroyPixmap)(pScratch);
+		fPtr->pScratchPixmap = pScratch = NULL;
+	}
+
+	if (NULL == pScratch) {
+
+		pScratch = (*pScreen->CreatePixmap)(pScreen, width, height, 32,
+						CREATE_PIXMAP_USAGE_SCRATCH);
+		if (NULL == pScratch) {
+			return FALSE;
+		}
+		fPtr->pScratchPixmap = pScratch;
+	}
+
+	return Z160CanAcceleratePixmap(pScratch);
+}
+
+/* Find the row of the solid color pixmap holding a premultiplied */
+/* color, writing the color into the least recently used row if no */
+/* row has it, and set up the buffer reading it.  Returns NULL if the */
+/* pixmap is not in GPU memory. */
+static IMXEXASolidCachePtr
+Z160EXAGetSolidColor(ScreenPtr pScreen, IMXEXAPtr fPtr, CARD32 color,
+			Z160Buffer* pBuffer)
+{
+	if (NULL == fPtr->pSolidPixmap) {
+
+		fPtr->pSolidPixmap = (*pScreen->CreatePixmap)(pScreen,
+					1, IMX_EXA_SOLID_CACHE_SIZE, 32, 0);
+		if (NULL == fPtr->pSolidPixmap) {
+			return NULL;
+		}
+	}
+
+	/* The pixmap may have been moved out of GPU memory. */
+	Z160Buffer z160Buffer;
+	if (!Z160CanAcceleratePixmap(fPtr->pSolidPixmap)) {
+		Z160EXAHeatPixmap(fPtr->pSolidPixmap);
+		return NULL;
+	}
+
+	/* Each row must be aligned for the Z160 to read it. */
+	if (!Z160GetPixmapConfig(fPtr->pSolidPixmap, &z160Buffer) ||
+		(0 != (z160Buffer.pitch & (Z160_ALIGN_OFFSET-1)))) {
+		return NULL;
+	}
+
+	IMXEXASolidCachePtr pSolid = NULL;
+	IMXEXASolidCachePtr pOldest = &fPtr->solidCache[0];
+	int i;
+	for (i = 0; i < IMX_EXA_SOLID_CACHE_SIZE; ++i) {
+
+		IMXEXASolidCachePtr pEntry = &fPtr->solidCache[i];
+		if (pEntry->valid && (color == pEntry->color)) {
+			pSolid = pEntry;
+			break;
+		}
+		if (!pEntry->valid ||
+			(pOldest->valid && (pEntry->lastUsed < pOldest->lastUsed))) {
+			pOldest = pEntry;
+		}
+	}
+
+	const int row = (NULL != pSolid) ? i : (pOldest - fPtr->solidCache);
+	CARD8* pRow = (CARD8*)z160Buffer.base + row * z160Buffer.pitch;
+
+	if (NULL != pSolid) {
+
+		++(fPtr->numSolidHits);
+
+	} else {
+
+		/* Operations still reading the old color come first, as do */
+		/* those of a pixmap destroyed since which used the offscreen */
+		/* memory. */
+		pSolid = pOldest;
+		Z160EXAWaitPixmap(fPtr->pSolidPixmap);
+
+		CARD8* pPixel = (CARD8*)Z160EXAGetPixmapAddress(fPtr->pSolidPixmap) +
+					row * z160Buffer.pitch;
+		*(CARD32*)pPixel = color;
+
+		pSolid->valid = TRUE;
+		pSolid->color = color;
+		++(fPtr->numSolidMisses);
+	}
+	pSolid->lastUsed = ++(fPtr->sourceCacheUses);
+
+	pBuffer->base = pRow;
+	pBuffer->width = 1;
+	pBuffer->height = 1;
+	pBuffer->pitch = z160Buffer.pitch;
+	pBuffer->bpp = 32;
+	pBuffer->format = Z160_FORMAT_8888;
+	pBuffer->swapRB = FALSE;
+	pBuffer->opaque = FALSE;
+	pBuffer->alpha4 = FALSE;
+
+	return pSolid;
+}
+
+/* Lay out the strip for a linear gradient source picture, filling in */
+/* the gradient and strip fields of the layout but not the stops. */
+/* Returns FALSE if the gradient cannot be drawn from a strip. */
+static Bool
+Z160EXALayOutGradient(PicturePtr pPicture, IMXEXAGradientCachePtr layout)
+{
+	const PictLinearGradient* pLinear = &pPicture->pSourcePict->linear;
+	xFixed start, end;
+
+	/* Transformed gradients may vary along both axes. */
+	if ((NULL != pPicture->transform) || (1 > pLinear->nstops)) {
+		return FALSE;
+	}
+
+	if ((pLinear->p1.y == pLinear->p2.y) && (pLinear->p1.x != pLinear->p2.x)) {
+
+		layout->vertical = FALSE;
+		start = pLinear->p1.x;
+		end = pLinear->p2.x;
+
+	} else if ((pLinear->p1.x == pLinear->p2.x) && (pLinear->p1.y != pLinear->p2.y)) {
+
+		layout->vertical = TRUE;
+		start = pLinear->p1.y;
+		end = pLinear->p2.y;
+
+	} else {
+		return FALSE;
+	}
+
+	const xFixed low = (start < end) ? start : end;
+	const xFixed high = (start < end) ? end : start;
+
+	layout->p1 = pLinear->p1;
+	layout->p2 = pLinear->p2;
+	layout->repeatType = pPicture->repeat ? pPicture->repeatType : RepeatNone;
+	layout->numStops = pLinear->nstops;
+	layout->stops = NULL;
+
+	switch (layout->repeatType) {
+
+		/* The GPU repeats a strip one period long, which must be */
+		/* a whole number of pixels.  Reflected gradients repeat */
+		/* every other ramp. */
+		case RepeatNormal:
+		case RepeatReflect:
+			if (0 != xFixedFrac(high - low)) {
+				return FALSE;
+			}
+			layout->period = xFixedToInt(high - low);
+			if (RepeatReflect == layout->repeatType) {
+				layout->period *= 2;
+			}
+			layout->origin = xFixedToInt(low);
+			layout->length = layout->period;
+			break;
+
+		/* Pixels beyond the ends of the ramp have the color of */
+		/* the first or last stop, or none. */
+		default:
+			layout->period = 0;
+			layout->origin = xFixedToInt(low) - IMX_EXA_GRADIENT_PAD_LENGTH;
+			layout->length = xFixedToInt(xFixedCeil(high)) +
+				IMX_EXA_GRADIENT_PAD_LENGTH - layout->origin;
+			break;
+	}
+
+	return layout->length <=
+		(layout->vertical ? Z160_MAX_HEIGHT : Z160_MAX_WIDTH);
+}
+
+/* Whether a source picture without a drawable can be drawn from GPU */
+/* memory.  Solid colors always can be.  Only linear gradients which */
+/* vary along the x or y axis can be drawn from a strip. */
+static Bool
+Z160EXAIsSourcePictAccelerated(PicturePtr pPicture)
+{
+	IMXEXAGradientCacheRec layout;
+
+	switch (pPicture->pSourcePict->type) {
+
+		case SourcePictTypeSolidFill:
+			return TRUE;
+
+		case SourcePictTypeLinear:
+			return Z160EXALayOutGradient(pPicture, &layout);
+
+		default:
+			return FALSE;
+	}
+}
+
+/* Premultiplied color of the gradient at the center of the pixel at */
+/* position along the axis of its strip. */
+static CARD32
+Z160EXAGetGradientPixel(IMXEXAGradientCachePtr gradient, int position)
+{
+	const xFixed start = gradient->vertical ? gradient->p1.y : gradient->p1.x;
+	const xFixed end = gradient->vertical ? gradient->p2.y : gradient->p2.x;
+
+	/* Position along the gradient, 0 at p1 and 1 at p2. */
+	double t = (position + 0.5 - xFixedToDouble(start)) /
+			xFixedToDouble(end - start);
+
+	switch (gradient->repeatType) {
+
+		case RepeatNone:
+			if ((0.0 > t) || (1.0 < t)) {
+				return 0;
+			}
+			break;
+
+		case RepeatNormal:
+			t -= floor(t);
+			break;
+
+		case RepeatReflect:
+			t -= 2.0 * floor(t / 2.0);
+			if (1.0 < t) {
+				t = 2.0 - t;
+			}
+			break;
+
+		default:
+			if (0.0 > t) {
+				t = 0.0;
+			} else if (1.0 < t) {
+				t = 1.0;
+			}
+			break;
+	}
+
+	/* Interpolate between the last stop at or before t and the next */
+	/* one, whose colors are not premultiplied.  Before the first and */
+	/* from the last stop the color is that of the stop. */
+	const PictGradientStop* stops = gradient->stops;
+	int i = 0;
+	while ((i < gradient->numStops) && (xFixedToDouble(stops[i].x) <= t)) {
+		++i;
+	}
+
+	const xRenderColor* c0 = &stops[(0 < i) ? i - 1 : 0].color;
+	const xRenderColor* c1 = &stops[(gradient->numStops > i) ? i : i - 1].color;
+	double f = 0.0;
+	if ((0 < i) && (gradient->numStops > i)) {
+		f = (t - xFixedToDouble(stops[i - 1].x)) /
+			xFixedToDouble(stops[i].x - stops[i - 1].x);
+	}
+
+	const double alpha = (c0->alpha + f * (c1->alpha - c0->alpha)) / 65535.0;
+	const double red = (c0->red + f * (c1->red - c0->red)) / 65535.0;
+	const double green = (c0->green + f * (c1->green - c0->green)) / 65535.0;
+	const double blue = (c0->blue + f * (c1->blue - c0->blue)) / 65535.0;
+
+	return ((CARD32)(alpha * 255.0 + 0.5) << 24) |
+		((CARD32)(red * alpha * 255.0 + 0.5) << 16) |
+		((CARD32)(green * alpha * 255.0 + 0.5) << 8) |
+		(CARD32)(blue * alpha * 255.0 + 0.5);
+}
+
+/* Free the strip and stops of a gradient cache entry. */
+static void
+Z160EXAFreeGradient(ScreenPtr pScreen, IMXEXAGradientCachePtr gradient)
+{
+	if (NULL != gradient->pPixmap) {
+		(*pScreen->DestroyPixmap)(gradient->pPixmap);
+		gradient->pPixmap = NULL;
+	}
+
+	free(gradient->stops);
+	gradient->stops = NULL;
+}
+
+/* Find the strip of a linear gradient source picture, drawing it into */
+/* a new pixmap in place of the least recently used one if there is */
+/* none.  Returns NULL if the gradient cannot be drawn from a strip in */
+/* GPU memory. */
+static IMXEXAGradientCachePtr
+Z160EXAGetGradient(ScreenPtr pScreen, IMXEXAPtr fPtr, PicturePtr pPicture)
+{
+	IMXEXAGradientCacheRec layout;
+	if (!Z160EXALayOutGradient(pPicture, &layout)) {
+		return NULL;
+	}
+
+	const PictGradientStop* stops = pPicture->pSourcePict->linear.stops;
+	const int stopsSize = layout.numStops * sizeof(PictGradientStop);
+
+	IMXEXAGradientCachePtr pOldest = &fPtr->gradientCache[0];
+	int i;
+	for (i = 0; i < IMX_EXA_GRADIENT_CACHE_SIZE; ++i) {
+
+		IMXEXAGradientCachePtr pEntry = &fPtr->gradientCache[i];
+		if ((NULL != pEntry->pPixmap) &&
+			(layout.p1.x == pEntry->p1.x) &&
+			(layout.p1.y == pEntry->p1.y) &&
+			(layout.p2.x == pEntry->p2.x) &&
+			(layout.p2.y == pEntry->p2.y) &&
+			(layout.repeatType == pEntry->repeatType) &&
+			(layout.numStops == pEntry->numStops) &&
+			(0 == memcmp(stops, pEntry->stops, stopsSize))) {
+
+			++(fPtr->numGradientHits);
+			pEntry->lastUsed = ++(fPtr->sourceCacheUses);
+
+			/* The strip may have been moved out of GPU memory. */
+			if (!Z160CanAcceleratePixmap(pEntry->pPixmap)) {
+				Z160EXAHeatPixmap(pEntry->pPixmap);
+				return NULL;
+			}
+			return pEntry;
+		}
+		if ((NULL == pEntry->pPixmap) ||
+			((NULL != pOldest->pPixmap) &&
+				(pEntry->lastUsed < pOldest->lastUsed))) {
+			pOldest = pEntry;
+		}
+	}
+
+	++(fPtr->numGradientMisses);
+
+	/* Operations still reading the old strip keep it until they */
+	/* are complete. */
+	IMXEXAGradientCachePtr pGradient = pOldest;
+	Z160EXAFreeGradient(pScreen, pGradient);
+
+	layout.stops = malloc(stopsSize);
+	if (NULL == layout.stops) {
+		return NULL;
+	}
+	memcpy(layout.stops, stops, stopsSize);
+
+	layout.pPixmap = (*pScreen->CreatePixmap)(pScreen,
+				layout.vertical ? 1 : layout.length,
+				layout.vertical ? layout.length : 1, 32, 0);
+	layout.lastUsed = ++(fPtr->sourceCacheUses);
+	*pGradient = layout;
+	if (NULL == pGradient->pPixmap) {
+		Z160EXAFreeGradient(pScreen, pGradient);
+		return NULL;
+	}
+
+	Z160Buffer z160Buffer;
+	if (!Z160CanAcceleratePixmap(pGradient->pPixmap) ||
+		!Z160GetPixmapConfig(pGradient->pPixmap, &z160Buffer)) {
+		Z160EXAFreeGradient(pScreen, pGradient);
+		return NULL;
+	}
+
+	/* The offscreen memory may have been used by the GPU for a */
+	/* pixmap destroyed since. */
+	Z160EXAWaitPixmap(pGradient->pPixmap);
+
+	CARD8* pStrip = (CARD8*)Z160EXAGetPixmapAddress(pGradient->pPixmap);
+	const int step = pGradient->vertical ? z160Buffer.pitch : 4;
+	for (i = 0; i < pGradient->length; ++i) {
+
+		*(CARD32*)(pStrip + i * step) =
+			Z160EXAGetGradientPixel(pGradient, pGradient->origin + i);
+	}
+
+	return pGradient;
+}
+
+/* Queue a composite rectangle whose source is a gradient strip.  Its */
+/* source position is moved into the strip, and it is cut where it */
+/* crosses the ends of the ramp of a gradient which does not repeat, */
+/* with the parts beyond cut to fit the colors at the strip ends. */
+static void
+Z160EXAQueueGradientRects(
+	IMXEXAPtr fPtr,
+	IMXEXAGradientCachePtr pGradient,
+	int srcX,
+	int srcY,
+	int maskX,
+	int maskY,
+	int dstX,
+	int dstY,
+	int width,
+	int height)
+{
+	const int length = pGradient->length;
+	const int rampEnd = length - IMX_EXA_GRADIENT_PAD_LENGTH;
+	const int size = pGradient->vertical ? height : width;
+	int position = (pGradient->vertical ? srcY : srcX) - pGradient->origin;
+	int done = 0;
+
+	while (done < size) {
+
+		int stripPosition, run;
+		if (0 < pGradient->period) {
+
+			stripPosition = position % pGradient->period;
+			if (0 > stripPosition) {
+				stripPosition += pGradient->period;
+			}
+			run = size - done;
+
+		} else if (IMX_EXA_GRADIENT_PAD_LENGTH > position) {
+
+			stripPosition = (0 < position) ? position : 0;
+			run = IMX_EXA_GRADIENT_PAD_LENGTH - stripPosition;
+
+		} else if (rampEnd > position) {
+
+			stripPosition = position;
+			run = rampEnd - position;
+
+		} else {
+
+			stripPosition = (length > position) ? position : rampEnd;
+			run = length - stripPosition;
+		}
+		if (run > size - done) {
+			run = size - done;
+		}
+
+		IMXEXABatchRectPtr pRect = Z160EXAQueueBatchRect(fPtr);
+		if (pGradient->vertical) {
+			pRect->dstX = dstX;
+			pRect->dstY = dstY + done;
+			pRect->width = width;
+			pRect->height = run;
+			pRect->srcX = 0;
+			pRect->srcY = stripPosition;
+			pRect->maskX = maskX;
+			pRect->maskY = maskY + done;
+		} else {
+			pRect->dstX = dstX + done;
+			pRect->dstY = dstY;
+			pRect->width = run;
+			pRect->height = height;
+			pRect->srcX = stripPosition;
+			pRect->srcY = 0;
+			pRect->maskX = maskX + done;
+			pRect->maskY = maskY;
+		}
+
+		position += run;
+		done += run;
+	}
+}
+
+#if IMX_EXA_DEBUG_CHECK_COMPOSITE
+
+static const char*
+Z160GetPictureTypeName(PicturePtr pPicture)
+{
+	switch(PICT_FORMAT_TYPE(pPicture->format)) {
+		case PICT_TYPE_OTHER:	return "other";
+		case PICT_TYPE_A:	return "alpha";
+		case PICT_TYPE_ARGB:	return "argb";
+		case PICT_TYPE_ABGR:	return "abgr";
+		case PICT_TYPE_COLOR:	return "color";
+		case PICT_TYPE_GRAY:	return "gray";
+		case PICT_TYPE_BGRA:	return "bgra";
+		default:		return "???";
+	}
+}
+
+#endif
+
+
+
+/*
+ * From /usr/include/xorg/exa.h:
+ *
+ * Notes on interpreting Picture structures:
+ * - The Picture structures will always have a valid pDrawable.
+ * - The Picture structures will never have alphaMap set.
+ * - The mask Picture (and therefore pMask) may be NULL, in which case the
+ *   operation is simply src OP dst instead of src IN mask OP dst, and
+ *   mask coordinates should be ignored.
+ * - pMarkPicture may have componentAlpha set, which greatly changes
+ *   the behavior of the Composite operation.  componentAlpha has no effect
+ *   when set on pSrcPicture or pDstPicture.
+ * - The source and mask Pictures may have a transformation set
+ *   (Picture->transform != NULL), which means that the source coordinates
+ *   should be transformed by that transformation, resulting in scaling,
+ *   rotation, etc.  The PictureTransformPoint() call can transform
+ *   coordinates for you.  Transforms have no effect on Pictures when used
+ *   as a destination.
+ * - The source and mask pictures may have a filter set.  PictFilterNearest
+ *   and PictFilterBilinear are defined in the Render protocol, but others
+ *   may be encountered, and must be handled correctly (usually by
+ *   PrepareComposite failing, and falling back to software).  Filters have
+ *   no effect on Pictures when used as a destination.
+ * - The source and mask Pictures may have repeating set, which must be
+ *   respected.  Many chipsets will be unable to support repeating on
+ *   pixmaps that have a width or height that is not a power of two.
+ */
+
+static Bool
+Z160EXACheckComposite(int op, PicturePtr pPictureSrc, PicturePtr pPictureMask, PicturePtr pPictureDst)
+{
+	/* Pictures for src and dst must be defined. */
+	if ((NULL == pPictureSrc) || (NULL == pPictureDst)) {
+		return FALSE;
+	}
+
+	/* Access the pixmap associated with each picture */
+	PixmapPtr pPixmapDst = Z160EXAGetPicturePixmap(pPictureDst);
+	PixmapPtr pPixmapSrc = Z160EXAGetPicturePixmap(pPictureSrc);
+	PixmapPtr pPixmapMask = Z160EXAGetPicturePixmap(pPictureMask);
+
+	/* Cannot perform blend if there is no target pixmap. */
+	if (NULL == pPixmapDst) {
+		return FALSE;
+	}
+
+	/* Access screen associated with dst pixmap (same screen as for src pixmap). */
+	ScrnInfoPtr pScrn = xf86Screens[pPixmapDst->drawable.pScreen->myNum];
+
+	/* Check the number of entities, and fail if it isn't one. */
+	if (pScrn->numEntities != 1) {
+
+		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+			"Z160EXACheckComposite called with number of screen entities (%d) not 1\n",
+			pScrn->numEntities);
+		return FALSE;
+	}
+
+	/* Cannot perform blend if there is no source pixmap, unless the */
+	/* source is a solid color or gradient drawn from GPU memory. */
+	if ((NULL == pPixmapSrc) &&
+		((NULL == pPictureSrc->pSourcePict) ||
+			!Z160EXAIsSourcePictAccelerated(pPictureSrc))) {
+		return FALSE;
+	}
+
+	/* Cannot perform blend unless screens associated with src and dst pictures are same. */
+	if ((NULL != pPixmapSrc) &&
+		(pPixmapSrc->drawable.pScreen->myNum !=
+			pPixmapDst->drawable.pScreen->myNum)) {
+		return FALSE;
+	}
+
+	/* Cannot perform blend with a mask which has no pixmap. */
+	if ((NULL != pPictureMask) && (NULL == pPixmapMask)) {
+		return FALSE;
+	}
+
+	/* Make sure operations can be accelerated on the target, source */
+	/* and optional mask pixmaps.  Pixmaps only held back by being in */
+	/* system memory go through the remaining checks so that they can */
+	/* be considered for promotion. */
+	PixmapPtr pPixmapsInSystemMemory[3];
+	int numPixmapsInSystemMemory = 0;
+	PixmapPtr pPixmapsToCheck[3] = { pPixmapDst, pPixmapSrc, pPixmapMask };
+	int i;
+	for (i = 0; i < 3; ++i) {
+
+		PixmapPtr pPixmap = pPixmapsToCheck[i];
+		if ((NULL == pPixmap) || Z160CanAcceleratePixmap(pPixmap)) {
+			continue;
+		}
+		if (!Z160EXAIsPixmapPromotable(pPixmap)) {
+			return FALSE;
+		}
+		pPixmapsInSystemMemory[numPixmapsInSystemMemory++] = pPixmap;
+	}
+
+	/* Access driver specific data */
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	/* Can't accelerate composite unless the target pixmap, and the */
+	/* pixmaps from non-repeating source and mask pictures, have enough */
+	/* pixels for the GPU to be faster. */
+	unsigned pixmapArea = pPixmapDst->drawable.width * pPixmapDst->drawable.height;
+	if ((NULL != pPixmapSrc) && !pPictureSrc->repeat) {
+
+		unsigned pixmapAreaSrc = pPixmapSrc->drawable.width * pPixmapSrc->drawable.height;
+		if (pixmapAreaSrc < pixmapArea) {
+			pixmapArea = pixmapAreaSrc;
+		}
+	}
+	if ((NULL != pPictureMask) && !pPictureMask->repeat) {
+
+		unsigned pixmapAreaMask = pPixmapMask->drawable.width * pPixmapMask->drawable.height;
+		if (pixmapAreaMask < pixmapArea) {
+			pixmapArea = pixmapAreaMask;
+		}
+	}
+	if (!Z160EXAIsAreaAccelerated(fPtr, IMX_EXA_BATCH_COMPOSITE,
+			pPixmapDst->drawable.bitsPerPixel, pixmapArea)) {
+		Z160EXACountCompositeFallback(fPtr, op);
+		return FALSE;
+	}
+
+	/* Reset this variable if cannot support composite. */
+	Bool canComposite = TRUE;
+
+	/* Check if blending operation is supported, by one blend or in */
+	/* passes. */
+	const int resolvedOp = Z160EXAResolveCompositeOp(op, pPictureDst);
+	const IMXEXACompositePlanRec* plan = NULL;
+	if (0 > resolvedOp) {
+
+		canComposite = FALSE;
+
+	} else {
+
+		plan = Z160EXAGetCompositePlan(resolvedOp, pPictureMask);
+		if ((NULL == plan) &&
+			(Z160_BLEND_UNKNOWN == Z160SetupBlendOpTable[resolvedOp])) {
+
+			canComposite = FALSE;
+		}
+
+		/* The source IN a component alpha mask cannot be kept in */
+		/* the scratch pixmap, which has one alpha per pixel. */
+		if ((NULL != plan) && plan->usesScratch &&
+			(NULL != pPictureMask) && pPictureMask->componentAlpha) {
+
+			canComposite = FALSE;
+		}
+
+		/* Passes reading the source or mask from the target after */
+		/* an earlier pass drew on it would read what that pass drew, */
+		/* as with Over through a component alpha mask. */
+		if ((NULL != plan) && Z160EXAPlanRereadsSource(plan) &&
+			((pPixmapSrc == pPixmapDst) || (pPixmapMask == pPixmapDst))) {
+
+			canComposite = FALSE;
+		}
+	}
+
+	/* Determine Z160 config that matches color format used in target picture. */
+	Z160Buffer z160BufferDst;
+	Bool z160BufferDstDefined = Z160GetPictureFormat(pPictureDst, &z160BufferDst);
+	if (!z160BufferDstDefined) {
+		canComposite = FALSE;
+	}
+
+	/* Determine Z160 config that matches color format used in source picture. */
+	Z160Buffer z160BufferSrc;
+	Bool z160BufferSrcDefined = Z160GetPictureFormat(pPictureSrc, &z160BufferSrc);
+	if (!z160BufferSrcDefined) {
+		canComposite = FALSE;
+	}
+
+	/* Determine Z160 config that matches color format used in mask picture. */
+	Z160Buffer z160BufferMask;
+	Bool z160BufferMaskDefined = FALSE;
+	if (NULL != pPictureMask) {
+
+		z160BufferMaskDefined = Z160GetPictureFormat(pPictureMask, &z160BufferMask);
+		if (!z160BufferMaskDefined) {
+			canComposite = FALSE;
+		}
+	}
+
+	/* Do not accelerate masks that do not have an alpha channel. */
+	if (z160BufferMaskDefined) {
+		if (0 == PICT_FORMAT_A(pPictureMask->format)) {
+			canComposite = FALSE;
+		}
+	}
+
+	/* Do not accelerate sources with a transform. */
+	if (NULL != pPictureSrc->transform) {
+		canComposite = FALSE;
+	}
+
+	/* Do not accelerate masks, if defined, that have a transform. */
+	if ((NULL != pPictureMask) && (NULL != pPictureMask->transform)) {
+		canComposite = FALSE;
+	}
+
+	/* Do not accelerate when mask, if defined, is repeating. */
+	if ((NULL != pPictureMask) && pPictureMask->repeat) {
+		canComposite = FALSE;
+	}
+
+	/* Would have been accelerated if the pixmaps were in GPU memory? */
+	if (0 < numPixmapsInSystemMemory) {
+
+		if (canComposite) {
+			for (i = 0; i < numPixmapsInSystemMemory; ++i) {
+				Z160EXAHeatPixmap(pPixmapsInSystemMemory[i]);
+			}
+		}
+		canComposite = FALSE;
+	}
+
+	/* Passes through the scratch pixmap need it in GPU memory, as */
+	/* large as the target. */
+	if (canComposite && (NULL != plan) && plan->usesScratch &&
+		!Z160EXAGetCompositeScratch(pPixmapDst->drawable.pScreen, fPtr,
+			pPixmapDst->drawable.width, pPixmapDst->drawable.height)) {
+
+		canComposite = FALSE;
+	}
+
+	if (!canComposite) {
+		Z160EXACountCompositeFallback(fPtr, op);
+	}
+
+#if IMX_EXA_DEBUG_CHECK_COMPOSITE
+
+	/* Check whether logging of parameter data when composite is rejected. */
+	if (! canComposite) {
+
+		/* Source OP Target */
+		if (NULL == pPictureMask) {
+
+			xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+				"Z160EXACheckComposite not support: SRC(%s%dx%d,%s%d%s:%d%d%d%d) op=%d DST(%d%s:%d%d%d%d)\n",
+				pPictureSrc->repeat ? "R" : "",
+				(NULL != pPictureSrc->pDrawable) ? pPictureSrc->pDrawable->width : 0,
+				(NULL != pPictureSrc->pDrawable) ? pPictureSrc->pDrawable->height : 0,
+				(NULL != pPictureSrc->transform) ? "T" : "",
+				PICT_FORMAT_BPP(pPictureSrc->format),
+				Z160GetPictureTypeName(pPictureSrc),
+				PICT_FORMAT_A(pPictureSrc->format),
+				PICT_FORMAT_R(pPictureSrc->format),
+				PICT_FORMAT_G(pPictureSrc->format),
+				PICT_FORMAT_B(pPictureSrc->format),
+				op,
+				PICT_FORMAT_BPP(pPictureDst->format),
+				Z160GetPictureTypeName(pPictureDst),
+				PICT_FORMAT_A(pPictureDst->format),
+				PICT_FORMAT_R(pPictureDst->format),
+				PICT_FORMAT_G(pPictureDst->format),
+				PICT_FORMAT_B(pPictureDst->format));
+
+
+		/* (Source IN Mask) OP Target */
+		} else {
+
+			xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+				"Z160EXACheckComposite not support: SRC(%s%dx%d,%s%d%s:%d%d%d%d) MASK(%s%dx%d,%s%d%s:%s%d%d%d%d) op=%d DST(%d%s:%d%d%d%d)\n",
+				pPictureSrc->repeat ? "R" : "",
+				(NULL != pPictureSrc->pDrawable) ? pPictureSrc->pDrawable->width : 0,
+				(NULL != pPictureSrc->pDrawable) ? pPictureSrc->pDrawable->height : 0,
+				(NULL != pPictureSrc->transform) ? "T" : "",
+				PICT_FORMAT_BPP(pPictureSrc->format),
+				Z160GetPictureTypeName(pPictureSrc),
+				PICT_FORMAT_A(pPictureSrc->format),
+				PICT_FORMAT_R(pPictureSrc->format),
+				PICT_FORMAT_G(pPictureSrc->format),
+				PICT_FORMAT_B(pPictureSrc->format),
+				pPictureMask->repeat ? "R" : "",
+				pPictureMask->pDrawable->width,
+				pPictureMask->pDrawable->height,
+				(NULL != pPictureMask->transform) ? "T" : "",
+				PICT_FORMAT_BPP(pPictureMask->format),
+				Z160GetPictureTypeName(pPictureMask),
+				pPictureMask->componentAlpha ? "C" : "",
+				PICT_FORMAT_A(pPictureMask->format),
+				PICT_FORMAT_R(pPictureMask->format),
+				PICT_FORMAT_G(pPictureMask->format),
+				PICT_FORMAT_B(pPictureMask->format),
+				op,
+				PICT_FORMAT_BPP(pPictureDst->format),
+				Z160GetPictureTypeName(pPictureDst),
+				PICT_FORMAT_A(pPictureDst->format),
+				PICT_FORMAT_R(pPictureDst->format),
+				PICT_FORMAT_G(pPictureDst->format),
+				PICT_FORMAT_B(pPictureDst->format));
+		}
+
+	}
+
+#endif
+
+	return canComposite;
+}
+
+static Bool
+Z160EXAPrepareComposite(
+	int op,
+	PicturePtr pPictureSrc,
+	PicturePtr pPictureMask,
+	PicturePtr pPictureDst,
+	PixmapPtr pPixmapSrc,
+	PixmapPtr pPixmapMask,
+	PixmapPtr pPixmapDst)
+{
+	/* Access screen associated with dst pixmap (same screen as for src pixmap). */
+	ScrnInfoPtr pScrn = xf86Screens[pPixmapDst->drawable.pScreen->myNum];
+
+	/* Access driver specific data */
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	/* NOTE - many preconditions were already verified in the CheckComposite callback. */
+
+	/* Determine Z160 config that matches pixel format used in source */
+	/* picture.  Solid colors and gradients are read from the pixmaps */
+	/* they are cached in.  Those may be created here, which can evict */
+	/* other pixmaps from GPU memory, so no other pixmap config is read */
+	/* until they are. */
+	Z160Buffer z160BufferSrc;
+	IMXEXASolidCachePtr pSolid = NULL;
+	IMXEXAGradientCachePtr pGradient = NULL;
+	if (NULL != pPictureSrc->pDrawable) {
+
+		if (!Z160GetPictureConfig(pScrn, pPictureSrc, &z160BufferSrc)) {
+			Z160EXACountCompositeFallback(fPtr, op);
+			return FALSE;
+		}
+
+	} else if (SourcePictTypeSolidFill == pPictureSrc->pSourcePict->type) {
+
+		pSolid = Z160EXAGetSolidColor(pPixmapDst->drawable.pScreen, fPtr,
+				pPictureSrc->pSourcePict->solidFill.color,
+				&z160BufferSrc);
+		if (NULL == pSolid) {
+			Z160EXACountCompositeFallback(fPtr, op);
+			return FALSE;
+		}
+		pPixmapSrc = fPtr->pSolidPixmap;
+
+	} else {
+
+		pGradient = Z160EXAGetGradient(pPixmapDst->drawable.pScreen, fPtr,
+				pPictureSrc);
+		if ((NULL == pGradient) ||
+			!Z160GetPixmapConfig(pGradient->pPixmap, &z160BufferSrc)) {
+			Z160EXACountCompositeFallback(fPtr, op);
+			return FALSE;
+		}
+		z160BufferSrc.format = Z160_FORMAT_8888;
+		z160BufferSrc.swapRB = FALSE;
+		z160BufferSrc.opaque = FALSE;
+		z160BufferSrc.alpha4 = FALSE;
+		pPixmapSrc = pGradient->pPixmap;
+	}
+
+	/* Determine Z160 config that matches pixel format used in target picture. */
+	Z160Buffer z160BufferDst;
+	if (!Z160CanAcceleratePixmap(pPixmapDst) ||
+		!Z160GetPictureConfig(pScrn, pPictureDst, &z160BufferDst)) {
+
+		Z160EXACountCompositeFallback(fPtr, op);
+		return FALSE;
+	}
+
+	/* Repeating sources one pixel in size are constant, and other */
+	/* repeating sources are patterns. */
+	Bool srcConst = (NULL != pSolid);
+	Bool srcPattern = (NULL != pGradient);
+	if ((NULL != pPictureSrc->pDrawable) && pPictureSrc->repeat) {
+
+		srcConst = Z160IsDrawablePixelOnly(pPictureSrc->pDrawable);
+		srcPattern = !srcConst;
+	}
+
+	/* Map the Xrender blend op into the Z160 blend op, or into the */
+	/* passes of an op the Z160 cannot blend. */
+	const int resolvedOp = Z160EXAResolveCompositeOp(op, pPictureDst);
+	Z160_BLEND z160BlendOp = Z160SetupBlendOpTable[resolvedOp];
+	const IMXEXACompositePlanRec* plan =
+		Z160EXAGetCompositePlan(resolvedOp, pPictureMask);
+
+	/* The scratch pixmap may have been moved out of GPU memory since */
+	/* the composite was checked. */
+	Z160Buffer z160BufferScratch;
+	if ((NULL != plan) && plan->usesScratch) {
+
+		if ((NULL == fPtr->pScratchPixmap) ||
+			!Z160GetPixmapConfig(fPtr->pScratchPixmap, &z160BufferScratch)) {
+
+			Z160EXACountCompositeFallback(fPtr, op);
+			return FALSE;
+		}
+		z160BufferScratch.format = Z160_FORMAT_8888;
+		z160BufferScratch.swapRB = FALSE;
+		z160BufferScratch.opaque = FALSE;
+		z160BufferScratch.alpha4 = FALSE;
+	}
+
+	/* Choose the Z160 blend setup, which is done when the first */
+	/* rectangles are submitted. */
+	IMXEXABlendKind blend = IMX_EXA_BLEND_IMAGE;
+	Z160Buffer z160BufferMask;
+	Bool blendDefined = FALSE;
+
+	/* Mask blend? */
+	fPtr->gpuOpSetup = FALSE;
+	if (NULL != pPictureMask) {
+		/* Determine Z160 config that matches pixel format used in mask picture */
+		if (!Z160GetPictureConfig(pScrn, pPictureMask, &z160BufferMask)) {
+			Z160EXACountCompositeFallback(fPtr, op);
+			return FALSE;
+		}
+
+		/* Blend repeating source using a mask */
+		if (srcConst || srcPattern) {
+			/* Source is 1x1 (constant) repeat pattern? */
+			if (srcConst) {
+
+				blend = IMX_EXA_BLEND_CONST_MASKED;
+				blendDefined = TRUE;
+			/* Source is arbitrary sized repeat pattern? */
+			} else {
+
+				blend = IMX_EXA_BLEND_PATTERN_MASKED;
+				blendDefined = TRUE;
+			}
+
+		/* Simple (source IN mask) blend */
+		} else {
+			blend = IMX_EXA_BLEND_IMAGE_MASKED;
+			blendDefined = TRUE;
+		}
+	/* Source only (no mask) blend */
+	} else {
+		/* Repeating source (pattern)? */
+		if (srcConst || srcPattern) {
+			/* Source is 1x1 (constant) repeat pattern? */
+			if (srcConst) {
+
+				blend = IMX_EXA_BLEND_CONST;
+				blendDefined = TRUE;
+			/* Source is arbitrary sized repeat pattern? */
+			} else {
+				blend = IMX_EXA_BLEND_PATTERN;
+				blendDefined = TRUE;
+			}
+		/* Simple source blend */
+		} else {
+			blend = IMX_EXA_BLEND_IMAGE;
+			blendDefined = TRUE;
+		}
+	}
+
+	/* Note if the composite operation is being accelerated. */
+	if (blendDefined) {
+
+		Z160EXAAcceptArea(fPtr, IMX_EXA_BATCH_COMPOSITE,
+			pPixmapDst->drawable.bitsPerPixel);
+		Z160EXABeginBatch(fPtr, IMX_EXA_BATCH_COMPOSITE);
+		fPtr->batch->target = z160BufferDst;
+		fPtr->batch->src = z160BufferSrc;
+		if (NULL != pPictureMask) {
+			fPtr->batch->mask = z160BufferMask;
+		}
+		fPtr->batch->blend = blend;
+		fPtr->batch->blendOp = z160BlendOp;
+		fPtr->compositeGradient = pGradient;
+
+		Z160EXAMarkPixmapUsed(pPixmapDst);
+		Z160EXAMarkPixmapUsed(pPixmapSrc);
+		Z160EXAMarkPixmapUsed(pPixmapMask);
+		Z160EXAFencePixmap(fPtr, pPixmapDst);
+		Z160EXAFencePixmap(fPtr, pPixmapSrc);
+		Z160EXAFencePixmap(fPtr, pPixmapMask);
+
+		/* The rectangles are drawn by the passes of the plan. */
+		if (NULL != plan) {
+
+			fPtr->compositePlan = plan;
+			fPtr->planBlend = blend;
+			fPtr->planTarget = z160BufferDst;
+			fPtr->planSrc = z160BufferSrc;
+			if (NULL != pPictureMask) {
+				fPtr->planMask = z160BufferMask;
+			}
+			if (plan->usesScratch) {
+				fPtr->planScratch = z160BufferScratch;
+				Z160EXAMarkPixmapUsed(fPtr->pScratchPixmap);
+				Z160EXAFencePixmap(fPtr, fPtr->pScratchPixmap);
+				fPtr->scratchUsedTime = GetTimeInMillis();
+			}
+		}
+
+		if ((NULL != plan) || (resolvedOp != op)) {
+			++(fPtr->numCompositeDecomposed[op]);
+		} else {
+			++(fPtr->numCompositeDirect[op]);
+		}
+
+		return TRUE;
+	}
+
+#if IMX_EXA_DEBUG_CHECK_COMPOSITE
+
+	/* Log info about which operations were not accelerated. */
+
+	/* Source OP Target */
+	if (NULL == pPictureMask) {
+
+		xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+			"Z160EXAPrepareComposite not support: SRC(%s%dx%d,%s%d%s:%d%d%d%d) op=%d DST(%d%s:%d%d%d%d)\n",
+			pPictureSrc->repeat ? "R" : "",
+			(NULL != pPictureSrc->pDrawable) ? pPictureSrc->pDrawable->width : 0,
+			(NULL != pPictureSrc->pDrawable) ? pPictureSrc->pDrawable->height : 0,
+			(NULL != pPictureSrc->transform) ? "T" : "",
+			PICT_FORMAT_BPP(pPictureSrc->format),
+			Z160GetPictureTypeName(pPictureSrc),
+			PICT_FORMAT_A(pPictureSrc->format),
+			PICT_FORMAT_R(pPictureSrc->format),
+			PICT_FORMAT_G(pPictureSrc->format),
+			PICT_FORMAT_B(pPictureSrc->format),
+			op,
+			PICT_FORMAT_BPP(pPictureDst->format),
+			Z160GetPictureTypeName(pPictureDst),
+			PICT_FORMAT_A(pPictureDst->format),
+			PICT_FORMAT_R(pPictureDst->format),
+			PICT_FORMAT_G(pPictureDst->format),
+			PICT_FORMAT_B(pPictureDst->format));
+
+
+	/* (Source IN Mask) OP Target */
+	} else {
+
+		xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+			"Z160EXAPrepareComposite not support: SRC(%s%dx%d,%s%d%s:%d%d%d%d) MASK(%s%dx%d,%s%d%s:%s%d%d%d%d) op=%d DST(%d%s:%d%d%d%d)\n",
+			pPictureSrc->repeat ? "R" : "",
+			(NULL != pPictureSrc->pDrawable) ? pPictureSrc->pDrawable->width : 0,
+			(NULL != pPictureSrc->pDrawable) ? pPictureSrc->pDrawable->height : 0,
+			(NULL != pPictureSrc->transform) ? "T" : "",
+			PICT_FORMAT_BPP(pPictureSrc->format),
+			Z160GetPictureTypeName(pPictureSrc),
+			PICT_FORMAT_A(pPictureSrc->format),
+			PICT_FORMAT_R(pPictureSrc->format),
 			PICT_FORMAT_G(pPictureSrc->format),
 			PICT_FORMAT_B(pPictureSrc->format),
 			pPictureMask->repeat ? "R" : "",
@@ -2003,112 +6473,956 @@ Z160EXAPrepareComposite(
 
 #endif
 
-	return FALSE;
+	Z160EXACountCompositeFallback(fPtr, op);
+	return FALSE;
+}
+
+/* Whether the rectangle overlaps one already queued in the batch. */
+static Bool
+Z160EXAOverlapsBatch(IMXEXABatchPtr batch, int x, int y, int width, int height)
+{
+	int i;
+
+	for (i = 0; i < batch->numRects; ++i) {
+
+		const IMXEXABatchRectPtr pRect = &batch->rects[i];
+		if ((x < pRect->dstX + pRect->width) &&
+			(pRect->dstX < x + width) &&
+			(y < pRect->dstY + pRect->height) &&
+			(pRect->dstY < y + height)) {
+
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static void
+Z160EXAComposite(
+	PixmapPtr pPixmapDst,
+	int srcX,
+	int srcY,
+	int maskX,
+	int maskY,
+	int dstX,
+	int dstY,
+	int width,
+	int height)
+{
+	/* Access screen associated with dst pixmap */
+	ScrnInfoPtr pScrn = xf86Screens[pPixmapDst->drawable.pScreen->myNum];
+
+	/* Access driver specific data */
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	/* Each pass draws all the queued rectangles, so those of a */
+	/* composite done in passes may not overlap. */
+	if ((NULL != fPtr->compositePlan) &&
+		(1 < fPtr->compositePlan->numPasses) &&
+		Z160EXAOverlapsBatch(fPtr->batch, dstX, dstY, width, height)) {
+
+		Z160EXAFlushBatch(fPtr);
+	}
+
+	if (NULL != fPtr->compositeGradient) {
+
+		Z160EXAQueueGradientRects(fPtr, fPtr->compositeGradient,
+			srcX, srcY, maskX, maskY, dstX, dstY, width, height);
+		return;
+	}
+
+	IMXEXABatchRectPtr pRect = Z160EXAQueueBatchRect(fPtr);
+	pRect->dstX = dstX;
+	pRect->dstY = dstY;
+	pRect->width = width;
+	pRect->height = height;
+	pRect->srcX = srcX;
+	pRect->srcY = srcY;
+	pRect->maskX = maskX;
+	pRect->maskY = maskY;
+
+#if IMX_EXA_DEBUG_INSTRUMENT_SYNCS
+
+	++(fPtr->numCompositeBeforeSync);
+
+#endif
+
+#if 0
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		"Z160EXAComposite called with src=(%d-%d,%d-%d) dst=(%d-%d,%d-%d)\n",
+		srcX, srcX+width, srcY, srcY+height, dstX, dstX+width, dstY, dstY+height);
+#endif
+}
+
+static void
+Z160EXADoneComposite(PixmapPtr pPixmapDst)
+{
+	/* Access screen associated with this pixmap */
+	ScrnInfoPtr pScrn = xf86Screens[pPixmapDst->drawable.pScreen->myNum];
+
+	/* Access driver specific data */
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	/* Submit queued rectangles.  The flush to the GPU is deferred to */
+	/* the block handler, or to when too much has gone unflushed. */
+	Z160EXAEndBatch(fPtr);
+}
+
+#if IMX_EXA_ENABLE_GLYPH_ATLAS
+
+/* Picture formats of the glyphs in each kind of atlas page. */
+static const CARD32 Z160GlyphFormats[IMX_EXA_GLYPH_NUM_FORMATS] =
+	{ PICT_a8, PICT_a8r8g8b8 };
+
+static inline unsigned
+Z160EXAGlyphHash(GlyphPtr pGlyph)
+{
+	return ((unsigned long)pGlyph >> 4) & (IMX_EXA_GLYPH_HASH_SIZE - 1);
+}
+
+/* Find where a glyph was copied into the atlas, or return NULL. */
+static IMXEXAGlyphEntryPtr
+Z160EXALookUpGlyph(IMXEXAPtr fPtr, GlyphPtr pGlyph)
+{
+	IMXEXAGlyphEntryPtr pEntry = fPtr->glyphHash[Z160EXAGlyphHash(pGlyph)];
+
+	while ((NULL != pEntry) && (pGlyph != pEntry->pGlyph)) {
+		pEntry = pEntry->hashNext;
+	}
+
+	return pEntry;
+}
+
+/* Forget a glyph copied into the atlas.  The space it took is only */
+/* reused once its shelf is emptied. */
+static void
+Z160EXAForgetGlyph(IMXEXAPtr fPtr, IMXEXAGlyphEntryPtr pEntry)
+{
+	IMXEXAGlyphEntryPtr* ppEntry =
+		&fPtr->glyphHash[Z160EXAGlyphHash(pEntry->pGlyph)];
+	while (pEntry != *ppEntry) {
+		ppEntry = &(*ppEntry)->hashNext;
+	}
+	*ppEntry = pEntry->hashNext;
+
+	ppEntry = &pEntry->pShelf->entries;
+	while (pEntry != *ppEntry) {
+		ppEntry = &(*ppEntry)->shelfNext;
+	}
+	*ppEntry = pEntry->shelfNext;
+
+	IMX_EXA_SlabFree(&fPtr->glyphSlab, pEntry);
+}
+
+/* Empty a shelf once the GPU is done reading its glyphs. */
+static void
+Z160EXAEmptyGlyphShelf(IMXEXAPtr fPtr, IMXEXAGlyphShelfPtr pShelf)
+{
+	while (NULL != pShelf->entries) {
+		Z160EXAForgetGlyph(fPtr, pShelf->entries);
+	}
+
+	Z160WaitSeq(fPtr, pShelf->gpuSeq);
+	pShelf->x = 0;
+	++(fPtr->numGlyphShelfEvictions);
+}
+
+/* Create the picture of an atlas page.  Returns FALSE if there is */
+/* no memory for it. */
+static Bool
+Z160EXACreateGlyphPage(ScreenPtr pScreen, IMXEXAGlyphPagePtr pPage,
+			CARD32 format)
+{
+	/* Both formats have as many bits per pixel as their depth. */
+	const int depth = PICT_FORMAT_BPP(format);
+	PixmapPtr pPixmap = (*pScreen->CreatePixmap)(pScreen,
+				IMX_EXA_GLYPH_PAGE_SIZE, IMX_EXA_GLYPH_PAGE_SIZE,
+				depth, IMX_EXA_CREATE_PIXMAP_USAGE_GLYPH_PAGE);
+	if (NULL == pPixmap) {
+		return FALSE;
+	}
+
+	/* The offscreen memory may have been used by the GPU for a */
+	/* pixmap destroyed since. */
+	Z160EXAWaitPixmap(pPixmap);
+
+	/* ARGB glyphs are component alpha, as glyph pictures are. */
+	XID componentAlpha = (0 != PICT_FORMAT_RGB(format));
+	int error;
+	pPage->pPicture = CreatePicture(0, &pPixmap->drawable,
+				PictureMatchFormat(pScreen, depth, format),
+				CPComponentAlpha, &componentAlpha,
+				serverClient, &error);
+
+	/* The picture holds the pixmap. */
+	(*pScreen->DestroyPixmap)(pPixmap);
+
+	if (NULL == pPage->pPicture) {
+		return FALSE;
+	}
+
+	pPage->lastRun = 0;
+	pPage->top = 0;
+	pPage->numShelves = 0;
+	return TRUE;
+}
+
+/* Find room for a glyph of width by height pixels in the atlas pages */
+/* of a format, emptying the shelf or page used least recently if */
+/* there is none.  Shelves used by the current glyph run are kept. */
+/* Returns the shelf whose first free column takes the glyph, or NULL. */
+static IMXEXAGlyphShelfPtr
+Z160EXAFindGlyphSpace(ScreenPtr pScreen, IMXEXAPtr fPtr, int format,
+			int width, int height, IMXEXAGlyphPagePtr* ppPage)
+{
+	IMXEXAGlyphPagePtr pages = fPtr->glyphPages[format];
+	const int shelfHeight = IMX_EXA_ALIGN(height, IMX_EXA_GLYPH_SHELF_ROWS);
+	IMXEXAGlyphShelfPtr pOldest = NULL;
+	IMXEXAGlyphPagePtr pOldestPage = NULL;
+	IMXEXAGlyphPagePtr pNewShelfPage = NULL;
+	int i, j;
+
+	for (i = 0; i < IMX_EXA_GLYPH_MAX_PAGES; ++i) {
+
+		IMXEXAGlyphPagePtr pPage = &pages[i];
+		if (NULL == pPage->pPicture) {
+
+			if ((NULL == pNewShelfPage) &&
+				Z160EXACreateGlyphPage(pScreen, pPage,
+					Z160GlyphFormats[format])) {
+
+				pNewShelfPage = pPage;
+			}
+			break;
+		}
+
+		for (j = 0; j < pPage->numShelves; ++j) {
+
+			IMXEXAGlyphShelfPtr pShelf = &pPage->shelves[j];
+			if ((shelfHeight == pShelf->height) &&
+				(pShelf->x + width <= IMX_EXA_GLYPH_PAGE_SIZE)) {
+
+				*ppPage = pPage;
+				return pShelf;
+			}
+			if ((shelfHeight <= pShelf->height) &&
+				(pShelf->lastRun != fPtr->glyphRuns) &&
+				((NULL == pOldest) ||
+					(pShelf->lastRun < pOldest->lastRun))) {
+
+				pOldest = pShelf;
+				*ppPage = pPage;
+			}
+		}
+
+		if ((NULL == pNewShelfPage) &&
+			(pPage->top + shelfHeight <= IMX_EXA_GLYPH_PAGE_SIZE)) {
+
+			pNewShelfPage = pPage;
+		}
+		if ((pPage->lastRun != fPtr->glyphRuns) &&
+			((NULL == pOldestPage) ||
+				(pPage->lastRun < pOldestPage->lastRun))) {
+
+			pOldestPage = pPage;
+		}
+	}
+
+	/* Start a shelf below the others. */
+	if (NULL != pNewShelfPage) {
+
+		IMXEXAGlyphShelfPtr pShelf =
+			&pNewShelfPage->shelves[pNewShelfPage->numShelves++];
+		pShelf->y = pNewShelfPage->top;
+		pShelf->height = shelfHeight;
+		pShelf->x = 0;
+		pShelf->lastRun = 0;
+		pShelf->gpuSeq = 0;
+		pShelf->entries = NULL;
+		pNewShelfPage->top += shelfHeight;
+
+		*ppPage = pNewShelfPage;
+		return pShelf;
+	}
+
+	/* Reuse the shelf which was used least recently. */
+	if (NULL != pOldest) {
+
+		Z160EXAEmptyGlyphShelf(fPtr, pOldest);
+		return pOldest;
+	}
+
+	/* No shelf is tall enough, so start the page used least */
+	/* recently over with one. */
+	if (NULL != pOldestPage) {
+
+		for (j = 0; j < pOldestPage->numShelves; ++j) {
+			Z160EXAEmptyGlyphShelf(fPtr, &pOldestPage->shelves[j]);
+		}
+		pOldestPage->numShelves = 1;
+		pOldestPage->top = shelfHeight;
+		pOldestPage->shelves[0].y = 0;
+		pOldestPage->shelves[0].height = shelfHeight;
+		pOldestPage->shelves[0].lastRun = 0;
+
+		*ppPage = pOldestPage;
+		return &pOldestPage->shelves[0];
+	}
+
+	return NULL;
+}
+
+/* Find a glyph in the atlas, copying it in if it is not there yet. */
+/* Returns NULL if it cannot be drawn from the atlas. */
+static IMXEXAGlyphEntryPtr
+Z160EXAGetGlyph(ScreenPtr pScreen, IMXEXAPtr fPtr, GlyphPtr pGlyph,
+		int format)
+{
+	IMXEXAGlyphEntryPtr pEntry = Z160EXALookUpGlyph(fPtr, pGlyph);
+
+	if (NULL == pEntry) {
+
+		const int width = pGlyph->info.width;
+		const int height = pGlyph->info.height;
+		IMXEXAGlyphPagePtr pPage;
+		IMXEXAGlyphShelfPtr pShelf = Z160EXAFindGlyphSpace(pScreen,
+				fPtr, format, width, height, &pPage);
+		if (NULL == pShelf) {
+			return NULL;
+		}
+
+		/* The page may have been moved out of GPU memory. */
+		PixmapPtr pPagePixmap = Z160EXAGetPicturePixmap(pPage->pPicture);
+		Z160Buffer z160Buffer;
+		if (!Z160CanAcceleratePixmap(pPagePixmap) ||
+			!Z160GetPixmapConfig(pPagePixmap, &z160Buffer)) {
+			return NULL;
+		}
+
+		PixmapPtr pGlyphPixmap = Z160EXAGetPicturePixmap(
+				GlyphPicture(pGlyph)[pScreen->myNum]);
+		const CARD8* pSrc =
+			(const CARD8*)Z160EXAGetPixmapAddress(pGlyphPixmap);
+		if (NULL == pSrc) {
+			return NULL;
+		}
+
+		pEntry = (IMXEXAGlyphEntryPtr)IMX_EXA_SlabAlloc(&fPtr->glyphSlab);
+		if (NULL == pEntry) {
+			return NULL;
+		}
+
+		/* Copy the glyph into the free columns of the shelf. */
+		Z160EXAWaitPixmap(pGlyphPixmap);
+		const int bytesPerPixel = pGlyphPixmap->drawable.bitsPerPixel / 8;
+		CARD8* pDst = (CARD8*)Z160EXAGetPixmapAddress(pPagePixmap) +
+				pShelf->y * z160Buffer.pitch +
+				pShelf->x * bytesPerPixel;
+		int row;
+		for (row = 0; row < height; ++row) {
+
+			memcpy(pDst, pSrc, width * bytesPerPixel);
+			pDst += z160Buffer.pitch;
+			pSrc += pGlyphPixmap->devKind;
+		}
+		++(fPtr->numGlyphUploads);
+
+		pEntry->pGlyph = pGlyph;
+		pEntry->pPage = pPage;
+		pEntry->pShelf = pShelf;
+		pEntry->x = pShelf->x;
+		pEntry->y = pShelf->y;
+		pShelf->x += width;
+
+		const unsigned hash = Z160EXAGlyphHash(pGlyph);
+		pEntry->hashNext = fPtr->glyphHash[hash];
+		fPtr->glyphHash[hash] = pEntry;
+		pEntry->shelfNext = pShelf->entries;
+		pShelf->entries = pEntry;
+	}
+
+	/* Keep the glyph in the atlas until the run is drawn. */
+	pEntry->pShelf->lastRun = fPtr->glyphRuns;
+	pEntry->pPage->lastRun = fPtr->glyphRuns;
+
+	return pEntry;
+}
+
+static int
+Z160EXACompareBoxes(const void* a, const void* b)
+{
+	return ((const BoxRec*)a)->x1 - ((const BoxRec*)b)->x1;
+}
+
+/* Whether any two of the boxes overlap.  The boxes are sorted. */
+static Bool
+Z160EXABoxesOverlap(BoxPtr boxes, int numBoxes)
+{
+	int i, j;
+
+	qsort(boxes, numBoxes, sizeof(BoxRec), Z160EXACompareBoxes);
+
+	for (i = 0; i < numBoxes; ++i) {
+		for (j = i + 1;
+			(j < numBoxes) && (boxes[j].x1 < boxes[i].x2); ++j) {
+
+			if ((boxes[j].y1 < boxes[i].y2) &&
+				(boxes[i].y1 < boxes[j].y2)) {
+				return TRUE;
+			}
+		}
+	}
+
+	return FALSE;
+}
+
+/* Whether the op leaves the target as it is where the mask is zero, */
+/* so that glyphs drawn through a mask may be drawn one at a time. */
+static Bool
+Z160EXAIsOpMaskBounded(CARD8 op)
+{
+	switch (op) {
+
+	case PictOpDst:
+	case PictOpOver:
+	case PictOpOverReverse:
+	case PictOpOutReverse:
+	case PictOpAtop:
+	case PictOpXor:
+	case PictOpAdd:
+		return TRUE;
+
+	default:
+		return FALSE;
+	}
+}
+
+/* Check that the glyphs can be drawn from the atlas, and find the */
+/* format of their pages.  Glyphs drawn through a mask must be in its */
+/* format and must not overlap, so that they can be drawn one at a */
+/* time.  Sets *pAnyOrder when no glyphs overlap, so that they can be */
+/* drawn page by page.  Returns the format, or -1 if they cannot. */
+static int
+Z160EXACheckGlyphs(ScreenPtr pScreen, CARD8 op, PictFormatPtr maskFormat,
+			int nlist, GlyphListPtr list, GlyphPtr* glyphs,
+			Bool* pAnyOrder)
+{
+	int format = -1;
+	int numGlyphs = 0;
+	int i, n;
+
+	for (i = 0; i < nlist; ++i) {
+		numGlyphs += list[i].len;
+	}
+
+	if ((NULL != maskFormat) && !Z160EXAIsOpMaskBounded(op)) {
+		return -1;
+	}
+
+	BoxRec boxesOnStack[IMX_EXA_GLYPH_STACK_BOXES];
+	BoxPtr boxes = boxesOnStack;
+	if (IMX_EXA_GLYPH_STACK_BOXES < numGlyphs) {
+
+		boxes = malloc(numGlyphs * sizeof(BoxRec));
+		if (NULL == boxes) {
+			return -1;
+		}
+	}
+
+	int numBoxes = 0;
+	int x = 0, y = 0;
+	for (i = 0; i < nlist; ++i, ++list) {
+
+		x += list->xOff;
+		y += list->yOff;
+
+		for (n = 0; n < list->len; ++n) {
+
+			GlyphPtr pGlyph = *glyphs++;
+			const int width = pGlyph->info.width;
+			const int height = pGlyph->info.height;
+
+			if ((0 < width) && (0 < height)) {
+
+				if ((IMX_EXA_GLYPH_MAX_SIZE < width) ||
+					(IMX_EXA_GLYPH_MAX_SIZE < height)) {
+					format = -1;
+					goto done;
+				}
+
+				PicturePtr pPicture =
+					GlyphPicture(pGlyph)[pScreen->myNum];
+				if (NULL == pPicture) {
+					format = -1;
+					goto done;
+				}
+				int f = 0;
+				while ((f < IMX_EXA_GLYPH_NUM_FORMATS) &&
+					(Z160GlyphFormats[f] != pPicture->format)) {
+					++f;
+				}
+				if ((IMX_EXA_GLYPH_NUM_FORMATS == f) ||
+					((0 <= format) && (f != format)) ||
+					((NULL != maskFormat) &&
+						(maskFormat->format != pPicture->format))) {
+					format = -1;
+					goto done;
+				}
+				format = f;
+
+				BoxPtr pBox = &boxes[numBoxes++];
+				pBox->x1 = x - pGlyph->info.x;
+				pBox->y1 = y - pGlyph->info.y;
+				pBox->x2 = pBox->x1 + width;
+				pBox->y2 = pBox->y1 + height;
+			}
+
+			x += pGlyph->info.xOff;
+			y += pGlyph->info.yOff;
+		}
+	}
+
+	if (0 <= format) {
+
+		*pAnyOrder = !Z160EXABoxesOverlap(boxes, numBoxes);
+		if ((NULL != maskFormat) && !*pAnyOrder) {
+			format = -1;
+		}
+	}
+
+done:
+	if (boxesOnStack != boxes) {
+		free(boxes);
+	}
+
+	return format;
+}
+
+/* Draw the glyphs from the atlas, in one batch for each page when */
+/* they do not overlap, or else in order with a batch for each run of */
+/* glyphs in the same page.  Each glyph is drawn as the source through */
+/* the glyph as a mask.  Returns FALSE, having drawn nothing, if they */
+/* cannot be drawn from the atlas. */
+static Bool
+Z160EXADrawGlyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+		PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
+		int nlist, GlyphListPtr list, GlyphPtr* glyphs)
+{
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+	int i, n;
+
+	/* The GPU belongs to another VT while ours is away. */
+	if (!pScrn->vtSema) {
+		return FALSE;
+	}
+
+	/* Only the target clip is applied here, so sources from a */
+	/* pixmap must repeat and have no clip of their own. */
+	if ((NULL != pSrc->alphaMap) || (NULL != pDst->alphaMap)) {
+		return FALSE;
+	}
+	if ((NULL != pSrc->pDrawable) &&
+		((DRAWABLE_PIXMAP != pSrc->pDrawable->type) || !pSrc->repeat ||
+			(CT_NONE != pSrc->clientClipType))) {
+		return FALSE;
+	}
+
+	Bool anyOrder = FALSE;
+	const int format = Z160EXACheckGlyphs(pScreen, op, maskFormat,
+					nlist, list, glyphs, &anyOrder);
+	if (0 > format) {
+		return FALSE;
+	}
+
+	/* Copy the glyphs which are not in the atlas yet into it. */
+	++(fPtr->glyphRuns);
+	GlyphPtr* pGlyphs = glyphs;
+	for (i = 0; i < nlist; ++i) {
+		for (n = 0; n < list[i].len; ++n) {
+
+			GlyphPtr pGlyph = *pGlyphs++;
+			if ((0 < pGlyph->info.width) && (0 < pGlyph->info.height) &&
+				(NULL == Z160EXAGetGlyph(pScreen, fPtr, pGlyph,
+								format))) {
+				return FALSE;
+			}
+		}
+	}
+
+	/* Check that the pages used can be drawn from.  Glyphs which */
+	/* do not overlap are drawn in a pass over them for each page, */
+	/* others in a single pass. */
+	IMXEXAGlyphPagePtr passPages[IMX_EXA_GLYPH_MAX_PAGES];
+	int numPasses = 0;
+	for (i = 0; i < IMX_EXA_GLYPH_MAX_PAGES; ++i) {
+
+		IMXEXAGlyphPagePtr pPage = &fPtr->glyphPages[format][i];
+		if ((NULL == pPage->pPicture) ||
+			(fPtr->glyphRuns != pPage->lastRun)) {
+			continue;
+		}
+		if (!Z160EXACheckComposite(op, pSrc, pPage->pPicture, pDst)) {
+			return FALSE;
+		}
+		passPages[numPasses++] = pPage;
+	}
+	if (!anyOrder || (1 >= numPasses)) {
+		passPages[0] = NULL;
+		numPasses = 1;
+	}
+
+	/* Clip rectangles are in screen coordinates, and windows may */
+	/* be redirected into pixmaps placed elsewhere. */
+	PixmapPtr pPixmapSrc = Z160EXAGetPicturePixmap(pSrc);
+	PixmapPtr pPixmapDst = Z160EXAGetPicturePixmap(pDst);
+	const int dstX = pDst->pDrawable->x;
+	const int dstY = pDst->pDrawable->y;
+	int offsetX = 0, offsetY = 0;
+#ifdef COMPOSITE
+	if (DRAWABLE_WINDOW == pDst->pDrawable->type) {
+		offsetX = -pPixmapDst->screen_x;
+		offsetY = -pPixmapDst->screen_y;
+	}
+#endif
+	const int numClipRects = REGION_NUM_RECTS(pDst->pCompositeClip);
+	const BoxPtr clipRects = REGION_RECTS(pDst->pCompositeClip);
+	const BoxPtr clipExtents = &pDst->pCompositeClip->extents;
+
+	/* Source position of the target drawable origin. */
+	const int srcOriginX = xSrc - list->xOff;
+	const int srcOriginY = ySrc - list->yOff;
+
+	IMXEXAGlyphPagePtr pBatchPage = NULL;
+	Bool prepareFailed = FALSE;
+	int pass;
+	for (pass = 0; pass < numPasses; ++pass) {
+
+		GlyphListPtr pList = list;
+		pGlyphs = glyphs;
+		int x = 0, y = 0;
+		for (i = 0; i < nlist; ++i, ++pList) {
+
+			x += pList->xOff;
+			y += pList->yOff;
+
+			for (n = 0; n < pList->len; ++n) {
+
+				GlyphPtr pGlyph = *pGlyphs++;
+				const int glyphX = x - pGlyph->info.x;
+				const int glyphY = y - pGlyph->info.y;
+				const int width = pGlyph->info.width;
+				const int height = pGlyph->info.height;
+				x += pGlyph->info.xOff;
+				y += pGlyph->info.yOff;
+
+				if ((0 == width) || (0 == height)) {
+					continue;
+				}
+
+				/* Glyphs outside the clip extents are not drawn. */
+				const int x1 = glyphX + dstX;
+				const int y1 = glyphY + dstY;
+				const int x2 = x1 + width;
+				const int y2 = y1 + height;
+				if ((x2 <= clipExtents->x1) || (clipExtents->x2 <= x1) ||
+					(y2 <= clipExtents->y1) || (clipExtents->y2 <= y1)) {
+					continue;
+				}
+
+				/* Each pass page by page draws only its page. */
+				IMXEXAGlyphEntryPtr pEntry =
+					Z160EXALookUpGlyph(fPtr, pGlyph);
+				if ((NULL != passPages[pass]) &&
+					(pEntry->pPage != passPages[pass])) {
+					continue;
+				}
+
+				/* Start a batch for each page drawn from in turn. */
+				if (!prepareFailed && (pEntry->pPage != pBatchPage)) {
+
+					if (NULL != pBatchPage) {
+						Z160EXADoneComposite(pPixmapDst);
+						pBatchPage = NULL;
+					}
+					if (Z160EXAPrepareComposite(op, pSrc,
+							pEntry->pPage->pPicture, pDst,
+							pPixmapSrc,
+							Z160EXAGetPicturePixmap(
+								pEntry->pPage->pPicture),
+							pPixmapDst)) {
+						pBatchPage = pEntry->pPage;
+					} else {
+						prepareFailed = TRUE;
+					}
+				}
+
+				/* Glyphs after a failed setup are composited */
+				/* one at a time. */
+				if (prepareFailed) {
+
+					CompositePicture(op, pSrc,
+						GlyphPicture(pGlyph)[pScreen->myNum],
+						pDst,
+						srcOriginX + glyphX, srcOriginY + glyphY,
+						0, 0, glyphX, glyphY, width, height);
+					continue;
+				}
+				pEntry->pShelf->gpuSeq = fPtr->gpuSeq;
+				++(fPtr->numGlyphsDrawn);
+
+				int r;
+				for (r = 0; r < numClipRects; ++r) {
+
+					const BoxPtr pClip = &clipRects[r];
+					const int cx1 = (x1 > pClip->x1) ? x1 : pClip->x1;
+					const int cy1 = (y1 > pClip->y1) ? y1 : pClip->y1;
+					const int cx2 = (x2 < pClip->x2) ? x2 : pClip->x2;
+					const int cy2 = (y2 < pClip->y2) ? y2 : pClip->y2;
+					if ((cx1 >= cx2) || (cy1 >= cy2)) {
+						continue;
+					}
+
+					Z160EXAComposite(pPixmapDst,
+						srcOriginX + cx1 - dstX,
+						srcOriginY + cy1 - dstY,
+						pEntry->x + cx1 - x1,
+						pEntry->y + cy1 - y1,
+						cx1 + offsetX, cy1 + offsetY,
+						cx2 - cx1, cy2 - cy1);
+				}
+			}
+		}
+	}
+
+	if (NULL != pBatchPage) {
+		Z160EXADoneComposite(pPixmapDst);
+		exaMarkSync(pScreen);
+	}
+
+	++(fPtr->numGlyphRuns);
+	return TRUE;
 }
 
+/* Draw glyphs from the atlas, or have EXA draw them if they cannot */
+/* be drawn from it. */
 static void
-Z160EXAComposite(
-	PixmapPtr pPixmapDst,
-	int srcX,
-	int srcY,
-	int maskX,
-	int maskY,
-	int dstX,
-	int dstY,
-	int width,
-	int height)
+Z160EXAGlyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+		PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
+		int nlist, GlyphListPtr list, GlyphPtr* glyphs)
 {
-	/* Access screen associated with dst pixmap */
-	ScrnInfoPtr pScrn = xf86Screens[pPixmapDst->drawable.pScreen->myNum];
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	PictureScreenPtr ps = GetPictureScreen(pScreen);
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
 
-	/* Access driver specific data */
+	if (Z160EXADrawGlyphs(op, pSrc, pDst, maskFormat, xSrc, ySrc,
+				nlist, list, glyphs)) {
+		return;
+	}
+
+	++(fPtr->numGlyphRunFallbacks);
+
+	ps->Glyphs = fPtr->Glyphs;
+	(*ps->Glyphs)(op, pSrc, pDst, maskFormat, xSrc, ySrc,
+			nlist, list, glyphs);
+	ps->Glyphs = Z160EXAGlyphs;
+}
+
+/* Forget a glyph being freed. */
+static void
+Z160EXAUnrealizeGlyph(ScreenPtr pScreen, GlyphPtr pGlyph)
+{
+	PictureScreenPtr ps = GetPictureScreen(pScreen);
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
 	IMXPtr imxPtr = IMXPTR(pScrn);
 	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
 
-	/* Perform rectangle render based on setup in PrepareComposite */
-	switch (z160_get_setup(fPtr->gpuContext)) {
+	IMXEXAGlyphEntryPtr pEntry = Z160EXALookUpGlyph(fPtr, pGlyph);
+	if (NULL != pEntry) {
+		Z160EXAForgetGlyph(fPtr, pEntry);
+	}
 
-		case Z160_SETUP_BLEND_IMAGE:
-			z160_blend_image_rect(
-				fPtr->gpuContext,
-				dstX, dstY,
-				width, height,
-				srcX, srcY);
-			break;
+	ps->UnrealizeGlyph = fPtr->UnrealizeGlyph;
+	(*ps->UnrealizeGlyph)(pScreen, pGlyph);
+	ps->UnrealizeGlyph = Z160EXAUnrealizeGlyph;
+}
 
-		case Z160_SETUP_BLEND_IMAGE_MASKED:
-			z160_blend_image_masked_rect(
-				fPtr->gpuContext,
-				dstX, dstY,
-				width, height,
-				srcX, srcY,
-				maskX, maskY);
-			break;
+/* Free the atlas pages and forget the glyphs in them. */
+static void
+Z160EXAFreeGlyphAtlas(IMXEXAPtr fPtr)
+{
+	int format, i, j;
 
-		case Z160_SETUP_BLEND_CONST:
-			z160_blend_const_rect(
-				fPtr->gpuContext,
-				dstX, dstY,
-				width, height);
-			break;
+	for (format = 0; format < IMX_EXA_GLYPH_NUM_FORMATS; ++format) {
+		for (i = 0; i < IMX_EXA_GLYPH_MAX_PAGES; ++i) {
 
-		case Z160_SETUP_BLEND_CONST_MASKED:
-			z160_blend_const_masked_rect(
-				fPtr->gpuContext,
-				dstX, dstY,
-				width, height,
-				maskX, maskY);
-			break;
+			IMXEXAGlyphPagePtr pPage = &fPtr->glyphPages[format][i];
+			if (NULL == pPage->pPicture) {
+				continue;
+			}
+			for (j = 0; j < pPage->numShelves; ++j) {
 
-		case Z160_SETUP_BLEND_PATTERN:
-			z160_blend_pattern_rect(
-				fPtr->gpuContext,
-				dstX, dstY,
-				width, height,
-				srcX, srcY);
-			break;
-		case Z160_SETUP_BLEND_PATTERN_MASKED:
-			z160_blend_pattern_masked_rect(
-				fPtr->gpuContext,
-				dstX, dstY,
-				width, height,
-				srcX, srcY,
-				maskX, maskY);
-			break;
-		default:
-			return;
+				IMXEXAGlyphShelfPtr pShelf = &pPage->shelves[j];
+				while (NULL != pShelf->entries) {
+					Z160EXAForgetGlyph(fPtr, pShelf->entries);
+				}
+			}
+			FreePicture(pPage->pPicture, 0);
+			pPage->pPicture = NULL;
+		}
 	}
+}
 
-#if IMX_EXA_DEBUG_INSTRUMENT_SYNCS
+#endif
 
-	++(fPtr->numCompositeBeforeSync);
+#if IMX_EXA_ENABLE_COMPOSITE_RECTS
 
-#endif
+/* Blend the color into the rectangles in one batch, each clipped to */
+/* the target clip.  The rectangles are queued in order, so that the */
+/* color is blended once for each rectangle where they overlap. */
+/* Returns FALSE, having drawn nothing, if they cannot be blended. */
+static Bool
+Z160EXADrawCompositeRects(CARD8 op, PicturePtr pDst, xRenderColor* color,
+				int nRect, xRectangle* rects)
+{
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	int i, r;
 
-#if 0
-	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
-		"Z160EXAComposite called with src=(%d-%d,%d-%d) dst=(%d-%d,%d-%d)\n",
-		srcX, srcX+width, srcY, srcY+height, dstX, dstX+width, dstY, dstY+height);
+	/* The GPU belongs to another VT while ours is away. */
+	if (!pScrn->vtSema) {
+		return FALSE;
+	}
+	if (NULL != pDst->alphaMap) {
+		return FALSE;
+	}
+
+	/* The server does not track damage for rectangles drawn here, */
+	/* so the area they cover is reported once they are drawn. */
+	RegionPtr pRegion = RECTS_TO_REGION(pScreen, nRect, rects, CT_UNSORTED);
+	if (NULL == pRegion) {
+		return FALSE;
+	}
+	REGION_TRANSLATE(pScreen, pRegion,
+		pDst->pDrawable->x, pDst->pDrawable->y);
+	REGION_INTERSECT(pScreen, pRegion, pRegion, pDst->pCompositeClip);
+
+	/* The color is drawn as a solid source picture, from the solid */
+	/* color pixmap, and ops the Z160 cannot blend are done in passes. */
+	int error;
+	PicturePtr pSrc = CreateSolidPicture(0, color, &error);
+	if (NULL == pSrc) {
+		REGION_DESTROY(pScreen, pRegion);
+		return FALSE;
+	}
+	PixmapPtr pPixmapDst = Z160EXAGetPicturePixmap(pDst);
+	if (!Z160EXACheckComposite(op, pSrc, NULL, pDst) ||
+		!Z160EXAPrepareComposite(op, pSrc, NULL, pDst,
+						NULL, NULL, pPixmapDst)) {
+		FreePicture(pSrc, 0);
+		REGION_DESTROY(pScreen, pRegion);
+		return FALSE;
+	}
+	DamageRegionAppend(pDst->pDrawable, pRegion);
+
+	/* Clip rectangles are in screen coordinates, and windows may */
+	/* be redirected into pixmaps placed elsewhere. */
+	const int dstX = pDst->pDrawable->x;
+	const int dstY = pDst->pDrawable->y;
+	int offsetX = 0, offsetY = 0;
+#ifdef COMPOSITE
+	if (DRAWABLE_WINDOW == pDst->pDrawable->type) {
+		offsetX = -pPixmapDst->screen_x;
+		offsetY = -pPixmapDst->screen_y;
+	}
 #endif
+	const int numClipRects = REGION_NUM_RECTS(pDst->pCompositeClip);
+	const BoxPtr clipRects = REGION_RECTS(pDst->pCompositeClip);
+	const BoxPtr clipExtents = &pDst->pCompositeClip->extents;
+
+	for (i = 0; i < nRect; ++i) {
+
+		const int x1 = rects[i].x + dstX;
+		const int y1 = rects[i].y + dstY;
+		const int x2 = x1 + rects[i].width;
+		const int y2 = y1 + rects[i].height;
+		if ((x2 <= clipExtents->x1) || (clipExtents->x2 <= x1) ||
+			(y2 <= clipExtents->y1) || (clipExtents->y2 <= y1)) {
+			continue;
+		}
+
+		for (r = 0; r < numClipRects; ++r) {
+
+			const BoxPtr pClip = &clipRects[r];
+			const int cx1 = (x1 > pClip->x1) ? x1 : pClip->x1;
+			const int cy1 = (y1 > pClip->y1) ? y1 : pClip->y1;
+			const int cx2 = (x2 < pClip->x2) ? x2 : pClip->x2;
+			const int cy2 = (y2 < pClip->y2) ? y2 : pClip->y2;
+			if ((cx1 >= cx2) || (cy1 >= cy2)) {
+				continue;
+			}
+
+			Z160EXAComposite(pPixmapDst, 0, 0, 0, 0,
+				cx1 + offsetX, cy1 + offsetY,
+				cx2 - cx1, cy2 - cy1);
+		}
+	}
+
+	Z160EXADoneComposite(pPixmapDst);
+	exaMarkSync(pScreen);
+
+	DamageRegionProcessPending(pDst->pDrawable);
+	REGION_DESTROY(pScreen, pRegion);
+	FreePicture(pSrc, 0);
+
+	return TRUE;
 }
 
+/* Blend a Render fill of rectangles in one batch, or leave it to the */
+/* server if it cannot be.  Src and Clear are always left to it, to */
+/* be filled through a GC. */
 static void
-Z160EXADoneComposite(PixmapPtr pPixmapDst)
+Z160EXACompositeRects(CARD8 op, PicturePtr pDst, xRenderColor* color,
+			int nRect, xRectangle* rects)
 {
-	/* Access screen associated with this pixmap */
-	ScrnInfoPtr pScrn = xf86Screens[pPixmapDst->drawable.pScreen->myNum];
-
-	/* Access driver specific data */
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	PictureScreenPtr ps = GetPictureScreen(pScreen);
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
 	IMXPtr imxPtr = IMXPTR(pScrn);
 	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
 
-	z160_flush(fPtr->gpuContext);
+	if (0 >= nRect) {
+		return;
+	}
 
-	/* Update state. */
-	fPtr->gpuSynced = FALSE;
-	fPtr->gpuOpSetup = FALSE;
+	/* An opaque color drawn Over the target replaces it. */
+	if ((PictOpOver == op) && (0xFFFF == color->alpha)) {
+		op = PictOpSrc;
+	}
+
+	if ((PictOpSrc != op) && (PictOpClear != op)) {
+
+		if (Z160EXADrawCompositeRects(op, pDst, color, nRect, rects)) {
+			++(fPtr->numRectFills);
+			return;
+		}
+		++(fPtr->numRectFillFallbacks);
+	}
+
+	ps->CompositeRects = fPtr->CompositeRects;
+	(*ps->CompositeRects)(op, pDst, color, nRect, rects);
+	ps->CompositeRects = Z160EXACompositeRects;
 }
 
+#endif
+
 static Bool
 Z160EXAUploadToScreen(
 	PixmapPtr pPixmapDst,
@@ -2128,103 +7442,429 @@ Z160EXAUploadToScreen(
 		return FALSE;
 	}
 
+	/* Offscreen memory is not ours while the VT is away. */
+	if (!pScrn->vtSema) {
+		return FALSE;
+	}
+
+	/* Contents saved across a VT switch must be put back first. */
+	Z160EXARestorePixmap(pPixmapDst);
+
+	/* Access driver specific data */
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	/* Wait for the GPU operations on the pixmap to complete. */
+	Z160EXAWaitPixmap(pPixmapDst);
+
+	/* Compute number of bytes per pixel to transfer. */
+	int bytesPerPixel = pPixmapDst->drawable.bitsPerPixel / 8;
+
+	/* Access the pitch for the target pixmap. */
+	int pitchDst = exaGetPixmapPitch(pPixmapDst);
+
+	/* Access the starting address for the pixmap. */
+	unsigned char* pBufferDst =
+		(unsigned char*)Z160EXAGetPixmapAddress(pPixmapDst);
+
+	/* Advance to the starting pixel. */
+	pBufferDst += (dstY * pitchDst + dstX * bytesPerPixel);
+
+	/* How many bytes to copy per line of rectangle? */
+	int lineCopyBytes = width * bytesPerPixel;
+
+	/* Do the copy */
+	while (height-- > 0) {
+
+		memcpy(pBufferDst, pBufferSrc, lineCopyBytes);
+		pBufferDst += pitchDst;
+		pBufferSrc += pitchSrc;
+	}
+
+	return TRUE;
+}
+
+static Bool
+Z160EXADownloadFromScreen(
+	PixmapPtr pPixmapSrc,
+	int srcX,
+	int srcY,
+	int width,
+	int height,
+	char* pBufferDst,
+	int pitchDst)
+{
+	/* Access screen associated with this pixmap */
+	ScreenPtr pScreen = pPixmapSrc->drawable.pScreen;
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+
+	/* Cannot support target pixmaps with less than 8 bits per pixel */
+	if (8 > pPixmapSrc->drawable.bitsPerPixel) {
+		return FALSE;
+	}
+
+	/* Offscreen memory is not ours while the VT is away. */
+	if (!pScrn->vtSema) {
+		return FALSE;
+	}
+
+	/* Contents saved across a VT switch must be put back first. */
+	Z160EXARestorePixmap(pPixmapSrc);
+
 	/* Access driver specific data */
 	IMXPtr imxPtr = IMXPTR(pScrn);
 	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
 
-	/* Wait for the GPU to become idle. */
-	exaWaitSync(pScreen);
+	/* Wait for the GPU operations on the pixmap to complete. */
+	Z160EXAWaitPixmap(pPixmapSrc);
+
+	/* Compute number of bytes per pixel to transfer. */
+	int bytesPerPixel = pPixmapSrc->drawable.bitsPerPixel / 8;
+
+	/* Access the pitch for the source pixmap. */
+	int pitchSrc = exaGetPixmapPitch(pPixmapSrc);
+
+	/* Access the starting address for the pixmap. */
+	unsigned char* pBufferSrc =
+		(unsigned char*)Z160EXAGetPixmapAddress(pPixmapSrc);
+
+	/* Advance to the starting pixel. */
+	pBufferSrc += (srcY * pitchSrc + srcX * bytesPerPixel);
+
+	/* How many bytes to copy per line of rectangle? */
+	int lineCopyBytes = width * bytesPerPixel;
+
+	/* Do the copy */
+	while (height-- > 0) {
+
+		memcpy(pBufferDst, pBufferSrc, lineCopyBytes);
+		pBufferDst += pitchDst;
+		pBufferSrc += pitchSrc;
+	}
+
+	return TRUE;
+}
+
+static int
+Z160EXAMarkSync(ScreenPtr pScreen)
+{
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+
+	/* Access driver specific data associated with the screen. */
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	/* The marker is the sequence number of the last operation. */
+	return (int)fPtr->gpuSeq;
+}
+
+static void
+Z160EXAWaitMarker(ScreenPtr pScreen, int marker)
+{
+#if IMX_EXA_ENABLE_HANDLES_PIXMAPS
+	/* EXA calls this with the marker of its last operation before */
+	/* any CPU access, whichever pixmap it is for.  PrepareAccess, */
+	/* UploadToScreen and DownloadFromScreen wait for the operations */
+	/* on the pixmap being accessed instead. */
+#else
+	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+
+	/* Access driver specific data associated with the screen. */
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	Z160WaitSeq(fPtr, (CARD32)marker);
+#endif
+}
+
+#if IMX_EXA_ENABLE_COMPLETION_THREAD
+
+/* Waits for the GPU work it is asked to, with the Z160 context lock */
+/* held, and then wakes the server.  z160_sync is the only way to wait */
+/* for the GPU and it needs the context, so the lock cannot be dropped */
+/* while waiting, and the server cannot use the GPU meanwhile. */
+static void*
+Z160CompletionThread(void* data)
+{
+	IMXEXAPtr fPtr = (IMXEXAPtr)data;
+	const uint64_t one = 1;
+
+	pthread_mutex_lock(&fPtr->gpuLock);
+	while (!fPtr->completionQuit) {
+
+		/* Nothing to wait for? */
+		if (fPtr->completionRequestSeq == fPtr->completionDoneSeq) {
+			pthread_cond_wait(&fPtr->completionCond, &fPtr->gpuLock);
+			continue;
+		}
+
+		const CARD32 seq = fPtr->completionRequestSeq;
+		if (NULL != fPtr->gpuContext) {
+			z160_sync(fPtr->gpuContext);
+		}
+		fPtr->completionDoneSeq = seq;
+
+		if (sizeof(one) != write(fPtr->completionFd, &one, sizeof(one))) {
+			/* The eventfd counter can only overflow if the */
+			/* server never reads it, so nothing to do. */
+		}
+	}
+	pthread_mutex_unlock(&fPtr->gpuLock);
+
+	return NULL;
+}
+
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+
+/* Owns the Z160 context and runs the batches queued in the ring, */
+/* waking the server when a batch asked it to wait for the GPU. */
+static void*
+Z160SubmitThread(void* data)
+{
+	IMXEXAPtr fPtr = (IMXEXAPtr)data;
+	const uint64_t one = 1;
+
+	for (;;) {
+
+		/* Batches still queued are run before quitting. */
+		Z160RingWait(fPtr, &fPtr->ringWork, Z160RingHasWork, 0);
+		if (fPtr->ringHead == fPtr->ringTail) {
+			break;
+		}
+		__sync_synchronize();
+
+		IMXEXABatchPtr batch =
+			&fPtr->ring[fPtr->ringHead & (IMX_EXA_SUBMIT_RING_SIZE - 1)];
+		if (NULL != fPtr->gpuContext) {
+			Z160EXARunBatch(fPtr, batch);
+		}
+		const Bool sync = batch->sync;
+		const CARD32 seq = batch->seq;
+
+		/* Give the slot back. */
+		__sync_synchronize();
+		fPtr->ringHead = fPtr->ringHead + 1;
+		Z160RingWake(&fPtr->ringSpace);
 
-	/* Compute number of bytes per pixel to transfer. */
-	int bytesPerPixel = pPixmapDst->drawable.bitsPerPixel / 8;
+		if (sync) {
+			fPtr->completionDoneSeq = seq;
+			Z160RingWake(&fPtr->ringDone);
 
-	/* Access the pitch for the target pixmap. */
-	int pitchDst = exaGetPixmapPitch(pPixmapDst);
+			if (sizeof(one) != write(fPtr->completionFd, &one, sizeof(one))) {
+				/* The eventfd counter can only overflow if the */
+				/* server never reads it, so nothing to do. */
+			}
+		}
+	}
 
-	/* Access the starting address for the pixmap. */
-	unsigned char* pBufferDst =
-		(unsigned char*)Z160EXAGetPixmapAddress(pPixmapDst);
+	return NULL;
+}
 
-	/* Advance to the starting pixel. */
-	pBufferDst += (dstY * pitchDst + dstX * bytesPerPixel);
+#endif
 
-	/* How many bytes to copy per line of rectangle? */
-	int lineCopyBytes = width * bytesPerPixel;
+static void
+Z160EXACompletionWakeupHandler(pointer data, int result, pointer pReadmask)
+{
+	IMXEXAPtr fPtr = (IMXEXAPtr)data;
+	uint64_t count;
 
-	/* Do the copy */
-	while (height-- > 0) {
+	if ((0 >= result) ||
+		!FD_ISSET(fPtr->completionFd, (fd_set*)pReadmask)) {
+		return;
+	}
 
-		memcpy(pBufferDst, pBufferSrc, lineCopyBytes);
-		pBufferDst += pitchDst;
-		pBufferSrc += pitchSrc;
+	if (sizeof(count) != read(fPtr->completionFd, &count, sizeof(count))) {
+		return;
 	}
 
-	return TRUE;
+	Z160Lock(fPtr);
+	Z160RetireCompleted(fPtr);
 }
 
-static Bool
-Z160EXADownloadFromScreen(
-	PixmapPtr pPixmapSrc,
-	int srcX,
-	int srcY,
-	int width,
-	int height,
-	char* pBufferDst,
-	int pitchDst)
+static void
+Z160StartCompletionThread(IMXEXAPtr fPtr)
 {
-	/* Access screen associated with this pixmap */
-	ScreenPtr pScreen = pPixmapSrc->drawable.pScreen;
-	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	fPtr->completionFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (0 > fPtr->completionFd) {
 
-	/* Cannot support target pixmaps with less than 8 bits per pixel */
-	if (8 > pPixmapSrc->drawable.bitsPerPixel) {
-		return FALSE;
+		xf86DrvMsg(fPtr->scrnIndex, X_WARNING,
+			"Unable to create GPU completion eventfd (%s)\n",
+			strerror(errno));
+		return;
 	}
 
-	/* Access driver specific data */
-	IMXPtr imxPtr = IMXPTR(pScrn);
-	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
-
-	/* Wait for the GPU to become idle. */
-	exaWaitSync(pScreen);
+	pthread_mutex_init(&fPtr->gpuLock, NULL);
+	pthread_cond_init(&fPtr->completionCond, NULL);
+	fPtr->completionQuit = FALSE;
+	fPtr->completionRequestSeq = fPtr->gpuSeq;
+	fPtr->completionDoneSeq = fPtr->gpuSeq;
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+	fPtr->ringWork.sleeping = FALSE;
+	fPtr->ringSpace.sleeping = FALSE;
+	fPtr->ringDone.sleeping = FALSE;
+	sem_init(&fPtr->ringWork.sem, 0, 0);
+	sem_init(&fPtr->ringSpace.sem, 0, 0);
+	sem_init(&fPtr->ringDone.sem, 0, 0);
+#endif
 
-	/* Compute number of bytes per pixel to transfer. */
-	int bytesPerPixel = pPixmapSrc->drawable.bitsPerPixel / 8;
+	/* Signals are for the server, not for the thread. */
+	sigset_t allSignals, oldSignals;
+	sigfillset(&allSignals);
+	pthread_sigmask(SIG_SETMASK, &allSignals, &oldSignals);
+	const int error =
+		pthread_create(&fPtr->completionThread, NULL,
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+				Z160SubmitThread,
+#else
+				Z160CompletionThread,
+#endif
+				fPtr);
+	pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
 
-	/* Access the pitch for the source pixmap. */
-	int pitchSrc = exaGetPixmapPitch(pPixmapSrc);
+	if (0 != error) {
 
-	/* Access the starting address for the pixmap. */
-	unsigned char* pBufferSrc =
-		(unsigned char*)Z160EXAGetPixmapAddress(pPixmapSrc);
+		xf86DrvMsg(fPtr->scrnIndex, X_WARNING,
+			"Unable to start GPU completion thread (%s)\n",
+			strerror(error));
 
-	/* Advance to the starting pixel. */
-	pBufferSrc += (srcY * pitchSrc + srcX * bytesPerPixel);
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+		sem_destroy(&fPtr->ringWork.sem);
+		sem_destroy(&fPtr->ringSpace.sem);
+		sem_destroy(&fPtr->ringDone.sem);
+#endif
+		pthread_cond_destroy(&fPtr->completionCond);
+		pthread_mutex_destroy(&fPtr->gpuLock);
+		close(fPtr->completionFd);
+		fPtr->completionFd = -1;
+		return;
+	}
 
-	/* How many bytes to copy per line of rectangle? */
-	int lineCopyBytes = width * bytesPerPixel;
+	fPtr->completionRunning = TRUE;
 
-	/* Do the copy */
-	while (height-- > 0) {
+	AddGeneralSocket(fPtr->completionFd);
+	RegisterBlockAndWakeupHandlers((BlockHandlerProcPtr)NoopDDA,
+		Z160EXACompletionWakeupHandler, fPtr);
+}
 
-		memcpy(pBufferDst, pBufferSrc, lineCopyBytes);
-		pBufferDst += pitchDst;
-		pBufferSrc += pitchSrc;
+static void
+Z160StopCompletionThread(IMXEXAPtr fPtr)
+{
+	if (!fPtr->completionRunning) {
+		return;
 	}
 
-	return TRUE;
+	RemoveBlockAndWakeupHandlers((BlockHandlerProcPtr)NoopDDA,
+		Z160EXACompletionWakeupHandler, fPtr);
+	RemoveGeneralSocket(fPtr->completionFd);
+
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+	/* The thread runs a held fill along with the rest. */
+	Z160EXAReleaseHeld(fPtr);
+	fPtr->completionQuit = TRUE;
+	Z160RingWake(&fPtr->ringWork);
+#else
+	Z160Lock(fPtr);
+	fPtr->completionQuit = TRUE;
+	pthread_cond_signal(&fPtr->completionCond);
+	Z160Unlock(fPtr);
+#endif
+
+	pthread_join(fPtr->completionThread, NULL);
+	fPtr->completionRunning = FALSE;
+
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+	/* The thread ran every batch queued, so the server uses the */
+	/* Z160 context directly from now on. */
+	sem_destroy(&fPtr->ringWork.sem);
+	sem_destroy(&fPtr->ringSpace.sem);
+	sem_destroy(&fPtr->ringDone.sem);
+	fPtr->ring[0] = *fPtr->batch;
+	fPtr->batch = &fPtr->ring[0];
+	fPtr->ringHead = 0;
+	fPtr->ringTail = 0;
+#endif
+	pthread_cond_destroy(&fPtr->completionCond);
+	pthread_mutex_destroy(&fPtr->gpuLock);
+	close(fPtr->completionFd);
+	fPtr->completionFd = -1;
 }
 
+#endif
+
 static void
-Z160EXAWaitMarker(ScreenPtr pScreen, int marker)
+Z160EXABlockHandler(int screenNum, pointer blockData, pointer pTimeout,
+			pointer pReadmask)
 {
-	ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+	ScreenPtr pScreen = screenInfo.screens[screenNum];
+	ScrnInfoPtr pScrn = xf86Screens[screenNum];
 
 	/* Access driver specific data associated with the screen. */
 	IMXPtr imxPtr = IMXPTR(pScrn);
 	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
 
-	Z160Sync(fPtr);
+	/* Call the wrapped block handler first. */
+	pScreen->BlockHandler = fPtr->BlockHandler;
+	(*pScreen->BlockHandler)(screenNum, blockData, pTimeout, pReadmask);
+	pScreen->BlockHandler = Z160EXABlockHandler;
+
+	/* Nothing more will be drawn until the server wakes up again, */
+	/* so send the operations whose flush was deferred to the GPU. */
+	if (Z160FlushPending(fPtr)) {
+		++(fPtr->numIdleFlushes);
+	}
+
+#if IMX_EXA_ENABLE_HANDLES_PIXMAPS
+	/* The server is idle, so this is a good time to move pixmaps, */
+	/* unless the VT is away and the GPU is not ours. */
+	if (pScrn->vtSema) {
+		Z160EXADefragment(pScreen);
+		Z160EXAPromotePixmaps(pScreen);
+	}
+#endif
+
+	/* Free the scratch pixmap once it has gone unused for a while, */
+	/* waking up to do so if the server would sleep until then. */
+	if (NULL != fPtr->pScratchPixmap) {
+
+		const CARD32 unused = GetTimeInMillis() - fPtr->scratchUsedTime;
+		if (unused >= IMX_EXA_SCRATCH_IDLE_DELAY) {
+
+			(*pScreen->DestroyPixmap)(fPtr->pScratchPixmap);
+			fPtr->pScratchPixmap = NULL;
+
+		} else {
+
+			AdjustWaitForDelay(pTimeout,
+				IMX_EXA_SCRATCH_IDLE_DELAY - unused);
+		}
+	}
+
+#if IMX_EXA_ENABLE_COMPLETION_THREAD
+	/* Have the thread wait for the GPU while the server sleeps, but */
+	/* only when a fence is known to be waited for later: memory freed */
+	/* while the GPU may still use it is waited for when it is reused. */
+	/* The thread holds the Z160 context while it waits, so the next */
+	/* operation of the server waits for the GPU to finish as well, */
+	/* and its submission no longer overlaps what the GPU is drawing. */
+	if (fPtr->completionRunning) {
+
+		if (!Z160IsSeqRetired(fPtr, fPtr->gpuFreedSeq) &&
+			(fPtr->completionRequestSeq != fPtr->gpuSeq)) {
+
+			Z160Lock(fPtr);
+			fPtr->completionRequestSeq = fPtr->gpuSeq;
+#if IMX_EXA_ENABLE_SUBMIT_THREAD
+			fPtr->batch->sync = TRUE;
+			fPtr->batch->seq = fPtr->gpuSeq;
+			Z160SubmitBatch(fPtr);
+#else
+			pthread_cond_signal(&fPtr->completionCond);
+#endif
+		}
+
+		Z160Unlock(fPtr);
+	}
+#endif
 }
 
 
@@ -2323,6 +7963,7 @@ Bool IMX_EXA_ScreenInit(int scrnIndex, ScreenPtr pScreen)
 		imxPtr->exaDriverPtr->maxY = Z160_MAX_HEIGHT - 1;
 
 		/* Required */
+		imxPtr->exaDriverPtr->MarkSync = Z160EXAMarkSync;
 		imxPtr->exaDriverPtr->WaitMarker = Z160EXAWaitMarker;
 
 		/* Solid fill - required */
@@ -2372,6 +8013,10 @@ Bool IMX_EXA_ScreenInit(int scrnIndex, ScreenPtr pScreen)
 			return FALSE;
 		}
 
+		/* Nothing uses offscreen memory yet, so measure where */
+		/* acceleration starts to pay off there. */
+		Z160EXACalibrate(pScreen);
+
 #if IMX_EXA_ENABLE_HANDLES_PIXMAPS
 		xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Driver handles allocation of pixmaps\n");
 		unsigned long numAvailPixmapBytes =
@@ -2380,9 +8025,43 @@ Bool IMX_EXA_ScreenInit(int scrnIndex, ScreenPtr pScreen)
 		xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Offscreen pixmap area of %luK bytes\n", numAvailPixmapBytes / 1024);
 
 		/* Driver allocation of pixmaps will use the built-in */
-		/* EXA offscreen memory manager. */
+		/* EXA offscreen memory manager, which also manages any */
+		/* extra memory pools. */
+		IMX_EXA_OffscreenOpenPools(pScreen);
 		IMX_EXA_OffscreenInit(pScreen);
 #endif
+
+		/* Wrap the block handler for work done while idle. */
+		fPtr->BlockHandler = pScreen->BlockHandler;
+		pScreen->BlockHandler = Z160EXABlockHandler;
+
+#if IMX_EXA_ENABLE_GLYPH_ATLAS || IMX_EXA_ENABLE_COMPOSITE_RECTS
+		PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
+#endif
+#if IMX_EXA_ENABLE_GLYPH_ATLAS
+		/* Wrap the glyph functions of EXA to draw glyphs from the */
+		/* atlas. */
+		if (NULL != ps) {
+
+			fPtr->Glyphs = ps->Glyphs;
+			ps->Glyphs = Z160EXAGlyphs;
+			fPtr->UnrealizeGlyph = ps->UnrealizeGlyph;
+			ps->UnrealizeGlyph = Z160EXAUnrealizeGlyph;
+		}
+#endif
+#if IMX_EXA_ENABLE_COMPOSITE_RECTS
+		/* Wrap the Render fill of rectangles to blend them in a */
+		/* batch. */
+		if (NULL != ps) {
+
+			fPtr->CompositeRects = ps->CompositeRects;
+			ps->CompositeRects = Z160EXACompositeRects;
+		}
+#endif
+
+#if IMX_EXA_ENABLE_COMPLETION_THREAD
+		Z160StartCompletionThread(fPtr);
+#endif
 	}
 
 	return TRUE;
@@ -2439,13 +8118,198 @@ Bool IMX_EXA_CloseScreen(int scrnIndex, ScreenPtr pScreen)
 		fPtr->numScreenCopyRectLarge);
 #endif
 
+#if IMX_EXA_DEBUG_INSTRUMENT_BATCHES
+	{
+		int kind;
+
+		for (kind = 0; kind < IMX_EXA_BATCH_NUM_KINDS; ++kind) {
+
+			const double seconds = fPtr->batchNanoseconds[kind] / 1.0e9;
+
+			syslog(LOG_INFO | LOG_USER,
+				"Z160 Xorg driver: %lu %s rects in %lu submits, %.0f rects/sec\n",
+				fPtr->numBatchedRects[kind],
+				Z160BatchKindNames[kind],
+				fPtr->numBatchSubmits[kind],
+				(seconds > 0.0) ? fPtr->numBatchedRects[kind] / seconds : 0.0);
+		}
+	}
+#endif
+
+#if IMX_EXA_ENABLE_COMPLETION_THREAD
+	Z160StopCompletionThread(fPtr);
+
+	xf86DrvMsgVerb(scrnIndex, X_INFO, 3,
+		"GPU work found complete while idle %lu times\n",
+		fPtr->numAsyncRetires);
+#endif
+
+	/* Unwrap the block handler. */
+	if (NULL != fPtr->BlockHandler) {
+		pScreen->BlockHandler = fPtr->BlockHandler;
+		fPtr->BlockHandler = NULL;
+	}
+
+#if IMX_EXA_ENABLE_GLYPH_ATLAS
+	/* Unwrap the glyph functions. */
+	if (NULL != fPtr->Glyphs) {
+
+		PictureScreenPtr ps = GetPictureScreen(pScreen);
+		ps->Glyphs = fPtr->Glyphs;
+		ps->UnrealizeGlyph = fPtr->UnrealizeGlyph;
+		fPtr->Glyphs = NULL;
+		fPtr->UnrealizeGlyph = NULL;
+	}
+#endif
+
+#if IMX_EXA_ENABLE_COMPOSITE_RECTS
+	/* Unwrap the fill of rectangles. */
+	if (NULL != fPtr->CompositeRects) {
+
+		PictureScreenPtr ps = GetPictureScreen(pScreen);
+		ps->CompositeRects = fPtr->CompositeRects;
+		fPtr->CompositeRects = NULL;
+	}
+#endif
+
 	/* EXA cleanup */
 	if (imxPtr->exaDriverPtr) {
 
+		xf86DrvMsgVerb(scrnIndex, X_INFO, 3,
+			"GPU flushes: %lu when idle, %lu at limits, %lu before CPU access\n",
+			fPtr->numIdleFlushes,
+			fPtr->numLimitFlushes,
+			fPtr->numSyncFlushes);
+
+		xf86DrvMsgVerb(scrnIndex, X_INFO, 3,
+			"Peephole: %lu fills and %lu rects (%llu pixels) drawn over, "
+			"%lu fills joined, %lu rects merged\n",
+			fPtr->numOverdrawnOps,
+			fPtr->numOverdrawnRects,
+			fPtr->numOverdrawnPixels,
+			fPtr->numJoinedFills,
+			fPtr->numMergedRects);
+
+		xf86DrvMsgVerb(scrnIndex, X_INFO, 3,
+			"GPU setups skipped: %lu targets, %lu operations\n",
+			fPtr->numTargetSetupsSkipped,
+			fPtr->numOpSetupsSkipped);
+
+		int op;
+		for (op = 0; op < IMX_EXA_NUM_PICT_OPS; ++op) {
+
+			if ((0 == fPtr->numCompositeDirect[op]) &&
+				(0 == fPtr->numCompositeDecomposed[op]) &&
+				(0 == fPtr->numCompositeFallbacks[op])) {
+				continue;
+			}
+			xf86DrvMsgVerb(scrnIndex, X_INFO, 3,
+				"Composite %s: %lu blended, %lu decomposed, "
+				"%lu in software\n",
+				Z160PictOpNames[op],
+				fPtr->numCompositeDirect[op],
+				fPtr->numCompositeDecomposed[op],
+				fPtr->numCompositeFallbacks[op]);
+		}
+
+		if (NULL != fPtr->pScratchPixmap) {
+			(*pScreen->DestroyPixmap)(fPtr->pScratchPixmap);
+			fPtr->pScratchPixmap = NULL;
+		}
+
+		xf86DrvMsgVerb(scrnIndex, X_INFO, 3,
+			"Source cache: %lu solid hits, %lu misses, "
+			"%lu gradient hits, %lu misses\n",
+			fPtr->numSolidHits,
+			fPtr->numSolidMisses,
+			fPtr->numGradientHits,
+			fPtr->numGradientMisses);
+
+		if (NULL != fPtr->pSolidPixmap) {
+			(*pScreen->DestroyPixmap)(fPtr->pSolidPixmap);
+			fPtr->pSolidPixmap = NULL;
+		}
+		int i;
+		for (i = 0; i < IMX_EXA_GRADIENT_CACHE_SIZE; ++i) {
+			Z160EXAFreeGradient(pScreen, &fPtr->gradientCache[i]);
+		}
+
+#if IMX_EXA_ENABLE_GLYPH_ATLAS
+		xf86DrvMsgVerb(scrnIndex, X_INFO, 3,
+			"Glyph atlas: %lu runs drawn, %lu left to EXA, "
+			"%lu glyphs drawn, %lu copied in, %lu shelves emptied\n",
+			fPtr->numGlyphRuns,
+			fPtr->numGlyphRunFallbacks,
+			fPtr->numGlyphsDrawn,
+			fPtr->numGlyphUploads,
+			fPtr->numGlyphShelfEvictions);
+
+		Z160EXAFreeGlyphAtlas(fPtr);
+#endif
+
+#if IMX_EXA_ENABLE_COMPOSITE_RECTS
+		xf86DrvMsgVerb(scrnIndex, X_INFO, 3,
+			"Rectangle fills: %lu blended in a batch, %lu left to the server\n",
+			fPtr->numRectFills,
+			fPtr->numRectFillFallbacks);
+#endif
+
+		xf86DrvMsgVerb(scrnIndex, X_INFO, 3,
+			"CPU access: %lu waited for the GPU, %lu did not\n",
+			fPtr->numFenceWaits,
+			fPtr->numFenceSkips);
+
+		IMXEXABatchKind kind;
+		int bpp;
+		for (kind = 0; kind < IMX_EXA_BATCH_NUM_KINDS; ++kind) {
+			for (bpp = 0; bpp < IMX_EXA_NUM_BPP; ++bpp) {
+
+				IMXEXAThresholdPtr t = &fPtr->thresholds[kind][bpp];
+				xf86DrvMsgVerb(scrnIndex, X_INFO, 3,
+					"Accelerated %s at %d bpp from %u pixels "
+					"(calibrated %u, refined %lu times, "
+					"%luns/rect queued): "
+					"%lu large enough, %lu too small\n",
+					Z160BatchKindNames[kind],
+					Z160ThresholdBitsPerPixel[bpp],
+					t->minPixelArea,
+					t->calibratedPixelArea,
+					t->numRefinements,
+					t->submitRectNs,
+					t->numAccepted,
+					t->numRefused);
+			}
+		}
+
 #if IMX_EXA_ENABLE_HANDLES_PIXMAPS
+		xf86DrvMsgVerb(scrnIndex, X_INFO, 3,
+			"Pixmap area recycling: %lu hits, %lu misses, %lu drained\n",
+			fPtr->numRecycleHits,
+			fPtr->numRecycleMisses,
+			fPtr->numRecycleDrains);
+
+		IMXOffscreenStatsRec stats;
+		IMX_EXA_OffscreenGetStats(pScreen, &stats);
+		xf86DrvMsgVerb(scrnIndex, X_INFO, 3,
+			"Offscreen memory: %lu allocs, %lu failed, %lu freed, "
+			"%lu evicted, %lu moved, peak %luK in use\n",
+			stats.numAllocs,
+			stats.numAllocFailures,
+			stats.numFrees,
+			stats.numEvictions,
+			stats.numMoves,
+			stats.peakBytesInUse / 1024);
+
+		xf86DrvMsgVerb(scrnIndex, X_INFO, 3,
+			"VT switch snapshots: %lu restored, %lu moved to system memory\n",
+			fPtr->numSnapshotRestores,
+			fPtr->numSnapshotMoves);
+
 		/* Driver allocation of pixmaps will use the built-in */
 		/* EXA offscreen memory manager. */
+		Z160EXARecycleDrain(pScreen, 0);
 		IMX_EXA_OffscreenFini(pScreen);
+		IMX_EXA_OffscreenClosePools(pScreen);
 #endif
 
 		exaDriverFini(pScreen);
@@ -2458,3 +8322,221 @@ Bool IMX_EXA_CloseScreen(int scrnIndex, ScreenPtr pScreen)
 
 	return TRUE;
 }
+
+#if IMX_EXA_ENABLE_HANDLES_PIXMAPS
+
+/* Resident memory of the server in kilobytes, from /proc/self/statm, */
+/* or 0 if it cannot be read. */
+static unsigned long
+Z160EXAGetResidentKB(void)
+{
+	unsigned long numPages = 0;
+	unsigned long numResidentPages = 0;
+
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (NULL == file) {
+		return 0;
+	}
+	if (2 != fscanf(file, "%lu %lu", &numPages, &numResidentPages)) {
+		numResidentPages = 0;
+	}
+	fclose(file);
+
+	return numResidentPages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+#endif
+
+/* Called by IMXLeaveVT before the frame buffer is given up.  The */
+/* contents of offscreen pixmaps are not kept by the kernel across a */
+/* VT switch or suspend, so they are compressed into system memory. */
+/* The areas stay allocated and each pixmap is put back the first */
+/* time it is used after the VT is entered again. */
+void IMX_EXA_LeaveVT(int scrnIndex, int flags)
+{
+#if IMX_EXA_ENABLE_HANDLES_PIXMAPS
+	ScrnInfoPtr pScrn = xf86Screens[scrnIndex];
+	ScreenPtr pScreen = screenInfo.screens[scrnIndex];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	if (NULL == imxPtr->exaDriverPtr) {
+		return;
+	}
+
+	const CARD32 startTime = GetTimeInMillis();
+	const unsigned long residentKB = Z160EXAGetResidentKB();
+
+	/* Pixmaps must be complete before they are read back, and */
+	/* cached areas of destroyed pixmaps need not be kept. */
+	Z160Sync(fPtr);
+	Z160EXARecycleDrain(pScreen, 0);
+
+	/* Pixmaps which the GPU cannot access are in ordinary memory */
+	/* which is not lost. */
+	int numPixmaps = 0;
+	int numFailed = 0;
+	unsigned long numRawBytes = 0;
+	IMXEXAPixmapPtr fPixmapPtr;
+	for (fPixmapPtr = fPtr->pixmapList; NULL != fPixmapPtr;
+		fPixmapPtr = fPixmapPtr->next) {
+
+		if ((NULL == fPixmapPtr->area) || !fPixmapPtr->canAccel ||
+			(NULL != fPixmapPtr->snapshot)) {
+
+			continue;
+		}
+
+		if (!Z160EXATakeSnapshot(fPtr, fPixmapPtr)) {
+			++numFailed;
+			continue;
+		}
+
+		++numPixmaps;
+		numRawBytes += fPixmapPtr->height *
+				Z160EXAGetPixmapRowBytes(fPixmapPtr);
+	}
+
+	/* The snapshot size is the memory the VT switch needs, and the */
+	/* resident size before and after shows how much the server grew. */
+	xf86DrvMsg(scrnIndex, X_INFO,
+		"Saved %d offscreen pixmaps, %luK in %luK, in %u ms, "
+		"RSS %luK before, %luK after\n",
+		numPixmaps,
+		numRawBytes / 1024,
+		fPtr->numSnapshotBytes / 1024,
+		(unsigned)(GetTimeInMillis() - startTime),
+		residentKB,
+		Z160EXAGetResidentKB());
+
+	if (0 < numFailed) {
+		xf86DrvMsg(scrnIndex, X_WARNING,
+			"Out of memory saving %d offscreen pixmaps\n",
+			numFailed);
+	}
+#endif
+}
+
+/* Called by IMXEnterVT once the frame buffer is back. */
+void IMX_EXA_EnterVT(int scrnIndex, int flags)
+{
+#if IMX_EXA_ENABLE_HANDLES_PIXMAPS
+	ScrnInfoPtr pScrn = xf86Screens[scrnIndex];
+	IMXPtr imxPtr = IMXPTR(pScrn);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	if (NULL == imxPtr->exaDriverPtr) {
+		return;
+	}
+
+	/* Snapshots are restored lazily; note when to time that from. */
+	fPtr->enterVTTime = GetTimeInMillis();
+
+	xf86DrvMsgVerb(scrnIndex, X_INFO, 3,
+		"%d offscreen pixmaps to restore from %luK of snapshots\n",
+		fPtr->numSnapshots,
+		fPtr->numSnapshotBytes / 1024);
+
+	/* Pixmaps created or moved to system memory while the VT was */
+	/* away may go back to offscreen memory. */
+	if (NULL != fPtr->sysPixmapList) {
+		fPtr->promoteWanted = TRUE;
+	}
+#endif
+}
+
+#if IMX_EXA_ENABLE_HANDLES_PIXMAPS
+/* Owner callback for IMX_EXA_OffscreenGetMap. */
+static int
+Z160EXAGetAreaOwner(ExaOffscreenArea* area)
+{
+	if (Z160EXARecycleSave == area->save) {
+		return IMX_EXT_AreaRecycled;
+	}
+
+	if (Z160EXAPixmapSave != area->save) {
+		return IMX_EXT_AreaOther;
+	}
+
+	IMXEXAPixmapPtr fPixmapPtr = (IMXEXAPixmapPtr)area->privData;
+	if ((NULL != fPixmapPtr) &&
+		(IMX_EXA_OFFSCREEN_GLYPH == fPixmapPtr->placement)) {
+
+		return IMX_EXT_AreaGlyph;
+	}
+
+	return IMX_EXT_AreaPixmap;
+}
+#endif
+
+/* Called by IMXGetOffscreenStats */
+Bool IMX_EXA_GetOffscreenStats(ScreenPtr pScreen, IMXOffscreenStatsPtr pStats)
+{
+#if IMX_EXA_ENABLE_HANDLES_PIXMAPS
+	IMXPtr imxPtr = IMXPTR(xf86Screens[pScreen->myNum]);
+
+	if (NULL == imxPtr->exaDriverPtr) {
+		return FALSE;
+	}
+
+	IMX_EXA_OffscreenGetStats(pScreen, pStats);
+	return TRUE;
+#else
+	/* Offscreen memory is managed by EXA, which keeps no counters. */
+	return FALSE;
+#endif
+}
+
+/* Called by IMXGetAccelThresholds */
+int IMX_EXA_GetAccelThresholds(ScreenPtr pScreen, IMXAccelThresholdInfoPtr infos)
+{
+	IMXPtr imxPtr = IMXPTR(xf86Screens[pScreen->myNum]);
+	IMXEXAPtr fPtr = IMXEXAPTR(imxPtr);
+
+	if (NULL == imxPtr->exaDriverPtr) {
+		return -1;
+	}
+
+	int numThresholds = 0;
+	IMXEXABatchKind kind;
+	int bpp;
+	for (kind = 0; kind < IMX_EXA_BATCH_NUM_KINDS; ++kind) {
+		for (bpp = 0; bpp < IMX_EXA_NUM_BPP; ++bpp) {
+
+			IMXEXAThresholdPtr t = &fPtr->thresholds[kind][bpp];
+			IMXAccelThresholdInfoPtr info = &infos[numThresholds++];
+
+			info->kind = kind;
+			info->bitsPerPixel = Z160ThresholdBitsPerPixel[bpp];
+			info->minPixelArea = t->minPixelArea;
+			info->calibratedPixelArea = t->calibratedPixelArea;
+			info->gpuSetupNs = t->gpuSetupNs + t->submitRectNs;
+			info->gpuPixelPs = t->gpuPixelPs;
+			info->cpuPixelPs = t->cpuPixelPs;
+			info->numAccepted = t->numAccepted;
+			info->numRefused = t->numRefused;
+			info->numRefinements = t->numRefinements;
+		}
+	}
+
+	return numThresholds;
+}
+
+/* Called by IMXGetOffscreenMap */
+int IMX_EXA_GetOffscreenMap(ScreenPtr pScreen,
+				IMXOffscreenHeapInfoPtr heaps, int* pNumHeaps,
+				IMXOffscreenAreaInfoPtr areas, int maxAreas)
+{
+#if IMX_EXA_ENABLE_HANDLES_PIXMAPS
+	IMXPtr imxPtr = IMXPTR(xf86Screens[pScreen->myNum]);
+
+	if (NULL == imxPtr->exaDriverPtr) {
+		return -1;
+	}
+
+	return IMX_EXA_OffscreenGetMap(pScreen, Z160EXAGetAreaOwner,
+					heaps, pNumHeaps, areas, maxAreas);
+#else
+	return -1;
+#endif
+}
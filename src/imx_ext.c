@@ -26,8 +26,11 @@
 #include <X11/Xproto.h>
 #include <dixstruct.h>
 #include <extension.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "imx_ext.h"
+#include "imx_type.h"
 
 /* External functions defined elsewhere in the driver. */
 extern Bool
@@ -36,10 +39,34 @@ IMXGetPixmapProperties(
 	void** pPhysAddr,	/* OUT: pixmap phys addr, NULL if not GPU mem */
 	int* pPitch);		/* OUT: pixmap pitch, 0 if not in GPU mem */
 
+extern Bool
+IMXGetOffscreenStats(
+	ScreenPtr pScreen,		/* IN */
+	IMXOffscreenStatsPtr pStats);	/* OUT: allocator counters */
+
+extern int
+IMXGetOffscreenMap(
+	ScreenPtr pScreen,		/* IN */
+	IMXOffscreenHeapInfoPtr heaps,	/* OUT: IMX_EXA_OFFSCREEN_MAX_HEAPS */
+	int* pNumHeaps,			/* OUT: number of heaps */
+	IMXOffscreenAreaInfoPtr areas,	/* OUT: up to maxAreas areas */
+	int maxAreas);			/* IN */
+
+extern int
+IMXGetAccelThresholds(
+	ScreenPtr pScreen,			/* IN */
+	IMXAccelThresholdInfoPtr infos);	/* OUT: IMX_EXA_NUM_ACCEL_THRESHOLDS */
+
 static DISPATCH_PROC(Proc_IMX_EXT_Dispatch);
 static DISPATCH_PROC(Proc_IMX_EXT_GetPixmapPhysAddr);
+static DISPATCH_PROC(Proc_IMX_EXT_GetOffscreenStats);
+static DISPATCH_PROC(Proc_IMX_EXT_GetOffscreenMap);
+static DISPATCH_PROC(Proc_IMX_EXT_GetAccelThresholds);
 static DISPATCH_PROC(SProc_IMX_EXT_Dispatch);
 static DISPATCH_PROC(SProc_IMX_EXT_GetPixmapPhysAddr);
+static DISPATCH_PROC(SProc_IMX_EXT_GetOffscreenStats);
+static DISPATCH_PROC(SProc_IMX_EXT_GetOffscreenMap);
+static DISPATCH_PROC(SProc_IMX_EXT_GetAccelThresholds);
 
 void IMX_EXT_Init()
 {
@@ -101,6 +128,266 @@ Proc_IMX_EXT_GetPixmapPhysAddr(ClientPtr client)
 	return client->noClientException;
 }
 
+static int
+Proc_IMX_EXT_GetOffscreenStats(ClientPtr client)
+{
+	int n;
+
+	REQUEST(xIMX_EXT_GetOffscreenStatsReq);
+	REQUEST_SIZE_MATCH(xIMX_EXT_GetOffscreenStatsReq);
+
+	if (stuff->screen >= screenInfo.numScreens)
+	{
+		client->errorValue = stuff->screen;
+		return BadValue;
+	}
+
+	/* Query the counters from the driver. */
+	IMXOffscreenStatsRec stats;
+	memset(&stats, 0, sizeof(stats));
+	Bool enabled =
+		IMXGetOffscreenStats(screenInfo.screens[stuff->screen], &stats);
+
+	/* Initialize reply */
+	xIMX_EXT_GetOffscreenStatsReply rep;
+	rep.type = X_Reply;
+	rep.enabled = enabled;
+	rep.sequenceNumber = client->sequence;
+	rep.length = (sz_xIMX_EXT_GetOffscreenStatsReply - 32) >> 2;
+	rep.numAllocs = stats.numAllocs;
+	rep.numAllocFailures = stats.numAllocFailures;
+	rep.numFrees = stats.numFrees;
+	rep.numEvictions = stats.numEvictions;
+	rep.numMoves = stats.numMoves;
+	rep.numAreasInUse = stats.numAreasInUse;
+	rep.bytesInUse = stats.bytesInUse;
+	rep.peakBytesInUse = stats.peakBytesInUse;
+	rep.bytesFree = stats.bytesFree;
+	rep.largestFree = stats.largestFree;
+	rep.fragmentation = stats.fragmentation;
+	rep.pad0 = 0;
+
+	/* Check if any reply values need byte swapping */
+	if (client->swapped)
+	{
+		swaps(&rep.sequenceNumber, n);
+		swapl(&rep.length, n);
+		swapl(&rep.numAllocs, n);
+		swapl(&rep.numAllocFailures, n);
+		swapl(&rep.numFrees, n);
+		swapl(&rep.numEvictions, n);
+		swapl(&rep.numMoves, n);
+		swapl(&rep.numAreasInUse, n);
+		swapl(&rep.bytesInUse, n);
+		swapl(&rep.peakBytesInUse, n);
+		swapl(&rep.bytesFree, n);
+		swapl(&rep.largestFree, n);
+		swapl(&rep.fragmentation, n);
+	}
+
+	/* Reply to client */
+	WriteToClient(client, sizeof(rep), (char*)&rep);
+	return client->noClientException;
+}
+
+static int
+Proc_IMX_EXT_GetOffscreenMap(ClientPtr client)
+{
+	int n, i;
+
+	REQUEST(xIMX_EXT_GetOffscreenMapReq);
+	REQUEST_SIZE_MATCH(xIMX_EXT_GetOffscreenMapReq);
+
+	if (stuff->screen >= screenInfo.numScreens)
+	{
+		client->errorValue = stuff->screen;
+		return BadValue;
+	}
+	ScreenPtr pScreen = screenInfo.screens[stuff->screen];
+
+	/* Count the areas, then query them from the driver. */
+	IMXOffscreenHeapInfoRec heaps[IMX_EXA_OFFSCREEN_MAX_HEAPS];
+	int numHeaps = 0;
+	int numAreas = IMXGetOffscreenMap(pScreen, heaps, &numHeaps, NULL, 0);
+
+	IMXOffscreenAreaInfoPtr areas = NULL;
+	if (0 < numAreas)
+	{
+		areas = malloc(numAreas * sizeof(IMXOffscreenAreaInfoRec));
+		if (NULL == areas)
+		{
+			return BadAlloc;
+		}
+		IMXGetOffscreenMap(pScreen, heaps, &numHeaps, areas, numAreas);
+	}
+
+	/* Initialize reply */
+	xIMX_EXT_GetOffscreenMapReply rep;
+	memset(&rep, 0, sizeof(rep));
+	rep.type = X_Reply;
+	rep.enabled = (0 <= numAreas);
+	rep.sequenceNumber = client->sequence;
+	if (!rep.enabled)
+	{
+		numHeaps = 0;
+		numAreas = 0;
+	}
+	rep.numHeaps = numHeaps;
+	rep.numAreas = numAreas;
+	rep.length = (numHeaps * sz_xIMX_EXT_OffscreenHeap +
+			numAreas * sz_xIMX_EXT_OffscreenArea) >> 2;
+
+	/* Convert heaps and areas to their wire format */
+	xIMX_EXT_OffscreenHeap* wireHeaps = NULL;
+	xIMX_EXT_OffscreenArea* wireAreas = NULL;
+	if (0 < rep.length)
+	{
+		wireHeaps = malloc(rep.length << 2);
+		if (NULL == wireHeaps)
+		{
+			free(areas);
+			return BadAlloc;
+		}
+		wireAreas = (xIMX_EXT_OffscreenArea*)(wireHeaps + numHeaps);
+	}
+
+	for (i = 0; i < numHeaps; ++i)
+	{
+		/* The IMX_EXA_OFFSCREEN_HEAP_* kinds are in the same */
+		/* order as IMX_EXT_HeapKind. */
+		wireHeaps[i].kind = heaps[i].kind;
+		wireHeaps[i].baseOffset = heaps[i].baseOffset;
+		wireHeaps[i].endOffset = heaps[i].endOffset;
+		wireHeaps[i].gpuAddressable = heaps[i].gpuAddressable;
+		if (client->swapped)
+		{
+			swapl(&wireHeaps[i].kind, n);
+			swapl(&wireHeaps[i].baseOffset, n);
+			swapl(&wireHeaps[i].endOffset, n);
+			swapl(&wireHeaps[i].gpuAddressable, n);
+		}
+	}
+
+	for (i = 0; i < numAreas; ++i)
+	{
+		wireAreas[i].offset = areas[i].offset;
+		wireAreas[i].size = areas[i].size;
+		wireAreas[i].age = areas[i].age;
+		wireAreas[i].idle = areas[i].idle;
+		wireAreas[i].heap = areas[i].heap;
+		wireAreas[i].owner = areas[i].owner;
+		wireAreas[i].locked = areas[i].locked;
+		wireAreas[i].pad0 = 0;
+		if (client->swapped)
+		{
+			swapl(&wireAreas[i].offset, n);
+			swapl(&wireAreas[i].size, n);
+			swapl(&wireAreas[i].age, n);
+			swapl(&wireAreas[i].idle, n);
+		}
+	}
+	free(areas);
+
+	/* Check if any reply values need byte swapping */
+	CARD32 length = rep.length;
+	if (client->swapped)
+	{
+		swaps(&rep.sequenceNumber, n);
+		swapl(&rep.length, n);
+		swapl(&rep.numHeaps, n);
+		swapl(&rep.numAreas, n);
+	}
+
+	/* Reply to client */
+	WriteToClient(client, sizeof(rep), (char*)&rep);
+	if (0 < length)
+	{
+		WriteToClient(client, length << 2, (char*)wireHeaps);
+	}
+	free(wireHeaps);
+	return client->noClientException;
+}
+
+static int
+Proc_IMX_EXT_GetAccelThresholds(ClientPtr client)
+{
+	int n, i;
+
+	REQUEST(xIMX_EXT_GetAccelThresholdsReq);
+	REQUEST_SIZE_MATCH(xIMX_EXT_GetAccelThresholdsReq);
+
+	if (stuff->screen >= screenInfo.numScreens)
+	{
+		client->errorValue = stuff->screen;
+		return BadValue;
+	}
+
+	/* Query the thresholds from the driver. */
+	IMXAccelThresholdInfoRec infos[IMX_EXA_NUM_ACCEL_THRESHOLDS];
+	int numThresholds =
+		IMXGetAccelThresholds(screenInfo.screens[stuff->screen], infos);
+
+	/* Initialize reply */
+	xIMX_EXT_GetAccelThresholdsReply rep;
+	memset(&rep, 0, sizeof(rep));
+	rep.type = X_Reply;
+	rep.enabled = (0 <= numThresholds);
+	rep.sequenceNumber = client->sequence;
+	if (!rep.enabled)
+	{
+		numThresholds = 0;
+	}
+	rep.numThresholds = numThresholds;
+	rep.length = (numThresholds * sz_xIMX_EXT_AccelThreshold) >> 2;
+
+	/* Convert thresholds to their wire format */
+	xIMX_EXT_AccelThreshold wire[IMX_EXA_NUM_ACCEL_THRESHOLDS];
+	for (i = 0; i < numThresholds; ++i)
+	{
+		/* The IMX_EXA_BATCH_* kinds are in the same order as */
+		/* IMX_EXT_AccelKind. */
+		wire[i].kind = infos[i].kind;
+		wire[i].bitsPerPixel = infos[i].bitsPerPixel;
+		wire[i].pad0 = 0;
+		wire[i].minPixelArea = infos[i].minPixelArea;
+		wire[i].calibratedPixelArea = infos[i].calibratedPixelArea;
+		wire[i].gpuSetupNs = infos[i].gpuSetupNs;
+		wire[i].gpuPixelPs = infos[i].gpuPixelPs;
+		wire[i].cpuPixelPs = infos[i].cpuPixelPs;
+		wire[i].numAccepted = infos[i].numAccepted;
+		wire[i].numRefused = infos[i].numRefused;
+		wire[i].numRefinements = infos[i].numRefinements;
+		if (client->swapped)
+		{
+			swapl(&wire[i].minPixelArea, n);
+			swapl(&wire[i].calibratedPixelArea, n);
+			swapl(&wire[i].gpuSetupNs, n);
+			swapl(&wire[i].gpuPixelPs, n);
+			swapl(&wire[i].cpuPixelPs, n);
+			swapl(&wire[i].numAccepted, n);
+			swapl(&wire[i].numRefused, n);
+			swapl(&wire[i].numRefinements, n);
+		}
+	}
+
+	/* Check if any reply values need byte swapping */
+	CARD32 length = rep.length;
+	if (client->swapped)
+	{
+		swaps(&rep.sequenceNumber, n);
+		swapl(&rep.length, n);
+		swapl(&rep.numThresholds, n);
+	}
+
+	/* Reply to client */
+	WriteToClient(client, sizeof(rep), (char*)&rep);
+	if (0 < length)
+	{
+		WriteToClient(client, length << 2, (char*)wire);
+	}
+	return client->noClientException;
+}
+
 static int
 Proc_IMX_EXT_Dispatch(ClientPtr client)
 {
@@ -109,6 +396,12 @@ Proc_IMX_EXT_Dispatch(ClientPtr client)
 	{
 		case X_IMX_EXT_GetPixmapPhysAddr:
 			return Proc_IMX_EXT_GetPixmapPhysAddr(client);
+		case X_IMX_EXT_GetOffscreenStats:
+			return Proc_IMX_EXT_GetOffscreenStats(client);
+		case X_IMX_EXT_GetOffscreenMap:
+			return Proc_IMX_EXT_GetOffscreenMap(client);
+		case X_IMX_EXT_GetAccelThresholds:
+			return Proc_IMX_EXT_GetAccelThresholds(client);
 		default:
 			return BadRequest;
 	}
@@ -128,6 +421,48 @@ SProc_IMX_EXT_GetPixmapPhysAddr(ClientPtr client)
 	return Proc_IMX_EXT_GetPixmapPhysAddr(client);
 }
 
+static int
+SProc_IMX_EXT_GetOffscreenStats(ClientPtr client)
+{
+	int n;
+
+	REQUEST(xIMX_EXT_GetOffscreenStatsReq);
+
+	swaps(&stuff->length, n);
+	REQUEST_SIZE_MATCH(xIMX_EXT_GetOffscreenStatsReq);
+
+	swapl(&stuff->screen, n);
+	return Proc_IMX_EXT_GetOffscreenStats(client);
+}
+
+static int
+SProc_IMX_EXT_GetOffscreenMap(ClientPtr client)
+{
+	int n;
+
+	REQUEST(xIMX_EXT_GetOffscreenMapReq);
+
+	swaps(&stuff->length, n);
+	REQUEST_SIZE_MATCH(xIMX_EXT_GetOffscreenMapReq);
+
+	swapl(&stuff->screen, n);
+	return Proc_IMX_EXT_GetOffscreenMap(client);
+}
+
+static int
+SProc_IMX_EXT_GetAccelThresholds(ClientPtr client)
+{
+	int n;
+
+	REQUEST(xIMX_EXT_GetAccelThresholdsReq);
+
+	swaps(&stuff->length, n);
+	REQUEST_SIZE_MATCH(xIMX_EXT_GetAccelThresholdsReq);
+
+	swapl(&stuff->screen, n);
+	return Proc_IMX_EXT_GetAccelThresholds(client);
+}
+
 static int
 SProc_IMX_EXT_Dispatch(ClientPtr client)
 {
@@ -136,6 +471,12 @@ SProc_IMX_EXT_Dispatch(ClientPtr client)
 	{
 		case X_IMX_EXT_GetPixmapPhysAddr:
 			return SProc_IMX_EXT_GetPixmapPhysAddr(client);
+		case X_IMX_EXT_GetOffscreenStats:
+			return SProc_IMX_EXT_GetOffscreenStats(client);
+		case X_IMX_EXT_GetOffscreenMap:
+			return SProc_IMX_EXT_GetOffscreenMap(client);
+		case X_IMX_EXT_GetAccelThresholds:
+			return SProc_IMX_EXT_GetAccelThresholds(client);
 		default:
 			return BadRequest;
 	}
@@ -33,6 +33,9 @@
 #define	IMX_EXT_NumEvents	0
 
 #define	X_IMX_EXT_GetPixmapPhysAddr	1
+#define	X_IMX_EXT_GetOffscreenStats	2
+#define	X_IMX_EXT_GetOffscreenMap	3
+#define	X_IMX_EXT_GetAccelThresholds	4
 
 /************************************************************************/
 
@@ -67,6 +70,151 @@ typedef struct {
 
 /************************************************************************/
 
+typedef struct {
+    CARD8	reqType;	/* always IMX_EXT major opcode */
+    CARD8	xtReqType;	/* always X_IMX_EXT_GetOffscreenStats */
+    CARD16	length B16;
+    CARD32	screen B32;
+} xIMX_EXT_GetOffscreenStatsReq;
+#define sz_xIMX_EXT_GetOffscreenStatsReq 8
+
+typedef struct {
+    CARD8	type;			/* must be X_Reply */
+    CARD8	enabled;		/* FALSE if driver does not allocate */
+    CARD16	sequenceNumber B16;	/* of last request received by server */
+    CARD32	length B32;		/* 4 byte quantities beyond size of GenericReply */
+    CARD32	numAllocs B32;		/* areas allocated */
+    CARD32	numAllocFailures B32;	/* allocations which found no room */
+    CARD32	numFrees B32;		/* areas freed by their owner */
+    CARD32	numEvictions B32;	/* areas freed to make room */
+    CARD32	numMoves B32;		/* areas moved by defragmentation */
+    CARD32	numAreasInUse B32;
+    CARD32	bytesInUse B32;
+    CARD32	peakBytesInUse B32;
+    CARD32	bytesFree B32;		/* main heap and pools, not glyphs */
+    CARD32	largestFree B32;	/* main heap and pools, not glyphs */
+    CARD32	fragmentation B32;	/* 1000 * (1 - largestFree / bytesFree) */
+    CARD32	pad0 B32;
+} xIMX_EXT_GetOffscreenStatsReply;
+#define	sz_xIMX_EXT_GetOffscreenStatsReply 56
+
+/************************************************************************/
+
+typedef struct {
+    CARD8	reqType;	/* always IMX_EXT major opcode */
+    CARD8	xtReqType;	/* always X_IMX_EXT_GetOffscreenMap */
+    CARD16	length B16;
+    CARD32	screen B32;
+} xIMX_EXT_GetOffscreenMapReq;
+#define sz_xIMX_EXT_GetOffscreenMapReq 8
+
+/* The reply is followed by numHeaps xIMX_EXT_OffscreenHeap and then by */
+/* numAreas xIMX_EXT_OffscreenArea, in address order within each heap. */
+typedef struct {
+    CARD8	type;			/* must be X_Reply */
+    CARD8	enabled;		/* FALSE if driver does not allocate */
+    CARD16	sequenceNumber B16;	/* of last request received by server */
+    CARD32	length B32;		/* 4 byte quantities beyond size of GenericReply */
+    CARD32	numHeaps B32;
+    CARD32	numAreas B32;
+    CARD32	pad0 B32;		/* bytes 17-20 */
+    CARD32	pad1 B32;		/* bytes 21-24 */
+    CARD32	pad2 B32;		/* bytes 25-28 */
+    CARD32	pad3 B32;		/* bytes 29-32 */
+} xIMX_EXT_GetOffscreenMapReply;
+#define	sz_xIMX_EXT_GetOffscreenMapReply 32
+
+typedef enum
+{
+	IMX_EXT_HeapMain,		/* frame buffer memory */
+	IMX_EXT_HeapGlyph,		/* frame buffer memory for glyphs */
+	IMX_EXT_HeapPool		/* OffscreenPools option */
+} IMX_EXT_HeapKind;
+
+typedef struct {
+    CARD32	kind B32;		/* has value of IMX_EXT_HeapKind */
+    CARD32	baseOffset B32;
+    CARD32	endOffset B32;
+    CARD32	gpuAddressable B32;
+} xIMX_EXT_OffscreenHeap;
+#define	sz_xIMX_EXT_OffscreenHeap 16
+
+typedef enum
+{
+	IMX_EXT_AreaFree,		/* not allocated */
+	IMX_EXT_AreaOther,		/* allocated by EXA or unknown */
+	IMX_EXT_AreaPixmap,		/* pixmap */
+	IMX_EXT_AreaGlyph,		/* pixmap of a glyph picture */
+	IMX_EXT_AreaSubPage,		/* page shared by small pixmaps */
+	IMX_EXT_AreaRecycled		/* kept from a destroyed pixmap */
+} IMX_EXT_AreaOwner;
+
+typedef struct {
+    CARD32	offset B32;		/* start of the area */
+    CARD32	size B32;
+    CARD32	age B32;		/* allocator ticks since allocated */
+    CARD32	idle B32;		/* allocator ticks since last used */
+    CARD8	heap;			/* index of the heap */
+    CARD8	owner;			/* has value of IMX_EXT_AreaOwner */
+    CARD8	locked;			/* TRUE if it cannot be evicted */
+    CARD8	pad0;
+} xIMX_EXT_OffscreenArea;
+#define	sz_xIMX_EXT_OffscreenArea 20
+
+/************************************************************************/
+
+typedef struct {
+    CARD8	reqType;	/* always IMX_EXT major opcode */
+    CARD8	xtReqType;	/* always X_IMX_EXT_GetAccelThresholds */
+    CARD16	length B16;
+    CARD32	screen B32;
+} xIMX_EXT_GetAccelThresholdsReq;
+#define sz_xIMX_EXT_GetAccelThresholdsReq 8
+
+/* The reply is followed by numThresholds xIMX_EXT_AccelThreshold. */
+typedef struct {
+    CARD8	type;			/* must be X_Reply */
+    CARD8	enabled;		/* FALSE if not accelerated */
+    CARD16	sequenceNumber B16;	/* of last request received by server */
+    CARD32	length B32;		/* 4 byte quantities beyond size of GenericReply */
+    CARD32	numThresholds B32;
+    CARD32	pad0 B32;		/* bytes 13-16 */
+    CARD32	pad1 B32;		/* bytes 17-20 */
+    CARD32	pad2 B32;		/* bytes 21-24 */
+    CARD32	pad3 B32;		/* bytes 25-28 */
+    CARD32	pad4 B32;		/* bytes 29-32 */
+} xIMX_EXT_GetAccelThresholdsReply;
+#define	sz_xIMX_EXT_GetAccelThresholdsReply 32
+
+typedef enum
+{
+	IMX_EXT_AccelSolid,		/* solid fill */
+	IMX_EXT_AccelCopy,		/* copy */
+	IMX_EXT_AccelComposite		/* composite */
+} IMX_EXT_AccelKind;
+
+/* Operations on pixmaps of fewer than minPixelArea pixels are left */
+/* to the CPU.  The GPU is modelled as taking gpuSetupNs nanoseconds */
+/* plus gpuPixelPs picoseconds per pixel, and the CPU cpuPixelPs */
+/* picoseconds per pixel.  gpuSetupNs includes the time the server */
+/* takes to queue a rectangle, measured while running. */
+typedef struct {
+    CARD8	kind;			/* has value of IMX_EXT_AccelKind */
+    CARD8	bitsPerPixel;
+    CARD16	pad0 B16;
+    CARD32	minPixelArea B32;	/* in use */
+    CARD32	calibratedPixelArea B32; /* at startup, 0 if not measured */
+    CARD32	gpuSetupNs B32;
+    CARD32	gpuPixelPs B32;
+    CARD32	cpuPixelPs B32;
+    CARD32	numAccepted B32;	/* operations large enough */
+    CARD32	numRefused B32;		/* operations too small */
+    CARD32	numRefinements B32;	/* times refined from timings */
+} xIMX_EXT_AccelThreshold;
+#define	sz_xIMX_EXT_AccelThreshold 36
+
+/************************************************************************/
+
 #undef Pixmap
 
 #endif
@@ -47,6 +47,187 @@
 #include "mxc_ipu_hl_lib.h"
 #endif
 
+/* Fixed size records are allocated from slabs: chunks holding many */
+/* records next to each other, with freed records kept on a free list */
+/* for reuse.  Chunks are only released when the slab is finished. */
+typedef struct _IMXSlab {
+	int				recordSize;
+	int				recordsPerChunk;
+	void*				chunkList;
+	void*				freeList;
+	int				numInUse;
+} IMXSlabRec, *IMXSlabPtr;
+
+/* Offscreen area record managed by imx_exa_offscreen.c */
+struct _IMXOffscreenArea;
+
+/* Small offscreen blocks are packed into shared pages, one list of pages */
+/* for each power of two block size from the minimum up. */
+struct _IMXOffscreenSubPage;
+
+#define	IMX_EXA_OFFSCREEN_SUB_MIN_SIZE		128
+#define	IMX_EXA_OFFSCREEN_SUB_NUM_SIZES		5
+
+/* Callback for a block in a shared page which is about to be evicted. */
+typedef void (*IMXOffscreenSubSaveProc)(ScreenPtr pScreen, pointer privData);
+
+/* Extra memory pools for offscreen pixmaps besides the frame buffer */
+/* memory.  Each pool is mapped at its own CPU address and may have its */
+/* own GPU address, but is given a range of offsets following the frame */
+/* buffer memory so that offsets stay unique. */
+#define	IMX_EXA_OFFSCREEN_MAX_POOLS		4
+
+typedef struct _IMXOffscreenPool {
+	int				baseOffset;	/* offset of pool start */
+	int				size;
+	unsigned char*			virtAddr;	/* CPU address of start */
+	unsigned long			physAddr;	/* GPU address of start */
+	Bool				gpuAddressable;
+	int				fd;
+} IMXOffscreenPoolRec, *IMXOffscreenPoolPtr;
+
+/* Offscreen memory is split into heaps, each a contiguous range of */
+/* offsets with its own list of areas.  The glyph atlas gets a heap of its */
+/* own so that it does not fragment the memory used by other pixmaps, and */
+/* each extra pool is a heap.  The main heap is always the first one and */
+/* the glyph heap, if any, the second one. */
+#define	IMX_EXA_OFFSCREEN_HEAP_MAIN		0
+#define	IMX_EXA_OFFSCREEN_HEAP_GLYPH		1
+#define	IMX_EXA_OFFSCREEN_HEAP_POOL		2
+#define	IMX_EXA_OFFSCREEN_MAX_HEAPS		(2 + IMX_EXA_OFFSCREEN_MAX_POOLS)
+
+typedef struct _IMXOffscreenHeap {
+	int				kind;		/* IMX_EXA_OFFSCREEN_HEAP_* */
+	int				baseOffset;
+	int				endOffset;
+	IMXSlabPtr			areaSlab;	/* shared by all heaps */
+	unsigned char*			virtAddr;	/* CPU address of base */
+	unsigned long			physAddr;	/* GPU address of base */
+	Bool				gpuAddressable;
+	ExaOffscreenArea*		areas;
+	unsigned			numAvailable;
+	struct _IMXOffscreenArea*	freeRoot;
+	struct _IMXOffscreenSubPage*	subPages[IMX_EXA_OFFSCREEN_SUB_NUM_SIZES];
+} IMXOffscreenHeapRec, *IMXOffscreenHeapPtr;
+
+/* Where an offscreen allocation should be placed, according to how long */
+/* it is expected to live.  IMX_EXA_OFFSCREEN_NO_EVICT may be or'ed in to */
+/* only use free memory, and IMX_EXA_OFFSCREEN_GPU_ONLY to only use memory */
+/* the GPU can address. */
+#define	IMX_EXA_OFFSCREEN_BEST_FIT		0	/* smallest free area */
+#define	IMX_EXA_OFFSCREEN_SHORT_LIVED		1	/* bottom of main heap */
+#define	IMX_EXA_OFFSCREEN_LONG_LIVED		2	/* top of main heap */
+#define	IMX_EXA_OFFSCREEN_GLYPH			3	/* glyph heap first */
+#define	IMX_EXA_OFFSCREEN_PLACEMENT_MASK	0x0F
+#define	IMX_EXA_OFFSCREEN_NO_EVICT		0x10
+#define	IMX_EXA_OFFSCREEN_GPU_ONLY		0x20
+
+/* Callback to copy the contents of an offscreen area to a new offset */
+/* during defragmentation; returns FALSE if the area cannot be moved. */
+typedef Bool (*IMXOffscreenMoveProc)(ScreenPtr pScreen,
+					ExaOffscreenArea* area, int offset);
+
+/* Counters kept by the offscreen allocator, each costing an increment */
+/* or two per call.  The free memory figures are only worked out when */
+/* asked for by IMX_EXA_OffscreenGetStats, and cover the main heap and */
+/* the pools but not the glyph heap. */
+typedef struct _IMXOffscreenStats {
+	unsigned long			numAllocs;
+	unsigned long			numAllocFailures;
+	unsigned long			numFrees;
+	unsigned long			numEvictions;
+	unsigned long			numMoves;
+	unsigned long			numAreasInUse;
+	unsigned long			bytesInUse;
+	unsigned long			peakBytesInUse;
+	unsigned long			bytesFree;
+	unsigned long			largestFree;
+	int				fragmentation;	/* per mille */
+} IMXOffscreenStatsRec, *IMXOffscreenStatsPtr;
+
+/* Snapshot of the offscreen heaps and of every area in them, as */
+/* returned by IMX_EXA_OffscreenGetMap.  Ages are in allocator ticks, */
+/* which advance on each allocation and each use of an area. */
+typedef struct _IMXOffscreenHeapInfo {
+	int				kind;		/* IMX_EXA_OFFSCREEN_HEAP_* */
+	int				baseOffset;
+	int				endOffset;
+	Bool				gpuAddressable;
+} IMXOffscreenHeapInfoRec, *IMXOffscreenHeapInfoPtr;
+
+typedef struct _IMXOffscreenAreaInfo {
+	int				heap;		/* index of the heap */
+	int				offset;		/* start of the area */
+	int				size;
+	unsigned			age;
+	unsigned			idle;
+	int				owner;		/* IMX_EXT_Area* */
+	Bool				locked;
+} IMXOffscreenAreaInfoRec, *IMXOffscreenAreaInfoPtr;
+
+/* Pixel area above which an operation is accelerated, for each kind */
+/* of operation and bits per pixel, as returned by */
+/* IMX_EXA_GetAccelThresholds.  The cost model behind it has the GPU */
+/* take a fixed setup time plus a time per pixel and the CPU only a */
+/* time per pixel.  The decisions count operations accepted and */
+/* refused because of their area. */
+#define	IMX_EXA_NUM_ACCEL_THRESHOLDS		9	/* 3 kinds, 3 depths */
+
+typedef struct _IMXAccelThresholdInfo {
+	int				kind;		/* IMX_EXT_Accel* */
+	int				bitsPerPixel;
+	unsigned			minPixelArea;	/* in use */
+	unsigned			calibratedPixelArea; /* 0 if not */
+	unsigned long			gpuSetupNs;
+	unsigned long			gpuPixelPs;	/* picoseconds */
+	unsigned long			cpuPixelPs;
+	unsigned long			numAccepted;
+	unsigned long			numRefused;
+	unsigned long			numRefinements;
+} IMXAccelThresholdInfoRec, *IMXAccelThresholdInfoPtr;
+
+/* Callback telling who owns an allocated area, as an IMX_EXT_Area* */
+/* value, for the areas the allocator does not know about itself. */
+typedef int (*IMXOffscreenOwnerProc)(ExaOffscreenArea* area);
+
+/* Offscreen allocator trace, written when the driver is configured with */
+/* --enable-offscreen-trace and IMX_OFFSCREEN_TRACE names the trace file. */
+/* The file starts with a header and is followed by fixed size records, */
+/* and is read back by tools/imx_offscreen_replay. */
+#define	IMX_EXA_TRACE_MAGIC			0x54584D49	/* "IMXT" */
+#define	IMX_EXA_TRACE_VERSION			1
+
+#define	IMX_EXA_TRACE_HEAP			1	/* heap layout at init */
+#define	IMX_EXA_TRACE_ALLOC			2
+#define	IMX_EXA_TRACE_FREE			3
+#define	IMX_EXA_TRACE_EVICT			4	/* freed to make room */
+#define	IMX_EXA_TRACE_MOVE			5	/* moved by defragmentation */
+
+#define	IMX_EXA_TRACE_LOCKED			0x80	/* or'ed into placement */
+#define	IMX_EXA_TRACE_NO_OFFSET			0xFFFFFFFF	/* failed alloc */
+
+typedef struct _IMXOffscreenTraceHeader {
+	CARD32				magic;
+	CARD32				version;
+	CARD32				recordSize;
+	CARD32				pad;
+} IMXOffscreenTraceHeaderRec;
+
+/* HEAP:  offset = heap base, size = heap span, flags = heap kind, */
+/*        align = TRUE when GPU addressable */
+/* ALLOC: size, align and flags as requested, offset of the result */
+/* FREE, EVICT: offset of the area */
+/* MOVE:  offset before the move, size = offset after the move */
+typedef struct _IMXOffscreenTraceRecord {
+	CARD32				time;		/* milliseconds */
+	CARD32				size;
+	CARD32				align;
+	CARD32				offset;
+	CARD8				op;		/* IMX_EXA_TRACE_* */
+	CARD8				flags;
+	CARD16				pad;
+} IMXOffscreenTraceRecord;
+
 /* -------------------------------------------------------------------- */
 /* our private data, and two functions to allocate/free this            */
 
@@ -88,9 +269,20 @@ typedef struct {
 	void*				exaDriverPrivate;
 
 	/* For EXA offscreen memory allocation. */
-	ExaOffscreenArea*		offScreenAreas;
+	IMXOffscreenHeapRec		offScreenHeaps[IMX_EXA_OFFSCREEN_MAX_HEAPS];
+	int				numOffscreenHeaps;
 	unsigned			offScreenCounter;
-	unsigned			numOffscreenAvailable;
+	int				offScreenGlyphSize;	/* bytes, -1 for default */
+	IMXSlabRec			offScreenAreaSlab;
+	const char*			offScreenPoolSpec;	/* OffscreenPools option */
+	IMXOffscreenPoolRec		offScreenPools[IMX_EXA_OFFSCREEN_MAX_POOLS];
+	int				numOffscreenPools;
+	IMXOffscreenStatsRec		offScreenStats;
+#if IMX_EXA_OFFSCREEN_TRACE
+	int				offScreenTraceFd;
+	IMXOffscreenTraceRecord*	offScreenTraceBuf;
+	int				offScreenTraceCount;
+#endif
 
 } IMXRec, *IMXPtr;
 
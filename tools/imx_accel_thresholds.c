@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2010 Freescale Semiconductor, Inc.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Asks a running X server with the imx driver for the pixel areas above
+ * which it accelerates solid fills, copies and composites, through the
+ * imx-ext extension, and prints them:
+ *
+ *	imx_accel_thresholds [-d display] [-s screen]
+ *
+ * For each kind of operation and bits per pixel it shows the area in
+ * use, the area measured when the screen was initialized, the cost
+ * model behind them and how many operations were accepted and refused
+ * because of their area.
+ */
+
+#include <X11/Xlibint.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "imx_ext.h"
+
+/* names of each IMX_EXT_AccelKind */
+static const char* kindNames[] = { "solid", "copy", "composite" };
+#define	NUM_KINDS	(sizeof(kindNames) / sizeof(kindNames[0]))
+
+static void
+Usage(const char* name)
+{
+	fprintf(stderr, "usage: %s [-d display] [-s screen]\n", name);
+	exit(2);
+}
+
+/* Returns the thresholds, to be freed by the caller. */
+static xIMX_EXT_AccelThreshold*
+GetAccelThresholds(Display* dpy, int majorOpcode, int screen,
+			xIMX_EXT_GetAccelThresholdsReply* pRep)
+{
+	xIMX_EXT_GetAccelThresholdsReq* req;
+	void* data = NULL;
+
+	LockDisplay(dpy);
+	GetReq(IMX_EXT_GetAccelThresholds, req);
+	req->reqType = majorOpcode;
+	req->xtReqType = X_IMX_EXT_GetAccelThresholds;
+	req->screen = screen;
+	if (_XReply(dpy, (xReply*)pRep, 0, xFalse)) {
+
+		const long size = (long)pRep->length << 2;
+		data = Xmalloc(size ? size : 1);
+		if (NULL != data) {
+			_XRead(dpy, data, size);
+		} else {
+			_XEatData(dpy, size);
+		}
+	}
+	UnlockDisplay(dpy);
+	SyncHandle();
+
+	return data;
+}
+
+static void
+PrintThresholds(const xIMX_EXT_AccelThreshold* thresholds, int num)
+{
+	int i;
+
+	printf("%-10s %4s %8s %10s %9s %9s %9s %10s %10s %8s\n",
+		"operation", "bpp", "area", "calibrated",
+		"gpu ns", "gpu ps/px", "cpu ps/px",
+		"accepted", "refused", "refined");
+
+	for (i = 0; i < num; ++i) {
+
+		const xIMX_EXT_AccelThreshold* t = &thresholds[i];
+		printf("%-10s %4u %8lu %10lu %9lu %9lu %9lu %10lu %10lu %8lu\n",
+			(t->kind < NUM_KINDS) ? kindNames[t->kind] : "?",
+			(unsigned)t->bitsPerPixel,
+			(unsigned long)t->minPixelArea,
+			(unsigned long)t->calibratedPixelArea,
+			(unsigned long)t->gpuSetupNs,
+			(unsigned long)t->gpuPixelPs,
+			(unsigned long)t->cpuPixelPs,
+			(unsigned long)t->numAccepted,
+			(unsigned long)t->numRefused,
+			(unsigned long)t->numRefinements);
+	}
+}
+
+int
+main(int argc, char** argv)
+{
+	const char* displayName = NULL;
+	int screen = -1;
+	int c;
+
+	while (-1 != (c = getopt(argc, argv, "d:s:"))) {
+
+		switch (c) {
+
+		case 'd':
+			displayName = optarg;
+			break;
+
+		case 's':
+			screen = atoi(optarg);
+			break;
+
+		default:
+			Usage(argv[0]);
+		}
+	}
+	if (optind != argc) {
+		Usage(argv[0]);
+	}
+
+	Display* dpy = XOpenDisplay(displayName);
+	if (NULL == dpy) {
+		fprintf(stderr, "cannot open display %s\n",
+			XDisplayName(displayName));
+		return 1;
+	}
+	if (0 > screen) {
+		screen = DefaultScreen(dpy);
+	}
+
+	int majorOpcode, firstEvent, firstError;
+	if (!XQueryExtension(dpy, IMX_EXT_NAME,
+				&majorOpcode, &firstEvent, &firstError)) {
+		fprintf(stderr, "%s extension not found\n", IMX_EXT_NAME);
+		return 1;
+	}
+
+	xIMX_EXT_GetAccelThresholdsReply rep;
+	xIMX_EXT_AccelThreshold* thresholds =
+		GetAccelThresholds(dpy, majorOpcode, screen, &rep);
+	if (NULL == thresholds) {
+		fprintf(stderr, "acceleration thresholds request failed\n");
+		return 1;
+	}
+	if (!rep.enabled) {
+		fprintf(stderr, "screen %d is not accelerated\n", screen);
+		return 1;
+	}
+
+	PrintThresholds(thresholds, rep.numThresholds);
+
+	Xfree(thresholds);
+	XCloseDisplay(dpy);
+
+	return 0;
+}
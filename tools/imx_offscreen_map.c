@@ -0,0 +1,373 @@
+/*
+ * Copyright (C) 2010 Freescale Semiconductor, Inc.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Asks a running X server with the imx driver for the counters and the
+ * area map of its offscreen memory allocator, through the imx-ext
+ * extension, and prints them:
+ *
+ *	imx_offscreen_map [-d display] [-s screen] [-w width] [-r rows] [-l]
+ *
+ * Each heap is drawn as rows of characters, each character standing for
+ * an equal part of the heap and showing who owns most of it:
+ *
+ *	.	free
+ *	p P	pixmap
+ *	g G	glyph pixmap
+ *	s S	page shared by small pixmaps
+ *	r	area kept from a destroyed pixmap
+ *	o O	EXA or unknown
+ *
+ * Upper case stands for locked areas, which cannot be evicted or moved.
+ * With -l every area is also listed with its size and its age and idle
+ * time in allocator ticks, which advance on each allocation and each use
+ * of an area.
+ */
+
+#include <X11/Xlibint.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "imx_ext.h"
+
+#define	MAP_DEFAULT_WIDTH		64
+#define	MAP_DEFAULT_ROWS		16
+
+/* map characters for each IMX_EXT_AreaOwner, removable then locked */
+static const char mapChars[][2] = {
+	{ '.', '.' },		/* IMX_EXT_AreaFree */
+	{ 'o', 'O' },		/* IMX_EXT_AreaOther */
+	{ 'p', 'P' },		/* IMX_EXT_AreaPixmap */
+	{ 'g', 'G' },		/* IMX_EXT_AreaGlyph */
+	{ 's', 'S' },		/* IMX_EXT_AreaSubPage */
+	{ 'r', 'R' }		/* IMX_EXT_AreaRecycled */
+};
+#define	MAP_NUM_OWNERS	(sizeof(mapChars) / sizeof(mapChars[0]))
+
+static const char* ownerNames[MAP_NUM_OWNERS] = {
+	"free", "other", "pixmap", "glyph", "subpage", "recycled"
+};
+
+static const char* heapNames[] = { "main", "glyph", "pool" };
+
+static void
+Usage(const char* name)
+{
+	fprintf(stderr,
+		"usage: %s [-d display] [-s screen] [-w width] [-r rows] [-l]\n",
+		name);
+	exit(2);
+}
+
+static Bool
+GetOffscreenStats(Display* dpy, int majorOpcode, int screen,
+			xIMX_EXT_GetOffscreenStatsReply* pRep)
+{
+	xIMX_EXT_GetOffscreenStatsReq* req;
+
+	LockDisplay(dpy);
+	GetReq(IMX_EXT_GetOffscreenStats, req);
+	req->reqType = majorOpcode;
+	req->xtReqType = X_IMX_EXT_GetOffscreenStats;
+	req->screen = screen;
+	Bool ok = _XReply(dpy, (xReply*)pRep,
+		(sz_xIMX_EXT_GetOffscreenStatsReply - sz_xReply) >> 2, xTrue);
+	UnlockDisplay(dpy);
+	SyncHandle();
+
+	return ok;
+}
+
+/* Returns the heaps and areas in one block, to be freed by the caller. */
+static void*
+GetOffscreenMap(Display* dpy, int majorOpcode, int screen,
+			xIMX_EXT_GetOffscreenMapReply* pRep)
+{
+	xIMX_EXT_GetOffscreenMapReq* req;
+	void* data = NULL;
+
+	LockDisplay(dpy);
+	GetReq(IMX_EXT_GetOffscreenMap, req);
+	req->reqType = majorOpcode;
+	req->xtReqType = X_IMX_EXT_GetOffscreenMap;
+	req->screen = screen;
+	if (_XReply(dpy, (xReply*)pRep, 0, xFalse)) {
+
+		const long size = (long)pRep->length << 2;
+		data = Xmalloc(size ? size : 1);
+		if (NULL != data) {
+			_XRead(dpy, data, size);
+		} else {
+			_XEatData(dpy, size);
+		}
+	}
+	UnlockDisplay(dpy);
+	SyncHandle();
+
+	return data;
+}
+
+static void
+PrintStats(const xIMX_EXT_GetOffscreenStatsReply* rep)
+{
+	printf("allocations   %lu (%lu failed)\n",
+		(unsigned long)rep->numAllocs,
+		(unsigned long)rep->numAllocFailures);
+	printf("frees         %lu, evictions %lu, moves %lu\n",
+		(unsigned long)rep->numFrees,
+		(unsigned long)rep->numEvictions,
+		(unsigned long)rep->numMoves);
+	printf("in use        %luK in %lu areas, peak %luK\n",
+		(unsigned long)rep->bytesInUse / 1024,
+		(unsigned long)rep->numAreasInUse,
+		(unsigned long)rep->peakBytesInUse / 1024);
+	printf("free          %luK, largest %luK, fragmentation %lu.%lu%%\n",
+		(unsigned long)rep->bytesFree / 1024,
+		(unsigned long)rep->largestFree / 1024,
+		(unsigned long)rep->fragmentation / 10,
+		(unsigned long)rep->fragmentation % 10);
+}
+
+/* Draw one heap as rows of width characters. */
+static void
+PrintHeap(int index, const xIMX_EXT_OffscreenHeap* heap,
+		const xIMX_EXT_OffscreenArea* areas, int numAreas,
+		int width, int rows)
+{
+	const long span = (long)heap->endOffset - heap->baseOffset;
+	const int numCells = width * rows;
+	const long cellSize = (span + numCells - 1) / numCells;
+
+	/* bytes of each owner and locked state in each cell */
+	long (*cells)[MAP_NUM_OWNERS][2] =
+		calloc(numCells, sizeof(*cells));
+	if (NULL == cells) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	long bytesFree = 0;
+	long largestFree = 0;
+	int numFree = 0;
+	int i;
+
+	for (i = 0; i < numAreas; ++i) {
+
+		const xIMX_EXT_OffscreenArea* area = &areas[i];
+		if (area->heap != index) {
+			continue;
+		}
+
+		const int owner = (area->owner < MAP_NUM_OWNERS) ?
+					area->owner : IMX_EXT_AreaOther;
+		const int locked = area->locked ? 1 : 0;
+
+		if (IMX_EXT_AreaFree == owner) {
+			bytesFree += area->size;
+			if (area->size > largestFree) {
+				largestFree = area->size;
+			}
+			++numFree;
+		}
+
+		/* Spread the area over the cells it covers. */
+		long start = (long)area->offset - heap->baseOffset;
+		const long end = start + area->size;
+		while (start < end) {
+
+			const long cell = start / cellSize;
+			long cellEnd = (cell + 1) * cellSize;
+			if (cellEnd > end) {
+				cellEnd = end;
+			}
+			cells[cell][owner][locked] += cellEnd - start;
+			start = cellEnd;
+		}
+	}
+
+	printf("\nheap %d: %s%s, offset 0x%08lx, %luK, %luK per character\n",
+		index,
+		(heap->kind < sizeof(heapNames) / sizeof(heapNames[0])) ?
+			heapNames[heap->kind] : "unknown",
+		heap->gpuAddressable ? "" : " (not GPU addressable)",
+		(unsigned long)heap->baseOffset,
+		(unsigned long)span / 1024,
+		(unsigned long)(cellSize + 1023) / 1024);
+
+	for (i = 0; i < numCells; ++i) {
+
+		/* The owner with the most bytes in the cell wins. */
+		int owner, locked;
+		int bestOwner = IMX_EXT_AreaFree;
+		int bestLocked = 0;
+		long best = -1;
+		for (owner = 0; owner < MAP_NUM_OWNERS; ++owner) {
+			for (locked = 0; locked < 2; ++locked) {
+				if (cells[i][owner][locked] > best) {
+					best = cells[i][owner][locked];
+					bestOwner = owner;
+					bestLocked = locked;
+				}
+			}
+		}
+
+		/* Cells past the end of the heap stay blank. */
+		putchar(((long)i * cellSize < span) ?
+			mapChars[bestOwner][bestLocked] : ' ');
+		if (width - 1 == i % width) {
+			putchar('\n');
+		}
+	}
+
+	printf("free %luK in %d areas, largest %luK, fragmentation %ld.%ld%%\n",
+		(unsigned long)bytesFree / 1024,
+		numFree,
+		(unsigned long)largestFree / 1024,
+		bytesFree ? (1000 - 1000 * largestFree / bytesFree) / 10 : 0,
+		bytesFree ? (1000 - 1000 * largestFree / bytesFree) % 10 : 0);
+
+	free(cells);
+}
+
+static void
+PrintAreas(const xIMX_EXT_OffscreenArea* areas, int numAreas)
+{
+	int i;
+
+	printf("\nheap  offset      size        owner     locked  age         idle\n");
+	for (i = 0; i < numAreas; ++i) {
+
+		const xIMX_EXT_OffscreenArea* area = &areas[i];
+		const int owner = (area->owner < MAP_NUM_OWNERS) ?
+					area->owner : IMX_EXT_AreaOther;
+
+		printf("%-4d  0x%08lx  %-10lu  %-8s  %-6s  %-10lu  %lu\n",
+			area->heap,
+			(unsigned long)area->offset,
+			(unsigned long)area->size,
+			ownerNames[owner],
+			area->locked ? "yes" : "no",
+			(unsigned long)area->age,
+			(unsigned long)area->idle);
+	}
+}
+
+int
+main(int argc, char** argv)
+{
+	const char* displayName = NULL;
+	int screen = -1;
+	int width = MAP_DEFAULT_WIDTH;
+	int rows = MAP_DEFAULT_ROWS;
+	Bool list = False;
+	int c;
+
+	while (-1 != (c = getopt(argc, argv, "d:s:w:r:l"))) {
+
+		switch (c) {
+
+		case 'd':
+			displayName = optarg;
+			break;
+
+		case 's':
+			screen = atoi(optarg);
+			break;
+
+		case 'w':
+			width = atoi(optarg);
+			break;
+
+		case 'r':
+			rows = atoi(optarg);
+			break;
+
+		case 'l':
+			list = True;
+			break;
+
+		default:
+			Usage(argv[0]);
+		}
+	}
+	if ((optind != argc) || (0 >= width) || (0 >= rows)) {
+		Usage(argv[0]);
+	}
+
+	Display* dpy = XOpenDisplay(displayName);
+	if (NULL == dpy) {
+		fprintf(stderr, "cannot open display %s\n",
+			XDisplayName(displayName));
+		return 1;
+	}
+	if (0 > screen) {
+		screen = DefaultScreen(dpy);
+	}
+
+	int majorOpcode, firstEvent, firstError;
+	if (!XQueryExtension(dpy, IMX_EXT_NAME,
+				&majorOpcode, &firstEvent, &firstError)) {
+		fprintf(stderr, "%s extension not found\n", IMX_EXT_NAME);
+		return 1;
+	}
+
+	xIMX_EXT_GetOffscreenStatsReply stats;
+	if (!GetOffscreenStats(dpy, majorOpcode, screen, &stats)) {
+		fprintf(stderr, "offscreen statistics request failed\n");
+		return 1;
+	}
+	if (!stats.enabled) {
+		fprintf(stderr, "screen %d does not use the driver offscreen "
+			"allocator\n", screen);
+		return 1;
+	}
+	PrintStats(&stats);
+
+	xIMX_EXT_GetOffscreenMapReply map;
+	void* data = GetOffscreenMap(dpy, majorOpcode, screen, &map);
+	if (NULL == data) {
+		fprintf(stderr, "offscreen map request failed\n");
+		return 1;
+	}
+
+	const xIMX_EXT_OffscreenHeap* heaps = data;
+	const xIMX_EXT_OffscreenArea* areas =
+		(const xIMX_EXT_OffscreenArea*)(heaps + map.numHeaps);
+	int i;
+	for (i = 0; i < map.numHeaps; ++i) {
+		PrintHeap(i, &heaps[i], areas, map.numAreas, width, rows);
+	}
+
+	if (list) {
+		PrintAreas(areas, map.numAreas);
+	}
+
+	Xfree(data);
+	XCloseDisplay(dpy);
+
+	return 0;
+}
@@ -0,0 +1,593 @@
+/*
+ * Copyright (C) 2010 Freescale Semiconductor, Inc.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Replays an offscreen allocator trace, written by a driver built with
+ * --enable-offscreen-trace, against imx_exa_offscreen.c outside the X
+ * server, and reports how the allocator performs:
+ *
+ *	imx_offscreen_replay [-i interval] [-q] trace
+ *
+ * The trace is replayed twice.  The first run is timed and gives the
+ * allocator throughput; the second samples the free memory of the main
+ * heap and the pools every interval operations, printing the largest free
+ * block and the fragmentation over time unless -q is given.
+ *
+ * Allocations are matched to their frees by the offset they got in the
+ * trace, so the replayed allocator may place them differently.  Areas
+ * which the driver evicted are freed when the eviction is replayed, areas
+ * which the replay evicts on its own are counted and forgotten, and moves
+ * made by defragmentation are replayed by defragmenting as much memory.
+ * Traces are read in the byte order of the machine which replays them.
+ */
+
+#include "xf86.h"
+#include "exa.h"
+#include "imx_type.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* allocator entry points, from imx_exa_offscreen.c */
+extern Bool IMX_EXA_OffscreenInit(ScreenPtr pScreen);
+extern void IMX_EXA_OffscreenFini(ScreenPtr pScreen);
+extern ExaOffscreenArea* IMX_EXA_OffscreenAllocPlaced(ScreenPtr pScreen,
+			int size, int align, Bool locked,
+			ExaOffscreenSaveProc save, pointer privData,
+			int placement);
+extern ExaOffscreenArea* IMX_EXA_OffscreenFree(ScreenPtr pScreen,
+			ExaOffscreenArea* area);
+extern int IMX_EXA_OffscreenLargestAvail(ScreenPtr pScreen);
+extern int IMX_EXA_OffscreenDefragment(ScreenPtr pScreen, int maxBytes,
+			IMXOffscreenMoveProc move);
+
+#define	REPLAY_HASH_BUCKETS		4096
+#define	REPLAY_DEFAULT_INTERVAL		1000
+
+/* a live allocation of the trace, keyed by its offset in the trace */
+typedef struct _ReplayEntry {
+	CARD32			offset;
+	ExaOffscreenArea*	area;		/* NULL once gone in the replay */
+	struct _ReplayEntry*	next;
+} ReplayEntryRec, *ReplayEntryPtr;
+
+typedef struct {
+	long			ops;
+	long			allocs;
+	long			traceFailures;
+	long			replayFailures;
+	long			replayEvictions;
+	long			unmatched;
+	long			movedBytes;
+	int			minLargest;
+	double			peakFrag;
+	CARD32			peakFragTime;
+} ReplayStatsRec, *ReplayStatsPtr;
+
+/* -------------------------------------------------------------------- */
+/* what the allocator needs from the server                             */
+
+static ScrnInfoRec replayScrn;
+static ScrnInfoPtr replayScreens[1] = { &replayScrn };
+ScrnInfoPtr* xf86Screens = replayScreens;
+
+static ScreenRec replayScreen;
+static IMXRec replayImx;
+static ExaDriverRec replayExa;
+static unsigned char replayFb[1];
+
+void
+ErrorF(const char* format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+void
+xf86DrvMsgVerb(int scrnIndex, MessageType type, int verb,
+		const char* format, ...)
+{
+	va_list args;
+
+	if (verb > 1)
+		return;
+
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+void
+xf86DrvMsg(int scrnIndex, MessageType type, const char* format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+CARD32
+GetTimeInMillis(void)
+{
+	return 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* live allocations                                                     */
+
+static ReplayEntryPtr replayHash[REPLAY_HASH_BUCKETS];
+static ReplayStatsPtr replayStats;
+
+static ReplayEntryPtr*
+ReplayLookup(CARD32 offset)
+{
+	ReplayEntryPtr* pEntry =
+		&replayHash[(offset >> 5) % REPLAY_HASH_BUCKETS];
+
+	while (*pEntry && (*pEntry)->offset != offset)
+		pEntry = &(*pEntry)->next;
+
+	return pEntry;
+}
+
+/* take an entry out of the table, freeing its area if still allocated */
+static void
+ReplayRemove(ReplayEntryPtr* pEntry)
+{
+	ReplayEntryPtr entry = *pEntry;
+
+	if (entry->area)
+		IMX_EXA_OffscreenFree(&replayScreen, entry->area);
+	*pEntry = entry->next;
+	free(entry);
+}
+
+static void
+ReplayClear(void)
+{
+	int i;
+
+	for (i = 0; i < REPLAY_HASH_BUCKETS; i++)
+		while (replayHash[i])
+			ReplayRemove(&replayHash[i]);
+}
+
+/* the replayed allocator evicted an area the driver kept */
+static void
+ReplaySave(ScreenPtr pScreen, ExaOffscreenArea* area)
+{
+	ReplayEntryPtr entry = area->privData;
+
+	entry->area = NULL;
+	replayStats->replayEvictions++;
+}
+
+static Bool
+ReplayMove(ScreenPtr pScreen, ExaOffscreenArea* area, int offset)
+{
+	return TRUE;
+}
+
+/* -------------------------------------------------------------------- */
+/* replay                                                               */
+
+/* set up the allocator for the heaps of one session of the trace */
+static Bool
+ReplayInit(const IMXOffscreenTraceRecord* heaps, int numHeaps)
+{
+	int i;
+
+	replayExa.memoryBase = replayFb;
+	replayExa.offScreenBase = 0;
+	replayExa.memorySize = 0;
+	replayImx.offScreenGlyphSize = 0;
+	replayImx.numOffscreenPools = 0;
+
+	for (i = 0; i < numHeaps; i++) {
+
+		const IMXOffscreenTraceRecord* rec = &heaps[i];
+
+		if (IMX_EXA_OFFSCREEN_HEAP_MAIN == rec->flags) {
+
+			replayExa.memorySize = rec->offset + rec->size;
+			if (0 == replayImx.offScreenGlyphSize)
+				replayExa.offScreenBase = rec->offset;
+
+		} else if (IMX_EXA_OFFSCREEN_HEAP_GLYPH == rec->flags) {
+
+			replayExa.offScreenBase = rec->offset;
+			replayImx.offScreenGlyphSize = rec->size;
+
+		} else if (replayImx.numOffscreenPools <
+				IMX_EXA_OFFSCREEN_MAX_POOLS) {
+
+			IMXOffscreenPoolPtr pool =
+				&replayImx.offScreenPools[
+					replayImx.numOffscreenPools++];
+
+			memset(pool, 0, sizeof(*pool));
+			pool->baseOffset = rec->offset;
+			pool->size = rec->size;
+			pool->gpuAddressable = rec->align;
+			pool->fd = -1;
+		}
+	}
+
+	return IMX_EXA_OffscreenInit(&replayScreen);
+}
+
+static void
+ReplayAlloc(const IMXOffscreenTraceRecord* rec)
+{
+	ReplayEntryPtr* pEntry;
+	ReplayEntryPtr entry;
+	ExaOffscreenArea* area;
+
+	replayStats->allocs++;
+	if (IMX_EXA_TRACE_NO_OFFSET == rec->offset)
+		replayStats->traceFailures++;
+
+	entry = malloc(sizeof(ReplayEntryRec));
+	if (NULL == entry) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	area = IMX_EXA_OffscreenAllocPlaced(&replayScreen, rec->size,
+			rec->align, rec->flags & IMX_EXA_TRACE_LOCKED,
+			ReplaySave, entry, rec->flags & ~IMX_EXA_TRACE_LOCKED);
+	if (NULL == area)
+		replayStats->replayFailures++;
+
+	/* the driver did without, so there is nothing to free later */
+	if (IMX_EXA_TRACE_NO_OFFSET == rec->offset) {
+		if (area)
+			IMX_EXA_OffscreenFree(&replayScreen, area);
+		free(entry);
+		return;
+	}
+
+	/* an offset handed out again replaces whatever was there */
+	pEntry = ReplayLookup(rec->offset);
+	if (*pEntry)
+		ReplayRemove(pEntry);
+
+	entry->offset = rec->offset;
+	entry->area = area;
+	entry->next = NULL;
+	*pEntry = entry;
+}
+
+static void
+ReplayFree(const IMXOffscreenTraceRecord* rec)
+{
+	ReplayEntryPtr* pEntry = ReplayLookup(rec->offset);
+
+	if (NULL == *pEntry) {
+		replayStats->unmatched++;
+		return;
+	}
+
+	ReplayRemove(pEntry);
+}
+
+/* returns the bytes the moved area holds in the replay */
+static int
+ReplayRename(const IMXOffscreenTraceRecord* rec)
+{
+	ReplayEntryPtr* pEntry = ReplayLookup(rec->offset);
+	ReplayEntryPtr entry = *pEntry;
+	ExaOffscreenArea* area;
+
+	if (NULL == entry) {
+		replayStats->unmatched++;
+		return 0;
+	}
+
+	*pEntry = entry->next;
+	pEntry = ReplayLookup(rec->size);
+	if (*pEntry)
+		ReplayRemove(pEntry);
+	entry->offset = rec->size;
+	entry->next = NULL;
+	*pEntry = entry;
+
+	area = entry->area;
+	if (NULL == area)
+		return 0;
+	return area->base_offset + area->size - area->offset;
+}
+
+/* free bytes of the heaps LargestAvail looks at */
+static int
+ReplayTotalAvail(void)
+{
+	int total = 0;
+	int i;
+
+	for (i = 0; i < replayImx.numOffscreenHeaps; i++) {
+
+		IMXOffscreenHeapPtr heap = &replayImx.offScreenHeaps[i];
+		ExaOffscreenArea* area;
+
+		if (IMX_EXA_OFFSCREEN_HEAP_GLYPH == heap->kind)
+			continue;
+
+		for (area = heap->areas; area; area = area->next)
+			if (ExaOffscreenAvail == area->state)
+				total += area->size;
+	}
+
+	return total;
+}
+
+static void
+ReplaySample(CARD32 time, Bool print)
+{
+	int largest = IMX_EXA_OffscreenLargestAvail(&replayScreen);
+	int total = ReplayTotalAvail();
+	double frag = total > 0 ? 1.0 - (double) largest / total : 0.0;
+
+	if (largest < replayStats->minLargest)
+		replayStats->minLargest = largest;
+	if (frag > replayStats->peakFrag) {
+		replayStats->peakFrag = frag;
+		replayStats->peakFragTime = time;
+	}
+
+	if (print)
+		printf("%10u %10ld %10d %10d %7.1f%%\n", (unsigned) time,
+			replayStats->ops, largest / 1024, total / 1024,
+			frag * 100.0);
+}
+
+/* replay the whole trace; sample every interval operations if not 0 */
+static Bool
+Replay(const IMXOffscreenTraceRecord* recs, long numRecs,
+	ReplayStatsPtr stats, long interval, Bool print)
+{
+	CARD32 startTime = numRecs > 0 ? recs[0].time : 0;
+	Bool initialized = FALSE;
+	int moveBytes = 0;
+	long i, heapStart = -1;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->minLargest = INT_MAX;
+	replayStats = stats;
+
+	for (i = 0; i < numRecs; i++) {
+
+		const IMXOffscreenTraceRecord* rec = &recs[i];
+
+		/* a run of moves ends with the replay defragmenting as much */
+		if (moveBytes > 0 && IMX_EXA_TRACE_MOVE != rec->op) {
+			stats->movedBytes += IMX_EXA_OffscreenDefragment(
+				&replayScreen, moveBytes, ReplayMove);
+			moveBytes = 0;
+		}
+
+		/* heap records start a session, which ends the previous one */
+		if (IMX_EXA_TRACE_HEAP == rec->op) {
+
+			if (initialized) {
+				ReplayClear();
+				IMX_EXA_OffscreenFini(&replayScreen);
+				initialized = FALSE;
+			}
+			if (heapStart < 0)
+				heapStart = i;
+			continue;
+		}
+
+		if (heapStart >= 0) {
+
+			if (!ReplayInit(&recs[heapStart], i - heapStart)) {
+				fprintf(stderr, "cannot set up the heaps\n");
+				return FALSE;
+			}
+			initialized = TRUE;
+			heapStart = -1;
+		}
+
+		if (!initialized) {
+			fprintf(stderr, "trace does not start with heaps\n");
+			return FALSE;
+		}
+
+		switch (rec->op) {
+
+		case IMX_EXA_TRACE_ALLOC:
+			ReplayAlloc(rec);
+			break;
+
+		case IMX_EXA_TRACE_FREE:
+		case IMX_EXA_TRACE_EVICT:
+			ReplayFree(rec);
+			break;
+
+		case IMX_EXA_TRACE_MOVE:
+			moveBytes += ReplayRename(rec);
+			break;
+
+		default:
+			fprintf(stderr, "unknown trace record %d\n", rec->op);
+			return FALSE;
+		}
+
+		stats->ops++;
+		if (interval > 0 && 0 == stats->ops % interval)
+			ReplaySample(rec->time - startTime, print);
+	}
+
+	if (initialized) {
+		ReplayClear();
+		IMX_EXA_OffscreenFini(&replayScreen);
+	}
+
+	return TRUE;
+}
+
+static IMXOffscreenTraceRecord*
+ReadTrace(const char* path, long* pNumRecs)
+{
+	IMXOffscreenTraceHeaderRec header;
+	IMXOffscreenTraceRecord* recs = NULL;
+	long numRecs = 0, maxRecs = 0;
+	FILE* file;
+
+	file = fopen(path, "rb");
+	if (NULL == file) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	if (1 != fread(&header, sizeof(header), 1, file) ||
+		IMX_EXA_TRACE_MAGIC != header.magic ||
+		IMX_EXA_TRACE_VERSION != header.version ||
+		sizeof(IMXOffscreenTraceRecord) != header.recordSize) {
+
+		fprintf(stderr, "%s: not an offscreen trace\n", path);
+		fclose(file);
+		return NULL;
+	}
+
+	for (;;) {
+
+		if (numRecs == maxRecs) {
+
+			IMXOffscreenTraceRecord* newRecs;
+
+			maxRecs = maxRecs ? maxRecs * 2 : 65536;
+			newRecs = realloc(recs, maxRecs * sizeof(*recs));
+			if (NULL == newRecs) {
+				fprintf(stderr, "out of memory\n");
+				free(recs);
+				fclose(file);
+				return NULL;
+			}
+			recs = newRecs;
+		}
+
+		numRecs += fread(&recs[numRecs], sizeof(*recs),
+				maxRecs - numRecs, file);
+		if (numRecs < maxRecs)
+			break;
+	}
+
+	fclose(file);
+	*pNumRecs = numRecs;
+	return recs;
+}
+
+static double
+Seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char** argv)
+{
+	IMXOffscreenTraceRecord* recs;
+	ReplayStatsRec stats;
+	long numRecs, interval = REPLAY_DEFAULT_INTERVAL;
+	Bool print = TRUE;
+	double elapsed;
+	int opt;
+
+	while (-1 != (opt = getopt(argc, argv, "i:q"))) {
+
+		switch (opt) {
+
+		case 'i':
+			interval = atol(optarg);
+			break;
+
+		case 'q':
+			print = FALSE;
+			break;
+
+		default:
+			optind = argc;
+			break;
+		}
+	}
+
+	if (optind != argc - 1 || interval <= 0) {
+		fprintf(stderr, "usage: %s [-i interval] [-q] trace\n",
+			argv[0]);
+		return 2;
+	}
+
+	recs = ReadTrace(argv[optind], &numRecs);
+	if (NULL == recs)
+		return 1;
+
+	replayScrn.scrnIndex = 0;
+	replayScrn.driverPrivate = &replayImx;
+	replayImx.exaDriverPtr = &replayExa;
+
+	/* timed run, without sampling */
+	elapsed = Seconds();
+	if (!Replay(recs, numRecs, &stats, 0, FALSE))
+		return 1;
+	elapsed = Seconds() - elapsed;
+
+	/* the allocator is deterministic, so this run sees the same */
+	if (print)
+		printf("%10s %10s %10s %10s %8s\n", "time(ms)", "ops",
+			"largest(K)", "free(K)", "frag");
+	if (!Replay(recs, numRecs, &stats, interval, print))
+		return 1;
+
+	printf("operations:           %ld in %.3f s, %.0f ops/sec\n",
+		stats.ops, elapsed, elapsed > 0 ? stats.ops / elapsed : 0.0);
+	printf("allocations:          %ld\n", stats.allocs);
+	printf("failures in trace:    %ld\n", stats.traceFailures);
+	printf("failures in replay:   %ld\n", stats.replayFailures);
+	printf("evictions by replay:  %ld\n", stats.replayEvictions);
+	printf("bytes moved:          %ld\n", stats.movedBytes);
+	printf("unmatched frees:      %ld\n", stats.unmatched);
+	if (stats.minLargest != INT_MAX)
+		printf("smallest largest free: %d K\n",
+			stats.minLargest / 1024);
+	printf("peak fragmentation:   %.1f%% at %u ms\n",
+		stats.peakFrag * 100.0, (unsigned) stats.peakFragTime);
+
+	free(recs);
+	return 0;
+}